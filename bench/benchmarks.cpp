@@ -0,0 +1,516 @@
+#include "benchmarks.hpp"
+#include "../formatters/chicago_formatter.hpp"
+#include "../include/citation.hpp"
+#include "../include/csl.hpp"
+#include "../include/export.hpp"
+#include "../include/text_buffer.hpp"
+#include "synthetic_library.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Library the micro-benchmarks iterate over
+const size_t micro_records = 1000;
+
+// Sends stdout to /dev/null while alive, so terminal exports and their
+// progress lines do not swamp the results
+class QuietStdout {
+public:
+  QuietStdout() {
+    std::cout.flush();
+    std::fflush(stdout);
+#ifndef _WIN32
+    saved_ = ::dup(1);
+    int null = ::open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+      ::dup2(null, 1);
+      ::close(null);
+    }
+#endif
+  }
+  ~QuietStdout() {
+    std::cout.flush();
+    std::fflush(stdout);
+#ifndef _WIN32
+    if (saved_ >= 0) {
+      ::dup2(saved_, 1);
+      ::close(saved_);
+    }
+#endif
+  }
+  QuietStdout(const QuietStdout &) = delete;
+  QuietStdout &operator=(const QuietStdout &) = delete;
+
+private:
+  int saved_ = -1;
+};
+
+void add_parse_name(std::vector<Benchmark> &out) {
+  static const std::pair<const char *, const char *> forms[] = {
+      {"comma", R"({"name": "Kuhn, Thomas S."})"},
+      {"space", R"({"name": "Thomas S. Kuhn"})"},
+      {"string", R"("Kuhn, Thomas S.")"},
+      {"given_family", R"({"given": "Thomas S.", "family": "Kuhn"})"},
+      {"firstname_lastname", R"({"firstname": "Thomas", "lastname": "Kuhn"})"},
+      {"unicode", R"({"name": "Gabriel José de la Concordia García Márquez"})"},
+  };
+  for (const auto &form : forms) {
+    std::string json = form.second;
+    out.push_back({std::string("parse_name/") + form.first,
+                   [json](BenchState &state) {
+                     nlohmann::json person = nlohmann::json::parse(json);
+                     std::string storage;
+                     state.set_items_per_iteration(1);
+                     state.loop([&] {
+                       storage.clear();
+                       ParsedName name = parse_name(person, storage);
+                       keep(name.last.length);
+                     });
+                   }});
+  }
+}
+
+void add_decode(std::vector<Benchmark> &out, BenchFixtures &fixtures) {
+  out.push_back({"decode_citation/" + size_label(micro_records),
+                 [&fixtures](BenchState &state) {
+                   std::ifstream in(fixtures.path(micro_records));
+                   nlohmann::json records = nlohmann::json::parse(in)["records"];
+                   state.set_items_per_iteration(records.size());
+                   state.loop([&] {
+                     for (const auto &record : records)
+                       keep(decode_citation(record).storage.size());
+                   });
+                 }});
+}
+
+void add_chicago(std::vector<Benchmark> &out, BenchFixtures &fixtures) {
+  struct Method {
+    const char *name;
+    ChicagoVariant variant;
+    Markup markup;
+  };
+  static const Method methods[] = {
+      {"chicago/format/html", ChicagoVariant::bibliography, Markup::html},
+      {"chicago/format/markdown", ChicagoVariant::bibliography,
+       Markup::markdown},
+      {"chicago/format/terminal", ChicagoVariant::bibliography,
+       Markup::terminal},
+      {"chicago/format_long_footnote/html", ChicagoVariant::long_footnote,
+       Markup::html},
+      {"chicago/format_short_footnote/html", ChicagoVariant::short_footnote,
+       Markup::html},
+  };
+  for (const Method &m : methods) {
+    out.push_back({m.name, [&fixtures, m](BenchState &state) {
+                     const auto &entries = fixtures.library(micro_records).entries;
+                     ChicagoFormatter formatter;
+                     OutputBuffer buffer(m.markup);
+                     state.set_items_per_iteration(entries.size());
+                     state.loop([&] {
+                       for (const Citation &entry : entries) {
+                         buffer.clear();
+                         formatter.format(entry, m.variant, buffer);
+                         keep(buffer.view());
+                       }
+                     });
+                   }});
+  }
+  out.push_back({"chicago/get_author_last_name", [&fixtures](BenchState &state) {
+                   const auto &entries = fixtures.library(micro_records).entries;
+                   state.set_items_per_iteration(entries.size());
+                   state.loop([&] {
+                     for (const Citation &entry : entries)
+                       keep(ChicagoFormatter::get_author_last_name(entry));
+                   });
+                 }});
+}
+
+// A CSL rendering of the Chicago bibliography entry, for comparing the
+// interpreter with the hand-written formatter
+const char chicago_csl[] = R"csl(<?xml version="1.0" encoding="utf-8"?>
+<style xmlns="http://purl.org/net/xbiblio/csl" class="note" version="1.0">
+  <info><title>Chicago (bibliography)</title></info>
+  <macro name="author">
+    <names variable="author">
+      <name name-as-sort-order="first" and="text" sort-separator=", "
+            delimiter=", " delimiter-precedes-last="always"/>
+      <label form="short" prefix=", "/>
+      <substitute><names variable="editor"/></substitute>
+    </names>
+  </macro>
+  <macro name="title">
+    <choose>
+      <if type="article-journal paper-conference chapter" match="any">
+        <text variable="title" quotes="true"/>
+      </if>
+      <else><text variable="title" font-style="italic"/></else>
+    </choose>
+  </macro>
+  <bibliography>
+    <sort><key macro="author"/><key variable="title"/><key variable="issued"/></sort>
+    <layout suffix=".">
+      <group delimiter=". ">
+        <text macro="author"/>
+        <text macro="title"/>
+        <choose>
+          <if type="article-journal">
+            <group>
+              <group delimiter=" ">
+                <text variable="container-title" font-style="italic"/>
+                <group delimiter=", ">
+                  <text variable="volume"/>
+                  <text variable="issue" prefix="no. "/>
+                </group>
+                <date variable="issued" prefix="(" suffix=")">
+                  <date-part name="year"/>
+                </date>
+              </group>
+              <text variable="page" prefix=": "/>
+            </group>
+          </if>
+          <else>
+            <group delimiter=", ">
+              <group delimiter=": ">
+                <text variable="publisher-place"/>
+                <text variable="publisher"/>
+              </group>
+              <date variable="issued"><date-part name="year"/></date>
+            </group>
+          </else>
+        </choose>
+        <text variable="DOI" prefix="https://doi.org/"/>
+      </group>
+    </layout>
+  </bibliography>
+</style>
+)csl";
+
+void add_csl(std::vector<Benchmark> &out, BenchFixtures &fixtures) {
+  out.push_back({"csl/compile", [](BenchState &state) {
+                   state.set_items_per_iteration(1);
+                   state.set_bytes_per_iteration(sizeof(chicago_csl) - 1);
+                   state.loop([&] {
+                     csl::Program program;
+                     std::string error;
+                     csl::compile(chicago_csl, program, error);
+                     keep(program.code.size());
+                   });
+                 }});
+
+  auto compiled = [] {
+    auto program = std::make_shared<csl::Program>();
+    std::string error;
+    csl::compile(chicago_csl, *program, error);
+    return CslFormatter(std::move(program));
+  };
+  out.push_back({"csl/format/html", [&fixtures, compiled](BenchState &state) {
+                   const auto &entries = fixtures.library(micro_records).entries;
+                   CslFormatter formatter = compiled();
+                   OutputBuffer buffer(Markup::html);
+                   state.set_items_per_iteration(entries.size());
+                   state.loop([&] {
+                     for (const Citation &entry : entries) {
+                       buffer.clear();
+                       formatter.format(entry, buffer);
+                       keep(buffer.view());
+                     }
+                   });
+                 }});
+  out.push_back({"csl/sort_order", [&fixtures, compiled](BenchState &state) {
+                   const auto &entries = fixtures.library(micro_records).entries;
+                   CslFormatter formatter = compiled();
+                   state.set_items_per_iteration(entries.size());
+                   state.loop([&] { keep(formatter.sort_order(entries).size()); });
+                 }});
+}
+
+// OutputBuffer::text (escaping record text) and from_neutral (converting
+// one neutral rendering per output), which took over from the old
+// html_escape and html_to_md passes
+void add_markup(std::vector<Benchmark> &out, BenchFixtures &fixtures) {
+  struct Input {
+    std::vector<std::string> plain;   // titles as they are
+    std::vector<std::string> special; // titles full of characters to escape
+    std::vector<std::string> neutral; // bibliography entries, Markup::neutral
+    size_t bytes(const std::vector<std::string> &list) const {
+      size_t n = 0;
+      for (const auto &s : list)
+        n += s.size();
+      return n;
+    }
+  };
+  auto input = std::make_shared<Input>();
+  auto prepare = [&fixtures, input] {
+    if (!input->plain.empty())
+      return;
+    ChicagoFormatter formatter;
+    OutputBuffer buffer(Markup::neutral);
+    for (const Citation &entry : fixtures.library(micro_records).entries) {
+      std::string title(entry.get(Field::title));
+      input->plain.push_back(title);
+      input->special.push_back("\"" + title + "\" & <Sons> 'n' " + title);
+      buffer.clear();
+      formatter.format(entry, buffer);
+      input->neutral.push_back(buffer.str());
+    }
+  };
+
+  struct TextCase {
+    const char *name;
+    Markup markup;
+    std::vector<std::string> Input::*list;
+  };
+  static const TextCase text_cases[] = {
+      {"text/html/plain", Markup::html, &Input::plain},
+      {"text/html/special", Markup::html, &Input::special},
+      {"text/neutral/special", Markup::neutral, &Input::special},
+      {"text/markdown/special", Markup::markdown, &Input::special},
+  };
+  for (const TextCase &c : text_cases) {
+    out.push_back({c.name, [prepare, input, c](BenchState &state) {
+                     prepare();
+                     const auto &list = (*input).*c.list;
+                     OutputBuffer buffer(c.markup);
+                     state.set_items_per_iteration(list.size());
+                     state.set_bytes_per_iteration(input->bytes(list));
+                     state.loop([&] {
+                       for (const auto &s : list) {
+                         buffer.clear();
+                         buffer.text(s);
+                         keep(buffer.view());
+                       }
+                     });
+                   }});
+  }
+
+  static const std::pair<const char *, Markup> conversions[] = {
+      {"from_neutral/html", Markup::html},
+      {"from_neutral/markdown", Markup::markdown},
+      {"from_neutral/terminal", Markup::terminal},
+  };
+  for (const auto &c : conversions) {
+    Markup markup = c.second;
+    out.push_back({c.first, [prepare, input, markup](BenchState &state) {
+                     prepare();
+                     OutputBuffer buffer(markup);
+                     state.set_items_per_iteration(input->neutral.size());
+                     state.set_bytes_per_iteration(input->bytes(input->neutral));
+                     state.loop([&] {
+                       for (const auto &s : input->neutral) {
+                         buffer.clear();
+                         buffer.from_neutral(s);
+                         keep(buffer.view());
+                       }
+                     });
+                   }});
+  }
+}
+
+void add_sized(std::vector<Benchmark> &out, BenchFixtures &fixtures,
+               size_t records) {
+  std::string label = size_label(records);
+
+  out.push_back({"load_library/" + label, [&fixtures, records](BenchState &state) {
+                   const std::string &path = fixtures.path(records);
+                   LibraryLoadOptions options;
+                   options.use_cache = false;
+                   std::error_code ec;
+                   state.set_items_per_iteration(records);
+                   state.set_bytes_per_iteration(
+                       std::filesystem::file_size(path, ec));
+                   state.loop([&] {
+                     Library library;
+                     load_library(path, library, options);
+                     keep(library.entries.size());
+                   });
+                 }});
+
+  // 200 shards of the same total size: one loader per core, then on a
+  // single thread for comparison
+  const size_t shards = 200;
+  for (unsigned jobs : {0u, 1u}) {
+    out.push_back(
+        {"load_library/" + std::to_string(shards) + "_shards/" + label +
+             (jobs == 1 ? "/1_thread" : ""),
+         [&fixtures, records, shards, jobs](BenchState &state) {
+           const std::string &dir = fixtures.shard_dir(records, shards);
+           LibraryLoadOptions options;
+           options.use_cache = false;
+           options.jobs = jobs;
+           state.set_items_per_iteration(records);
+           state.loop([&] {
+             Library library;
+             load_library(dir, library, options);
+             keep(library.entries.size());
+           });
+         }});
+  }
+
+  out.push_back({"sort/merge_sorted_runs/" + label,
+                 [&fixtures, records, shards](BenchState &state) {
+                   LibraryLoadOptions options;
+                   options.use_cache = false;
+                   Library library;
+                   load_library(fixtures.shard_dir(records, shards), library,
+                                options);
+                   state.set_items_per_iteration(library.entries.size());
+                   state.loop([&] { keep(library_sort_order(library).size()); });
+                 }});
+
+  out.push_back({"sort/chicago_sort_key/" + label,
+                 [&fixtures, records](BenchState &state) {
+                   const auto &entries = fixtures.library(records).entries;
+                   state.set_items_per_iteration(entries.size());
+                   state.loop([&] {
+                     for (const Citation &entry : entries)
+                       keep(chicago_sort_key(entry));
+                   });
+                 }});
+
+  out.push_back({"sort/sort_order_by_keys/" + label,
+                 [&fixtures, records](BenchState &state) {
+                   const auto &entries = fixtures.library(records).entries;
+                   std::vector<std::string> keys;
+                   keys.reserve(entries.size());
+                   for (const Citation &entry : entries)
+                     keys.push_back(chicago_sort_key(entry));
+                   state.set_items_per_iteration(entries.size());
+                   state.loop([&] { keep(sort_order_by_keys(keys).size()); });
+                 }});
+
+  // The whole sort step of format_chicago_with_footnotes: keys and order
+  out.push_back({"sort/chicago_sort_order/" + label,
+                 [&fixtures, records](BenchState &state) {
+                   const auto &entries = fixtures.library(records).entries;
+                   state.set_items_per_iteration(entries.size());
+                   state.loop([&] { keep(chicago_sort_order(entries).size()); });
+                 }});
+
+  out.push_back({"format_chicago_with_footnotes/" + label,
+                 [&fixtures, records](BenchState &state) {
+                   const auto &entries = fixtures.library(records).entries;
+                   state.set_items_per_iteration(entries.size());
+                   state.loop([&] {
+                     TextArena arena;
+                     keep(format_chicago_with_footnotes(entries, arena).size());
+                   });
+                 }});
+
+  static const std::pair<const char *, const char *> formats[] = {
+      {"terminal", ""}, {"markdown", ".md"}, {"html", ".html"}};
+  for (const auto &format : formats) {
+    std::string extension = format.second;
+    out.push_back(
+        {std::string("export/") + format.first + "/" + label,
+         [&fixtures, records, extension](BenchState &state) {
+           const std::string &path = fixtures.path(records);
+           std::vector<std::string> outputs;
+           if (!extension.empty())
+             outputs.push_back(path + ".export" + extension);
+           ExportOptions options;
+           options.use_cache = false;
+           state.set_items_per_iteration(records);
+           {
+             QuietStdout quiet;
+             state.loop([&] {
+               keep(static_cast<std::uint64_t>(
+                   cite_export(path, "chicago", outputs, options)));
+             });
+           }
+           for (const auto &output : outputs)
+             std::remove(output.c_str());
+         }});
+  }
+}
+
+} // namespace
+
+std::string size_label(size_t records) {
+  if (records >= 1000000 && records % 1000000 == 0)
+    return std::to_string(records / 1000000) + "m";
+  if (records >= 1000 && records % 1000 == 0)
+    return std::to_string(records / 1000) + "k";
+  return std::to_string(records);
+}
+
+const std::string &BenchFixtures::path(size_t records) {
+  auto it = paths_.find(records);
+  if (it != paths_.end())
+    return it->second;
+  std::error_code ec;
+  std::filesystem::create_directories(dir_, ec);
+  std::string path =
+      (std::filesystem::path(dir_) / ("synthetic-" + size_label(records) + ".json"))
+          .string();
+  if (!std::filesystem::exists(path, ec))
+    std::cerr << "Generating " << path << "...\n";
+  if (!ensure_synthetic_library(path, records)) {
+    std::cerr << "Error: Cannot write " << path << "\n";
+    path.clear();
+  }
+  return paths_.emplace(records, path).first->second;
+}
+
+const std::string &BenchFixtures::shard_dir(size_t records, size_t shards) {
+  auto key = std::make_pair(records, shards);
+  auto it = shard_dirs_.find(key);
+  if (it != shard_dirs_.end())
+    return it->second;
+  std::string dir = (std::filesystem::path(dir_) /
+                     ("synthetic-" + size_label(records) + "-" +
+                      std::to_string(shards) + "-shards"))
+                        .string();
+  auto shard_path = [&dir](size_t k) {
+    return (std::filesystem::path(dir) /
+            ("shard-" + std::to_string(k) + ".json"))
+        .string();
+  };
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if (!std::filesystem::exists(shard_path(shards - 1), ec))
+    std::cerr << "Generating " << dir << "...\n";
+  for (size_t k = 0; k < shards; ++k) {
+    // Spread the remainder so the shards add up to `records`
+    size_t count = records / shards + (k < records % shards ? 1 : 0);
+    std::string path = shard_path(k);
+    if (!ensure_synthetic_library(path, count, k + 1)) {
+      std::cerr << "Error: Cannot write " << path << "\n";
+      dir.clear();
+      break;
+    }
+  }
+  return shard_dirs_.emplace(key, dir).first->second;
+}
+
+const Library &BenchFixtures::library(size_t records) {
+  auto &slot = libraries_[records];
+  if (!slot) {
+    slot = std::make_unique<Library>();
+    LibraryLoadOptions options;
+    options.use_cache = false;
+    load_library(path(records), *slot, options);
+  }
+  return *slot;
+}
+
+std::vector<Benchmark> make_benchmarks(BenchFixtures &fixtures,
+                                       const std::vector<size_t> &sizes) {
+  std::vector<Benchmark> out;
+  add_parse_name(out);
+  add_decode(out, fixtures);
+  add_chicago(out, fixtures);
+  add_csl(out, fixtures);
+  add_markup(out, fixtures);
+  for (size_t records : sizes)
+    add_sized(out, fixtures, records);
+  return out;
+}
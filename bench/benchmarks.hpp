@@ -0,0 +1,41 @@
+#pragma once
+#include "../include/library.hpp"
+#include "harness.hpp"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Synthetic libraries shared by the benchmarks, generated into `dir` on
+// first use and kept there for later runs
+class BenchFixtures {
+public:
+  explicit BenchFixtures(std::string dir) : dir_(std::move(dir)) {}
+
+  // Path of the library with `records` records; empty if it could not be
+  // generated
+  const std::string &path(size_t records);
+
+  // The same library, loaded once
+  const Library &library(size_t records);
+
+  // Directory of `shards` libraries holding `records` records between them
+  // (different seeds, so not the same records as path()); empty if it
+  // could not be generated
+  const std::string &shard_dir(size_t records, size_t shards);
+
+private:
+  std::string dir_;
+  std::map<size_t, std::string> paths_;
+  std::map<std::pair<size_t, size_t>, std::string> shard_dirs_;
+  std::map<size_t, std::unique_ptr<Library>> libraries_;
+};
+
+// "1k", "100k", "1m" style labels
+std::string size_label(size_t records);
+
+// Everything cite_bench knows how to run. Micro-benchmarks work over the
+// 1k library; the load, sort, format-all and export benchmarks are made
+// once per entry of `sizes`.
+std::vector<Benchmark> make_benchmarks(BenchFixtures &fixtures,
+                                       const std::vector<size_t> &sizes);
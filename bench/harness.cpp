@@ -0,0 +1,80 @@
+#include "harness.hpp"
+#include <algorithm>
+#include <cstdio>
+
+static volatile std::uint64_t sink;
+
+void keep(std::string_view s) {
+  sink = sink + s.size() + (s.empty() ? 0 : static_cast<unsigned char>(s[0]));
+}
+
+void keep(std::uint64_t n) { sink = sink + n; }
+
+BenchResult run_benchmark(const Benchmark &bench, double min_seconds) {
+  std::uint64_t iterations = 1;
+  for (;;) {
+    BenchState state(iterations);
+    bench.run(state);
+    double seconds = state.seconds();
+    // The iteration cap stops a benchmark that never calls loop()
+    if (seconds >= min_seconds || iterations >= (1ULL << 40)) {
+      BenchResult r;
+      r.name = bench.name;
+      r.iterations = iterations;
+      r.seconds_per_iteration = seconds / static_cast<double>(iterations);
+      if (seconds > 0) {
+        double n = static_cast<double>(iterations);
+        r.items_per_second = static_cast<double>(state.items()) * n / seconds;
+        r.bytes_per_second = static_cast<double>(state.bytes()) * n / seconds;
+      }
+      return r;
+    }
+    // Aim a little past the minimum, growing at most 100x per step
+    double scale = seconds > 0 ? 1.4 * min_seconds / seconds : 100.0;
+    scale = std::min(std::max(scale, 2.0), 100.0);
+    iterations = static_cast<std::uint64_t>(static_cast<double>(iterations) *
+                                            scale);
+  }
+}
+
+static std::string human_time(double seconds) {
+  char buf[32];
+  if (seconds < 1e-6)
+    std::snprintf(buf, sizeof(buf), "%.1f ns", seconds * 1e9);
+  else if (seconds < 1e-3)
+    std::snprintf(buf, sizeof(buf), "%.2f us", seconds * 1e6);
+  else if (seconds < 1)
+    std::snprintf(buf, sizeof(buf), "%.2f ms", seconds * 1e3);
+  else
+    std::snprintf(buf, sizeof(buf), "%.2f s", seconds);
+  return buf;
+}
+
+static std::string human_rate(double per_second, const char *unit) {
+  if (per_second <= 0)
+    return "";
+  static const char *prefixes[] = {"", "k", "M", "G"};
+  int p = 0;
+  while (per_second >= 1000 && p < 3) {
+    per_second /= 1000;
+    ++p;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.1f %s%s/s", per_second, prefixes[p], unit);
+  return buf;
+}
+
+void print_result_header() {
+  std::printf("%-44s %12s %12s %14s %14s\n", "benchmark", "iterations",
+              "time/iter", "items", "bytes");
+  std::printf("%s\n", std::string(100, '-').c_str());
+}
+
+void print_result(const BenchResult &r) {
+  std::printf("%-44s %12llu %12s %14s %14s\n", r.name.c_str(),
+              static_cast<unsigned long long>(r.iterations),
+              human_time(r.seconds_per_iteration).c_str(),
+              human_rate(r.items_per_second, "").c_str(),
+              human_rate(r.bytes_per_second, "B").c_str());
+  std::fflush(stdout);
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A minimal benchmark runner in the shape of Google Benchmark, without the
+// dependency. A benchmark does its setup, then hands the code to time to
+// BenchState::loop(), which runs it iterations() times. The runner repeats
+// with more iterations until one run lasts at least the minimum time.
+class BenchState {
+public:
+  explicit BenchState(std::uint64_t iterations) : iterations_(iterations) {}
+
+  std::uint64_t iterations() const { return iterations_; }
+
+  // Runs `body` iterations() times; only this is timed
+  template <typename F> void loop(F &&body) {
+    auto start = std::chrono::steady_clock::now();
+    for (std::uint64_t i = 0; i < iterations_; ++i)
+      body();
+    elapsed_ += std::chrono::steady_clock::now() - start;
+  }
+
+  // Work done by one iteration, for the items/s and bytes/s columns
+  void set_items_per_iteration(std::uint64_t n) { items_ = n; }
+  void set_bytes_per_iteration(std::uint64_t n) { bytes_ = n; }
+
+  double seconds() const { return elapsed_.count(); }
+  std::uint64_t items() const { return items_; }
+  std::uint64_t bytes() const { return bytes_; }
+
+private:
+  std::uint64_t iterations_;
+  std::chrono::duration<double> elapsed_{0};
+  std::uint64_t items_ = 0;
+  std::uint64_t bytes_ = 0;
+};
+
+// Keeps a result observable so the compiler cannot drop the work that
+// produced it
+void keep(std::string_view s);
+void keep(std::uint64_t n);
+
+struct Benchmark {
+  std::string name;
+  std::function<void(BenchState &)> run;
+};
+
+struct BenchResult {
+  std::string name;
+  std::uint64_t iterations = 0;
+  double seconds_per_iteration = 0;
+  double items_per_second = 0; // 0 when the benchmark does not count items
+  double bytes_per_second = 0;
+};
+
+BenchResult run_benchmark(const Benchmark &bench, double min_seconds);
+
+// One aligned line per result, under a header
+void print_result_header();
+void print_result(const BenchResult &result);
@@ -0,0 +1,163 @@
+#include "benchmarks.hpp"
+#include "synthetic_library.hpp"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Parses a record count: a number, optionally with a k or m suffix
+static bool parse_records(const std::string &s, size_t &out) {
+  if (s.empty())
+    return false;
+  size_t scale = 1;
+  std::string digits = s;
+  char suffix = s.back();
+  if (suffix == 'k' || suffix == 'K')
+    scale = 1000;
+  else if (suffix == 'm' || suffix == 'M')
+    scale = 1000000;
+  if (scale != 1)
+    digits.pop_back();
+  if (digits.empty() ||
+      digits.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  try {
+    out = static_cast<size_t>(std::stoull(digits)) * scale;
+  } catch (...) {
+    return false;
+  }
+  return out > 0;
+}
+
+static void print_usage() {
+  std::cout << "cite_bench - benchmarks for cite\n\n";
+  std::cout << "USAGE:\n";
+  std::cout << "  cite_bench [--filter TEXT] [--sizes 1k,100k,1m] [--min-time S]\n";
+  std::cout << "             [--dir DIR] [--list]\n";
+  std::cout << "  cite_bench generate <records> <output.json> [--seed N]\n\n";
+  std::cout << "  --filter TEXT  Run only benchmarks whose name contains TEXT\n";
+  std::cout << "  --sizes LIST   Library sizes for the load, sort, format and\n";
+  std::cout << "                 export benchmarks (default 1k,100k)\n";
+  std::cout << "  --min-time S   Repeat each benchmark for at least S seconds\n";
+  std::cout << "                 (default 0.5)\n";
+  std::cout << "  --dir DIR      Where synthetic libraries are generated and\n";
+  std::cout << "                 kept between runs (default: temp directory)\n";
+  std::cout << "  --list         Print benchmark names without running them\n\n";
+  std::cout << "  generate writes a synthetic BibJSON library, e.g.\n";
+  std::cout << "  cite_bench generate 100k library.json\n";
+}
+
+static int generate(int argc, char *argv[]) {
+  size_t records = 0;
+  if (argc < 4 || !parse_records(argv[2], records)) {
+    std::cerr << "Usage: cite_bench generate <records> <output.json> [--seed N]\n";
+    return 1;
+  }
+  std::uint64_t seed = 1;
+  for (int i = 4; i < argc; ++i) {
+    std::string arg = argv[i];
+    size_t value = 0;
+    if (arg == "--seed" && i + 1 < argc && parse_records(argv[i + 1], value)) {
+      seed = value;
+      ++i;
+    } else {
+      std::cerr << "Error: Unexpected argument '" << arg << "'\n";
+      return 1;
+    }
+  }
+  std::ofstream out(argv[3], std::ios::binary);
+  if (!out) {
+    std::cerr << "Error: Cannot open " << argv[3] << " for writing\n";
+    return 3;
+  }
+  write_synthetic_library(out, records, seed);
+  if (!out.flush()) {
+    std::cerr << "Error: Failed writing " << argv[3] << "\n";
+    return 3;
+  }
+  std::cout << "Wrote " << records << " records to " << argv[3] << "\n";
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc >= 2 && std::string(argv[1]) == "generate")
+    return generate(argc, argv);
+
+  std::string filter;
+  std::vector<size_t> sizes = {1000, 100000};
+  double min_time = 0.5;
+  std::string dir =
+      (std::filesystem::temp_directory_path() / "cite-bench").string();
+  bool list = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--filter" && has_value) {
+      filter = argv[++i];
+    } else if (arg == "--sizes" && has_value) {
+      sizes.clear();
+      std::string spec = argv[++i];
+      size_t start = 0;
+      while (start <= spec.size()) {
+        size_t comma = spec.find(',', start);
+        if (comma == std::string::npos)
+          comma = spec.size();
+        size_t records = 0;
+        if (!parse_records(spec.substr(start, comma - start), records)) {
+          std::cerr << "Error: --sizes expects counts such as 1k,100k,1m\n";
+          return 1;
+        }
+        sizes.push_back(records);
+        start = comma + 1;
+      }
+    } else if (arg == "--min-time" && has_value) {
+      try {
+        min_time = std::stod(argv[++i]);
+      } catch (...) {
+        min_time = -1;
+      }
+      if (min_time <= 0) {
+        std::cerr << "Error: --min-time expects a positive number of seconds\n";
+        return 1;
+      }
+    } else if (arg == "--dir" && has_value) {
+      dir = argv[++i];
+    } else if (arg == "--list") {
+      list = true;
+    } else if (arg == "--help" || arg == "-h") {
+      print_usage();
+      return 0;
+    } else {
+      std::cerr << "Error: Unexpected argument '" << arg << "'\n\n";
+      print_usage();
+      return 1;
+    }
+  }
+
+  BenchFixtures fixtures(dir);
+  std::vector<Benchmark> benchmarks = make_benchmarks(fixtures, sizes);
+  if (list) {
+    for (const Benchmark &bench : benchmarks)
+      std::cout << bench.name << "\n";
+    return 0;
+  }
+
+  bool header = false;
+  for (const Benchmark &bench : benchmarks) {
+    if (bench.name.find(filter) == std::string::npos)
+      continue;
+    BenchResult result = run_benchmark(bench, min_time);
+    if (!header) {
+      print_result_header();
+      header = true;
+    }
+    print_result(result);
+  }
+  if (!header) {
+    std::cerr << "No benchmark matches '" << filter << "'\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,233 @@
+#include "synthetic_library.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <nlohmann/json.hpp>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// splitmix64: small, fast, and the same sequence on every platform, which
+// <random>'s distributions do not promise
+class Rng {
+public:
+  explicit Rng(std::uint64_t seed) : state_(seed) {}
+
+  std::uint64_t next() {
+    std::uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+  // Uniform in [0, n)
+  size_t below(size_t n) { return static_cast<size_t>(next() % n); }
+  // True with probability percent / 100
+  bool chance(unsigned percent) { return below(100) < percent; }
+
+  template <size_t N> std::string_view pick(const std::string_view (&list)[N]) {
+    return list[below(N)];
+  }
+
+private:
+  std::uint64_t state_;
+};
+
+const std::string_view given_names[] = {
+    "Alan",   "Thomas",    "Hannah", "Maria",   "Jean-Paul", "Søren",
+    "Zoë",    "François",  "José",   "Björn",   "Łukasz",    "Ahmed",
+    "Yuki",   "Chinua",    "Olga",   "Rosa",    "Ada",       "Émile",
+    "Nguyễn", "Dmitri",    "Ingrid", "Kwame",   "Mei",       "Ana María"};
+
+const std::string_view family_names[] = {
+    "Turing",   "Kuhn",        "Arendt",    "Curie",    "Sartre",
+    "Kierkegaard", "Müller",   "Dvořák",    "Ørsted",   "Ångström",
+    "García Márquez", "de Beauvoir", "van der Waals", "O'Brien", "Núñez",
+    "Achebe",   "Tanaka",      "Lovelace",  "Durkheim", "Ibn Khaldun",
+    "Šimić",    "Szymańska",   "Nakamura",  "Adeyemi",  "Smith"};
+
+// Non-Latin names, written the way CrossRef returns them
+const std::string_view native_names[][2] = {
+    {"太郎", "山田"}, {"Дмитрий", "Иванов"}, {"Σοφία", "Παπαδοπούλου"},
+    {"明", "李"},     {"محمد", "العلي"}};
+
+const std::string_view title_words[] = {
+    "computing", "machinery", "intelligence", "structure", "scientific",
+    "revolutions", "human", "condition", "theory", "history", "society",
+    "language", "évolution", "über", "naïve", "quantum", "networks",
+    "memory", "archive", "città", "modern", "ancient", "economy", "ritual",
+    "knowledge", "power", "translation", "φύσις", "人間", "systems"};
+
+const std::string_view journals[] = {
+    "Mind", "Nature", "Philosophical Review", "Journal of Modern History",
+    "Annales. Histoire, Sciences Sociales", "Zeitschrift für Physik",
+    "Physical Review Letters", "Past & Present"};
+
+const std::string_view publishers[] = {
+    "University of Chicago Press", "Oxford University Press", "Gallimard",
+    "Suhrkamp", "MIT Press", "Penguin", "Iwanami Shoten", "Routledge"};
+
+const std::string_view places[] = {"Chicago", "Oxford", "Paris", "Frankfurt",
+                                   "Cambridge, MA", "London", "Tōkyō",
+                                   "New York"};
+
+std::string make_title(Rng &rng) {
+  size_t words = 2 + rng.below(9);
+  std::string title;
+  // Some titles start with an article, which sorting has to skip
+  if (rng.chance(20))
+    title = rng.chance(50) ? "The " : "A ";
+  for (size_t i = 0; i < words; ++i) {
+    std::string_view word = rng.pick(title_words);
+    if (!title.empty() && title.back() != ' ')
+      title += ' ';
+    if (i == 0 && title.empty() && !word.empty() && word[0] >= 'a' &&
+        word[0] <= 'z') {
+      title += static_cast<char>(word[0] - 'a' + 'A');
+      title.append(word.substr(1));
+    } else {
+      title.append(word);
+    }
+    if (i == words / 2 && i + 1 < words && rng.chance(25))
+      title += ':';
+  }
+  return title;
+}
+
+// A person in one of the forms parse_name understands
+nlohmann::json make_person(Rng &rng) {
+  if (rng.chance(5)) {
+    const auto &name = native_names[rng.below(std::size(native_names))];
+    return {{"given", name[0]}, {"family", name[1]}};
+  }
+  std::string given(rng.pick(given_names));
+  std::string family(rng.pick(family_names));
+  switch (rng.below(5)) {
+  case 0:
+    return {{"name", family + ", " + given}};
+  case 1:
+    return {{"name", given + " " + family}};
+  case 2:
+    return {{"given", given}, {"family", family}};
+  case 3:
+    return {{"firstname", given}, {"lastname", family}};
+  default:
+    return family + ", " + given;
+  }
+}
+
+// Most works have one to three authors; a few have many, and some none
+size_t author_count(Rng &rng) {
+  size_t roll = rng.below(100);
+  if (roll < 4)
+    return 0;
+  if (roll < 45)
+    return 1;
+  if (roll < 70)
+    return 2;
+  if (roll < 85)
+    return 3;
+  if (roll < 95)
+    return 4 + rng.below(3);
+  return 7 + rng.below(6);
+}
+
+std::string make_isbn(Rng &rng) {
+  std::string isbn = "978";
+  for (int i = 0; i < 10; ++i)
+    isbn += static_cast<char>('0' + rng.below(10));
+  return isbn;
+}
+
+nlohmann::json make_record(Rng &rng, size_t index) {
+  static const std::string_view types[] = {
+      "article", "article", "article", "article", "book", "book", "book",
+      "chapter", "paper",   "website", "report"};
+  std::string_view type = rng.pick(types);
+
+  nlohmann::json r = nlohmann::json::object();
+  r["id"] = "rec_" + std::to_string(index + 1);
+  r["type"] = type;
+  if (rng.chance(97))
+    r["title"] = make_title(rng);
+  if (rng.chance(92))
+    r["year"] = std::to_string(1850 + rng.below(175));
+
+  nlohmann::json authors = nlohmann::json::array();
+  for (size_t i = author_count(rng); i > 0; --i)
+    authors.push_back(make_person(rng));
+  if (!authors.empty())
+    r["author"] = std::move(authors);
+
+  nlohmann::json ids = nlohmann::json::array();
+  if (type == "article" || type == "paper") {
+    if (rng.chance(90)) {
+      nlohmann::json journal = {{"name", rng.pick(journals)}};
+      if (rng.chance(85))
+        journal["volume"] = std::to_string(1 + rng.below(120));
+      if (rng.chance(60))
+        journal["number"] = std::to_string(1 + rng.below(12));
+      if (rng.chance(80)) {
+        size_t first = 1 + rng.below(900);
+        journal["pages"] = std::to_string(first) + "-" +
+                           std::to_string(first + 1 + rng.below(40));
+      }
+      r["journal"] = std::move(journal);
+    }
+    if (rng.chance(75))
+      ids.push_back({{"type", "doi"},
+                     {"id", "10." + std::to_string(1000 + rng.below(9000)) +
+                                "/bench." + std::to_string(index)}});
+  } else if (type == "book" || type == "chapter" || type == "report") {
+    if (rng.chance(85))
+      r["publisher"] = rng.pick(publishers);
+    if (rng.chance(70))
+      r["place"] = rng.pick(places);
+    if (type == "chapter" && rng.chance(70)) {
+      nlohmann::json editors = nlohmann::json::array();
+      for (size_t i = 1 + rng.below(2); i > 0; --i)
+        editors.push_back(make_person(rng));
+      r["editor"] = std::move(editors);
+    }
+    if (rng.chance(60))
+      ids.push_back({{"type", "isbn"}, {"id", make_isbn(rng)}});
+  }
+  if (type == "website" || rng.chance(10))
+    r["url"] = "https://example.org/works/" + std::to_string(index + 1);
+  if (!ids.empty())
+    r["identifier"] = std::move(ids);
+  return r;
+}
+
+} // namespace
+
+void write_synthetic_library(std::ostream &out, size_t records,
+                             std::uint64_t seed) {
+  Rng rng(seed);
+  out << "{\"metadata\":{\"collection\":\"bench\",\"records\":" << records
+      << "},\"records\":[\n";
+  for (size_t i = 0; i < records; ++i) {
+    out << make_record(rng, i).dump();
+    out << (i + 1 < records ? ",\n" : "\n");
+  }
+  out << "]}\n";
+}
+
+bool ensure_synthetic_library(const std::string &path, size_t records,
+                              std::uint64_t seed) {
+  std::error_code ec;
+  if (std::filesystem::exists(path, ec))
+    return true;
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary);
+    if (!out)
+      return false;
+    write_synthetic_library(out, records, seed);
+    if (!out.flush())
+      return false;
+  }
+  std::filesystem::rename(tmp, path, ec);
+  return !ec;
+}
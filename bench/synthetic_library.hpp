@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Writes a BibJSON library of `records` made-up records to `out`. The mix
+// follows what real libraries look like to the formatters: mostly articles
+// and books, some chapters, papers and untyped records; zero to a dozen
+// authors in every name form parse_name accepts; names and titles with
+// accented and non-Latin characters; and optional fields (year, publisher,
+// place, journal parts, identifiers) left out at random. The same `seed`
+// always gives the same bytes.
+void write_synthetic_library(std::ostream &out, size_t records,
+                             std::uint64_t seed = 1);
+
+// Writes the library to `path` unless a file is already there (generating
+// 1M records takes a while). False if it could not be written.
+bool ensure_synthetic_library(const std::string &path, size_t records,
+                              std::uint64_t seed = 1);
@@ -0,0 +1,47 @@
+#include "apa_formatter.hpp"
+#include "style_engine.hpp"
+
+namespace {
+
+using namespace style;
+
+// Last, F. M., & Last, F. (2001). Title of article. *Journal*, *3*(2),
+// 1-20. https://doi.org/...
+//
+// Without authors or editors the title moves to the front:
+// *Title of book*. (2001). Publisher.
+struct Reference {
+  static constexpr Op ops[] = {
+      names(NameForm::apa).label(" (Ed.).", " (Eds.)."),
+      field(Field::title).post(".").or_else("Untitled")
+          .if_names(NamesIf::none).when(Type::article),
+      field(Field::title).italic().post(".").or_else("Untitled")
+          .if_names(NamesIf::none).when(Type::other),
+
+      field(Field::year).pre(" (").post(").").or_else("n.d."),
+
+      field(Field::title).pre(" ").post(".").or_else("Untitled")
+          .if_names(NamesIf::some).when(Type::article),
+      field(Field::title).pre(" ").italic().post(".").or_else("Untitled")
+          .if_names(NamesIf::some).when(Type::other),
+
+      group(" ", ", "),
+      field(Field::journal_name).italic().when(Container::journal),
+      field(Field::volume).italic().when(Container::journal),
+      field(Field::issue).pre("(").post(")").attached()
+          .when(Container::journal),
+      field(Field::pages).when(Container::journal),
+      end_group("."),
+
+      field(Field::publisher).pre(" ").post(".").when(Container::publisher),
+
+      field(Field::doi).pre(" https://doi.org/").when(Link::doi),
+      field(Field::url).pre(" ").when(Link::url),
+  };
+};
+
+} // namespace
+
+void APAFormatter::format(const Citation &entry, OutputBuffer &out) const {
+  style::format<Reference>(entry, out);
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include "../include/citation.hpp"
+
+// APA (7th edition) reference list entries
+class APAFormatter : public CitationFormatter {
+public:
+  using CitationFormatter::format;
+  void format(const Citation &entry, OutputBuffer &out) const override;
+};
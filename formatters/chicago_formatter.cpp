@@ -1,386 +1,134 @@
 #include "chicago_formatter.hpp"
-#include <algorithm>
-#include <cctype>
-#include <sstream>
-#include <vector>
+#include "style_engine.hpp"
 
-static std::string html_italic(const std::string &s) {
-  return "<i>" + s + "</i>";
-}
+namespace {
 
-static std::string get_str(const nlohmann::json &obj, const std::string &key) {
-  if (obj.contains(key) && obj[key].is_string())
-    return obj[key];
-  return "";
-}
+using namespace style;
 
-static std::string title_case(const std::string &s) {
-  std::string result = s;
-  bool new_word = true;
-  for (char &c : result) {
-    if (std::isspace(c) || c == '-') {
-      new_word = true;
-    } else if (new_word) {
-      c = std::toupper(c);
-      new_word = false;
-    }
-  }
-  return result;
-}
+constexpr FieldMask place_or_publisher = bits(Field::place, Field::publisher);
+
+struct Bibliography {
+  static constexpr Op ops[] = {
+      names(NameForm::chicago_bibliography).label(", ed", ", eds")
+          .or_else("Unknown Author"),
+      lit(". "),
+
+      // Title (italicized for books, quoted for articles)
+      field(Field::title).pre("\"").post(".\"").or_else("Untitled")
+          .when(Type::article),
+      field(Field::title).italic().post(".").or_else("Untitled")
+          .when(Type::other),
+
+      // Container (journal, book, etc.)
+      lit(" ").when(Container::journal),
+      field(Field::journal_name).italic().when(Container::journal),
+      field(Field::volume).pre(" ").when(Container::journal),
+      field(Field::issue).pre(", no. ").if_all(bit(Field::volume))
+          .when(Container::journal),
+      field(Field::year).pre(" (").post(")").when(Container::journal),
+      field(Field::pages).pre(": ").when(Container::journal),
+      lit(".").when(Container::journal),
+
+      lit(" ").if_any(place_or_publisher).when(Container::publisher),
+      field(Field::place).post(": ").when(Container::publisher),
+      field(Field::publisher).when(Container::publisher),
+      field(Field::year).pre(", ").if_any(place_or_publisher)
+          .when(Container::publisher),
+      lit(".").if_any(place_or_publisher).when(Container::publisher),
+      field(Field::year).pre(" ").post(".").if_none(place_or_publisher)
+          .when(Container::publisher),
+      lit(".").if_none(place_or_publisher | bit(Field::year))
+          .when(Container::publisher),
+
+      // Just year if nothing else
+      field(Field::year).pre(" ").post(".").when(Container::none),
+      lit(".").if_none(bit(Field::year)).when(Container::none),
 
-struct ParsedName {
-  std::string first;
-  std::string last;
-  std::string full;
+      // DOI or URL
+      field(Field::doi).pre(" https://doi.org/").post(".").when(Link::doi),
+      field(Field::url).pre(" ").post(".").when(Link::url),
+  };
 };
 
-static ParsedName parse_name(const nlohmann::json &person) {
-  ParsedName pn;
-  
-  if (person.is_object()) {
-    // Try structured fields first
-    if (person.contains("firstname") && person.contains("lastname")) {
-      pn.first = person["firstname"].get<std::string>();
-      pn.last = person["lastname"].get<std::string>();
-      pn.full = pn.last + ", " + pn.first;
-    } else if (person.contains("given") && person.contains("family")) {
-      // CrossRef format
-      pn.first = person["given"].get<std::string>();
-      pn.last = person["family"].get<std::string>();
-      pn.full = pn.last + ", " + pn.first;
-    } else if (person.contains("name")) {
-      pn.full = person["name"].get<std::string>();
-      // Try to parse "Last, First" format
-      auto comma = pn.full.find(',');
-      if (comma != std::string::npos) {
-        pn.last = pn.full.substr(0, comma);
-        pn.first = pn.full.substr(comma + 1);
-        // Trim whitespace
-        while (!pn.first.empty() && std::isspace(pn.first[0]))
-          pn.first.erase(0, 1);
-      } else {
-        // Try "First Last" format
-        auto space = pn.full.rfind(' ');
-        if (space != std::string::npos) {
-          pn.first = pn.full.substr(0, space);
-          pn.last = pn.full.substr(space + 1);
-        } else {
-          pn.last = pn.full;
-        }
-      }
-    }
-  } else if (person.is_string()) {
-    pn.full = person.get<std::string>();
-    auto comma = pn.full.find(',');
-    if (comma != std::string::npos) {
-      pn.last = pn.full.substr(0, comma);
-      pn.first = pn.full.substr(comma + 1);
-      while (!pn.first.empty() && std::isspace(pn.first[0]))
-        pn.first.erase(0, 1);
-    } else {
-      auto space = pn.full.rfind(' ');
-      if (space != std::string::npos) {
-        pn.first = pn.full.substr(0, space);
-        pn.last = pn.full.substr(space + 1);
-      } else {
-        pn.last = pn.full;
-      }
-    }
-  }
-  
-  return pn;
+// Long footnote (full citation, first use)
+struct LongFootnote {
+  static constexpr Op ops[] = {
+      names(NameForm::chicago_note).label(", ed.", ", eds.")
+          .or_else("Unknown Author"),
+      lit(", "),
+
+      field(Field::title).pre("\"").post(",\"").or_else("Untitled")
+          .when(Type::article),
+      field(Field::title).italic().or_else("Untitled").when(Type::other),
+
+      lit(" ").when(Container::journal),
+      field(Field::journal_name).italic().when(Container::journal),
+      field(Field::volume).pre(" ").when(Container::journal),
+      field(Field::issue).pre(", no. ").if_all(bit(Field::volume))
+          .when(Container::journal),
+      field(Field::year).pre(" (").post(")").when(Container::journal),
+      lit(": [pg].").when(Container::journal),
+
+      lit(" (").when(Container::publisher),
+      field(Field::place).post(": ").when(Container::publisher),
+      field(Field::publisher).when(Container::publisher),
+      field(Field::year).pre(", ").when(Container::publisher),
+      lit("), [pg].").when(Container::publisher),
+
+      field(Field::year).pre(" (").post(")").when(Container::none),
+      lit(", [pg].").when(Container::none),
+  };
+};
+
+// Short footnote (subsequent references): last name and the title's first
+// four words, leading article dropped
+struct ShortFootnote {
+  static constexpr Op ops[] = {
+      lead_name().post(", "),
+      short_title().pre("\"").post(",\"").or_else("Untitled")
+          .when(Type::article),
+      short_title().italic().or_else("Untitled").when(Type::other),
+      lit(" [pg]."),
+  };
+};
+
+} // namespace
+
+std::string_view ChicagoFormatter::get_author_last_name(const Citation &entry) {
+  return style::lead_last_name(entry);
 }
 
-static std::string join_names_biblio(const nlohmann::json &people) {
-  if (!people.is_array() || people.empty())
-    return "";
-  
-  std::vector<ParsedName> names;
-  for (const auto &p : people) {
-    names.push_back(parse_name(p));
-  }
-  
-  if (names.empty())
-    return "";
-  
-  std::ostringstream oss;
-  oss << names[0].last;
-  if (!names[0].first.empty())
-    oss << ", " << names[0].first;
-  
-  if (names.size() == 2) {
-    oss << ", and " << names[1].first;
-    if (!names[1].first.empty())
-      oss << " ";
-    oss << names[1].last;
-  } else if (names.size() > 2) {
-    for (size_t i = 1; i < names.size(); ++i) {
-      oss << ", ";
-      if (i == names.size() - 1)
-        oss << "and ";
-      oss << names[i].first;
-      if (!names[i].first.empty())
-        oss << " ";
-      oss << names[i].last;
-    }
-  }
-  
-  return oss.str();
+void ChicagoFormatter::format(const Citation &entry, OutputBuffer &out) const {
+  style::format<Bibliography>(entry, out);
 }
 
-static std::string join_names_footnote(const nlohmann::json &people) {
-  if (!people.is_array() || people.empty())
-    return "";
-  
-  std::vector<ParsedName> names;
-  for (const auto &p : people) {
-    names.push_back(parse_name(p));
-  }
-  
-  if (names.empty())
-    return "";
-  
-  std::ostringstream oss;
-  for (size_t i = 0; i < names.size(); ++i) {
-    if (i > 0) {
-      if (i == names.size() - 1)
-        oss << ", and ";
-      else
-        oss << ", ";
-    }
-    oss << names[i].first;
-    if (!names[i].first.empty())
-      oss << " ";
-    oss << names[i].last;
+void ChicagoFormatter::format(const Citation &entry, ChicagoVariant variant,
+                              OutputBuffer &out) const {
+  switch (variant) {
+    case ChicagoVariant::bibliography: format(entry, out); break;
+    case ChicagoVariant::long_footnote: format_long_footnote(entry, out); break;
+    case ChicagoVariant::short_footnote: format_short_footnote(entry, out); break;
   }
-  
-  return oss.str();
 }
 
-std::string ChicagoFormatter::get_author_last_name(const nlohmann::json &entry) {
-  if (entry.contains("author") && entry["author"].is_array() && 
-      !entry["author"].empty()) {
-    ParsedName pn = parse_name(entry["author"][0]);
-    return pn.last.empty() ? "Unknown" : pn.last;
-  }
-  if (entry.contains("editor") && entry["editor"].is_array() && 
-      !entry["editor"].empty()) {
-    ParsedName pn = parse_name(entry["editor"][0]);
-    return pn.last.empty() ? "Unknown" : pn.last;
-  }
-  return "Unknown";
+void ChicagoFormatter::format_long_footnote(const Citation &entry,
+                                            OutputBuffer &out) const {
+  style::format<LongFootnote>(entry, out);
 }
 
-std::string ChicagoFormatter::format(const nlohmann::json &entry) const {
-  std::ostringstream oss;
-  
-  bool has_author = entry.contains("author") && entry["author"].is_array() && 
-                    !entry["author"].empty();
-  bool has_editor = entry.contains("editor") && entry["editor"].is_array() && 
-                    !entry["editor"].empty();
-  
-  if (has_author) {
-    oss << join_names_biblio(entry["author"]);
-  } else if (has_editor) {
-    oss << join_names_biblio(entry["editor"]);
-    oss << (entry["editor"].size() > 1 ? ", eds" : ", ed");
-  } else {
-    oss << "Unknown Author";
-  }
-  
-  oss << ". ";
-  
-  // Title (italicized for books, quoted for articles)
-  std::string title = entry.value("title", "Untitled");
-  std::string type = entry.value("type", "");
-  
-  if (type == "article" || type == "paper") {
-    oss << "\"" << title << ".\"";
-  } else {
-    oss << html_italic(title) << ".";
-  }
-  
-  // Container (journal, book, etc.)
-  if (entry.contains("journal") && entry["journal"].is_object()) {
-    oss << " ";
-    std::string journal_name = get_str(entry["journal"], "name");
-    if (!journal_name.empty())
-      oss << html_italic(journal_name);
-    
-    std::string volume = get_str(entry["journal"], "volume");
-    std::string issue = get_str(entry["journal"], "number");
-    
-    if (!volume.empty()) {
-      oss << " " << volume;
-      if (!issue.empty())
-        oss << ", no. " << issue;
-    }
-    
-    // Year in parentheses for journal articles
-    std::string year = entry.value("year", "");
-    if (!year.empty())
-      oss << " (" << year << ")";
-    
-    std::string pages = get_str(entry["journal"], "pages");
-    if (!pages.empty())
-      oss << ": " << pages;
-    
-    oss << ".";
-  } else if (entry.contains("publisher")) {
-    // Book format
-    std::string place = entry.value("place", "");
-    std::string publisher = get_str(entry, "publisher");
-    std::string year = entry.value("year", "");
-    
-    if (!place.empty() || !publisher.empty()) {
-      oss << " ";
-      if (!place.empty())
-        oss << place << ": ";
-      if (!publisher.empty())
-        oss << publisher;
-      if (!year.empty())
-        oss << ", " << year;
-      oss << ".";
-    } else if (!year.empty()) {
-      oss << " " << year << ".";
-    } else {
-      oss << ".";
-    }
-  } else {
-    // Just year if nothing else
-    std::string year = entry.value("year", "");
-    if (!year.empty())
-      oss << " " << year << ".";
-    else
-      oss << ".";
-  }
-  
-  // DOI or URL
-  if (entry.contains("identifier") && entry["identifier"].is_array()) {
-    for (const auto &id : entry["identifier"]) {
-      if (id.contains("type") && id["type"] == "doi") {
-        std::string doi = get_str(id, "id");
-        if (!doi.empty())
-          oss << " https://doi.org/" << doi << ".";
-        break;
-      }
-    }
-  } else if (entry.contains("url")) {
-    std::string url = get_str(entry, "url");
-    if (!url.empty())
-      oss << " " << url << ".";
-  }
-  
-  return oss.str();
+std::string ChicagoFormatter::format_long_footnote(const Citation &entry) const {
+  OutputBuffer out;
+  format_long_footnote(entry, out);
+  return out.str();
 }
 
-// Long footnote (full citation, first use)
-std::string ChicagoFormatter::format_long_footnote(const nlohmann::json &entry) const {
-  std::ostringstream oss;
-  
-  // Author(s) in First Last format
-  bool has_author = entry.contains("author") && entry["author"].is_array() && 
-                    !entry["author"].empty();
-  bool has_editor = entry.contains("editor") && entry["editor"].is_array() && 
-                    !entry["editor"].empty();
-  
-  if (has_author) {
-    oss << join_names_footnote(entry["author"]);
-  } else if (has_editor) {
-    oss << join_names_footnote(entry["editor"]);
-    oss << (entry["editor"].size() > 1 ? ", eds." : ", ed.");
-  } else {
-    oss << "Unknown Author";
-  }
-  
-  oss << ", ";
-  
-  // Title
-  std::string title = entry.value("title", "Untitled");
-  std::string type = entry.value("type", "");
-  
-  if (type == "article" || type == "paper") {
-    oss << "\"" << title << ",\"";
-  } else {
-    oss << html_italic(title);
-  }
-  
-  // Container info
-  if (entry.contains("journal") && entry["journal"].is_object()) {
-    oss << " ";
-    std::string journal_name = get_str(entry["journal"], "name");
-    if (!journal_name.empty())
-      oss << html_italic(journal_name);
-    
-    std::string volume = get_str(entry["journal"], "volume");
-    std::string issue = get_str(entry["journal"], "number");
-    
-    if (!volume.empty()) {
-      oss << " " << volume;
-      if (!issue.empty())
-        oss << ", no. " << issue;
-    }
-    
-    std::string year = entry.value("year", "");
-    if (!year.empty())
-      oss << " (" << year << ")";
-    
-    oss << ": [pg].";
-  } else if (entry.contains("publisher")) {
-    std::string place = entry.value("place", "");
-    std::string publisher = get_str(entry, "publisher");
-    std::string year = entry.value("year", "");
-    
-    oss << " (";
-    if (!place.empty())
-      oss << place << ": ";
-    if (!publisher.empty())
-      oss << publisher;
-    if (!year.empty())
-      oss << ", " << year;
-    oss << "), [pg].";
-  } else {
-    std::string year = entry.value("year", "");
-    if (!year.empty())
-      oss << " (" << year << ")";
-    oss << ", [pg].";
-  }
-  
-  return oss.str();
+void ChicagoFormatter::format_short_footnote(const Citation &entry,
+                                             OutputBuffer &out) const {
+  style::format<ShortFootnote>(entry, out);
 }
 
-// Short footnote (subsequent references)
-std::string ChicagoFormatter::format_short_footnote(const nlohmann::json &entry) const {
-  std::ostringstream oss;
-  
-  // Last name only
-  std::string last = get_author_last_name(entry);
-  oss << last << ", ";
-  
-  // Shortened title (first 4 words, no articles)
-  std::string title = entry.value("title", "Untitled");
-  std::istringstream iss(title);
-  std::string word, short_title;
-  int count = 0;
-  
-  while (iss >> word && count < 4) {
-    // Skip articles at the beginning
-    if (count == 0 && (word == "The" || word == "A" || word == "An"))
-      continue;
-    
-    if (!short_title.empty())
-      short_title += " ";
-    short_title += word;
-    count++;
-  }
-  
-  std::string type = entry.value("type", "");
-  if (type == "article" || type == "paper") {
-    oss << "\"" << short_title << ",\"";
-  } else {
-    oss << html_italic(short_title);
-  }
-  
-  oss << " [pg].";
-  return oss.str();
+std::string ChicagoFormatter::format_short_footnote(const Citation &entry) const {
+  OutputBuffer out;
+  format_short_footnote(entry, out);
+  return out.str();
 }
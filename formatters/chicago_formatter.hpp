@@ -1,19 +1,27 @@
 #pragma once
 #include "../include/citation.hpp"
-#include <nlohmann/json.hpp>
 #include <string>
+#include <string_view>
 
 class ChicagoFormatter : public CitationFormatter {
 public:
+  using CitationFormatter::format;
+
   // Bibliography entry
-  std::string format(const nlohmann::json &entry) const override;
+  void format(const Citation &entry, OutputBuffer &out) const override;
 
   // Long footnote (full, 1st use)
-  std::string format_long_footnote(const nlohmann::json &entry) const;
+  void format_long_footnote(const Citation &entry, OutputBuffer &out) const;
+  std::string format_long_footnote(const Citation &entry) const;
 
   // Short footnote (subsequent)
-  std::string format_short_footnote(const nlohmann::json &entry) const;
+  void format_short_footnote(const Citation &entry, OutputBuffer &out) const;
+  std::string format_short_footnote(const Citation &entry) const;
+
+  // One of the three renderings above
+  void format(const Citation &entry, ChicagoVariant variant,
+              OutputBuffer &out) const;
 
   // Extract last name for sorting
-  static std::string get_author_last_name(const nlohmann::json &entry);
+  static std::string_view get_author_last_name(const Citation &entry);
 };
@@ -1,6 +1,40 @@
 #include "mla_formatter.hpp"
+#include "style_engine.hpp"
 
-// Stub MLA formatter
-std::string MLAFormatter::format(const nlohmann::json& entry) const {
-    return "[MLA] " + (entry.value("title", "Unknown Title"));
+namespace {
+
+using namespace style;
+
+// MLA 9th edition works-cited entry:
+//   Last, First, and First Last. "Title." *Journal*, vol. 3, no. 2, 2001,
+//   pp. 1-20. https://doi.org/...
+struct WorksCited {
+  static constexpr Op ops[] = {
+      names(NameForm::mla).label(", editor", ", editors"),
+      lit(". ").collapsing().if_names(NamesIf::some),
+
+      field(Field::title).pre("\"").post(".\"").or_else("Untitled")
+          .when(Type::article),
+      field(Field::title).italic().post(".").or_else("Untitled")
+          .when(Type::other),
+
+      // Container and publication facts, comma-separated
+      group(" ", ", "),
+      field(Field::journal_name).italic().when(Container::journal),
+      field(Field::volume).pre("vol. ").when(Container::journal),
+      field(Field::issue).pre("no. ").when(Container::journal),
+      field(Field::publisher).when(Container::publisher),
+      field(Field::year),
+      field(Field::pages).pre("pp. ").when(Container::journal),
+      end_group("."),
+
+      field(Field::doi).pre(" https://doi.org/").post(".").when(Link::doi),
+      field(Field::url).pre(" ").post(".").when(Link::url),
+  };
+};
+
+} // namespace
+
+void MLAFormatter::format(const Citation &entry, OutputBuffer &out) const {
+  style::format<WorksCited>(entry, out);
 }
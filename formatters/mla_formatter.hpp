@@ -1,7 +1,9 @@
 #pragma once
 #include "../include/citation.hpp"
 
+// MLA works-cited entries
 class MLAFormatter : public CitationFormatter {
 public:
-    std::string format(const nlohmann::json& entry) const override;
+    using CitationFormatter::format;
+    void format(const Citation& entry, OutputBuffer& out) const override;
 };
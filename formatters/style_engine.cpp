@@ -0,0 +1,196 @@
+#include "style_engine.hpp"
+#include <algorithm>
+
+namespace style {
+
+unsigned shape_of(const Citation &entry) {
+  Type type = entry.type == CitationType::article ||
+                      entry.type == CitationType::paper
+                  ? Type::article
+                  : Type::other;
+  Container container = entry.flag(Citation::has_journal)     ? Container::journal
+                        : entry.flag(Citation::has_publisher) ? Container::publisher
+                                                              : Container::none;
+  Link link = entry.flag(Citation::has_identifiers) ? Link::doi
+              : entry.flag(Citation::has_url)       ? Link::url
+                                                    : Link::none;
+  return shape_index(type, container, link);
+}
+
+FieldMask fields_present(const Citation &entry) {
+  FieldMask m = 0;
+  for (size_t f = 0; f < entry.fields.size(); ++f)
+    if (entry.fields[f].length > 0)
+      m |= 1u << f;
+  return m;
+}
+
+// "First Last", or just "Last" when there is no given name
+static void append_first_last(OutputBuffer &out, const Citation &entry,
+                              const ParsedName &name) {
+  out.text(entry.text(name.first));
+  if (name.first.length)
+    out.append(' ');
+  out.text(entry.text(name.last));
+}
+
+// "Last, First", or just "Last"
+static void append_last_first(OutputBuffer &out, const Citation &entry,
+                              const ParsedName &name) {
+  out.text(entry.text(name.last));
+  if (name.first.length)
+    out.append(", ").text(entry.text(name.first));
+}
+
+// Length of the UTF-8 sequence starting with `c`
+static size_t utf8_length(unsigned char c) {
+  if (c >= 0xF0)
+    return 4;
+  if (c >= 0xE0)
+    return 3;
+  if (c >= 0xC0)
+    return 2;
+  return 1;
+}
+
+// "Last, J. R." for APA: an initial per given name, hyphenated names
+// keeping their hyphen ("J.-P.")
+static void append_last_initials(OutputBuffer &out, const Citation &entry,
+                                 const ParsedName &name) {
+  out.text(entry.text(name.last));
+  std::string_view first = entry.text(name.first);
+  bool any = false;
+  size_t pos = 0;
+  while (pos < first.size()) {
+    if (first[pos] == ' ') {
+      ++pos;
+      continue;
+    }
+    out.append(any ? " " : ", ");
+    any = true;
+    // One word: initials of its hyphenated parts
+    bool part_start = true;
+    while (pos < first.size() && first[pos] != ' ') {
+      char c = first[pos];
+      if (c == '-') {
+        out.append('-');
+        part_start = true;
+        ++pos;
+      } else if (part_start && c != '.') {
+        size_t n = std::min(utf8_length(static_cast<unsigned char>(c)),
+                            first.size() - pos);
+        out.text(first.substr(pos, n)).append('.');
+        part_start = false;
+        pos += n;
+      } else {
+        ++pos;
+      }
+    }
+  }
+}
+
+void write_names(OutputBuffer &out, const Citation &entry,
+                 const ParsedName *names, size_t count, NameForm form) {
+  if (count == 0)
+    return;
+
+  switch (form) {
+    case NameForm::chicago_bibliography:
+      append_last_first(out, entry, names[0]);
+      if (count == 2) {
+        out.append(", and ");
+        append_first_last(out, entry, names[1]);
+      } else if (count > 2) {
+        for (size_t i = 1; i < count; ++i) {
+          out.append(", ");
+          if (i == count - 1)
+            out.append("and ");
+          append_first_last(out, entry, names[i]);
+        }
+      }
+      break;
+
+    case NameForm::chicago_note:
+      for (size_t i = 0; i < count; ++i) {
+        if (i > 0) {
+          if (i == count - 1)
+            out.append(", and ");
+          else
+            out.append(", ");
+        }
+        append_first_last(out, entry, names[i]);
+      }
+      break;
+
+    case NameForm::mla:
+      append_last_first(out, entry, names[0]);
+      if (count == 2) {
+        out.append(", and ");
+        append_first_last(out, entry, names[1]);
+      } else if (count > 2) {
+        out.append(", et al.");
+      }
+      break;
+
+    case NameForm::apa: {
+      // Up to 20 names; beyond that the first 19, an ellipsis and the last
+      size_t shown = count > 20 ? 19 : count;
+      for (size_t i = 0; i < shown; ++i) {
+        if (i > 0)
+          out.append(count <= 20 && i == count - 1 ? ", & " : ", ");
+        append_last_initials(out, entry, names[i]);
+      }
+      if (count > 20) {
+        out.append(", . . . ");
+        append_last_initials(out, entry, names[count - 1]);
+      }
+      break;
+    }
+  }
+}
+
+std::string_view lead_last_name(const Citation &entry) {
+  if (entry.author_count > 0) {
+    std::string_view last = entry.text(entry.author(0).last);
+    return last.empty() ? "Unknown" : last;
+  }
+  if (entry.editor_count > 0) {
+    std::string_view last = entry.text(entry.editor(0).last);
+    return last.empty() ? "Unknown" : last;
+  }
+  return "Unknown";
+}
+
+static bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+         c == '\r';
+}
+
+// First four words of the title, skipping a leading article, written
+// straight from the source text
+void write_short_title(OutputBuffer &out, std::string_view title) {
+  size_t pos = 0;
+  int count = 0;
+  while (count < 4) {
+    while (pos < title.size() && is_space(title[pos]))
+      ++pos;
+    if (pos == title.size())
+      break;
+    size_t end = pos;
+    while (end < title.size() && !is_space(title[end]))
+      ++end;
+    std::string_view word = title.substr(pos, end - pos);
+    pos = end;
+
+    // Skip articles at the beginning
+    if (count == 0 && (word == "The" || word == "A" || word == "An"))
+      continue;
+
+    if (count > 0)
+      out.append(' ');
+    out.text(word);
+    count++;
+  }
+}
+
+} // namespace style
@@ -0,0 +1,334 @@
+#pragma once
+#include "../include/citation.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+// Declarative citation styles. A style is a list of segments (Op) per
+// rendering, e.g. for a Chicago bibliography entry
+//
+//   struct Bibliography {
+//     static constexpr style::Op ops[] = {
+//         style::names(style::NameForm::chicago_bibliography),
+//         style::lit(". "),
+//         style::field(Field::title).pre("\"").post(".\"")
+//             .when(style::Type::article),
+//         ...
+//     };
+//   };
+//
+// and format<Bibliography>() turns it into formatting code at compile
+// time. Every entry has one of shape_count shapes (article or not; journal,
+// publisher or neither; DOI, URL or no link), and each shape gets its own
+// straight-line function with the segments that cannot apply to it compiled
+// out. At run time the shape is worked out once per call from the record's
+// type and flags, and what remains are the checks on field contents.
+namespace style {
+
+// What decides the shape of an entry
+enum class Type : std::uint8_t { other, article }; // article: article or paper
+enum class Container : std::uint8_t { none, journal, publisher };
+enum class Link : std::uint8_t { none, doi, url };
+
+constexpr unsigned shape_count = 2 * 3 * 3;
+
+constexpr unsigned shape_index(Type type, Container container, Link link) {
+  return static_cast<unsigned>(type) * 9 +
+         static_cast<unsigned>(container) * 3 + static_cast<unsigned>(link);
+}
+
+using ShapeMask = std::uint32_t;
+constexpr ShapeMask all_shapes = (1u << shape_count) - 1;
+
+// Shapes with the given type, container or link
+constexpr ShapeMask shapes_with(Type type) {
+  ShapeMask m = 0;
+  for (unsigned s = 0; s < shape_count; ++s)
+    if (s / 9 == static_cast<unsigned>(type))
+      m |= 1u << s;
+  return m;
+}
+constexpr ShapeMask shapes_with(Container container) {
+  ShapeMask m = 0;
+  for (unsigned s = 0; s < shape_count; ++s)
+    if (s / 3 % 3 == static_cast<unsigned>(container))
+      m |= 1u << s;
+  return m;
+}
+constexpr ShapeMask shapes_with(Link link) {
+  ShapeMask m = 0;
+  for (unsigned s = 0; s < shape_count; ++s)
+    if (s % 3 == static_cast<unsigned>(link))
+      m |= 1u << s;
+  return m;
+}
+
+unsigned shape_of(const Citation &entry);
+
+// Field presence bits for the run-time conditions
+using FieldMask = std::uint32_t;
+
+constexpr FieldMask bit(Field f) { return 1u << static_cast<unsigned>(f); }
+template <typename... Fields>
+constexpr FieldMask bits(Fields... fields) {
+  return (bit(fields) | ...);
+}
+
+FieldMask fields_present(const Citation &entry);
+
+// How the contributors are listed
+enum class NameForm : std::uint8_t {
+  chicago_bibliography, // Last, First, First Last, and First Last
+  chicago_note,         // First Last, First Last, and First Last
+  mla,                  // Last, First; Last, First, and First Last; Last, First, et al.
+  apa                   // Last, F. M., Last, F., & Last, F.
+};
+
+// Which contributors a segment requires
+enum class NamesIf : std::uint8_t { always, some, none };
+
+enum class Kind : std::uint8_t {
+  literal,     // `pre`
+  field,       // pre, the field (or `fallback` if empty), post
+  names,       // authors, else editors and the editor label, else `fallback`
+  lead_name,   // last name of the first author or editor, else "Unknown"
+  short_title, // first four words of the title, leading article dropped
+  group_begin, // items up to group_end are joined with `delimiter`; the
+  group_end    // group gets the begin's `pre` and the end's `post` if any
+};             // item was written
+
+struct Op {
+  Kind kind = Kind::literal;
+  Field field = Field::count;
+  NameForm form = NameForm::chicago_bibliography;
+  std::string_view prefix, suffix, fallback, delimiter;
+  std::string_view editor, editors; // names: label after one / several editors
+  bool emphasis = false;            // field text is set in italics
+  bool attach = false;              // in a group, written without the delimiter
+  bool collapse = false;            // no leading '.' right after a '.'
+  ShapeMask shapes = all_shapes;
+  FieldMask all = 0, any = 0, none = 0; // fields that must be (non)empty
+  NamesIf names_if = NamesIf::always;
+
+  constexpr Op pre(std::string_view s) const { Op o = *this; o.prefix = s; return o; }
+  constexpr Op post(std::string_view s) const { Op o = *this; o.suffix = s; return o; }
+  constexpr Op or_else(std::string_view s) const { Op o = *this; o.fallback = s; return o; }
+  constexpr Op italic() const { Op o = *this; o.emphasis = true; return o; }
+  constexpr Op attached() const { Op o = *this; o.attach = true; return o; }
+  constexpr Op collapsing() const { Op o = *this; o.collapse = true; return o; }
+  constexpr Op label(std::string_view one, std::string_view several) const {
+    Op o = *this;
+    o.editor = one;
+    o.editors = several;
+    return o;
+  }
+
+  template <typename Shape>
+  constexpr Op when(Shape s) const { Op o = *this; o.shapes &= shapes_with(s); return o; }
+  constexpr Op if_all(FieldMask m) const { Op o = *this; o.all |= m; return o; }
+  constexpr Op if_any(FieldMask m) const { Op o = *this; o.any |= m; return o; }
+  constexpr Op if_none(FieldMask m) const { Op o = *this; o.none |= m; return o; }
+  constexpr Op if_names(NamesIf n) const { Op o = *this; o.names_if = n; return o; }
+};
+
+constexpr Op lit(std::string_view s) { return Op().pre(s); }
+constexpr Op field(Field f) { Op o; o.kind = Kind::field; o.field = f; return o; }
+constexpr Op names(NameForm form) { Op o; o.kind = Kind::names; o.form = form; return o; }
+constexpr Op lead_name() { Op o; o.kind = Kind::lead_name; return o; }
+constexpr Op short_title() { Op o; o.kind = Kind::short_title; o.field = Field::title; return o; }
+constexpr Op group(std::string_view prefix, std::string_view delimiter) {
+  Op o;
+  o.kind = Kind::group_begin;
+  o.prefix = prefix;
+  o.delimiter = delimiter;
+  return o;
+}
+constexpr Op end_group(std::string_view suffix) {
+  Op o;
+  o.kind = Kind::group_end;
+  o.suffix = suffix;
+  return o;
+}
+
+// Shared pieces the generated code calls
+void write_names(OutputBuffer &out, const Citation &entry,
+                 const ParsedName *names, size_t count, NameForm form);
+std::string_view lead_last_name(const Citation &entry);
+void write_short_title(OutputBuffer &out, std::string_view title);
+
+namespace detail {
+
+struct State {
+  const Citation &entry;
+  OutputBuffer &out;
+  FieldMask present;
+  bool group_open = false;
+};
+
+// Index of the group_begin enclosing ops[i], or -1
+template <typename Program>
+constexpr int enclosing_group(size_t i) {
+  for (size_t j = i; j-- > 0;) {
+    if (Program::ops[j].kind == Kind::group_end)
+      return -1;
+    if (Program::ops[j].kind == Kind::group_begin)
+      return static_cast<int>(j);
+  }
+  return -1;
+}
+
+// Appends ops[I].*S; the string is known at compile time, so empty ones
+// cost nothing and single characters are pushed directly
+template <typename Program, size_t I, std::string_view Op::*S>
+inline void put(OutputBuffer &out) {
+  constexpr std::string_view s = Program::ops[I].*S;
+  if constexpr (s.size() == 1)
+    out.append(s[0]);
+  else if constexpr (!s.empty())
+    out.append(s);
+}
+
+template <typename Program, size_t I>
+inline void open_item(State &st) {
+  constexpr int g = enclosing_group<Program>(I);
+  constexpr size_t G = g >= 0 ? static_cast<size_t>(g) : 0;
+  if constexpr (g >= 0) {
+    if (!st.group_open) {
+      put<Program, G, &Op::prefix>(st.out);
+      st.group_open = true;
+    } else if constexpr (!Program::ops[I].attach) {
+      put<Program, G, &Op::delimiter>(st.out);
+    }
+  }
+}
+
+template <typename Program, unsigned Shape, size_t I>
+inline void emit(State &st) {
+  constexpr const Op &op = Program::ops[I];
+  if constexpr ((op.shapes >> Shape & 1u) != 0) {
+    // Run-time conditions; the ones a segment does not use compile away
+    if constexpr (op.all != 0)
+      if ((st.present & op.all) != op.all)
+        return;
+    if constexpr (op.any != 0)
+      if ((st.present & op.any) == 0)
+        return;
+    if constexpr (op.none != 0)
+      if ((st.present & op.none) != 0)
+        return;
+    if constexpr (op.names_if != NamesIf::always) {
+      bool some = st.entry.author_count + st.entry.editor_count > 0;
+      if (some != (op.names_if == NamesIf::some))
+        return;
+    }
+
+    OutputBuffer &out = st.out;
+    if constexpr (op.kind == Kind::literal) {
+      open_item<Program, I>(st);
+      if constexpr (op.collapse && !op.prefix.empty() && op.prefix[0] == '.') {
+        if (!out.empty() && out.view().back() == '.')
+          out.append(op.prefix.substr(1));
+        else
+          out.append(op.prefix);
+      } else {
+        put<Program, I, &Op::prefix>(out);
+      }
+    } else if constexpr (op.kind == Kind::field ||
+                         op.kind == Kind::short_title) {
+      std::string_view value = st.entry.get(op.field);
+      if constexpr (op.fallback.empty()) {
+        if (value.empty())
+          return;
+      } else {
+        if (value.empty())
+          value = op.fallback;
+      }
+      open_item<Program, I>(st);
+      put<Program, I, &Op::prefix>(out);
+      if constexpr (op.emphasis)
+        out.begin_italic();
+      if constexpr (op.kind == Kind::short_title)
+        write_short_title(out, value);
+      else
+        out.text(value);
+      if constexpr (op.emphasis)
+        out.end_italic();
+      put<Program, I, &Op::suffix>(out);
+    } else if constexpr (op.kind == Kind::names) {
+      const Citation &e = st.entry;
+      if (e.author_count > 0) {
+        open_item<Program, I>(st);
+        put<Program, I, &Op::prefix>(out);
+        write_names(out, e, &e.author(0), e.author_count, op.form);
+      } else if (e.editor_count > 0) {
+        open_item<Program, I>(st);
+        put<Program, I, &Op::prefix>(out);
+        write_names(out, e, &e.editor(0), e.editor_count, op.form);
+        out.append(e.editor_count > 1 ? op.editors : op.editor);
+      } else if constexpr (!op.fallback.empty()) {
+        open_item<Program, I>(st);
+        put<Program, I, &Op::prefix>(out);
+        out.append(op.fallback);
+      } else {
+        return;
+      }
+      put<Program, I, &Op::suffix>(out);
+    } else if constexpr (op.kind == Kind::lead_name) {
+      open_item<Program, I>(st);
+      put<Program, I, &Op::prefix>(out);
+      out.text(lead_last_name(st.entry));
+      put<Program, I, &Op::suffix>(out);
+    } else if constexpr (op.kind == Kind::group_begin) {
+      st.group_open = false;
+    } else if constexpr (op.kind == Kind::group_end) {
+      if (st.group_open)
+        put<Program, I, &Op::suffix>(out);
+      st.group_open = false;
+    }
+  }
+}
+
+template <typename Program, unsigned Shape, size_t... I>
+inline void run(State &st, std::index_sequence<I...>) {
+  (emit<Program, Shape, I>(st), ...);
+}
+
+// Whether any segment of Program tests field contents
+template <typename Program>
+constexpr bool tests_fields() {
+  for (const Op &op : Program::ops)
+    if (op.all | op.any | op.none)
+      return true;
+  return false;
+}
+
+template <typename Program, unsigned Shape>
+void format_shape(const Citation &entry, OutputBuffer &out) {
+  State st{entry, out, 0};
+  if constexpr (tests_fields<Program>())
+    st.present = fields_present(entry);
+  constexpr size_t n = sizeof(Program::ops) / sizeof(Program::ops[0]);
+  run<Program, Shape>(st, std::make_index_sequence<n>());
+}
+
+using FormatFn = void (*)(const Citation &, OutputBuffer &);
+
+template <typename Program, size_t... S>
+constexpr std::array<FormatFn, shape_count>
+shape_table(std::index_sequence<S...>) {
+  return {{&format_shape<Program, static_cast<unsigned>(S)>...}};
+}
+
+} // namespace detail
+
+// Appends the rendering `Program` describes
+template <typename Program>
+void format(const Citation &entry, OutputBuffer &out) {
+  static constexpr std::array<detail::FormatFn, shape_count> table =
+      detail::shape_table<Program>(std::make_index_sequence<shape_count>());
+  table[shape_of(entry)](entry, out);
+}
+
+} // namespace style
@@ -1,13 +1,43 @@
 #pragma once
+#include "metadata_cache.hpp"
 #include <string>
 #include <nlohmann/json.hpp>
 
+struct AddOptions {
+  unsigned max_inflight = 8; // concurrent lookups in batch mode
+  bool use_cache = true;     // consult the lookup cache (CITE_CACHE_DIR)
+  bool offline = false;      // answer only from the lookup cache
+  unsigned timeout = 30;     // seconds per request, 0 = none
+  unsigned retries = 2;      // retries after errors, 429 and 5xx
+  bool stats = false;        // print per-phase and network timings (RunStats)
+  std::string stats_json;    // also write them as JSON here ("-" = stdout)
+};
+
+class RunStats;
+
 // Entry point for new add flow
-int add_entry(const std::string &filename);
+int add_entry(const std::string &filename,
+              const AddOptions &options = AddOptions());
 
-nlohmann::json search_sources(const std::string &query);
+// Looks `query` up upstream, through `cache` when given. A request that
+// goes to the network has its DNS/connect/TLS/transfer times added to
+// `stats`.
+nlohmann::json search_sources(const std::string &query,
+                              MetadataCache *cache = nullptr,
+                              const AddOptions &options = AddOptions(),
+                              RunStats *stats = nullptr);
 std::vector<nlohmann::json> parse_results(const nlohmann::json &src, const std::string &mode);
 int show_results(const std::vector<nlohmann::json> &entries);
 void show_details(const nlohmann::json &entry);
 nlohmann::json edit_entry(nlohmann::json entry);
-void add_to_json(const std::string &filename, const nlohmann::json &entry);
+// Appends one entry unless the library already has its DOI or ISBN
+bool add_to_json(const std::string &filename, const nlohmann::json &entry);
+
+// Non-interactive add: looks up every DOI/ISBN listed in `list_file`
+// ("-" for stdin) with up to `max_inflight` concurrent requests and appends
+// the exact matches in one write
+int add_batch(const std::string &filename, const std::string &list_file,
+              const AddOptions &options = AddOptions());
+
+// Folds the add journal back into the library file
+int compact_entries(const std::string &filename);
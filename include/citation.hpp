@@ -1,25 +1,81 @@
 #pragma once
+#include "citation_record.hpp"
+#include "text_buffer.hpp"
+#include <cstdint>
+#include <functional>
 #include <memory>
-#include <nlohmann/json.hpp>
 #include <string>
 #include <vector>
 
 class CitationFormatter {
 public:
   virtual ~CitationFormatter() = default;
-  virtual std::string format(const nlohmann::json &entry) const = 0;
+
+  // Appends the bibliography entry for `entry` to `out`
+  virtual void format(const Citation &entry, OutputBuffer &out) const = 0;
+
+  std::string format(const Citation &entry) const;
 };
 
 std::unique_ptr<CitationFormatter> create_formatter(const std::string &style);
-std::vector<std::string> format_bibliography(const nlohmann::json &entries,
+
+// Collation key for Chicago bibliography order: last name, first name,
+// title (leading article ignored), then year, case-folded
+std::string chicago_sort_key(const Citation &entry);
+
+// Same for an APA reference list: a first author's works go by year
+std::string apa_sort_key(const Citation &entry);
+
+// Indices of `entries` in Chicago bibliography order
+std::vector<size_t> chicago_sort_order(const std::vector<Citation> &entries);
+
+// Same, from keys computed earlier (one per entry)
+std::vector<size_t> sort_order_by_keys(const std::vector<std::string> &keys);
+
+std::vector<std::string> format_bibliography(const std::vector<Citation> &entries,
                                              const std::string &style);
 
+// The three Chicago renderings of an entry
+enum class ChicagoVariant : std::uint8_t {
+  bibliography,
+  long_footnote,
+  short_footnote
+};
+
+// Formats entries[order[k]] for k = 0, 1, ... in `markup` and passes each
+// result to `emit` in that order. Works through the list in fixed-size
+// windows, formatting each window on `jobs` threads, so memory stays bounded
+// however long the list is. The view is only valid during the call.
+void for_each_chicago_citation(
+    const std::vector<Citation> &entries, const std::vector<size_t> &order,
+    ChicagoVariant variant, Markup markup, unsigned jobs,
+    const std::function<void(size_t k, std::string_view text)> &emit);
+
+// Same for any formatter; its format() must be safe to call from several
+// threads at once
+void for_each_citation(
+    const std::vector<Citation> &entries, const std::vector<size_t> &order,
+    const CitationFormatter &formatter, Markup markup, unsigned jobs,
+    const std::function<void(size_t k, std::string_view text)> &emit);
+
 // --- Add this struct definition ---
+// Views into the TextArena passed to format_chicago_with_footnotes
 struct ChicagoCitationBundle {
-  std::string bibliography;
-  std::string long_footnote;
-  std::string short_footnote;
+  std::string_view bibliography;
+  std::string_view long_footnote;
+  std::string_view short_footnote;
 };
 
+// Formats all three renderings of entries[indices[k]] into bundle k, in
+// `markup`; the text is stored in `arena`. `jobs` worker threads share the
+// work (0 = one per core); output does not depend on it.
+std::vector<ChicagoCitationBundle>
+format_chicago_bundles(const std::vector<Citation> &entries,
+                       const std::vector<size_t> &indices, Markup markup,
+                       TextArena &arena, unsigned jobs = 1);
+
+// Formats every entry in Chicago order, in `markup` (HTML by default)
 std::vector<ChicagoCitationBundle>
-format_chicago_with_footnotes(const nlohmann::json &entries);
+format_chicago_with_footnotes(const std::vector<Citation> &entries,
+                              TextArena &arena, unsigned jobs = 1,
+                              Markup markup = Markup::html);
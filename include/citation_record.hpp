@@ -0,0 +1,91 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Work types the formatters branch on; anything else is `other`
+enum class CitationType : std::uint8_t { other, article, paper, book, chapter };
+
+// Scalar fields of a record, decoded once from BibJSON
+enum class Field : std::uint8_t {
+  id,
+  type_name,
+  title,
+  year,
+  place,
+  publisher,
+  url,
+  doi,
+  isbn,
+  journal_name,
+  volume,
+  issue,
+  pages,
+  count
+};
+
+// Offset and length of a string inside Citation::storage
+struct FieldRef {
+  std::uint32_t offset = 0;
+  std::uint32_t length = 0;
+};
+
+// Author or editor, split into given and family names
+struct ParsedName {
+  FieldRef first;
+  FieldRef last;
+};
+
+// Flat, typed form of a BibJSON record. Every string lives in one packed
+// buffer and is addressed by offset, so a record is two allocations no
+// matter how many fields it has, and copies/moves keep the refs valid.
+struct Citation {
+  enum Flags : std::uint8_t {
+    has_journal = 1,     // "journal" is an object
+    has_publisher = 2,   // "publisher" key present
+    has_identifiers = 4, // "identifier" is an array
+    has_url = 8          // "url" key present
+  };
+
+  CitationType type = CitationType::other;
+  std::uint8_t flags = 0;
+  std::uint32_t author_count = 0;
+  std::uint32_t editor_count = 0;
+  std::array<FieldRef, static_cast<std::size_t>(Field::count)> fields{};
+  std::vector<ParsedName> names; // authors first, then editors
+  std::string storage;
+
+  std::string_view text(FieldRef r) const {
+    return std::string_view(storage.data() + r.offset, r.length);
+  }
+  std::string_view get(Field f) const {
+    return text(fields[static_cast<std::size_t>(f)]);
+  }
+  bool has(Field f) const {
+    return fields[static_cast<std::size_t>(f)].length > 0;
+  }
+  bool flag(Flags f) const { return (flags & f) != 0; }
+
+  const ParsedName &author(std::size_t i) const { return names[i]; }
+  const ParsedName &editor(std::size_t i) const {
+    return names[author_count + i];
+  }
+};
+
+// Appends a string to `storage` and returns its ref
+FieldRef intern(std::string &storage, std::string_view s);
+
+// Splits a BibJSON person (structured object or "Last, First"/"First Last"
+// string) into first/last, interning the parts into `storage`
+ParsedName parse_name(const nlohmann::json &person, std::string &storage);
+
+// Decodes one BibJSON record
+Citation decode_citation(const nlohmann::json &entry);
+
+// Content hash of everything the formatters read from a record; equal
+// hashes mean equal renderings
+std::uint64_t citation_hash(const Citation &c);
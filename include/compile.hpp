@@ -0,0 +1,8 @@
+#pragma once
+#include <string>
+
+// Compiles a BibJSON library into a binary .citec cache that export loads
+// instead of the JSON while the JSON is unchanged. An empty output_file
+// means the default path next to the library. A sharded library (see
+// is_sharded_library) has each shard compiled next to itself.
+int cite_compile(const std::string &filename, const std::string &output_file);
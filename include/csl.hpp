@@ -0,0 +1,209 @@
+#pragma once
+#include "citation.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// CSL (Citation Style Language, citationstyles.org) styles. A .csl file is
+// parsed once and compiled into a flat instruction list for its
+// bibliography layout, with macros inlined, locale terms resolved and
+// choose/if turned into jumps; the interpreter then runs that list over
+// each record. Compiled styles are cached on disk under the style's
+// content hash, so later runs skip the XML entirely.
+//
+// Supported: macros, text (variable, macro, term, value), number, label,
+// names (name options, et-al, label, substitute), date (year), group,
+// choose (type, variable, is-numeric; match any/all/none), affixes,
+// delimiters, italics, quotes, text-case, strip-periods, locale terms
+// and bibliography sort keys. The rest of CSL (citation layouts,
+// disambiguation, months and days, which records do not have) is ignored.
+namespace csl {
+
+// Record data a style can ask for
+enum class Var : std::uint8_t {
+  title,
+  container_title,
+  volume,
+  issue,
+  page,
+  publisher,
+  publisher_place,
+  doi,
+  url,
+  isbn,
+  issued, // year only
+  author,
+  editor,
+  unknown, // anything else: always empty
+  count
+};
+
+struct StrRef {
+  std::uint32_t offset = 0;
+  std::uint32_t length = 0;
+};
+
+enum class Op : std::uint8_t {
+  text,      // a/b: offset/length in strings
+  variable,  // arg: Var, flags: Case, a: 1 + Frame of its affixes, or 0
+  label,     // arg: Var, a: terms index of the singular, plural after it
+  names,     // a: NameSpec, b: jump target when a name was written
+  begin,     // a: Frame
+  end,       // a: Frame
+  separator, // a: Frame whose delimiter goes before the next child
+  close_separator, // drops the delimiter again if the child wrote nothing
+  test,      // a: Condition, b: jump target when it fails
+  jump,      // b: target
+  substitute_begin,
+  substitute_check, // b: jump target once a substitute wrote something
+  substitute_end,
+  halt
+};
+
+// Text-case and strip-periods on a leaf
+enum Case : std::uint8_t {
+  case_none = 0,
+  case_lowercase,
+  case_uppercase,
+  case_capitalize_first,
+  case_capitalize_all,
+  case_title,
+  case_mask = 7,
+  strip_periods = 8
+};
+
+struct Instr {
+  Op op = Op::halt;
+  std::uint8_t flags = 0;
+  std::uint16_t arg = 0;
+  std::uint32_t a = 0;
+  std::uint32_t b = 0;
+};
+
+// Affixes, formatting and delimiter of a rendering element
+struct Frame {
+  StrRef prefix, suffix, delimiter;
+  std::uint8_t italic = 0;
+  std::uint8_t quotes = 0;
+  std::uint8_t group = 0; // suppressed when it calls only empty variables
+  std::uint8_t reserved = 0;
+};
+
+enum class Match : std::uint8_t { all, any, none };
+
+struct Condition {
+  std::uint32_t types = 0;     // record types, any of which matches
+  std::uint32_t variables = 0; // Var bits that must be non-empty
+  std::uint32_t numeric = 0;   // Var bits that must be numeric
+  std::uint32_t impossible = 0; // tests that are never true for a record
+  Match match = Match::all;
+  std::uint8_t reserved[3] = {};
+};
+
+enum class NameOrder : std::uint8_t { given_first, first_inverted, all_inverted };
+enum class Precedes : std::uint8_t { contextual, always, never, after_inverted };
+
+struct NameSpec {
+  std::uint8_t vars[4] = {};     // Var, in the order listed
+  std::uint8_t var_count = 0;
+  NameOrder order = NameOrder::given_first;
+  Precedes delimiter_precedes_last = Precedes::contextual;
+  Precedes delimiter_precedes_et_al = Precedes::contextual;
+  std::uint8_t short_form = 0;   // family names only
+  std::uint8_t count_form = 0;   // the number of names
+  std::uint8_t initialize = 0;   // given names as initials
+  std::uint8_t label_after = 1;  // label follows the names
+  std::uint16_t et_al_min = 0;   // 0 = never abbreviate
+  std::uint16_t et_al_use_first = 1;
+  StrRef delimiter;              // between names
+  StrRef and_term;               // before the last name, if any
+  StrRef sort_separator;         // between family and given name
+  StrRef initialize_with;
+  StrRef et_al;
+  StrRef names_delimiter;        // between the lists of several variables
+  StrRef name_prefix, name_suffix;
+  StrRef label_prefix, label_suffix;
+  StrRef label_single[4], label_plural[4]; // per var; empty = no label
+};
+
+struct SortKey {
+  std::uint32_t entry = 0; // code offset of the key's program
+  std::uint8_t descending = 0;
+  std::uint8_t reserved[3] = {};
+};
+
+// A compiled style: flat arrays of plain structs and one string pool,
+// written to the on-disk cache as they are
+struct Program {
+  std::string title;
+  std::uint32_t bibliography = 0; // code offset
+  std::vector<Instr> code;
+  std::vector<Frame> frames;
+  std::vector<Condition> conditions;
+  std::vector<NameSpec> names;
+  std::vector<SortKey> sort;
+  std::vector<StrRef> terms; // label terms, singular then plural
+  std::string strings;
+
+  std::string_view str(StrRef r) const {
+    return std::string_view(strings.data() + r.offset, r.length);
+  }
+};
+
+// Compiles CSL XML. False with a message in `error` if the style cannot
+// be read.
+bool compile(std::string_view xml, Program &program, std::string &error);
+
+// Applies a leaf's Case flags to `s` (ASCII letters only)
+void apply_text_case(std::string &s, std::uint8_t flags);
+
+// Cache file for the style whose XML hashes to `source_hash`:
+// <dir>/csl/<hash>.cslc
+std::string cache_path(const std::string &dir, std::uint64_t source_hash);
+
+// Writes through a temp file and rename, creating the directory
+bool write_cache(const std::string &path, std::uint64_t source_hash,
+                 const Program &program);
+
+// Loads a cache file written for this source, checking that every index
+// and offset in it is in range
+bool read_cache(const std::string &path, std::uint64_t source_hash,
+                Program &program);
+
+// Deepest nesting of frames and substitutes a program may use
+constexpr unsigned max_depth = 32;
+
+} // namespace csl
+
+// Formats bibliography entries with a compiled CSL style
+class CslFormatter : public CitationFormatter {
+public:
+  explicit CslFormatter(std::shared_ptr<const csl::Program> program);
+
+  using CitationFormatter::format;
+  void format(const Citation &entry, OutputBuffer &out) const override;
+
+  // The style's name from its <info><title>
+  const std::string &title() const { return program_->title; }
+
+  // Indices of `entries` in the order of the style's bibliography <sort>
+  // keys; input order if it has none
+  std::vector<size_t> sort_order(const std::vector<Citation> &entries) const;
+
+private:
+  std::shared_ptr<const csl::Program> program_;
+  bool escape_; // style text has to go through OutputBuffer::text()
+};
+
+struct CslLoadInfo {
+  bool from_cache = false; // the XML was not parsed
+};
+
+// Loads a .csl file, from the compiled cache in `cache_dir` when it holds
+// this exact style ("" = no cache), compiling and caching it otherwise.
+// Prints the reason to stderr and returns nullptr on failure.
+std::unique_ptr<CslFormatter> load_csl_style(const std::string &path,
+                                             const std::string &cache_dir,
+                                             CslLoadInfo *info = nullptr);
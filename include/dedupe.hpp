@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+
+struct DedupeOptions {
+  bool merge = false; // rewrite the library without the duplicates
+  bool fuzzy = true;  // also match on title, first author and year
+};
+
+// Finds records describing the same work: any shared DOI or ISBN (every
+// entry of the "identifier" array, normalized, ISBN-10s as ISBN-13), and
+// unless disabled, near-identical titles by the same first author in the
+// same year. Identifiers go through hash tables and titles are only
+// compared within a (last name, year) block, so the pass stays close to
+// linear in the size of the library.
+//
+// Prints the groups found. With `merge`, the first record of each group
+// is kept, gains the fields and identifiers only its duplicates had, and
+// the rest are removed from the file.
+int cite_dedupe(const std::string &filename, const DedupeOptions &options);
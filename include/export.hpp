@@ -1,4 +1,35 @@
 #pragma once
 #include <string>
+#include <vector>
+
+struct ExportOptions {
+  unsigned jobs = 1;      // formatting threads, 0 = one per core
+  bool map_input = true;  // mmap the library instead of streaming it
+  bool use_cache = true;  // load a matching compiled .citec cache instead
+  bool incremental = false; // re-render only records changed since last run
+  bool watch = false;     // keep running, rewriting on library changes
+  bool stats = false;     // print per-phase timings to stderr (RunStats)
+  std::string stats_json; // also write them as JSON here ("-" = stdout)
+  std::string csl;        // .csl style file to format with instead of `style`
+};
+
+// Writes the bibliography to each of `output_files` (.html or .md), or to
+// the terminal when there are none. Several outputs share one formatting
+// pass: entries are formatted once in Markup::neutral and converted for
+// each file.
+//
+// For mla and apa the document is the style's works cited or reference
+// list alone. With `csl`, it is that style's bibliography, sorted by its
+// <sort> keys. The compiled style is cached next to the lookup cache
+// (see load_csl_style) unless `use_cache` is off.
+//
+// `filename` may also be a directory or glob of shards (see
+// load_library), loaded in parallel and merged.
+//
+// With `watch`, stays running after the first write: the library and its
+// journal are watched (LiveSnapshot), and every change is reloaded in the
+// background and written to the same outputs until SIGINT or SIGTERM. For
+// shards, those are the shards found at startup.
 int cite_export(const std::string &filename, const std::string &style,
-                const std::string &output_file);
+                const std::vector<std::string> &output_files,
+                const ExportOptions &options = ExportOptions());
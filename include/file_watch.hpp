@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Waits for changes to a set of files. On Linux this is inotify on their
+// directories, so a save is seen as soon as the file is closed or renamed
+// into place (write_json_file_atomic, editors that replace the file).
+// Elsewhere, or if inotify is unavailable, sizes and modification times
+// are polled every `poll_ms`.
+class FileWatcher {
+public:
+  explicit FileWatcher(const std::vector<std::string> &paths,
+                       unsigned poll_ms = 500);
+  ~FileWatcher();
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+  // True once any of the files changed, false after `timeout_ms` without
+  // a change. Bursts of events from one save are folded into one return.
+  bool wait(unsigned timeout_ms);
+
+private:
+  bool wait_inotify(unsigned timeout_ms);
+  bool wait_polling(unsigned timeout_ms);
+  std::vector<std::uint64_t> stamps() const;
+
+  std::vector<std::string> paths_;
+  unsigned poll_ms_;
+  int inotify_ = -1;
+  std::vector<std::pair<int, std::string>> watched_; // watch id, file name
+  std::vector<std::uint64_t> stamps_;
+};
+
+// Holds the current immutable snapshot of something loaded from files
+// (a library and what is derived from it). Readers take it with get(),
+// which is an atomic shared_ptr load: they never wait for a reload and
+// keep the version they got for as long as they hold it. A background
+// thread watches the files, builds a new snapshot when they change and
+// publishes it with an atomic store; the old one is freed when its last
+// reader lets go. A load that fails keeps the previous snapshot.
+template <typename T> class LiveSnapshot {
+public:
+  using Loader = std::function<std::shared_ptr<const T>()>;
+  using Listener = std::function<void(const std::shared_ptr<const T> &)>;
+
+  LiveSnapshot() = default;
+  ~LiveSnapshot() { stop(); }
+  LiveSnapshot(const LiveSnapshot &) = delete;
+  LiveSnapshot &operator=(const LiveSnapshot &) = delete;
+
+  // Loads the first snapshot on the calling thread, then starts watching
+  // `paths`. `published` (if given) runs on the watch thread after each
+  // reload. False if the first load failed.
+  bool start(const std::vector<std::string> &paths, Loader load,
+             Listener published = nullptr, unsigned poll_ms = 500) {
+    std::shared_ptr<const T> first = load();
+    if (!first)
+      return false;
+    std::atomic_store(&current_, first);
+    load_ = std::move(load);
+    published_ = std::move(published);
+    watcher_ = std::make_unique<FileWatcher>(paths, poll_ms);
+    thread_ = std::thread([this] { run(); });
+    return true;
+  }
+
+  void stop() {
+    stop_ = true;
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  std::shared_ptr<const T> get() const { return std::atomic_load(&current_); }
+
+  std::uint64_t reloads() const { return reloads_; }
+
+private:
+  void run() {
+    while (!stop_) {
+      if (!watcher_->wait(200))
+        continue;
+      std::shared_ptr<const T> fresh = load_();
+      if (!fresh) {
+        std::cerr << "Warning: keeping the previous version after a failed "
+                     "reload\n";
+        continue;
+      }
+      std::atomic_store(&current_, fresh);
+      ++reloads_;
+      if (published_)
+        published_(fresh);
+    }
+  }
+
+  std::shared_ptr<const T> current_;
+  Loader load_;
+  Listener published_;
+  std::unique_ptr<FileWatcher> watcher_;
+  std::atomic<bool> stop_{false};
+  std::atomic<std::uint64_t> reloads_{0};
+  std::thread thread_;
+};
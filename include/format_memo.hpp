@@ -0,0 +1,85 @@
+#pragma once
+#include "citation.hpp"
+#include <array>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// In-process memo of formatted citations, in front of the formatters.
+// Renderings are keyed by content (citation_hash() of the record, the
+// style and the variant), not by id, so an edited record is never served
+// stale and identical records share one entry. They are stored in
+// Markup::neutral and converted on the way out, so HTML, Markdown and
+// terminal output all share the same entry.
+//
+// Thread-safe: entries are spread over independently locked shards, and
+// formatting on a miss happens outside the lock. Memory is bounded; each
+// shard evicts its least recently used entries.
+class FormatMemo {
+public:
+  struct Stats {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0; // rendered text plus bookkeeping
+  };
+
+  static constexpr size_t default_max_bytes = 32 * 1024 * 1024;
+
+  explicit FormatMemo(size_t max_bytes = default_max_bytes);
+
+  // Appends `variant` of `entry` in `style` ("chicago", "mla", "apa") to
+  // `out`, in out.markup(). Styles other than Chicago only have the
+  // bibliography variant; false for anything that cannot be formatted.
+  bool format(const Citation &entry, const std::string &style,
+              ChicagoVariant variant, OutputBuffer &out);
+
+  // Same, with citation_hash(entry) already computed
+  bool format(const Citation &entry, std::uint64_t hash,
+              const std::string &style, ChicagoVariant variant,
+              OutputBuffer &out);
+
+  // True if `style` is one format() can use
+  bool has_style(const std::string &style);
+
+  Stats stats() const;
+  void clear();
+
+private:
+  struct Key {
+    std::uint64_t record;
+    std::uint64_t style;
+    ChicagoVariant variant;
+    bool operator==(const Key &o) const {
+      return record == o.record && style == o.style && variant == o.variant;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &k) const;
+  };
+  using Lru = std::list<std::pair<Key, std::string>>;
+  struct Shard {
+    mutable std::mutex mutex;
+    Lru lru; // most recently used first
+    std::unordered_map<Key, Lru::iterator, KeyHash> index;
+    size_t bytes = 0;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+  };
+
+  const CitationFormatter *formatter(const std::string &style);
+  void insert(Shard &shard, const Key &key, std::string text);
+
+  static constexpr size_t shard_count = 16;
+  std::array<Shard, shard_count> shards_;
+  size_t shard_max_bytes_;
+
+  std::mutex formatters_mutex_;
+  std::unordered_map<std::string, std::unique_ptr<CitationFormatter>>
+      formatters_;
+};
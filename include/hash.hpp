@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Fast non-cryptographic 64-bit hash for change detection and cache keys.
+// FNV-1a style, but consumes 8 bytes per step so hashing a large library
+// runs at memory speed.
+inline std::uint64_t hash_bytes(std::string_view s,
+                                std::uint64_t seed = 0xcbf29ce484222325ULL) {
+  const std::uint64_t prime = 0x100000001b3ULL;
+  std::uint64_t h = seed ^ (s.size() * prime);
+  size_t i = 0;
+  for (; i + 8 <= s.size(); i += 8) {
+    std::uint64_t word;
+    std::memcpy(&word, s.data() + i, 8);
+    h = (h ^ word) * prime;
+    h ^= h >> 29;
+  }
+  for (; i < s.size(); ++i)
+    h = (h ^ static_cast<unsigned char>(s[i])) * prime;
+  h ^= h >> 32;
+  return h;
+}
+
+// Folds another value into a running hash
+inline std::uint64_t hash_combine(std::uint64_t h, std::uint64_t v) {
+  return (h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2))) *
+         0x100000001b3ULL;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "json_filter.hpp"
+#include <curl/curl.h>
+#include <string>
+#include <vector>
+
+struct HttpOptions {
+  long connect_timeout_ms = 10000;
+  long timeout_ms = 30000;            // whole transfer, 0 = none
+  unsigned retries = 2;               // extra attempts on errors, 429 and 5xx
+  long backoff_ms = 500;              // first retry delay, doubled each time
+  unsigned max_host_connections = 8;  // per host, across all transfers
+};
+
+// Where a request's time went, from curl_easy_getinfo, summed over its
+// attempts. A reused connection shows no DNS, connect or TLS time.
+struct HttpTiming {
+  double dns_s = 0;      // name lookup
+  double connect_s = 0;  // TCP connect, after the lookup
+  double tls_s = 0;      // TLS handshake, after the connect
+  double transfer_s = 0; // from the handshake to the last byte
+};
+
+// One GET; filled in by HttpClient
+struct HttpRequest {
+  std::string url;
+  // With a filter the response is pruned as it arrives and `body` receives
+  // only the pruned JSON (empty if the response was not valid JSON)
+  JsonFieldFilter *filter = nullptr;
+  std::string body;
+  long status = 0;  // HTTP status of the last attempt
+  bool ok = false;  // transfer completed (any status)
+  unsigned attempts = 0;
+  HttpTiming timing;
+};
+
+// Long-lived HTTP client for metadata lookups. Connections, resolved
+// names and TLS sessions are kept across requests (one share handle behind
+// a reused easy handle and a persistent multi handle), so only the first
+// lookup per host pays for the handshakes. Concurrent requests to one host
+// are multiplexed over HTTP/2 where the server supports it.
+class HttpClient {
+public:
+  explicit HttpClient(HttpOptions options = HttpOptions());
+  ~HttpClient();
+  HttpClient(const HttpClient &) = delete;
+  HttpClient &operator=(const HttpClient &) = delete;
+
+  const HttpOptions &options() const { return options_; }
+  void set_options(const HttpOptions &options) { options_ = options; }
+
+  // Blocking GET with retries; true once a response (any status) arrived
+  bool get(HttpRequest &request);
+
+  // Runs all requests with at most `max_inflight` transfers at a time,
+  // retrying each as `get` would
+  void get_all(const std::vector<HttpRequest *> &requests,
+               unsigned max_inflight);
+
+private:
+  void configure(CURL *curl, HttpRequest &request) const;
+  static void begin_attempt(HttpRequest &request);
+  static void end_attempt(CURL *curl, HttpRequest &request);
+  bool should_retry(const HttpRequest &request) const;
+  long retry_delay_ms(CURL *curl, const HttpRequest &request) const;
+
+  HttpOptions options_;
+  CURLSH *share_ = nullptr;
+  CURL *easy_ = nullptr;
+  CURLM *multi_ = nullptr;
+};
@@ -0,0 +1,49 @@
+#pragma once
+#include "json_utils.hpp"
+#include <nlohmann/json.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Write-ahead journal for `cite add`. New records are appended to
+// <library>.journal as JSON lines (one O(1), fsynced write per add) instead
+// of rewriting the library; readers replay the journal on top of the
+// library, and compaction folds it back in with an atomic temp-file+rename.
+//
+// The first line is a header recording the library's record count and size
+// when the journal was started, and the number of its first "rec_N" id,
+// chosen past every id the library already uses. While the library still
+// has that many records the journal is replayed as is; after an edit or an
+// interrupted compaction, records whose id the library already holds count
+// as applied. Appends and compactions hold an advisory lock on
+// <library>.journal.lock, so concurrent `cite add` runs do not hand out the
+// same id or race a compaction.
+
+// Journals larger than this are compacted by the next append
+const size_t journal_compact_threshold = 1000;
+
+// lib.json -> lib.journal
+std::string journal_path(const std::string &library);
+
+// Appends `entries` in one write, assigning each the next "rec_N" id and
+// the collection; the assigned ids are stored in `ids`. Creates the library
+// if it does not exist.
+bool journal_append(const std::string &library,
+                    const std::vector<nlohmann::json> &entries,
+                    std::vector<std::string> &ids, std::string *error);
+
+// Streams the journal's pending records, given how many records the library
+// itself holds. Only if that differs from the journal's header is
+// `in_library` asked about ids, to skip records already applied (with a
+// warning on stderr). Does nothing if there is no journal.
+void for_each_journal_record(
+    const std::string &library, size_t library_records,
+    const std::function<bool(const std::string &id)> &in_library,
+    const RecordCallback &on_record);
+
+// Folds pending journal records into the library and removes the journal.
+// Records already in the library are not added twice; a library record with
+// a journaled id but different content is an error, and the journal is kept.
+// `compacted` (if given) receives the number of records moved.
+bool compact_journal(const std::string &library, std::string *error,
+                     size_t *compacted = nullptr);
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Push parser that prunes a JSON document while it streams in. Bytes are
+// fed as they arrive (e.g. from a curl write callback); only the parts
+// reachable through a schema are copied out, as compact JSON text, and
+// everything else is skipped without being buffered. The pruned text is
+// then small enough to hand to nlohmann::json::parse.
+class JsonFieldFilter {
+public:
+  // Which parts of a value to keep
+  struct Node {
+    std::vector<std::pair<std::string, const Node *>> keys; // object members
+    const Node *any_key = nullptr; // members not listed in `keys`
+    const Node *items = nullptr;   // array elements
+    bool keep_all = false;         // the whole value, verbatim
+
+    const Node *find(std::string_view key) const;
+    static const Node &all();
+  };
+
+  explicit JsonFieldFilter(const Node &root);
+
+  // Feeds the next chunk; false once the input is not valid JSON
+  bool feed(std::string_view chunk);
+
+  // True if the input so far is one complete document
+  bool finish();
+
+  // Starts over on a new document
+  void reset();
+
+  // The pruned document
+  std::string &output() { return out_; }
+
+private:
+  enum class Emit : std::uint8_t { none, all, filtered };
+  enum class State : std::uint8_t {
+    value,
+    value_or_end,
+    key,
+    key_or_end,
+    colon,
+    comma_or_end,
+    string,
+    scalar,
+    end
+  };
+  struct Target {
+    Emit emit;
+    const Node *node;
+  };
+  struct Frame {
+    bool object;
+    Emit emit;
+    const Node *node;
+    bool wrote; // a member was emitted (filtered frames write their commas)
+  };
+
+  bool step(char c);
+  bool start_value(char c);
+  void start_key();
+  void resolve_key();
+  bool close(char c);
+  void end_value();
+  Target element_target() const;
+  void begin_member(Frame &f);
+
+  const Node &root_;
+  std::vector<Frame> stack_;
+  State state_ = State::value;
+  Target pending_;
+  std::string out_;
+  std::string key_;
+  std::string *sink_ = nullptr; // where string bytes go
+  bool str_key_ = false;
+  bool escape_ = false;
+  bool scalar_emit_ = false;
+  bool failed_ = false;
+};
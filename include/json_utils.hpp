@@ -1,7 +1,41 @@
 #pragma once
+#include <functional>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <string_view>
 #include <vector>
 
+struct JsonReadOptions {
+  // Map the file and parse it in place instead of through an istream.
+  // Meant for read-only commands such as export.
+  bool map_file = false;
+};
+
 // Loads a JSON file from disk and returns the parsed nlohmann::json object
-nlohmann::json load_json_file(const std::string &filepath);
+nlohmann::json load_json_file(const std::string &filepath,
+                              const JsonReadOptions &options = JsonReadOptions());
+
+// Writes `j` (indented) to a temp file next to `filepath`, syncs it and
+// renames it over `filepath`, so readers see either the old or the new file
+bool write_json_file_atomic(const std::string &filepath,
+                            const nlohmann::json &j,
+                            std::string *error = nullptr);
+
+enum class RecordStreamStatus { ok, open_failed, parse_error, no_records };
+
+// Called once per record; return false to stop reading early
+using RecordCallback = std::function<bool(nlohmann::json &&record)>;
+
+// Streams BibJSON records one at a time from the file's "records" array or
+// from a top-level array, without building a DOM for the whole library.
+// On parse_error, `error` (if given) receives the parser message.
+RecordStreamStatus
+for_each_json_record(const std::string &filepath,
+                     const RecordCallback &on_record,
+                     std::string *error = nullptr,
+                     const JsonReadOptions &options = JsonReadOptions());
+
+// Same, over JSON text already in memory (e.g. a MappedFile)
+RecordStreamStatus for_each_json_record_in(std::string_view text,
+                                           const RecordCallback &on_record,
+                                           std::string *error = nullptr);
@@ -0,0 +1,52 @@
+#pragma once
+#include "citation.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A loaded bibliography: decoded records plus, when they came from a
+// compiled cache, their precomputed Chicago sort keys
+struct Library {
+  std::vector<Citation> entries;
+  std::vector<std::string> sort_keys; // empty, or one per entry
+  std::uint64_t source_hash = 0;      // hash_bytes() of the JSON source
+  std::uint64_t source_size = 0;
+
+  // Sharded libraries: each shard's entries (as indices into `entries`)
+  // in Chicago order, for library_sort_order to merge
+  std::vector<std::vector<size_t>> sorted_runs;
+};
+
+struct LibraryLoadOptions {
+  bool map_file = true;  // mmap the JSON instead of streaming it
+  bool use_cache = true; // load <file>.citec instead when it matches
+  bool include_journal = true; // replay records added since last compaction
+  unsigned jobs = 0; // shards loaded at once, 0 = one per core
+};
+
+// A library can also be a set of BibJSON shards: a directory (its *.json
+// files) or a glob in the last path component ("refs/2024-*.json").
+bool is_sharded_library(const std::string &spec);
+
+// The files `spec` stands for, sorted by path: its shards, or the file
+// itself. Empty, with the reason in `error`, if a directory or glob has no
+// matching files.
+std::vector<std::string> library_shards(const std::string &spec,
+                                        std::string &error);
+
+// Files whose changes mean the library has to be reloaded: every shard
+// and its add journal
+std::vector<std::string> library_watch_paths(const std::string &spec);
+
+// Loads a BibJSON library. On failure prints the reason to stderr and
+// returns 2 (the export exit code for bad input); returns 0 on success.
+//
+// Shards are loaded on `jobs` threads, each one like a single-file
+// library (its own .citec cache and journal), sorted on the same thread,
+// and appended in path order.
+int load_library(const std::string &filename, Library &library,
+                 const LibraryLoadOptions &options = LibraryLoadOptions());
+
+// Chicago order of the library's entries, using stored keys when present.
+// A sharded library's sorted runs are merged rather than sorted again.
+std::vector<size_t> library_sort_order(const Library &library);
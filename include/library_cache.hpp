@@ -0,0 +1,25 @@
+#pragma once
+#include "library.hpp"
+#include <cstdint>
+#include <string>
+
+// Compiled library cache (.citec). A versioned binary image of a Library:
+// header, offset table, then one fixed-layout block per record holding the
+// type, flags, field refs, pre-split names, packed strings and the Chicago
+// sort key. Tied to its JSON source by size and hash_bytes().
+
+// lib.json -> lib.citec
+std::string library_cache_path(const std::string &json_path);
+
+// Writes the cache through a temp file and rename, so readers never see a
+// partial file. `library.sort_keys` are computed if missing.
+bool write_library_cache(const std::string &path, const Library &library,
+                         std::string *error = nullptr);
+
+enum class CacheStatus { loaded, missing, stale, invalid };
+
+// Loads the cache into `library` if it was built from a source with this
+// hash and size
+CacheStatus read_library_cache(const std::string &path,
+                               std::uint64_t source_hash,
+                               std::uint64_t source_size, Library &library);
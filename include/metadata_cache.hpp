@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// On-disk cache of CrossRef/OpenLibrary responses for `cite add`, stored
+// as pruned by the lookup's JsonFieldFilter (only the fields it reads).
+// One file per lookup, named by a hash of the normalized identifier and
+// the request URL, so several machines can share one cache directory.
+// Entries expire after a TTL; when the directory outgrows its size cap the
+// least recently used files (by mtime, refreshed on every hit) are evicted.
+struct MetadataCacheOptions {
+  std::string dir;                           // "" = disabled
+  std::int64_t ttl_seconds = 30 * 24 * 3600; // 0 = never expire
+  std::uint64_t max_bytes = 64ull << 20;     // 0 = unbounded
+  bool offline = false;                      // never touch the network
+
+  // Defaults, overridden by CITE_CACHE_DIR (else $XDG_CACHE_HOME/cite or
+  // ~/.cache/cite), CITE_CACHE_TTL (seconds), CITE_CACHE_MAX_MB and
+  // CITE_OFFLINE=1
+  static MetadataCacheOptions from_env();
+};
+
+class MetadataCache {
+public:
+  explicit MetadataCache(MetadataCacheOptions options);
+
+  bool enabled() const { return !options_.dir.empty(); }
+  bool offline() const { return options_.offline; }
+
+  // Identifier in canonical form: DOIs lowercased, ISBNs without hyphens,
+  // search terms trimmed and lowercased
+  static std::string normalize(const std::string &mode,
+                               const std::string &query);
+
+  // Fresh cached body for the lookup, if any
+  bool get(const std::string &key, const std::string &url, std::string &body);
+
+  // Stores a successful response through a temp file and rename
+  void put(const std::string &key, const std::string &url,
+           const std::string &body);
+
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+private:
+  std::string path_for(const std::string &key, const std::string &url) const;
+  void evict();
+
+  MetadataCacheOptions options_;
+  std::uint64_t total_bytes_ = 0;
+  bool total_known_ = false;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Resolves a --jobs value: 0 means one job per hardware thread
+inline unsigned resolve_jobs(unsigned jobs) {
+  if (jobs == 0)
+    jobs = std::thread::hardware_concurrency();
+  return jobs == 0 ? 1 : jobs;
+}
+
+// Splits [0, n) into `jobs` contiguous chunks and runs fn(begin, end) for
+// each on its own thread. The calling thread takes the first chunk, and
+// small inputs run inline, so jobs == 1 never spawns a thread.
+template <typename Fn>
+void parallel_for_chunks(size_t n, unsigned jobs, Fn &&fn) {
+  jobs = static_cast<unsigned>(
+      std::min<size_t>(resolve_jobs(jobs), std::max<size_t>(n, 1)));
+  if (jobs <= 1) {
+    fn(size_t{0}, n);
+    return;
+  }
+
+  size_t chunk = (n + jobs - 1) / jobs;
+  std::vector<std::thread> workers;
+  workers.reserve(jobs - 1);
+  for (unsigned j = 1; j < jobs; ++j) {
+    size_t begin = std::min(n, j * chunk);
+    size_t end = std::min(n, begin + chunk);
+    if (begin < end)
+      workers.emplace_back([&fn, begin, end] { fn(begin, end); });
+  }
+  fn(size_t{0}, std::min(n, chunk));
+  for (auto &w : workers)
+    w.join();
+}
+
+// Runs fn(i) for every i in [0, n) on `jobs` threads. Each thread takes
+// the next index as soon as it is done with the last, so items of very
+// different cost (files of different sizes) still keep every thread busy.
+template <typename Fn>
+void parallel_for_each_index(size_t n, unsigned jobs, Fn &&fn) {
+  std::atomic<size_t> next{0};
+  size_t threads = std::min<size_t>(resolve_jobs(jobs), n);
+  parallel_for_chunks(threads, jobs, [&](size_t, size_t) {
+    for (size_t i = next++; i < n; i = next++)
+      fn(i);
+  });
+}
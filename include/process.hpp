@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+
+// Resolves the citation keys of a Markdown manuscript against a library,
+// Pandoc style: `[@rec_12, 45]`, `[see @rec_3, 12-14; @rec_7]`. Each
+// bracketed group becomes a footnote, with the long Chicago note the first
+// time a work is cited and the short note after that, the page numbers in
+// place of `[pg]`. A bibliography of the works cited is appended.
+//
+// The manuscript is read in one pass; keys are looked up by record id in
+// a hash map, so the cost is linear in the text plus the number of
+// citations. Code spans and fenced code blocks are copied unchanged.
+// An empty output_file writes to stdout. Returns 1 if any key could not be
+// resolved (those groups are left as written).
+int cite_process(const std::string &manuscript, const std::string &filename,
+                 const std::string &output_file);
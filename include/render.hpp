@@ -0,0 +1,70 @@
+#pragma once
+#include "text_buffer.hpp"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Buffers writes and hands them to a FILE* (or appends them to a string)
+// in large chunks
+class OutputSink {
+public:
+  explicit OutputSink(std::FILE *file, size_t capacity = 256 * 1024);
+  explicit OutputSink(std::string &target, size_t capacity = 64 * 1024);
+  ~OutputSink();
+
+  OutputSink(const OutputSink &) = delete;
+  OutputSink &operator=(const OutputSink &) = delete;
+
+  void write(std::string_view s);
+  void write_number(size_t n);
+  bool flush();
+
+  bool ok() const { return ok_; }
+  size_t bytes_written() const { return written_ + buffer_.size(); }
+
+  // Time spent in fwrite/fflush so far, wall and process CPU (--stats)
+  double write_seconds() const { return write_wall_s_; }
+  double write_cpu_seconds() const { return write_cpu_s_; }
+
+private:
+  void write_file(const char *data, size_t n);
+
+  std::FILE *file_ = nullptr;
+  std::string *target_ = nullptr;
+  std::vector<char> buffer_;
+  size_t written_ = 0;
+  bool ok_ = true;
+  double write_wall_s_ = 0;
+  double write_cpu_s_ = 0;
+};
+
+enum class OutputFormat { terminal, markdown, html };
+
+// Picks the format from the output path: "" is the terminal, otherwise the
+// path must end in .md or .html. Returns false for anything else.
+bool output_format_for(const std::string &path, OutputFormat &format);
+
+// Writes a citation document in one pass: sections of numbered items,
+// each item already formatted in markup()
+class Renderer {
+public:
+  virtual ~Renderer() = default;
+
+  virtual Markup markup() const = 0;
+
+  // `style` names the citation style ("Chicago Style"); `source` is the
+  // input file, shown where the format has room for it
+  virtual void begin_document(std::string_view style,
+                              std::string_view source) = 0;
+  virtual void begin_section(std::string_view heading) = 0;
+  virtual void item(size_t number, std::string_view text) = 0;
+  virtual void end_section() = 0;
+
+  // Closing note, if not empty; `backticked` spans are set as code
+  virtual void end_document(std::string_view note) = 0;
+};
+
+std::unique_ptr<Renderer> create_renderer(OutputFormat format,
+                                          OutputSink &sink);
@@ -0,0 +1,45 @@
+#pragma once
+#include "citation.hpp"
+#include "mapped_file.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Sidecar cache for `cite export --incremental`: the rendered bundle of
+// every record, keyed by record id and tagged with citation_hash(), so an
+// export only formats records that are new or changed since the last run.
+class RenderCache {
+public:
+  // Where the cache for an export lives: next to the output file, or next
+  // to the library for terminal output
+  static std::string path_for(const std::string &library,
+                              const std::string &output_file);
+
+  // Maps the cache file; a missing or incompatible file loads as empty
+  bool load(const std::string &path, Markup markup);
+
+  // Cached bundle for `id` if it was rendered from content with `hash`.
+  // Views stay valid while this cache is alive.
+  const ChicagoCitationBundle *find(std::string_view id,
+                                    std::uint64_t hash) const;
+
+  size_t size() const { return entries_.size(); }
+
+  // Writes bundles[i] for entries[i] (records without an id are skipped)
+  // through a temp file and rename
+  static bool save(const std::string &path, Markup markup,
+                   const std::vector<Citation> &entries,
+                   const std::vector<std::uint64_t> &hashes,
+                   const std::vector<ChicagoCitationBundle> &bundles);
+
+private:
+  struct Entry {
+    std::uint64_t hash;
+    ChicagoCitationBundle bundle;
+  };
+
+  MappedFile file_;
+  std::unordered_map<std::string_view, Entry> entries_;
+};
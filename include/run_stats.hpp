@@ -0,0 +1,102 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <nlohmann/json.hpp>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct HttpTiming;
+
+// Heap activity since the process started. Only counted in builds
+// configured with -DCITE_COUNT_ALLOCATIONS=ON, which replace the global
+// operator new/delete with counting versions; otherwise all zero.
+struct AllocationCounts {
+  std::uint64_t allocations = 0;
+  std::uint64_t frees = 0;
+  std::uint64_t bytes = 0; // requested by allocations
+};
+
+bool allocation_counting_enabled();
+AllocationCounts allocation_counts();
+
+// Largest resident set size the process has had, in bytes (0 if unknown)
+std::uint64_t peak_rss_bytes();
+
+// Collects what `--stats` reports for one command run: wall and CPU time
+// (process-wide, so all threads) per phase, heap allocations per phase,
+// records, bytes written, peak RSS and, for commands that go to the
+// network, where request time went. Phases are timed with scoped guards:
+//
+//   { auto phase = stats.phase("load"); load_library(...); }
+//
+// A disabled RunStats ignores everything, so call sites need no checks.
+class RunStats {
+public:
+  struct PhaseTimes {
+    std::string name;
+    double wall_s = 0;
+    double cpu_s = 0;
+    AllocationCounts heap;
+  };
+
+  class Phase {
+  public:
+    Phase(RunStats *stats, std::string name);
+    ~Phase();
+    Phase(Phase &&other) noexcept;
+    Phase(const Phase &) = delete;
+    Phase &operator=(const Phase &) = delete;
+    Phase &operator=(Phase &&) = delete;
+
+    // Ends the phase before the guard goes out of scope
+    void end();
+
+  private:
+    RunStats *stats_;
+    std::string name_;
+    std::chrono::steady_clock::time_point wall_;
+    std::clock_t cpu_;
+    AllocationCounts heap_;
+  };
+
+  explicit RunStats(std::string command, bool enabled = true);
+
+  bool enabled() const { return enabled_; }
+  Phase phase(std::string name) { return Phase(enabled_ ? this : nullptr, name); }
+
+  // Adds time measured elsewhere (such as output writes spread over a
+  // formatting pass) as its own phase, and takes it out of `from`
+  void split_phase(const std::string &from, std::string name, double wall_s,
+                   double cpu_s);
+
+  void set_records(std::uint64_t n) { records_ = n; }
+  void add_bytes_written(std::uint64_t n) { bytes_written_ += n; }
+  void add_request(const HttpTiming &timing);
+
+  nlohmann::json to_json() const;
+  void print(std::ostream &out) const;
+
+  // Prints to stderr and/or writes the JSON form to `json_path` ("-" for
+  // stdout), as the --stats and --stats-json flags ask. False if the JSON
+  // file could not be written.
+  bool report(bool human, const std::string &json_path) const;
+
+private:
+  void add_phase(PhaseTimes phase);
+
+  std::string command_;
+  bool enabled_;
+  std::chrono::steady_clock::time_point started_;
+  std::clock_t started_cpu_;
+  std::vector<PhaseTimes> phases_;
+  std::uint64_t records_ = 0;
+  std::uint64_t bytes_written_ = 0;
+
+  std::uint64_t requests_ = 0;
+  double dns_s_ = 0;
+  double connect_s_ = 0;
+  double tls_s_ = 0;
+  double transfer_s_ = 0;
+};
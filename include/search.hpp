@@ -0,0 +1,11 @@
+#pragma once
+#include <string>
+
+// Lists the records of a library that contain every word of `query`
+// (titles, author last names, journals, years, ids, DOIs and ISBNs),
+// building or refreshing the .citeidx index as needed. At most `limit`
+// matches are printed, 0 = all. A sharded library (a directory or glob,
+// see load_library) is searched through one index per shard, opened in
+// parallel.
+int cite_search(const std::string &filename, const std::string &query,
+                size_t limit);
@@ -0,0 +1,90 @@
+#pragma once
+#include "citation_record.hpp"
+#include "mapped_file.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Inverted index over a library for `cite search` and duplicate checks,
+// kept in <library>.citeidx. Titles, author/editor last names, journal
+// names, years, ids and identifiers are split into case-folded tokens;
+// each token maps to the sorted list of records containing it, and DOIs
+// and ISBNs also go into a hash table for O(1) exact lookups.
+//
+// The file is tied to the library's size and modification time, so
+// opening it costs a stat and an mmap. Records still in the add journal
+// are indexed in memory on open (there are at most
+// journal_compact_threshold of them).
+
+// lib.json -> lib.citeidx
+std::string search_index_path(const std::string &library);
+
+// Canonical forms used as identifier keys: DOIs lowercased without a
+// resolver prefix, ISBNs as 13 digits (ISBN-10s are converted)
+std::string normalized_doi(std::string_view doi);
+std::string normalized_isbn(std::string_view isbn);
+
+// One-line description of a record: "Turing. Computing Machinery and
+// Intelligence (1950)"
+std::string record_summary(const Citation &c);
+
+// "doi:<doi>" and "isbn:<isbn>" keys for the identifiers a record carries
+std::vector<std::string> identifier_keys(const Citation &c);
+
+class SearchIndex {
+public:
+  struct Hit {
+    std::string_view id;
+    std::string_view summary; // "Authors. Title (Year)"
+  };
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  // Opens the index for `library`, rebuilding it first if it is missing or
+  // stale. `rebuilt` (if given) is set when that happened.
+  bool open(const std::string &library, std::string *error,
+            bool *rebuilt = nullptr);
+
+  // Records in the library, journal included
+  size_t size() const { return record_count_ + pending_.size(); }
+
+  // Records containing every token of `query`, in library order
+  std::vector<size_t> search(std::string_view query) const;
+
+  Hit record(size_t i) const;
+
+  // Record carrying this DOI or ISBN, or npos
+  size_t find_doi(std::string_view doi) const;
+  size_t find_isbn(std::string_view isbn) const;
+
+private:
+  struct Pending {
+    std::string id;
+    std::string summary;
+    std::vector<std::string> tokens; // sorted, unique
+  };
+
+  bool attach(std::string_view bytes, std::uint64_t size, std::int64_t mtime);
+  size_t find_key(const std::string &key) const;
+  bool find_term(std::string_view token, size_t &first, size_t &count) const;
+  std::uint32_t posting(size_t i) const;
+  std::string_view string_at(std::uint32_t offset, std::uint32_t length) const;
+
+  MappedFile file_;
+  std::string built_; // freshly built index that could not be saved
+  size_t record_count_ = 0;
+  size_t term_count_ = 0;
+  size_t posting_count_ = 0;
+  size_t slot_count_ = 0;
+  const char *records_ = nullptr;
+  const char *terms_ = nullptr;
+  const char *postings_ = nullptr;
+  const char *slots_ = nullptr;
+  const char *strings_ = nullptr;
+  std::uint64_t strings_size_ = 0;
+
+  std::vector<Pending> pending_;
+  std::unordered_map<std::string, size_t> pending_keys_;
+};
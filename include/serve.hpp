@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <vector>
+
+struct ServeOptions {
+  std::vector<std::string> libraries;
+  std::string socket_path; // Unix socket to listen on instead of TCP
+  unsigned port = 8765;    // on 127.0.0.1 only
+  unsigned threads = 0;    // request handlers, 0 = one per core
+  unsigned reload_ms = 1000; // polling interval where inotify is unavailable
+};
+
+// Resident formatting server for `cite serve`. Libraries are loaded once
+// and kept decoded in memory, with their id table, Chicago order and
+// search index, and formatted citations are memoized (FormatMemo), so a
+// request costs a hash lookup instead of a process start and a parse.
+//
+// Speaks HTTP/1.1 (keep-alive) on a localhost port or a Unix socket;
+// connections are served by a fixed pool of threads. Each library is an
+// immutable snapshot behind an atomically swapped pointer (LiveSnapshot):
+// when its file or journal changes (any shard's, for a directory or glob)
+// it is reloaded in the background and swapped in, while requests already
+// running keep the version they started with.
+//
+//   GET /libraries
+//   GET /format?lib=L&id=rec_1&id=rec_2&variant=long&markup=html
+//   GET /export?lib=L&format=html|md|terminal
+//   GET /search?lib=L&q=words&limit=20
+//   GET /stats
+//
+// `lib` is the library's file or directory name without .json; it may be
+// left out when only one library is served. Runs until SIGINT or SIGTERM.
+int cite_serve(const ServeOptions &options);
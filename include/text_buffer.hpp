@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Target markup for formatted text: decides how italics are written and
+// whether field text needs escaping. `neutral` is an internal form that
+// marks italics and record text with control bytes, so one rendering can
+// be converted to any of the others (OutputBuffer::from_neutral) with the
+// same bytes as formatting for that markup directly.
+enum class Markup : std::uint8_t { html, markdown, terminal, neutral };
+
+// Append-only buffer the formatters write into. Meant to be reused across
+// entries: clear() keeps the capacity, so once it has grown to the longest
+// citation, formatting does not touch the heap.
+class OutputBuffer {
+public:
+  explicit OutputBuffer(Markup markup = Markup::html) : markup_(markup) {
+    data_.reserve(512);
+  }
+
+  Markup markup() const { return markup_; }
+  void set_markup(Markup markup) { markup_ = markup; }
+
+  void clear() { data_.clear(); }
+  // Drops everything after the first `n` bytes
+  void truncate(size_t n) { data_.resize(n); }
+  void reserve(size_t n) { data_.reserve(n); }
+  size_t size() const { return data_.size(); }
+  bool empty() const { return data_.empty(); }
+  std::string_view view() const { return data_; }
+  std::string str() const { return data_; }
+
+  OutputBuffer &append(std::string_view s) {
+    data_.append(s.data(), s.size());
+    return *this;
+  }
+  OutputBuffer &append(char c) {
+    data_.push_back(c);
+    return *this;
+  }
+
+  // Appends record text (titles, names, ...), escaped for the markup;
+  // append() is for the formatter's own punctuation
+  OutputBuffer &text(std::string_view s);
+
+  OutputBuffer &begin_italic() {
+    return append(markup_ == Markup::html      ? "<i>"
+                  : markup_ == Markup::neutral ? "\x02"
+                                               : "*");
+  }
+  OutputBuffer &end_italic() {
+    return append(markup_ == Markup::html      ? "</i>"
+                  : markup_ == Markup::neutral ? "\x03"
+                                               : "*");
+  }
+  OutputBuffer &italic(std::string_view s) {
+    return begin_italic().text(s).end_italic();
+  }
+
+  // Appends text formatted in Markup::neutral, converted to this buffer's
+  // markup
+  OutputBuffer &from_neutral(std::string_view s);
+
+private:
+  std::string data_;
+  Markup markup_;
+};
+
+// Owns formatted text that has to outlive the buffer it was built in.
+// Strings are copied into large fixed blocks that never move, so the
+// returned views stay valid until the arena is destroyed.
+class TextArena {
+public:
+  explicit TextArena(size_t block_size = 64 * 1024) : block_size_(block_size) {}
+
+  TextArena(TextArena &&) = default;
+  TextArena &operator=(TextArena &&) = default;
+
+  std::string_view store(std::string_view s);
+
+  // Takes ownership of another arena's blocks (e.g. a worker's)
+  void adopt(TextArena &&other);
+
+private:
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  size_t block_size_;
+  size_t used_ = 0; // bytes used in blocks_.back()
+  size_t capacity_ = 0;
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Minimal XML document tree, enough for CSL style files: elements,
+// attributes and text with the predefined and numeric entities decoded.
+// Comments, processing instructions and DOCTYPE are skipped; namespaces
+// are not interpreted (a prefixed name keeps its prefix).
+struct XmlNode {
+  std::string name;
+  std::vector<std::pair<std::string, std::string>> attributes;
+  std::vector<XmlNode> children;
+  std::string text; // character data directly inside this element
+
+  // Attribute value, or nullptr if absent
+  const std::string *attribute(std::string_view key) const;
+
+  // First child element called `child_name`, or nullptr
+  const XmlNode *child(std::string_view child_name) const;
+};
+
+// Parses `source` into `root`. On failure returns false and sets `error`
+// to a message with the line number.
+bool parse_xml(std::string_view source, XmlNode &root, std::string &error);
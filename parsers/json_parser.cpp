@@ -2,6 +2,14 @@
 #include "../include/json_utils.hpp"
 
 // Implementation
-nlohmann::json parse_json(const std::string &filepath) {
-  return load_json_file(filepath);
+nlohmann::json parse_json(const std::string &filepath,
+                          const JsonReadOptions &options) {
+  return load_json_file(filepath, options);
+}
+
+RecordStreamStatus parse_json_records(const std::string &filepath,
+                                      const RecordCallback &on_record,
+                                      std::string *error,
+                                      const JsonReadOptions &options) {
+  return for_each_json_record(filepath, on_record, error, options);
 }
@@ -1,5 +1,13 @@
 #pragma once
+#include "../include/json_utils.hpp"
 #include <nlohmann/json.hpp>
 #include <string>
 
-nlohmann::json parse_json(const std::string &filepath);
+nlohmann::json parse_json(const std::string &filepath,
+                          const JsonReadOptions &options = JsonReadOptions());
+
+// Streaming variant: yields one BibJSON record at a time
+RecordStreamStatus
+parse_json_records(const std::string &filepath, const RecordCallback &on_record,
+                   std::string *error = nullptr,
+                   const JsonReadOptions &options = JsonReadOptions());
@@ -1,7 +1,14 @@
 #include "add.hpp"
-#include <curl/curl.h>
+#include "http_client.hpp"
+#include "run_stats.hpp"
+#include "search_index.hpp"
+#include "journal.hpp"
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <unordered_set>
 #include <nlohmann/json.hpp>
 #include <vector>
 #include <algorithm>
@@ -13,49 +20,160 @@ static std::string prompt(const std::string &q) {
   return a;
 }
 
-// libcurl write callback
-static size_t write_cb(void *contents, size_t size, size_t nmemb, void *userp) {
-  ((std::string *)userp)->append((char *)contents, size * nmemb);
-  return size * nmemb;
+// One client for the whole add subsystem, so connections, DNS and TLS
+// sessions carry over between lookups
+static HttpClient &http_client(const AddOptions &options) {
+  static HttpClient client;
+  HttpOptions http = client.options();
+  http.timeout_ms = static_cast<long>(options.timeout) * 1000;
+  http.retries = options.retries;
+  client.set_options(http);
+  return client;
 }
 
-// Query CrossRef for DOI/title/author, or OpenLibrary for ISBN
-nlohmann::json search_sources(const std::string &query) {
-  CURL *curl = curl_easy_init();
-  std::string readBuffer, url;
-  
-  if (query.rfind("10.", 0) == 0) { // DOI
-    url = "https://api.crossref.org/works/" + query;
-  } else if (query.size() >= 10 && query.size() <= 13 &&
-             std::all_of(query.begin(), query.end(), [](char c) { 
-               return std::isdigit(c) || c == '-' || c == 'X'; 
-             })) { // ISBN
-    std::string clean_isbn = query;
-    clean_isbn.erase(std::remove(clean_isbn.begin(), clean_isbn.end(), '-'), 
-                     clean_isbn.end());
-    url = "https://openlibrary.org/api/books?bibkeys=ISBN:" + clean_isbn +
-          "&format=json&jscmd=data";
-  } else { // Title/author search (CrossRef)
-    char *esc = curl_easy_escape(curl, query.c_str(), 0);
-    url = "https://api.crossref.org/works?query=" + std::string(esc ? esc : "") +
-          "&rows=10";
-    if (esc)
-      curl_free(esc);
+// Percent-encodes everything but RFC 3986 unreserved characters
+static std::string url_escape(const std::string &s) {
+  static const char hex[] = "0123456789ABCDEF";
+  std::string out;
+  for (unsigned char c : s) {
+    if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      out += static_cast<char>(c);
+    } else {
+      out += '%';
+      out += hex[c >> 4];
+      out += hex[c & 15];
+    }
   }
+  return out;
+}
 
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
-  curl_easy_setopt(curl, CURLOPT_USERAGENT, "Cite/1.0 (mailto:user@example.com)");
-  CURLcode res = curl_easy_perform(curl);
-  curl_easy_cleanup(curl);
+static std::string clean_isbn(const std::string &query) {
+  std::string isbn = query;
+  isbn.erase(std::remove(isbn.begin(), isbn.end(), '-'), isbn.end());
+  return isbn;
+}
 
-  if (res != CURLE_OK || readBuffer.empty()) {
-    return nlohmann::json::object();
+// "doi", "isbn" or "search", by the shape of the query. Hyphens don't
+// count towards an ISBN's length, so 978-0-226-45808-3 is one too.
+static std::string query_mode(const std::string &query) {
+  if (query.rfind("10.", 0) == 0)
+    return "doi";
+  std::string isbn = clean_isbn(query);
+  if ((isbn.size() == 10 || isbn.size() == 13) &&
+      std::all_of(query.begin(), query.end(), [](char c) { 
+        return std::isdigit(static_cast<unsigned char>(c)) || c == '-' ||
+               c == 'X'; 
+      }))
+    return "isbn";
+  return "search";
+}
+
+// API base URLs; overridable through the environment (e.g. for a local
+// mock server)
+static std::string api_base(const char *env, const char *fallback) {
+  const char *v = std::getenv(env);
+  return v && *v ? v : fallback;
+}
+
+// Lookup URL for a query: CrossRef for DOI/title/author, OpenLibrary for ISBN
+static std::string lookup_url(const std::string &query,
+                              const std::string &mode) {
+  if (mode == "doi") {
+    // DOIs are case-insensitive; one spelling keeps the cache key stable
+    std::string doi = query;
+    std::transform(doi.begin(), doi.end(), doi.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return api_base("CITE_CROSSREF_URL", "https://api.crossref.org") +
+           "/works/" + doi;
+  } else if (mode == "isbn") {
+    return api_base("CITE_OPENLIBRARY_URL", "https://openlibrary.org") +
+           "/api/books?bibkeys=ISBN:" + clean_isbn(query) +
+           "&format=json&jscmd=data";
+  }
+  return api_base("CITE_CROSSREF_URL", "https://api.crossref.org") +
+         "/works?query=" + url_escape(query) + "&rows=10";
+}
+
+static MetadataCache make_cache(const AddOptions &options) {
+  MetadataCacheOptions cache = MetadataCacheOptions::from_env();
+  if (!options.use_cache)
+    cache.dir.clear();
+  if (options.offline)
+    cache.offline = true;
+  return MetadataCache(std::move(cache));
+}
+
+// The parts of a response that convert_to_bibjson and the match checks
+// read; responses are pruned to these while they download
+using Schema = JsonFieldFilter::Node;
+
+static const Schema &crossref_schema() {
+  static const Schema &keep = Schema::all();
+  static const Schema name{{{"given", &keep}, {"family", &keep}}};
+  static const Schema authors{{}, nullptr, &name};
+  static const Schema issued{{{"date-parts", &keep}}};
+  static const std::vector<std::pair<std::string, const Schema *>> fields = {
+      {"type", &keep},   {"title", &keep},     {"author", &authors},
+      {"issued", &issued}, {"container-title", &keep}, {"volume", &keep},
+      {"issue", &keep},  {"page", &keep},      {"ISSN", &keep},
+      {"publisher", &keep}, {"DOI", &keep},    {"URL", &keep}};
+  static const Schema work{fields};
+  static const Schema items{{}, nullptr, &work};
+  // "message" is one work for a DOI lookup, or holds "items" for a search
+  static const Schema message{[] {
+    auto keys = fields;
+    keys.emplace_back("items", &items);
+    return keys;
+  }()};
+  static const Schema root{{{"message", &message}}};
+  return root;
+}
+
+static const Schema &openlibrary_schema() {
+  static const Schema &keep = Schema::all();
+  static const Schema name{{{"name", &keep}}};
+  static const Schema names{{}, nullptr, &name};
+  static const Schema identifiers{{{"isbn_13", &keep}}};
+  static const Schema book{{{"title", &keep},
+                            {"authors", &names},
+                            {"publishers", &names},
+                            {"publish_date", &keep},
+                            {"identifiers", &identifiers},
+                            {"url", &keep}}};
+  // Keyed by "ISBN:<isbn>"
+  static const Schema root{{}, &book};
+  return root;
+}
+
+static const Schema &response_schema(const std::string &mode) {
+  return mode == "isbn" ? openlibrary_schema() : crossref_schema();
+}
+
+// Query CrossRef for DOI/title/author, or OpenLibrary for ISBN
+nlohmann::json search_sources(const std::string &query, MetadataCache *cache,
+                              const AddOptions &options, RunStats *stats) {
+  HttpRequest request;
+  std::string mode = query_mode(query);
+  request.url = lookup_url(query, mode);
+  JsonFieldFilter filter(response_schema(mode));
+  request.filter = &filter;
+  std::string key = MetadataCache::normalize(mode, query);
+
+  if (!cache || !cache->get(key, request.url, request.body)) {
+    if (cache && cache->offline())
+      return nlohmann::json::object();
+    bool ok = http_client(options).get(request);
+    if (stats)
+      stats->add_request(request.timing);
+    if (!ok || request.body.empty()) {
+      return nlohmann::json::object();
+    }
+    if (cache && request.status == 200)
+      cache->put(key, request.url, request.body);
   }
 
   try {
-    return nlohmann::json::parse(readBuffer);
+    return nlohmann::json::parse(request.body);
   } catch (...) {
     return nlohmann::json::object();
   }
@@ -322,49 +440,245 @@ nlohmann::json edit_entry(nlohmann::json entry) {
   return entry;
 }
 
-// Append entry to JSON file
-void add_to_json(const std::string &filename, const nlohmann::json &entry) {
-  nlohmann::json root;
-  std::ifstream in(filename);
-  if (in) {
-    try {
-      in >> root;
-    } catch (...) {
-      root = nlohmann::json::object();
+// Opens the library's search index for duplicate checks; a library that
+// does not exist yet has nothing to collide with
+static bool open_index(const std::string &filename, SearchIndex &index) {
+  std::error_code ec;
+  return std::filesystem::exists(filename, ec) && index.open(filename, nullptr);
+}
+
+// Record already carrying the entry's DOI or ISBN, or npos
+static size_t find_duplicate(const SearchIndex &index, const Citation &c) {
+  size_t found = SearchIndex::npos;
+  if (c.has(Field::doi))
+    found = index.find_doi(c.get(Field::doi));
+  if (found == SearchIndex::npos && c.has(Field::isbn))
+    found = index.find_isbn(c.get(Field::isbn));
+  return found;
+}
+
+// Append entry to the library's journal; the library file itself is only
+// rewritten when the journal is compacted
+bool add_to_json(const std::string &filename, const nlohmann::json &entry) {
+  SearchIndex index;
+  if (open_index(filename, index)) {
+    size_t dup = find_duplicate(index, decode_citation(entry));
+    if (dup != SearchIndex::npos) {
+      SearchIndex::Hit hit = index.record(dup);
+      std::cout << "\nAlready in " << filename << " as " << hit.id << ": "
+                << hit.summary << "\nEntry not added.\n";
+      return false;
     }
-    in.close();
   }
-  
-  // Ensure proper structure
-  if (root.is_null() || !root.is_object()) {
-    root = {{"metadata", {{"collection", "my_collection"}}},
-            {"records", nlohmann::json::array()}};
+
+  std::vector<std::string> ids;
+  std::string error;
+  if (!journal_append(filename, {entry}, ids, &error)) {
+    std::cerr << "Error: Could not add entry to " << filename << ": " << error
+              << "\n";
+    return false;
   }
-  
-  if (!root.contains("records") || !root["records"].is_array()) {
-    root["records"] = nlohmann::json::array();
+  std::cout << "\n✓ Entry added to " << filename << " with ID: " << ids[0] << "\n";
+  return true;
+}
+
+int compact_entries(const std::string &filename) {
+  std::string error;
+  size_t moved = 0;
+  if (!compact_journal(filename, &error, &moved)) {
+    std::cerr << "Error: Could not compact " << filename << ": " << error << "\n";
+    return 1;
   }
-  
-  // Generate unique ID
-  std::string id = "rec_" + std::to_string(root["records"].size() + 1);
-  nlohmann::json new_entry = entry;
-  new_entry["id"] = id;
-  new_entry["collection"] = "my_collection";
-  
-  root["records"].push_back(new_entry);
-  
-  // Update metadata
-  if (!root.contains("metadata"))
-    root["metadata"] = nlohmann::json::object();
-  root["metadata"]["records"] = root["records"].size();
-  
-  std::ofstream out(filename);
-  out << root.dump(2) << std::endl;
-  std::cout << "\n✓ Entry added to " << filename << " with ID: " << id << "\n";
+  std::cout << "Compacted " << moved << " journaled entries into " << filename
+            << "\n";
+  return 0;
+}
+
+// One queued lookup of a batch
+struct BatchItem {
+  std::string query;
+  std::string mode;
+  std::string key; // lookup cache key
+  HttpRequest http;
+  std::unique_ptr<JsonFieldFilter> filter;
+  bool cached = false;
+};
+
+static std::string lower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return s;
+}
+
+// The result for exactly this DOI or ISBN, or null
+static nlohmann::json exact_match(const BatchItem &item) {
+  nlohmann::json src = nlohmann::json::parse(item.http.body, nullptr, false);
+  if (src.is_discarded() || !src.is_object())
+    return nullptr;
+  try {
+    if (item.mode == "doi") {
+      auto msg = src.find("message");
+      if (msg == src.end() || !msg->is_object())
+        return nullptr;
+      auto doi = msg->find("DOI");
+      if (doi != msg->end() &&
+          (!doi->is_string() || lower(*doi) != lower(item.query)))
+        return nullptr;
+      return convert_to_bibjson(*msg, "crossref");
+    }
+    auto book = src.find("ISBN:" + clean_isbn(item.query));
+    if (book == src.end() || !book->is_object())
+      return nullptr;
+    return convert_to_bibjson(*book, "openlibrary");
+  } catch (const nlohmann::json::exception &) {
+    return nullptr;
+  }
+}
+
+int add_batch(const std::string &filename, const std::string &list_file,
+              const AddOptions &options) {
+  RunStats stats("add", options.stats || !options.stats_json.empty());
+  auto read_phase = stats.phase("read list");
+  std::ifstream file;
+  if (list_file != "-") {
+    file.open(list_file);
+    if (!file) {
+      std::cerr << "Error: Could not open " << list_file << "\n";
+      return 1;
+    }
+  }
+  std::istream &in = list_file == "-" ? std::cin : file;
+
+  std::vector<BatchItem> items;
+  size_t skipped = 0;
+  std::string line;
+  while (std::getline(in, line)) {
+    auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#')
+      continue;
+    auto last = line.find_last_not_of(" \t\r");
+    BatchItem item;
+    item.query = line.substr(first, last - first + 1);
+    item.mode = query_mode(item.query);
+    if (item.mode == "search") {
+      std::cerr << "Skipping (not a DOI or ISBN): " << item.query << "\n";
+      ++skipped;
+      continue;
+    }
+    item.key = MetadataCache::normalize(item.mode, item.query);
+    item.http.url = lookup_url(item.query, item.mode);
+    items.push_back(std::move(item));
+  }
+  if (items.empty()) {
+    std::cerr << "Error: No DOIs or ISBNs to look up\n";
+    return 1;
+  }
+  read_phase.end();
+  stats.set_records(items.size());
+
+  auto cache_phase = stats.phase("cache");
+  MetadataCache cache = make_cache(options);
+  std::vector<HttpRequest *> pending;
+  for (auto &item : items) {
+    if (cache.get(item.key, item.http.url, item.http.body)) {
+      item.http.ok = item.cached = true;
+      item.http.status = 200;
+    } else if (!cache.offline()) {
+      item.filter = std::make_unique<JsonFieldFilter>(response_schema(item.mode));
+      item.http.filter = item.filter.get();
+      pending.push_back(&item.http);
+    }
+  }
+
+  // Status lines go to stderr when stdout carries the --stats-json report
+  std::ostream &status = options.stats_json == "-" ? std::cerr : std::cout;
+  unsigned max_inflight = std::max(1u, options.max_inflight);
+  status << "Looking up " << items.size() << " identifiers (" << cache.hits()
+         << " cached";
+  if (cache.offline())
+    status << ", offline";
+  else
+    status << ", " << max_inflight << " requests at a time";
+  status << ")...\n";
+  cache_phase.end();
+  {
+    auto phase = stats.phase("network");
+    http_client(options).get_all(pending, max_inflight);
+  }
+  for (const HttpRequest *request : pending)
+    stats.add_request(request->timing);
+
+  auto match_phase = stats.phase("match");
+  SearchIndex index;
+  bool indexed = open_index(filename, index);
+  std::unordered_set<std::string> seen; // identifiers earlier in this batch
+  std::vector<nlohmann::json> entries;
+  size_t failed = 0, duplicates = 0;
+  for (const auto &item : items) {
+    nlohmann::json entry;
+    if (item.http.ok && item.http.status == 200)
+      entry = exact_match(item);
+    if (!entry.is_null() && !item.cached)
+      cache.put(item.key, item.http.url, item.http.body);
+    if (entry.is_null() || entry.empty()) {
+      std::cerr << "Not found: " << item.query;
+      if (cache.offline() && !item.cached)
+        std::cerr << " (not cached, offline)";
+      else if (!item.http.ok)
+        std::cerr << " (request failed)";
+      else if (item.http.status != 200)
+        std::cerr << " (HTTP " << item.http.status << ")";
+      std::cerr << "\n";
+      ++failed;
+      continue;
+    }
+
+    Citation c = decode_citation(entry);
+    size_t dup = indexed ? find_duplicate(index, c) : SearchIndex::npos;
+    bool repeated = false;
+    for (std::string &key : identifier_keys(c))
+      repeated |= !seen.insert(std::move(key)).second;
+    if (dup != SearchIndex::npos || repeated) {
+      std::cerr << "Already in library: " << item.query;
+      if (dup != SearchIndex::npos)
+        std::cerr << " (" << index.record(dup).id << ")";
+      else
+        std::cerr << " (repeated in list)";
+      std::cerr << "\n";
+      ++duplicates;
+      continue;
+    }
+    entries.push_back(std::move(entry));
+  }
+
+  match_phase.end();
+
+  if (!entries.empty()) {
+    std::vector<std::string> ids;
+    std::string error;
+    bool appended;
+    {
+      auto phase = stats.phase("write");
+      appended = journal_append(filename, entries, ids, &error);
+    }
+    if (!appended) {
+      std::cerr << "Error: Could not add entries to " << filename << ": "
+                << error << "\n";
+      stats.report(options.stats, options.stats_json);
+      return 1;
+    }
+    status << "\n✓ Added " << ids.size() << " entries to " << filename
+           << " (" << ids.front() << " to " << ids.back() << ")\n";
+  }
+  if (failed || skipped || duplicates)
+    status << failed << " not found, " << duplicates << " already present, "
+           << skipped << " skipped\n";
+  stats.report(options.stats, options.stats_json);
+  return entries.empty() && duplicates == 0 ? 1 : 0;
 }
 
 // Entry point for add command
-int add_entry(const std::string &filename) {
+int add_entry(const std::string &filename, const AddOptions &options) {
   std::cout << "\n=== Add New Citation ===\n\n";
   std::string query = prompt("Search by DOI, ISBN, or Title/Author");
   
@@ -374,26 +688,31 @@ int add_entry(const std::string &filename) {
   }
   
   // Determine search mode
-  std::string mode;
-  if (query.rfind("10.", 0) == 0) {
-    mode = "doi";
+  std::string mode = query_mode(query);
+  if (mode == "doi")
     std::cout << "Searching CrossRef by DOI...\n";
-  } else if (query.size() >= 10 && query.size() <= 13 &&
-             std::all_of(query.begin(), query.end(), [](char c) { 
-               return std::isdigit(c) || c == '-' || c == 'X'; 
-             })) {
-    mode = "isbn";
+  else if (mode == "isbn")
     std::cout << "Searching OpenLibrary by ISBN...\n";
-  } else {
-    mode = "search";
+  else
     std::cout << "Searching CrossRef...\n";
-  }
   
-  nlohmann::json results = search_sources(query);
-  auto entries = parse_results(results, mode);
+  // Only the lookup and the write are timed, not the prompts
+  RunStats stats("add", options.stats || !options.stats_json.empty());
+  MetadataCache cache = make_cache(options);
+  std::vector<nlohmann::json> entries;
+  {
+    auto phase = stats.phase("lookup");
+    nlohmann::json results = search_sources(query, &cache, options, &stats);
+    entries = parse_results(results, mode);
+  }
+  stats.set_records(entries.size());
 
   if (entries.empty()) {
-    std::cout << "No results found. Try a different query.\n";
+    if (cache.offline())
+      std::cout << "No cached results (offline mode).\n";
+    else
+      std::cout << "No results found. Try a different query.\n";
+    stats.report(options.stats, options.stats_json);
     return 1;
   }
   
@@ -413,11 +732,13 @@ int add_entry(const std::string &filename) {
     entry = edit_entry(entry);
 
   std::string confirm = prompt("Add this entry to " + filename + "? (y/n)");
+  bool added = false;
   if (confirm == "y" || confirm == "Y") {
-    add_to_json(filename, entry);
-    return 0;
+    auto phase = stats.phase("write");
+    added = add_to_json(filename, entry);
   } else {
     std::cout << "Entry not added.\n";
-    return 1;
   }
+  stats.report(options.stats, options.stats_json);
+  return added ? 0 : 1;
 }
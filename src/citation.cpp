@@ -1,34 +1,127 @@
 #include "../include/citation.hpp"
+#include "../formatters/apa_formatter.hpp"
 #include "../formatters/chicago_formatter.hpp"
 #include "../formatters/mla_formatter.hpp"
+#include "../include/parallel.hpp"
 #include <algorithm>
+#include <mutex>
 
 std::unique_ptr<CitationFormatter> create_formatter(const std::string &style) {
   if (style == "chicago") {
     return std::make_unique<ChicagoFormatter>();
   } else if (style == "mla") {
     return std::make_unique<MLAFormatter>();
+  } else if (style == "apa") {
+    return std::make_unique<APAFormatter>();
   }
   return nullptr;
 }
 
-std::vector<std::string> format_bibliography(const nlohmann::json &entries,
+std::string CitationFormatter::format(const Citation &entry) const {
+  OutputBuffer out;
+  format(entry, out);
+  return out.str();
+}
+
+// Separates key components; sorts below every printable character so that
+// "Smith" orders before "Smithson"
+static const char key_separator = '\x01';
+
+// Appends `s` case-folded (ASCII only; UTF-8 bytes compare as-is)
+static void append_collated(std::string &key, std::string_view s) {
+  for (char c : s) {
+    if (c >= 'A' && c <= 'Z')
+      c = static_cast<char>(c - 'A' + 'a');
+    key += c;
+  }
+}
+
+// Leading articles are ignored when alphabetizing titles
+static std::string_view strip_article(std::string_view title) {
+  for (std::string_view article : {"The ", "A ", "An "}) {
+    if (title.substr(0, article.size()) == article)
+      return title.substr(article.size());
+  }
+  return title;
+}
+
+std::string chicago_sort_key(const Citation &entry) {
+  std::string_view first;
+  if (entry.author_count > 0)
+    first = entry.text(entry.author(0).first);
+  else if (entry.editor_count > 0)
+    first = entry.text(entry.editor(0).first);
+
+  std::string key;
+  key.reserve(entry.storage.size() / 2);
+  append_collated(key, ChicagoFormatter::get_author_last_name(entry));
+  key += key_separator;
+  append_collated(key, first);
+  key += key_separator;
+  append_collated(key, strip_article(entry.get(Field::title)));
+  key += key_separator;
+  key.append(entry.get(Field::year));
+  return key;
+}
+
+std::string apa_sort_key(const Citation &entry) {
+  std::string_view first;
+  if (entry.author_count > 0)
+    first = entry.text(entry.author(0).first);
+  else if (entry.editor_count > 0)
+    first = entry.text(entry.editor(0).first);
+
+  std::string key;
+  key.reserve(entry.storage.size() / 2);
+  append_collated(key, ChicagoFormatter::get_author_last_name(entry));
+  key += key_separator;
+  append_collated(key, first);
+  key += key_separator;
+  key.append(entry.get(Field::year));
+  key += key_separator;
+  append_collated(key, strip_article(entry.get(Field::title)));
+  return key;
+}
+
+std::vector<size_t> chicago_sort_order(const std::vector<Citation> &entries) {
+  // One key per entry, then sort (key, index) pairs; the entries
+  // themselves never move
+  std::vector<std::pair<std::string, size_t>> keyed;
+  keyed.reserve(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i)
+    keyed.emplace_back(chicago_sort_key(entries[i]), i);
+  std::sort(keyed.begin(), keyed.end());
+
+  std::vector<size_t> order;
+  order.reserve(keyed.size());
+  for (const auto &k : keyed)
+    order.push_back(k.second);
+  return order;
+}
+
+std::vector<size_t> sort_order_by_keys(const std::vector<std::string> &keys) {
+  std::vector<size_t> order(keys.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) {
+    int c = keys[a].compare(keys[b]);
+    return c != 0 ? c < 0 : a < b;
+  });
+  return order;
+}
+
+std::vector<std::string> format_bibliography(const std::vector<Citation> &entries,
                                              const std::string &style) {
   auto formatter = create_formatter(style);
   std::vector<std::string> results;
   if (!formatter)
     return results;
 
+  results.reserve(entries.size());
   if (style == "chicago") {
-    // Chicago bibliography should be sorted by last name
-    std::vector<nlohmann::json> sorted_entries = entries;
-    std::sort(sorted_entries.begin(), sorted_entries.end(),
-              [](const nlohmann::json &a, const nlohmann::json &b) {
-                return ChicagoFormatter::get_author_last_name(a) <
-                       ChicagoFormatter::get_author_last_name(b);
-              });
-    for (const auto &entry : sorted_entries) {
-      results.push_back(formatter->format(entry));
+    // Chicago bibliography is sorted by author, then title
+    for (size_t i : chicago_sort_order(entries)) {
+      results.push_back(formatter->format(entries[i]));
     }
   } else {
     for (const auto &entry : entries) {
@@ -38,21 +131,124 @@ std::vector<std::string> format_bibliography(const nlohmann::json &entries,
   return results;
 }
 
+// Shared by the for_each_*_citation functions; `format_one(entry, buf)`
+// appends one rendering
+template <typename FormatOne>
+static void for_each_formatted(
+    const std::vector<Citation> &entries, const std::vector<size_t> &order,
+    Markup markup, unsigned jobs, const FormatOne &format_one,
+    const std::function<void(size_t k, std::string_view text)> &emit) {
+  jobs = resolve_jobs(jobs);
+
+  if (jobs == 1) {
+    OutputBuffer buf(markup);
+    for (size_t k = 0; k < order.size(); ++k) {
+      buf.clear();
+      format_one(entries[order[k]], buf);
+      emit(k, buf.view());
+    }
+    return;
+  }
+
+  // Each worker formats a slice of the window into one shared buffer and
+  // records where every entry ends; the slices are then emitted in order
+  const size_t window = 2048 * jobs;
+  struct Slice {
+    OutputBuffer buf;
+    std::vector<size_t> ends;
+  };
+  std::vector<Slice> slices(jobs);
+  for (auto &slice : slices)
+    slice.buf.set_markup(markup);
+
+  for (size_t base = 0; base < order.size(); base += window) {
+    size_t count = std::min(window, order.size() - base);
+    size_t per_slice = (count + jobs - 1) / jobs;
+    parallel_for_chunks(jobs, jobs, [&](size_t first, size_t last) {
+      for (size_t s = first; s < last; ++s) {
+        Slice &slice = slices[s];
+        slice.buf.clear();
+        slice.ends.clear();
+        size_t end = std::min(count, (s + 1) * per_slice);
+        for (size_t k = s * per_slice; k < end; ++k) {
+          format_one(entries[order[base + k]], slice.buf);
+          slice.ends.push_back(slice.buf.size());
+        }
+      }
+    });
+
+    size_t k = base;
+    for (const auto &slice : slices) {
+      size_t start = 0;
+      for (size_t end : slice.ends) {
+        emit(k++, slice.buf.view().substr(start, end - start));
+        start = end;
+      }
+    }
+  }
+}
+
+void for_each_chicago_citation(
+    const std::vector<Citation> &entries, const std::vector<size_t> &order,
+    ChicagoVariant variant, Markup markup, unsigned jobs,
+    const std::function<void(size_t k, std::string_view text)> &emit) {
+  ChicagoFormatter formatter;
+  for_each_formatted(
+      entries, order, markup, jobs,
+      [&](const Citation &entry, OutputBuffer &buf) {
+        formatter.format(entry, variant, buf);
+      },
+      emit);
+}
+
+void for_each_citation(
+    const std::vector<Citation> &entries, const std::vector<size_t> &order,
+    const CitationFormatter &formatter, Markup markup, unsigned jobs,
+    const std::function<void(size_t k, std::string_view text)> &emit) {
+  for_each_formatted(
+      entries, order, markup, jobs,
+      [&](const Citation &entry, OutputBuffer &buf) {
+        formatter.format(entry, buf);
+      },
+      emit);
+}
+
 std::vector<ChicagoCitationBundle>
-format_chicago_with_footnotes(const nlohmann::json &entries) {
+format_chicago_bundles(const std::vector<Citation> &entries,
+                       const std::vector<size_t> &indices, Markup markup,
+                       TextArena &arena, unsigned jobs) {
   ChicagoFormatter formatter;
-  // Sort entries by last name
-  std::vector<nlohmann::json> sorted_entries = entries;
-  std::sort(sorted_entries.begin(), sorted_entries.end(),
-            [](const nlohmann::json &a, const nlohmann::json &b) {
-              return ChicagoFormatter::get_author_last_name(a) <
-                     ChicagoFormatter::get_author_last_name(b);
-            });
-  std::vector<ChicagoCitationBundle> bundles;
-  for (const auto &entry : sorted_entries) {
-    bundles.push_back({formatter.format(entry),
-                       formatter.format_long_footnote(entry),
-                       formatter.format_short_footnote(entry)});
-  }
+  std::vector<ChicagoCitationBundle> bundles(indices.size());
+  std::mutex arena_mutex;
+
+  // Entries are independent, so each worker formats a contiguous slice
+  // straight into its final slots, using its own buffer and arena; the
+  // arenas are merged into the caller's once the slice is done
+  parallel_for_chunks(indices.size(), jobs, [&](size_t begin, size_t end) {
+    OutputBuffer buf(markup);
+    TextArena local;
+    for (size_t k = begin; k < end; ++k) {
+      const Citation &entry = entries[indices[k]];
+      ChicagoCitationBundle &b = bundles[k];
+      buf.clear();
+      formatter.format(entry, buf);
+      b.bibliography = local.store(buf.view());
+      buf.clear();
+      formatter.format_long_footnote(entry, buf);
+      b.long_footnote = local.store(buf.view());
+      buf.clear();
+      formatter.format_short_footnote(entry, buf);
+      b.short_footnote = local.store(buf.view());
+    }
+    std::lock_guard<std::mutex> lock(arena_mutex);
+    arena.adopt(std::move(local));
+  });
   return bundles;
 }
+
+std::vector<ChicagoCitationBundle>
+format_chicago_with_footnotes(const std::vector<Citation> &entries,
+                              TextArena &arena, unsigned jobs, Markup markup) {
+  return format_chicago_bundles(entries, chicago_sort_order(entries), markup,
+                                arena, jobs);
+}
@@ -0,0 +1,164 @@
+#include "citation_record.hpp"
+#include "hash.hpp"
+#include <cctype>
+
+FieldRef intern(std::string &storage, std::string_view s) {
+  FieldRef r;
+  r.offset = static_cast<std::uint32_t>(storage.size());
+  r.length = static_cast<std::uint32_t>(s.size());
+  storage.append(s.data(), s.size());
+  return r;
+}
+
+// String value of a JSON scalar; numbers are kept in their JSON spelling
+// so `"year": 1950` and `"year": "1950"` decode the same way
+static std::string scalar_str(const nlohmann::json &v) {
+  if (v.is_string())
+    return v.get_ref<const std::string &>();
+  if (v.is_number())
+    return v.dump();
+  return "";
+}
+
+static std::string member_str(const nlohmann::json &obj, const char *key) {
+  if (!obj.is_object())
+    return "";
+  auto it = obj.find(key);
+  return it == obj.end() ? "" : scalar_str(*it);
+}
+
+static ParsedName split_name(std::string_view full, std::string &storage) {
+  ParsedName pn;
+  auto comma = full.find(',');
+  if (comma != std::string_view::npos) {
+    // "Last, First"
+    std::string_view first = full.substr(comma + 1);
+    while (!first.empty() && std::isspace(static_cast<unsigned char>(first[0])))
+      first.remove_prefix(1);
+    pn.last = intern(storage, full.substr(0, comma));
+    pn.first = intern(storage, first);
+  } else {
+    // "First Last"
+    auto space = full.rfind(' ');
+    if (space != std::string_view::npos) {
+      pn.first = intern(storage, full.substr(0, space));
+      pn.last = intern(storage, full.substr(space + 1));
+    } else {
+      pn.last = intern(storage, full);
+    }
+  }
+  return pn;
+}
+
+ParsedName parse_name(const nlohmann::json &person, std::string &storage) {
+  ParsedName pn;
+
+  if (person.is_object()) {
+    // Try structured fields first
+    if (person.contains("firstname") && person.contains("lastname")) {
+      pn.first = intern(storage, member_str(person, "firstname"));
+      pn.last = intern(storage, member_str(person, "lastname"));
+    } else if (person.contains("given") && person.contains("family")) {
+      // CrossRef format
+      pn.first = intern(storage, member_str(person, "given"));
+      pn.last = intern(storage, member_str(person, "family"));
+    } else if (person.contains("name")) {
+      pn = split_name(member_str(person, "name"), storage);
+    }
+  } else if (person.is_string()) {
+    pn = split_name(person.get_ref<const std::string &>(), storage);
+  }
+
+  return pn;
+}
+
+static CitationType type_from_name(const std::string &type) {
+  if (type == "article")
+    return CitationType::article;
+  if (type == "paper")
+    return CitationType::paper;
+  if (type == "book")
+    return CitationType::book;
+  if (type == "chapter")
+    return CitationType::chapter;
+  return CitationType::other;
+}
+
+static std::uint32_t decode_names(Citation &c, const nlohmann::json &entry,
+                                  const char *key) {
+  auto it = entry.find(key);
+  if (it == entry.end() || !it->is_array())
+    return 0;
+  for (const auto &p : *it)
+    c.names.push_back(parse_name(p, c.storage));
+  return static_cast<std::uint32_t>(it->size());
+}
+
+Citation decode_citation(const nlohmann::json &entry) {
+  Citation c;
+  if (!entry.is_object())
+    return c;
+
+  auto set = [&c](Field f, const std::string &s) {
+    c.fields[static_cast<std::size_t>(f)] = intern(c.storage, s);
+  };
+
+  std::string type = member_str(entry, "type");
+  c.type = type_from_name(type);
+  set(Field::id, member_str(entry, "id"));
+  set(Field::type_name, type);
+  set(Field::title, member_str(entry, "title"));
+  set(Field::year, member_str(entry, "year"));
+  set(Field::place, member_str(entry, "place"));
+
+  if (entry.contains("publisher")) {
+    c.flags |= Citation::has_publisher;
+    set(Field::publisher, member_str(entry, "publisher"));
+  }
+  if (entry.contains("url")) {
+    c.flags |= Citation::has_url;
+    set(Field::url, member_str(entry, "url"));
+  }
+
+  auto journal = entry.find("journal");
+  if (journal != entry.end() && journal->is_object()) {
+    c.flags |= Citation::has_journal;
+    set(Field::journal_name, member_str(*journal, "name"));
+    set(Field::volume, member_str(*journal, "volume"));
+    set(Field::issue, member_str(*journal, "number"));
+    set(Field::pages, member_str(*journal, "pages"));
+  }
+
+  auto ids = entry.find("identifier");
+  if (ids != entry.end() && ids->is_array()) {
+    c.flags |= Citation::has_identifiers;
+    bool doi_seen = false, isbn_seen = false;
+    for (const auto &id : *ids) {
+      std::string id_type = member_str(id, "type");
+      if (id_type == "doi" && !doi_seen) {
+        doi_seen = true;
+        set(Field::doi, member_str(id, "id"));
+      } else if (id_type == "isbn" && !isbn_seen) {
+        isbn_seen = true;
+        set(Field::isbn, member_str(id, "id"));
+      }
+    }
+  }
+
+  c.author_count = decode_names(c, entry, "author");
+  c.editor_count = decode_names(c, entry, "editor");
+  return c;
+}
+
+std::uint64_t citation_hash(const Citation &c) {
+  std::uint64_t h = hash_bytes(c.storage);
+  h = hash_combine(h, static_cast<std::uint64_t>(c.type) << 8 | c.flags);
+  h = hash_combine(h, std::uint64_t(c.author_count) << 32 | c.editor_count);
+  for (const FieldRef &r : c.fields)
+    h = hash_combine(h, std::uint64_t(r.offset) << 32 | r.length);
+  for (const ParsedName &n : c.names) {
+    h = hash_combine(h, std::uint64_t(n.first.offset) << 32 | n.first.length);
+    h = hash_combine(h, std::uint64_t(n.last.offset) << 32 | n.last.length);
+  }
+  return h;
+}
@@ -0,0 +1,45 @@
+#include "compile.hpp"
+#include "../include/library.hpp"
+#include "../include/library_cache.hpp"
+#include <iostream>
+
+int cite_compile(const std::string &filename, const std::string &output_file) {
+  if (is_sharded_library(filename)) {
+    // Each shard gets its own cache, which loading the shards picks up
+    if (!output_file.empty()) {
+      std::cerr << "Error: " << filename
+                << " is a set of shards; each is compiled next to itself\n";
+      return 1;
+    }
+    std::string error;
+    std::vector<std::string> shards = library_shards(filename, error);
+    if (shards.empty()) {
+      std::cerr << "Error: " << error << "\n";
+      return 2;
+    }
+    for (const std::string &shard : shards)
+      if (int rc = cite_compile(shard, ""))
+        return rc;
+    return 0;
+  }
+
+  Library library;
+  LibraryLoadOptions load_options;
+  load_options.use_cache = false;
+  // The cache mirrors the JSON file; journaled adds are replayed on top
+  load_options.include_journal = false;
+  if (int rc = load_library(filename, library, load_options))
+    return rc;
+
+  std::string path =
+      output_file.empty() ? library_cache_path(filename) : output_file;
+  std::string error;
+  if (!write_library_cache(path, library, &error)) {
+    std::cerr << "Error: Could not write " << path << ": " << error << "\n";
+    return 3;
+  }
+
+  std::cout << "Compiled " << library.entries.size() << " entries from "
+            << filename << " into " << path << "\n";
+  return 0;
+}
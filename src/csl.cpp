@@ -0,0 +1,877 @@
+#include "csl.hpp"
+#include "hash.hpp"
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <sstream>
+
+namespace csl {
+
+static bool is_lower(char c) { return c >= 'a' && c <= 'z'; }
+static bool is_upper(char c) { return c >= 'A' && c <= 'Z'; }
+static char to_upper(char c) { return is_lower(c) ? static_cast<char>(c - 32) : c; }
+static char to_lower(char c) { return is_upper(c) ? static_cast<char>(c + 32) : c; }
+
+// Short words title case leaves in lower case, except at the start
+static bool is_stop_word(std::string_view w) {
+  static const char *const words[] = {"a",   "an",  "and", "as", "at",
+                                      "but", "by",  "for", "in", "nor",
+                                      "of",  "on",  "or",  "so", "the",
+                                      "to",  "up",  "yet", "via"};
+  for (const char *s : words)
+    if (w == s)
+      return true;
+  return false;
+}
+
+void apply_text_case(std::string &s, std::uint8_t flags) {
+  if (flags & strip_periods)
+    s.erase(std::remove(s.begin(), s.end(), '.'), s.end());
+  switch (flags & case_mask) {
+    case case_lowercase:
+      std::transform(s.begin(), s.end(), s.begin(), to_lower);
+      break;
+    case case_uppercase:
+      std::transform(s.begin(), s.end(), s.begin(), to_upper);
+      break;
+    case case_capitalize_first:
+      if (!s.empty())
+        s[0] = to_upper(s[0]);
+      break;
+    case case_capitalize_all:
+    case case_title: {
+      bool title = (flags & case_mask) == case_title;
+      size_t pos = 0;
+      bool first = true;
+      while (pos < s.size()) {
+        size_t end = s.find(' ', pos);
+        if (end == std::string::npos)
+          end = s.size();
+        std::string_view word(s.data() + pos, end - pos);
+        // Title case only touches words written in lower case
+        bool lower = std::all_of(word.begin(), word.end(),
+                                 [](char c) { return !is_upper(c); });
+        if (!word.empty() &&
+            (!title || (lower && (first || !is_stop_word(word)))))
+          s[pos] = to_upper(s[pos]);
+        first = false;
+        pos = end + 1;
+      }
+      break;
+    }
+  }
+}
+
+namespace {
+
+const Field var_fields[] = {
+    Field::title,     Field::journal_name, Field::volume, Field::issue,
+    Field::pages,     Field::publisher,    Field::place,  Field::doi,
+    Field::url,       Field::isbn,         Field::year};
+
+// Bit of the record's type in Condition::types; matches record_types in
+// csl_compile.cpp
+std::uint32_t record_type(const Citation &e) {
+  switch (e.type) {
+    case CitationType::article:
+      return e.flag(Citation::has_journal) ? 1u << 1 : 1u << 0;
+    case CitationType::paper: return 1u << 2;
+    case CitationType::book: return 1u << 3;
+    case CitationType::chapter: return 1u << 4;
+    case CitationType::other: break;
+  }
+  return 1u << 5;
+}
+
+const char close_quote[] = "\xE2\x80\x9D";
+const char open_quote[] = "\xE2\x80\x9C";
+
+bool ends_with(std::string_view s, std::string_view tail) {
+  return s.size() >= tail.size() &&
+         s.compare(s.size() - tail.size(), tail.size(), tail) == 0;
+}
+
+unsigned popcount(std::uint32_t v) {
+  return static_cast<unsigned>(std::bitset<32>(v).count());
+}
+
+// Numeric in the CSL sense: digits, possibly a range or list of them
+bool is_numeric(std::string_view s) {
+  bool digit = false;
+  for (char c : s) {
+    if (c >= '0' && c <= '9')
+      digit = true;
+    else if (c != '-' && c != ',' && c != '&' && c != ' ')
+      return false;
+  }
+  return digit;
+}
+
+// More than one page, volume, ...: a range or a list
+bool is_plural(std::string_view s) {
+  return s.find_first_of("-,&") != std::string_view::npos ||
+         s.find("\xE2\x80\x93") != std::string_view::npos;
+}
+
+size_t utf8_length(unsigned char c) {
+  if (c >= 0xF0)
+    return 4;
+  if (c >= 0xE0)
+    return 3;
+  if (c >= 0xC0)
+    return 2;
+  return 1;
+}
+
+class Interpreter {
+public:
+  Interpreter(const Program &p, const Citation &e, OutputBuffer &out,
+              bool plain, bool escape)
+      : p_(p), e_(e), out_(out), plain_(plain), escape_(escape) {
+    for (size_t v = 0; v < std::size(var_fields); ++v)
+      if (e.has(var_fields[v]))
+        present_ |= 1u << v;
+    if (e.author_count)
+      present_ |= 1u << static_cast<unsigned>(Var::author);
+    if (e.editor_count)
+      present_ |= 1u << static_cast<unsigned>(Var::editor);
+  }
+
+  void run(std::uint32_t pc);
+
+private:
+  // Left uninitialized until begin() fills it in
+  struct State {
+    std::uint32_t frame;
+    size_t start;     // before the prefix
+    size_t content;   // after the prefix and opening formatting
+    size_t separator; // where the pending delimiter starts, or npos
+    size_t after_separator;
+    std::uint32_t tried, found; // variable counters on entry
+  };
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  std::string_view value(Var v) const {
+    return e_.get(var_fields[static_cast<unsigned>(v)]);
+  }
+  bool has(Var v) const {
+    std::uint32_t bit = 1u << static_cast<unsigned>(v);
+    return (present_ & bit) && !(suppressed_ & bit);
+  }
+
+  void punctuation(std::string_view s) {
+    if (!s.empty())
+      style_text(s);
+  }
+  void style_text(std::string_view s);
+  void variable(const Instr &in);
+  void label(const Instr &in);
+  bool names(const NameSpec &spec);
+  void name_list(const NameSpec &spec, const ParsedName *names, size_t count);
+  void given(const NameSpec &spec, std::string_view first);
+  bool test(const Condition &c) const;
+  void open(const Frame &f);
+  void close(const Frame &f);
+  void begin(std::uint32_t frame);
+  void end();
+
+  const Program &p_;
+  const Citation &e_;
+  OutputBuffer &out_;
+  bool plain_;  // sort keys: no italics or quotes
+  bool escape_; // style text has characters the markup escapes
+
+  std::uint32_t present_ = 0;
+  std::uint32_t suppressed_ = 0; // used by a substitute, not printed again
+  std::uint32_t tried_ = 0, found_ = 0;
+  unsigned substituting_ = 0;
+  State stack_[max_depth];
+  unsigned depth_ = 0;
+};
+
+// Style text (affixes, delimiters, terms). A period right after one is
+// dropped, and periods and commas move inside a closing quote, as en-US
+// punctuation does.
+void Interpreter::style_text(std::string_view s) {
+  std::string_view written = out_.view();
+  if (s[0] == '.' || s[0] == ',') {
+    if (ends_with(written, close_quote)) {
+      out_.truncate(out_.size() - (sizeof(close_quote) - 1));
+      if (!(s[0] == '.' && ends_with(out_.view(), ".")))
+        out_.append(s[0]);
+      out_.append(close_quote);
+      s.remove_prefix(1);
+    } else if (s[0] == '.' && ends_with(written, ".")) {
+      s.remove_prefix(1);
+    }
+  }
+  if (escape_)
+    out_.text(s);
+  else
+    out_.append(s);
+}
+
+void Interpreter::variable(const Instr &in) {
+  Var v = static_cast<Var>(in.arg);
+  ++tried_;
+  if (v == Var::unknown || !has(v))
+    return;
+  ++found_;
+  if (substituting_)
+    suppressed_ |= 1u << static_cast<unsigned>(v);
+  if (in.a)
+    open(p_.frames[in.a - 1]);
+  if (in.flags == 0) {
+    out_.text(value(v));
+  } else {
+    std::string s(value(v));
+    apply_text_case(s, in.flags);
+    out_.text(s);
+  }
+  if (in.a)
+    close(p_.frames[in.a - 1]);
+}
+
+void Interpreter::label(const Instr &in) {
+  Var v = static_cast<Var>(in.arg);
+  bool plural;
+  if (v == Var::editor) {
+    if (!has(v))
+      return;
+    plural = e_.editor_count > 1;
+  } else {
+    if (v == Var::unknown || !has(v))
+      return;
+    plural = is_plural(value(v));
+  }
+  punctuation(p_.str(p_.terms[in.a + (plural ? 1 : 0)]));
+}
+
+void Interpreter::given(const NameSpec &spec, std::string_view first) {
+  if (!spec.initialize) {
+    out_.text(first);
+    return;
+  }
+  // One initial per name part: "John Ronald" -> "J. R.", "Jean-Paul" ->
+  // "J.-P." with initialize-with=". "
+  std::string_view with = p_.str(spec.initialize_with);
+  std::string_view tight = with;
+  while (!tight.empty() && tight.back() == ' ')
+    tight.remove_suffix(1);
+  std::string initials;
+  size_t pos = 0;
+  while (pos < first.size()) {
+    if (first[pos] == ' ') {
+      ++pos;
+      continue;
+    }
+    size_t end = first.find(' ', pos);
+    if (end == std::string_view::npos)
+      end = first.size();
+    std::string_view word = first.substr(pos, end - pos);
+    size_t part = 0;
+    while (part < word.size()) {
+      size_t hyphen = word.find('-', part);
+      size_t n = std::min(utf8_length(static_cast<unsigned char>(word[part])),
+                          word.size() - part);
+      initials.append(word.data() + part, n);
+      if (hyphen == std::string_view::npos) {
+        initials.append(with.data(), with.size());
+        break;
+      }
+      initials.append(tight.data(), tight.size()).append("-");
+      part = hyphen + 1;
+    }
+    pos = end;
+  }
+  while (!initials.empty() && initials.back() == ' ')
+    initials.pop_back();
+  out_.text(initials);
+}
+
+void Interpreter::name_list(const NameSpec &spec, const ParsedName *names,
+                            size_t count) {
+  size_t shown = count;
+  bool et_al = false;
+  if (spec.et_al_min && count >= spec.et_al_min &&
+      spec.et_al_use_first < count) {
+    shown = std::max<size_t>(spec.et_al_use_first, 1);
+    et_al = true;
+  }
+  if (spec.count_form) {
+    out_.text(std::to_string(shown));
+    return;
+  }
+  std::string_view delimiter = p_.str(spec.delimiter);
+  std::string_view and_term = p_.str(spec.and_term);
+
+  auto inverted = [&](size_t i) {
+    return !spec.short_form &&
+           (spec.order == NameOrder::all_inverted ||
+            (spec.order == NameOrder::first_inverted && i == 0));
+  };
+  auto precedes = [&](Precedes rule, size_t i) {
+    switch (rule) {
+      case Precedes::always: return true;
+      case Precedes::never: return false;
+      case Precedes::after_inverted: return inverted(i - 1);
+      case Precedes::contextual: break;
+    }
+    return shown > 2;
+  };
+
+  for (size_t i = 0; i < shown; ++i) {
+    if (i > 0) {
+      if (i == shown - 1 && !et_al && !and_term.empty()) {
+        if (precedes(spec.delimiter_precedes_last, i))
+          punctuation(delimiter);
+        else
+          out_.append(' ');
+        out_.text(and_term).append(' ');
+      } else {
+        punctuation(delimiter);
+      }
+    }
+    const ParsedName &n = names[i];
+    std::string_view first = e_.text(n.first);
+    std::string_view last = e_.text(n.last);
+    if (spec.short_form || first.empty()) {
+      out_.text(last);
+    } else if (inverted(i)) {
+      out_.text(last);
+      punctuation(p_.str(spec.sort_separator));
+      given(spec, first);
+    } else {
+      given(spec, first);
+      out_.append(' ').text(last);
+    }
+  }
+  if (et_al) {
+    bool before = spec.delimiter_precedes_et_al == Precedes::contextual
+                      ? shown > 1
+                      : precedes(spec.delimiter_precedes_et_al, shown);
+    if (before)
+      punctuation(delimiter);
+    else
+      out_.append(' ');
+    punctuation(p_.str(spec.et_al));
+  }
+}
+
+bool Interpreter::names(const NameSpec &spec) {
+  bool wrote = false;
+  for (unsigned k = 0; k < spec.var_count; ++k) {
+    Var v = static_cast<Var>(spec.vars[k]);
+    ++tried_;
+    if (!has(v))
+      continue;
+    ++found_;
+    if (substituting_)
+      suppressed_ |= 1u << static_cast<unsigned>(v);
+    bool editors = v == Var::editor;
+    const ParsedName *list = editors ? &e_.editor(0) : &e_.author(0);
+    size_t count = editors ? e_.editor_count : e_.author_count;
+
+    if (wrote)
+      punctuation(p_.str(spec.names_delimiter));
+    wrote = true;
+    StrRef term = count > 1 ? spec.label_plural[k] : spec.label_single[k];
+    if (term.length && !spec.label_after) {
+      punctuation(p_.str(spec.label_prefix));
+      punctuation(p_.str(term));
+      punctuation(p_.str(spec.label_suffix));
+    }
+    punctuation(p_.str(spec.name_prefix));
+    name_list(spec, list, count);
+    punctuation(p_.str(spec.name_suffix));
+    if (term.length && spec.label_after) {
+      punctuation(p_.str(spec.label_prefix));
+      punctuation(p_.str(term));
+      punctuation(p_.str(spec.label_suffix));
+    }
+  }
+  return wrote;
+}
+
+bool Interpreter::test(const Condition &c) const {
+  unsigned total = popcount(c.types) + popcount(c.variables) +
+                   popcount(c.numeric) + c.impossible;
+  unsigned passed = (c.types & record_type(e_)) ? 1 : 0;
+  std::uint32_t tested = c.variables | c.numeric;
+  for (unsigned v = 0; tested >> v; ++v) {
+    std::uint32_t bit = 1u << v;
+    if (!(tested & bit))
+      continue;
+    bool present = has(static_cast<Var>(v));
+    if ((c.variables & bit) && present)
+      ++passed;
+    if ((c.numeric & bit) && present && v < std::size(var_fields) &&
+        is_numeric(value(static_cast<Var>(v))))
+      ++passed;
+  }
+  switch (c.match) {
+    case Match::all: return passed == total;
+    case Match::any: return passed > 0;
+    case Match::none: return passed == 0;
+  }
+  return false;
+}
+
+void Interpreter::open(const Frame &f) {
+  punctuation(p_.str(f.prefix));
+  if (!plain_) {
+    if (f.quotes)
+      out_.append(open_quote);
+    if (f.italic)
+      out_.begin_italic();
+  }
+}
+
+void Interpreter::close(const Frame &f) {
+  if (!plain_) {
+    if (f.italic)
+      out_.end_italic();
+    if (f.quotes)
+      out_.append(close_quote);
+  }
+  punctuation(p_.str(f.suffix));
+}
+
+void Interpreter::begin(std::uint32_t frame) {
+  State &st = stack_[depth_++];
+  st.frame = frame;
+  st.start = out_.size();
+  st.separator = npos;
+  st.tried = tried_;
+  st.found = found_;
+  open(p_.frames[frame]);
+  st.content = out_.size();
+}
+
+void Interpreter::end() {
+  State &st = stack_[--depth_];
+  const Frame &f = p_.frames[st.frame];
+  // A group whose variables were all empty disappears, as does anything
+  // that wrote nothing between its affixes
+  if ((f.group && tried_ > st.tried && found_ == st.found) ||
+      out_.size() == st.content) {
+    out_.truncate(st.start);
+    return;
+  }
+  close(f);
+}
+
+void Interpreter::run(std::uint32_t pc) {
+  // Held locally: writes to the output could alias the vector's pointer
+  const Instr *code = p_.code.data();
+  for (;;) {
+    const Instr &in = code[pc++];
+    switch (in.op) {
+      case Op::text:
+        punctuation(std::string_view(p_.strings.data() + in.a, in.b));
+        break;
+      case Op::variable: variable(in); break;
+      case Op::label: label(in); break;
+      case Op::names:
+        if (names(p_.names[in.a]))
+          pc = in.b;
+        break;
+      case Op::begin: begin(in.a); break;
+      case Op::end: end(); break;
+      case Op::separator: {
+        State &st = stack_[depth_ - 1];
+        if (out_.size() > st.content) {
+          st.separator = out_.size();
+          punctuation(p_.str(p_.frames[in.a].delimiter));
+          st.after_separator = out_.size();
+        } else {
+          st.separator = npos;
+        }
+        break;
+      }
+      case Op::close_separator: {
+        State &st = stack_[depth_ - 1];
+        if (st.separator != npos && out_.size() == st.after_separator)
+          out_.truncate(st.separator);
+        st.separator = npos;
+        break;
+      }
+      case Op::test:
+        if (!test(p_.conditions[in.a]))
+          pc = in.b;
+        break;
+      case Op::jump: pc = in.b; break;
+      case Op::substitute_begin: {
+        State &st = stack_[depth_++];
+        st.start = out_.size();
+        ++substituting_;
+        break;
+      }
+      case Op::substitute_check:
+        if (out_.size() > stack_[depth_ - 1].start)
+          pc = in.b;
+        break;
+      case Op::substitute_end:
+        --depth_;
+        --substituting_;
+        break;
+      case Op::halt: return;
+    }
+  }
+}
+
+// --- On-disk cache ---
+
+const char cache_magic[8] = {'C', 'I', 'T', 'E', 'C', 'S', 'L', '\0'};
+const std::uint32_t cache_version = 1;
+const std::uint32_t byte_order_mark = 0x01020304;
+
+struct CacheHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint64_t source_hash;
+  std::uint32_t bibliography;
+  std::uint32_t code_count;
+  std::uint32_t frame_count;
+  std::uint32_t condition_count;
+  std::uint32_t names_count;
+  std::uint32_t sort_count;
+  std::uint32_t term_count;
+  std::uint32_t strings_size;
+  std::uint32_t title_size;
+  std::uint32_t reserved;
+};
+static_assert(sizeof(CacheHeader) == 64, "CacheHeader layout");
+static_assert(sizeof(Instr) == 12, "Instr layout");
+
+template <typename T>
+void write_array(std::ostream &out, const std::vector<T> &v) {
+  out.write(reinterpret_cast<const char *>(v.data()),
+            static_cast<std::streamsize>(v.size() * sizeof(T)));
+}
+
+template <typename T>
+bool read_array(std::istream &in, std::vector<T> &v, std::uint32_t count) {
+  v.resize(count);
+  in.read(reinterpret_cast<char *>(v.data()),
+          static_cast<std::streamsize>(count * sizeof(T)));
+  return static_cast<bool>(in);
+}
+
+// Every index and offset in range, so a damaged cache cannot make the
+// interpreter read out of bounds
+bool valid(const Program &p) {
+  auto str_ok = [&](StrRef r) {
+    return r.offset <= p.strings.size() &&
+           r.length <= p.strings.size() - r.offset;
+  };
+  size_t n = p.code.size();
+  if (n == 0 || p.bibliography >= n || p.code.back().op != Op::halt)
+    return false;
+  for (const Instr &in : p.code) {
+    switch (in.op) {
+      case Op::text:
+        if (!str_ok({in.a, in.b}))
+          return false;
+        break;
+      case Op::variable:
+        if (in.a > p.frames.size() ||
+            in.arg >= static_cast<unsigned>(Var::count) ||
+            in.arg == static_cast<unsigned>(Var::author) ||
+            in.arg == static_cast<unsigned>(Var::editor))
+          return false;
+        break;
+      case Op::label:
+        if (in.arg >= static_cast<unsigned>(Var::count) ||
+            p.terms.size() < 2 || in.a > p.terms.size() - 2)
+          return false;
+        break;
+      case Op::names:
+        if (in.a >= p.names.size() || in.b > n)
+          return false;
+        break;
+      case Op::begin:
+      case Op::end:
+      case Op::separator:
+        if (in.a >= p.frames.size())
+          return false;
+        break;
+      case Op::test:
+        if (in.a >= p.conditions.size() || in.b >= n)
+          return false;
+        break;
+      case Op::jump:
+      case Op::substitute_check:
+        if (in.b >= n)
+          return false;
+        break;
+      case Op::close_separator:
+      case Op::substitute_begin:
+      case Op::substitute_end:
+      case Op::halt:
+        break;
+      default:
+        return false;
+    }
+  }
+  // Frames and substitutes nest properly: the depth never exceeds the
+  // interpreter's stack, is zero at every halt, and every jump lands at the
+  // depth it left from
+  std::vector<std::uint8_t> depth(n + 1);
+  unsigned d = 0;
+  for (size_t pc = 0; pc < n; ++pc) {
+    depth[pc] = static_cast<std::uint8_t>(d);
+    Op op = p.code[pc].op;
+    if (op == Op::begin || op == Op::substitute_begin) {
+      if (++d > max_depth)
+        return false;
+    } else if (op == Op::end || op == Op::substitute_end) {
+      if (d-- == 0)
+        return false;
+    } else if ((op == Op::separator || op == Op::close_separator ||
+                op == Op::substitute_check) &&
+               d == 0) {
+      return false;
+    } else if (op == Op::halt && d != 0) {
+      return false;
+    }
+  }
+  depth[n] = 0;
+  for (size_t pc = 0; pc < n; ++pc) {
+    const Instr &in = p.code[pc];
+    bool jumps = in.op == Op::names || in.op == Op::test ||
+                 in.op == Op::jump || in.op == Op::substitute_check;
+    if (jumps && depth[in.b] != depth[pc])
+      return false;
+  }
+  for (const SortKey &k : p.sort)
+    if (depth[k.entry] != 0)
+      return false;
+  if (depth[p.bibliography] != 0)
+    return false;
+
+  const std::uint32_t all_vars = (1u << static_cast<unsigned>(Var::count)) - 1;
+  for (const Condition &c : p.conditions)
+    if ((c.variables | c.numeric) & ~all_vars)
+      return false;
+  for (const Frame &f : p.frames)
+    if (!str_ok(f.prefix) || !str_ok(f.suffix) || !str_ok(f.delimiter))
+      return false;
+  for (StrRef r : p.terms)
+    if (!str_ok(r))
+      return false;
+  for (const NameSpec &s : p.names) {
+    if (s.var_count > 4)
+      return false;
+    for (unsigned k = 0; k < s.var_count; ++k)
+      if (s.vars[k] != static_cast<unsigned>(Var::author) &&
+          s.vars[k] != static_cast<unsigned>(Var::editor))
+        return false;
+    for (StrRef r : {s.delimiter, s.and_term, s.sort_separator,
+                     s.initialize_with, s.et_al, s.names_delimiter,
+                     s.name_prefix, s.name_suffix, s.label_prefix,
+                     s.label_suffix})
+      if (!str_ok(r))
+        return false;
+    for (unsigned k = 0; k < 4; ++k)
+      if (!str_ok(s.label_single[k]) || !str_ok(s.label_plural[k]))
+        return false;
+  }
+  for (const SortKey &k : p.sort)
+    if (k.entry >= n)
+      return false;
+  return true;
+}
+
+} // namespace
+
+std::string cache_path(const std::string &dir, std::uint64_t source_hash) {
+  static const char hex[] = "0123456789abcdef";
+  std::string name(16, '0');
+  for (int i = 15; i >= 0; --i, source_hash >>= 4)
+    name[i] = hex[source_hash & 15];
+  return (std::filesystem::path(dir) / "csl" / (name + ".cslc")).string();
+}
+
+bool write_cache(const std::string &path, std::uint64_t source_hash,
+                 const Program &program) {
+  std::error_code ec;
+  std::filesystem::create_directories(
+      std::filesystem::path(path).parent_path(), ec);
+
+  CacheHeader header{};
+  std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.version = cache_version;
+  header.byte_order = byte_order_mark;
+  header.source_hash = source_hash;
+  header.bibliography = program.bibliography;
+  header.code_count = static_cast<std::uint32_t>(program.code.size());
+  header.frame_count = static_cast<std::uint32_t>(program.frames.size());
+  header.condition_count =
+      static_cast<std::uint32_t>(program.conditions.size());
+  header.names_count = static_cast<std::uint32_t>(program.names.size());
+  header.sort_count = static_cast<std::uint32_t>(program.sort.size());
+  header.term_count = static_cast<std::uint32_t>(program.terms.size());
+  header.strings_size = static_cast<std::uint32_t>(program.strings.size());
+  header.title_size = static_cast<std::uint32_t>(program.title.size());
+
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    write_array(out, program.code);
+    write_array(out, program.frames);
+    write_array(out, program.conditions);
+    write_array(out, program.names);
+    write_array(out, program.sort);
+    write_array(out, program.terms);
+    out.write(program.strings.data(),
+              static_cast<std::streamsize>(program.strings.size()));
+    out.write(program.title.data(),
+              static_cast<std::streamsize>(program.title.size()));
+    if (!out.flush()) {
+      std::filesystem::remove(tmp, ec);
+      return false;
+    }
+  }
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  return true;
+}
+
+bool read_cache(const std::string &path, std::uint64_t source_hash,
+                Program &program) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+  CacheHeader header;
+  if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+      header.version != cache_version ||
+      header.byte_order != byte_order_mark ||
+      header.source_hash != source_hash)
+    return false;
+
+  // The counts must add up to the file's length before anything is sized
+  // from them
+  std::error_code ec;
+  std::uint64_t file_size = std::filesystem::file_size(path, ec);
+  std::uint64_t expected =
+      sizeof(header) + std::uint64_t{header.code_count} * sizeof(Instr) +
+      std::uint64_t{header.frame_count} * sizeof(Frame) +
+      std::uint64_t{header.condition_count} * sizeof(Condition) +
+      std::uint64_t{header.names_count} * sizeof(NameSpec) +
+      std::uint64_t{header.sort_count} * sizeof(SortKey) +
+      std::uint64_t{header.term_count} * sizeof(StrRef) + header.strings_size +
+      header.title_size;
+  if (ec || expected != file_size)
+    return false;
+
+  Program p;
+  p.bibliography = header.bibliography;
+  p.strings.resize(header.strings_size);
+  p.title.resize(header.title_size);
+  if (!read_array(in, p.code, header.code_count) ||
+      !read_array(in, p.frames, header.frame_count) ||
+      !read_array(in, p.conditions, header.condition_count) ||
+      !read_array(in, p.names, header.names_count) ||
+      !read_array(in, p.sort, header.sort_count) ||
+      !read_array(in, p.terms, header.term_count) ||
+      !in.read(p.strings.data(), header.strings_size) ||
+      !in.read(p.title.data(), header.title_size) || !valid(p))
+    return false;
+  program = std::move(p);
+  return true;
+}
+
+} // namespace csl
+
+CslFormatter::CslFormatter(std::shared_ptr<const csl::Program> program)
+    : program_(std::move(program)) {
+  // Characters OutputBuffer::text() escapes in some markup
+  escape_ = program_->strings.find_first_of("&<>\"'\x02\x03\x1b") !=
+            std::string::npos;
+}
+
+void CslFormatter::format(const Citation &entry, OutputBuffer &out) const {
+  csl::Interpreter(*program_, entry, out, false, escape_)
+      .run(program_->bibliography);
+}
+
+std::vector<size_t>
+CslFormatter::sort_order(const std::vector<Citation> &entries) const {
+  std::vector<size_t> order(entries.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  const auto &sort = program_->sort;
+  if (sort.empty())
+    return order;
+
+  // One row of keys per entry, case-folded
+  std::vector<std::string> keys(entries.size() * sort.size());
+  OutputBuffer buf(Markup::terminal);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    for (size_t k = 0; k < sort.size(); ++k) {
+      buf.clear();
+      csl::Interpreter(*program_, entries[i], buf, true, escape_)
+          .run(sort[k].entry);
+      std::string &key = keys[i * sort.size() + k];
+      key.assign(buf.view());
+      csl::apply_text_case(key, csl::case_lowercase);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    for (size_t k = 0; k < sort.size(); ++k) {
+      const std::string &ka = keys[a * sort.size() + k];
+      const std::string &kb = keys[b * sort.size() + k];
+      // Entries without the key go last either way
+      if (ka.empty() != kb.empty())
+        return kb.empty();
+      int c = ka.compare(kb);
+      if (c != 0)
+        return sort[k].descending ? c > 0 : c < 0;
+    }
+    return false;
+  });
+  return order;
+}
+
+std::unique_ptr<CslFormatter> load_csl_style(const std::string &path,
+                                             const std::string &cache_dir,
+                                             CslLoadInfo *info) {
+  std::ifstream in(path, std::ios::binary);
+  std::ostringstream text;
+  if (!in || !(text << in.rdbuf())) {
+    std::cerr << "Error: Cannot read style " << path << "\n";
+    return nullptr;
+  }
+  std::string xml = text.str();
+  std::uint64_t hash = hash_bytes(xml);
+
+  auto program = std::make_shared<csl::Program>();
+  std::string cached = cache_dir.empty() ? "" : csl::cache_path(cache_dir, hash);
+  bool from_cache = !cached.empty() && csl::read_cache(cached, hash, *program);
+  if (!from_cache) {
+    std::string error;
+    if (!csl::compile(xml, *program, error)) {
+      std::cerr << "Error: " << path << ": " << error << "\n";
+      return nullptr;
+    }
+    // Best effort: without a cache the style is just compiled again
+    if (!cached.empty())
+      csl::write_cache(cached, hash, *program);
+  }
+  if (info)
+    info->from_cache = from_cache;
+  return std::make_unique<CslFormatter>(std::move(program));
+}
@@ -0,0 +1,802 @@
+#include "csl.hpp"
+#include "xml.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+namespace csl {
+namespace {
+
+// CSL types records can have; see record_type() in csl.cpp
+const char *const record_types[] = {"article",  "article-journal",
+                                    "paper-conference", "book",
+                                    "chapter",  "document"};
+
+struct TermText {
+  std::string single, multiple;
+};
+
+// en-US terms the styles commonly use; a style's <locale> overrides them
+struct DefaultTerm {
+  const char *name, *form, *single, *multiple;
+} const default_terms[] = {
+    {"and", "long", "and", "and"},
+    {"and", "symbol", "&", "&"},
+    {"et-al", "long", "et al.", "et al."},
+    {"and others", "long", "and others", "and others"},
+    {"anonymous", "long", "anonymous", "anonymous"},
+    {"anonymous", "short", "anon.", "anon."},
+    {"accessed", "long", "accessed", "accessed"},
+    {"available at", "long", "available at", "available at"},
+    {"by", "long", "by", "by"},
+    {"chapter", "long", "chapter", "chapters"},
+    {"chapter", "short", "chap.", "chaps."},
+    {"edition", "long", "edition", "editions"},
+    {"edition", "short", "ed.", "eds."},
+    {"editor", "long", "editor", "editors"},
+    {"editor", "short", "ed.", "eds."},
+    {"editor", "verb", "edited by", "edited by"},
+    {"editor", "verb-short", "ed.", "ed."},
+    {"from", "long", "from", "from"},
+    {"ibid", "long", "ibid.", "ibid."},
+    {"in", "long", "in", "in"},
+    {"issue", "long", "issue", "issues"},
+    {"issue", "short", "no.", "nos."},
+    {"no date", "long", "no date", "no date"},
+    {"no date", "short", "n.d.", "n.d."},
+    {"number", "long", "number", "numbers"},
+    {"number", "short", "no.", "nos."},
+    {"online", "long", "online", "online"},
+    {"page", "long", "page", "pages"},
+    {"page", "short", "p.", "pp."},
+    {"presented at", "long", "presented at the", "presented at the"},
+    {"retrieved", "long", "retrieved", "retrieved"},
+    {"translator", "long", "translator", "translators"},
+    {"translator", "short", "tran.", "trans."},
+    {"translator", "verb", "translated by", "translated by"},
+    {"volume", "long", "volume", "volumes"},
+    {"volume", "short", "vol.", "vols."},
+    {"open-quote", "long", "\xE2\x80\x9C", "\xE2\x80\x9C"},
+    {"close-quote", "long", "\xE2\x80\x9D", "\xE2\x80\x9D"},
+    {"open-inner-quote", "long", "\xE2\x80\x98", "\xE2\x80\x98"},
+    {"close-inner-quote", "long", "\xE2\x80\x99", "\xE2\x80\x99"},
+};
+
+Var variable_named(std::string_view name) {
+  static const struct {
+    const char *name;
+    Var var;
+  } vars[] = {
+      {"title", Var::title},
+      {"title-short", Var::title},
+      {"container-title", Var::container_title},
+      {"container-title-short", Var::container_title},
+      {"volume", Var::volume},
+      {"issue", Var::issue},
+      {"page", Var::page},
+      {"page-first", Var::page},
+      {"publisher", Var::publisher},
+      {"publisher-place", Var::publisher_place},
+      {"DOI", Var::doi},
+      {"URL", Var::url},
+      {"ISBN", Var::isbn},
+      {"issued", Var::issued},
+      {"author", Var::author},
+      {"editor", Var::editor},
+  };
+  for (const auto &v : vars)
+    if (name == v.name)
+      return v.var;
+  return Var::unknown;
+}
+
+bool is_name_var(Var v) { return v == Var::author || v == Var::editor; }
+
+// Term a <label> prints for a variable
+const char *label_term(Var v) {
+  switch (v) {
+    case Var::page: return "page";
+    case Var::volume: return "volume";
+    case Var::issue: return "issue";
+    case Var::editor: return "editor";
+    default: return nullptr;
+  }
+}
+
+std::vector<std::string_view> split_spaces(std::string_view s) {
+  std::vector<std::string_view> words;
+  size_t pos = 0;
+  while (pos < s.size()) {
+    size_t end = s.find(' ', pos);
+    if (end == std::string_view::npos)
+      end = s.size();
+    if (end > pos)
+      words.push_back(s.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return words;
+}
+
+// Inheritable settings while compiling an element
+struct Context {
+  std::uint8_t text_case = 0;       // from a <text macro> with text-case
+  const NameSpec *parent = nullptr; // enclosing <names>, in a substitute
+  unsigned depth = 0;               // runtime frame nesting
+  unsigned macro_depth = 0;
+};
+
+class Compiler {
+public:
+  explicit Compiler(Program &program) : p_(program) {}
+
+  bool compile(const XmlNode &style, std::string &error);
+
+private:
+  bool fail(std::string message) {
+    if (error_.empty())
+      error_ = std::move(message);
+    return false;
+  }
+
+  StrRef intern(std::string_view s);
+  std::uint32_t emit(Op op, std::uint32_t a = 0, std::uint32_t b = 0,
+                     std::uint16_t arg = 0, std::uint8_t flags = 0);
+  std::uint32_t here() const {
+    return static_cast<std::uint32_t>(p_.code.size());
+  }
+
+  void load_terms(const XmlNode &style);
+  const TermText *find_term(std::string_view name, std::string_view form) const;
+  std::string term(std::string_view name, std::string_view form,
+                   bool plural) const;
+
+  std::uint8_t case_flags(const XmlNode &n, const Context &ctx) const;
+  const std::string *inherited(const XmlNode *name, std::string_view key,
+                               std::string_view outer_key = {}) const;
+  std::string inherited_or(const XmlNode *name, std::string_view key,
+                           std::string_view fallback,
+                           std::string_view outer_key = {}) const {
+    const std::string *v = inherited(name, key, outer_key);
+    return v ? *v : std::string(fallback);
+  }
+
+  // Adds a frame for the element's affixes and formatting if it has any;
+  // returns its index or -1
+  int add_frame(const XmlNode &n, bool group, std::string_view delimiter);
+  // Same, and opens it
+  int open_frame(const XmlNode &n, Context &ctx, bool group,
+                 std::string_view delimiter);
+  void close_frame(int frame, Context &ctx);
+
+  bool element(const XmlNode &n, Context ctx);
+  bool children(const XmlNode &n, Context ctx, int delimited_frame);
+  bool text(const XmlNode &n, Context ctx);
+  bool leaf_variable(const XmlNode &n, Var v, Context ctx);
+  bool label(const XmlNode &n, Context ctx);
+  bool date(const XmlNode &n, Context ctx);
+  bool names(const XmlNode &n, Context ctx);
+  bool choose(const XmlNode &n, Context ctx);
+  bool macro(std::string_view name, Context ctx);
+  bool sort_keys(const XmlNode &sort);
+
+  Program &p_;
+  std::string error_;
+  std::unordered_map<std::string, StrRef> interned_;
+  std::map<std::string, const XmlNode *, std::less<>> macros_;
+  std::map<std::pair<std::string, std::string>, TermText> terms_;
+  const XmlNode *style_ = nullptr;
+  const XmlNode *section_ = nullptr; // <bibliography>
+};
+
+StrRef Compiler::intern(std::string_view s) {
+  auto it = interned_.find(std::string(s));
+  if (it != interned_.end())
+    return it->second;
+  StrRef r;
+  r.offset = static_cast<std::uint32_t>(p_.strings.size());
+  r.length = static_cast<std::uint32_t>(s.size());
+  p_.strings.append(s.data(), s.size());
+  interned_.emplace(std::string(s), r);
+  return r;
+}
+
+std::uint32_t Compiler::emit(Op op, std::uint32_t a, std::uint32_t b,
+                             std::uint16_t arg, std::uint8_t flags) {
+  Instr in;
+  in.op = op;
+  in.flags = flags;
+  in.arg = arg;
+  in.a = a;
+  in.b = b;
+  p_.code.push_back(in);
+  return here() - 1;
+}
+
+void Compiler::load_terms(const XmlNode &style) {
+  for (const auto &t : default_terms)
+    terms_[{t.name, t.form}] = {t.single, t.multiple};
+
+  for (const XmlNode &locale : style.children) {
+    if (locale.name != "locale")
+      continue;
+    const std::string *lang = locale.attribute("xml:lang");
+    if (lang && lang->compare(0, 2, "en") != 0)
+      continue;
+    const XmlNode *list = locale.child("terms");
+    if (!list)
+      continue;
+    for (const XmlNode &t : list->children) {
+      const std::string *name = t.attribute("name");
+      if (t.name != "term" || !name)
+        continue;
+      const std::string *form = t.attribute("form");
+      TermText text;
+      const XmlNode *single = t.child("single");
+      const XmlNode *multiple = t.child("multiple");
+      text.single = single ? single->text : t.text;
+      text.multiple = multiple ? multiple->text : text.single;
+      terms_[{*name, form ? *form : "long"}] = std::move(text);
+    }
+  }
+}
+
+const TermText *Compiler::find_term(std::string_view name,
+                                    std::string_view form) const {
+  // Missing forms fall back: verb-short -> verb -> long, symbol -> short
+  // -> long
+  for (;;) {
+    auto it = terms_.find({std::string(name), std::string(form)});
+    if (it != terms_.end())
+      return &it->second;
+    if (form == "verb-short")
+      form = "verb";
+    else if (form == "symbol")
+      form = "short";
+    else if (form != "long")
+      form = "long";
+    else
+      return nullptr;
+  }
+}
+
+std::string Compiler::term(std::string_view name, std::string_view form,
+                           bool plural) const {
+  const TermText *t = find_term(name, form.empty() ? "long" : form);
+  if (!t)
+    return std::string();
+  return plural ? t->multiple : t->single;
+}
+
+std::uint8_t Compiler::case_flags(const XmlNode &n, const Context &ctx) const {
+  std::uint8_t flags = ctx.text_case;
+  if (const std::string *tc = n.attribute("text-case")) {
+    flags &= ~case_mask;
+    if (*tc == "lowercase")
+      flags |= case_lowercase;
+    else if (*tc == "uppercase")
+      flags |= case_uppercase;
+    else if (*tc == "capitalize-first" || *tc == "sentence")
+      flags |= case_capitalize_first;
+    else if (*tc == "capitalize-all")
+      flags |= case_capitalize_all;
+    else if (*tc == "title")
+      flags |= case_title;
+  }
+  if (const std::string *sp = n.attribute("strip-periods"); sp && *sp == "true")
+    flags |= strip_periods;
+  return flags;
+}
+
+// Name option from <name>, else <bibliography>, else <style>; the outer
+// elements spell some options differently ("name-form" for "form")
+const std::string *Compiler::inherited(const XmlNode *name,
+                                       std::string_view key,
+                                       std::string_view outer_key) const {
+  if (outer_key.empty())
+    outer_key = key;
+  if (name)
+    if (const std::string *v = name->attribute(key))
+      return v;
+  for (const XmlNode *outer : {section_, style_})
+    if (outer)
+      if (const std::string *v = outer->attribute(outer_key))
+        return v;
+  return nullptr;
+}
+
+int Compiler::add_frame(const XmlNode &n, bool group,
+                        std::string_view delimiter) {
+  Frame f;
+  const std::string *prefix = n.attribute("prefix");
+  const std::string *suffix = n.attribute("suffix");
+  const std::string *font = n.attribute("font-style");
+  const std::string *quotes = n.attribute("quotes");
+  f.italic = font && (*font == "italic" || *font == "oblique");
+  f.quotes = quotes && *quotes == "true";
+  f.group = group;
+  if (prefix)
+    f.prefix = intern(*prefix);
+  if (suffix)
+    f.suffix = intern(*suffix);
+  f.delimiter = intern(delimiter);
+  if (!f.prefix.length && !f.suffix.length && !f.italic && !f.quotes &&
+      !f.group && delimiter.empty())
+    return -1;
+  p_.frames.push_back(f);
+  return static_cast<int>(p_.frames.size() - 1);
+}
+
+int Compiler::open_frame(const XmlNode &n, Context &ctx, bool group,
+                         std::string_view delimiter) {
+  int index = add_frame(n, group, delimiter);
+  if (index < 0)
+    return -1;
+  if (++ctx.depth > max_depth) {
+    fail("elements nested too deeply");
+    return -1;
+  }
+  emit(Op::begin, static_cast<std::uint32_t>(index));
+  return index;
+}
+
+void Compiler::close_frame(int frame, Context &ctx) {
+  if (frame < 0)
+    return;
+  emit(Op::end, static_cast<std::uint32_t>(frame));
+  --ctx.depth;
+}
+
+bool Compiler::children(const XmlNode &n, Context ctx, int delimited_frame) {
+  for (const XmlNode &c : n.children) {
+    if (delimited_frame >= 0)
+      emit(Op::separator, static_cast<std::uint32_t>(delimited_frame));
+    if (!element(c, ctx))
+      return false;
+    if (delimited_frame >= 0)
+      emit(Op::close_separator, static_cast<std::uint32_t>(delimited_frame));
+  }
+  return true;
+}
+
+bool Compiler::element(const XmlNode &n, Context ctx) {
+  if (n.name == "text")
+    return text(n, ctx);
+  if (n.name == "number") {
+    const std::string *v = n.attribute("variable");
+    return leaf_variable(n, v ? variable_named(*v) : Var::unknown, ctx);
+  }
+  if (n.name == "label")
+    return label(n, ctx);
+  if (n.name == "date")
+    return date(n, ctx);
+  if (n.name == "names")
+    return names(n, ctx);
+  if (n.name == "choose")
+    return choose(n, ctx);
+  if (n.name == "group") {
+    const std::string *delimiter = n.attribute("delimiter");
+    int frame = open_frame(n, ctx, true, delimiter ? *delimiter : "");
+    bool ok = children(n, ctx,
+                       delimiter && !delimiter->empty() ? frame : -1);
+    close_frame(frame, ctx);
+    return ok && error_.empty();
+  }
+  // Unsupported elements render nothing
+  return true;
+}
+
+bool Compiler::text(const XmlNode &n, Context ctx) {
+  if (const std::string *v = n.attribute("variable"))
+    return leaf_variable(n, variable_named(*v), ctx);
+
+  if (const std::string *m = n.attribute("macro")) {
+    int frame = open_frame(n, ctx, false, "");
+    Context inner = ctx;
+    inner.text_case = case_flags(n, ctx);
+    bool ok = macro(*m, inner);
+    close_frame(frame, ctx);
+    return ok && error_.empty();
+  }
+
+  std::string literal;
+  if (const std::string *t = n.attribute("term")) {
+    const std::string *form = n.attribute("form");
+    const std::string *plural = n.attribute("plural");
+    literal = term(*t, form ? *form : "long", plural && *plural == "true");
+  } else if (const std::string *v = n.attribute("value")) {
+    literal = *v;
+  }
+  apply_text_case(literal, case_flags(n, ctx));
+  if (literal.empty())
+    return true;
+  int frame = open_frame(n, ctx, false, "");
+  StrRef r = intern(literal);
+  emit(Op::text, r.offset, r.length);
+  close_frame(frame, ctx);
+  return error_.empty();
+}
+
+bool Compiler::leaf_variable(const XmlNode &n, Var v, Context ctx) {
+  if (is_name_var(v)) {
+    // <text variable="author"> reads as a plain names list
+    XmlNode as_names;
+    as_names.name = "names";
+    as_names.attributes = n.attributes;
+    return names(as_names, ctx);
+  }
+  // The variable writes its own affixes, saving a begin/end pair on the
+  // commonest element
+  int frame = add_frame(n, false, "");
+  emit(Op::variable, static_cast<std::uint32_t>(frame + 1), 0,
+       static_cast<std::uint16_t>(v), case_flags(n, ctx));
+  return error_.empty();
+}
+
+bool Compiler::label(const XmlNode &n, Context ctx) {
+  const std::string *v = n.attribute("variable");
+  Var var = v ? variable_named(*v) : Var::unknown;
+  const char *name = label_term(var);
+  if (!name)
+    return true;
+  const std::string *form_attr = n.attribute("form");
+  const std::string *plural = n.attribute("plural");
+  std::string form = form_attr ? *form_attr : "long";
+  std::string single = term(name, form, false);
+  std::string multiple = term(name, form, true);
+  if (plural && *plural == "always")
+    single = multiple;
+  else if (plural && *plural == "never")
+    multiple = single;
+  std::uint8_t flags = case_flags(n, ctx);
+  apply_text_case(single, flags);
+  apply_text_case(multiple, flags);
+
+  int frame = open_frame(n, ctx, false, "");
+  emit(Op::label, static_cast<std::uint32_t>(p_.terms.size()), 0,
+       static_cast<std::uint16_t>(var));
+  p_.terms.push_back(intern(single));
+  p_.terms.push_back(intern(multiple));
+  close_frame(frame, ctx);
+  return error_.empty();
+}
+
+bool Compiler::date(const XmlNode &n, Context ctx) {
+  const std::string *v = n.attribute("variable");
+  Var var = v && *v == "issued" ? Var::issued : Var::unknown;
+  int frame = open_frame(n, ctx, false, "");
+
+  // Records only have a year: render the year part with its affixes, or
+  // the plain year for a localized date form without parts
+  bool has_parts = false;
+  for (const XmlNode &part : n.children) {
+    if (part.name != "date-part")
+      continue;
+    has_parts = true;
+    const std::string *name = part.attribute("name");
+    if (!name || *name != "year")
+      continue;
+    if (!leaf_variable(part, var, ctx))
+      return false;
+  }
+  if (!has_parts)
+    emit(Op::variable, 0, 0, static_cast<std::uint16_t>(var),
+         case_flags(n, ctx));
+  close_frame(frame, ctx);
+  return error_.empty();
+}
+
+bool Compiler::names(const XmlNode &n, Context ctx) {
+  NameSpec spec;
+  const XmlNode *name = n.child("name");
+  const XmlNode *et_al = n.child("et-al");
+  const XmlNode *label = n.child("label");
+  const XmlNode *substitute = n.child("substitute");
+
+  if (const std::string *v = n.attribute("variable")) {
+    for (std::string_view word : split_spaces(*v)) {
+      Var var = variable_named(word);
+      if (is_name_var(var) && spec.var_count < 4)
+        spec.vars[spec.var_count++] = static_cast<std::uint8_t>(var);
+    }
+  }
+
+  if (!name && !label && ctx.parent) {
+    // Shorthand <names variable="editor"/> inside a substitute: same name
+    // options as the <names> it stands in for
+    std::uint8_t vars[4];
+    std::memcpy(vars, spec.vars, sizeof(vars));
+    std::uint8_t count = spec.var_count;
+    spec = *ctx.parent;
+    std::memcpy(spec.vars, vars, sizeof(vars));
+    spec.var_count = count;
+  } else {
+    std::string form = inherited_or(name, "form", "long", "name-form");
+    spec.short_form = form == "short";
+    spec.count_form = form == "count";
+    std::string order = inherited_or(name, "name-as-sort-order", "");
+    spec.order = order == "all"     ? NameOrder::all_inverted
+                 : order == "first" ? NameOrder::first_inverted
+                                    : NameOrder::given_first;
+    auto precedes = [](const std::string &s) {
+      return s == "always"                ? Precedes::always
+             : s == "never"               ? Precedes::never
+             : s == "after-inverted-name" ? Precedes::after_inverted
+                                          : Precedes::contextual;
+    };
+    spec.delimiter_precedes_last =
+        precedes(inherited_or(name, "delimiter-precedes-last", ""));
+    spec.delimiter_precedes_et_al =
+        precedes(inherited_or(name, "delimiter-precedes-et-al", ""));
+    spec.et_al_min = static_cast<std::uint16_t>(
+        std::atoi(inherited_or(name, "et-al-min", "0").c_str()));
+    spec.et_al_use_first = static_cast<std::uint16_t>(
+        std::atoi(inherited_or(name, "et-al-use-first", "1").c_str()));
+
+    spec.delimiter =
+        intern(inherited_or(name, "delimiter", ", ", "name-delimiter"));
+    std::string and_mode = inherited_or(name, "and", "");
+    if (and_mode == "text")
+      spec.and_term = intern(term("and", "long", false));
+    else if (and_mode == "symbol")
+      spec.and_term = intern(term("and", "symbol", false));
+    spec.sort_separator = intern(inherited_or(name, "sort-separator", ", "));
+    std::string initialize_with = inherited_or(name, "initialize-with", "");
+    spec.initialize = !initialize_with.empty() &&
+                      inherited_or(name, "initialize", "true") != "false";
+    spec.initialize_with = intern(initialize_with);
+    if (name) {
+      if (const std::string *p = name->attribute("prefix"))
+        spec.name_prefix = intern(*p);
+      if (const std::string *s = name->attribute("suffix"))
+        spec.name_suffix = intern(*s);
+    }
+
+    std::string et_al_term = "et-al";
+    if (et_al)
+      if (const std::string *t = et_al->attribute("term"))
+        et_al_term = *t;
+    spec.et_al = intern(term(et_al_term, "long", false));
+
+    if (label) {
+      const std::string *form_attr = label->attribute("form");
+      const std::string *plural = label->attribute("plural");
+      std::string label_form = form_attr ? *form_attr : "long";
+      for (unsigned i = 0; i < spec.var_count; ++i) {
+        const char *t = label_term(static_cast<Var>(spec.vars[i]));
+        if (!t)
+          continue;
+        std::string single = term(t, label_form, false);
+        std::string multiple = term(t, label_form, true);
+        if (plural && *plural == "always")
+          single = multiple;
+        else if (plural && *plural == "never")
+          multiple = single;
+        std::uint8_t flags = case_flags(*label, Context());
+        apply_text_case(single, flags);
+        apply_text_case(multiple, flags);
+        spec.label_single[i] = intern(single);
+        spec.label_plural[i] = intern(multiple);
+      }
+      if (const std::string *p = label->attribute("prefix"))
+        spec.label_prefix = intern(*p);
+      if (const std::string *s = label->attribute("suffix"))
+        spec.label_suffix = intern(*s);
+      // A label before <name> goes before the names
+      spec.label_after = true;
+      for (const XmlNode &c : n.children) {
+        if (&c == label) {
+          spec.label_after = false;
+          break;
+        }
+        if (&c == name)
+          break;
+      }
+    }
+  }
+  if (const std::string *d = n.attribute("delimiter"))
+    spec.names_delimiter = intern(*d);
+  else
+    spec.names_delimiter = intern(", ");
+
+  int frame = open_frame(n, ctx, false, "");
+  p_.names.push_back(spec);
+  std::uint32_t at =
+      emit(Op::names, static_cast<std::uint32_t>(p_.names.size() - 1));
+  if (substitute) {
+    if (++ctx.depth > max_depth)
+      return fail("elements nested too deeply");
+    emit(Op::substitute_begin);
+    std::vector<std::uint32_t> checks;
+    Context inner = ctx;
+    NameSpec parent = p_.names.back(); // the vector may grow below
+    inner.parent = &parent;
+    for (const XmlNode &c : substitute->children) {
+      if (!element(c, inner))
+        return false;
+      checks.push_back(emit(Op::substitute_check));
+    }
+    std::uint32_t end = emit(Op::substitute_end);
+    for (std::uint32_t c : checks)
+      p_.code[c].b = end;
+    --ctx.depth;
+  }
+  p_.code[at].b = here();
+  close_frame(frame, ctx);
+  return error_.empty();
+}
+
+bool Compiler::choose(const XmlNode &n, Context ctx) {
+  std::vector<std::uint32_t> exits;
+  for (const XmlNode &branch : n.children) {
+    std::uint32_t test = 0;
+    bool conditional = branch.name == "if" || branch.name == "else-if";
+    if (!conditional && branch.name != "else")
+      continue;
+    if (conditional) {
+      Condition cond;
+      const std::string *match = branch.attribute("match");
+      cond.match = !match || *match == "all" ? Match::all
+                   : *match == "any"         ? Match::any
+                                             : Match::none;
+      for (const auto &attr : branch.attributes) {
+        const std::string &key = attr.first;
+        std::vector<std::string_view> values = split_spaces(attr.second);
+        if (key == "match")
+          continue;
+        if (key == "type") {
+          for (std::string_view t : values) {
+            bool known = false;
+            for (size_t i = 0; i < sizeof(record_types) / sizeof(*record_types);
+                 ++i) {
+              if (t == record_types[i]) {
+                cond.types |= 1u << i;
+                known = true;
+              }
+            }
+            if (!known)
+              ++cond.impossible;
+          }
+        } else if (key == "variable" || key == "is-numeric") {
+          for (std::string_view v : values) {
+            Var var = variable_named(v);
+            if (var == Var::unknown) {
+              ++cond.impossible;
+              continue;
+            }
+            std::uint32_t bit = 1u << static_cast<unsigned>(var);
+            (key == "variable" ? cond.variables : cond.numeric) |= bit;
+          }
+        } else {
+          // position, locator, disambiguate, is-uncertain-date: never
+          // true for a bibliography entry
+          cond.impossible += static_cast<std::uint32_t>(values.size());
+        }
+      }
+      p_.conditions.push_back(cond);
+      test = emit(Op::test,
+                  static_cast<std::uint32_t>(p_.conditions.size() - 1));
+    }
+    if (!children(branch, ctx, -1))
+      return false;
+    if (!conditional)
+      break;
+    exits.push_back(emit(Op::jump));
+    p_.code[test].b = here();
+  }
+  for (std::uint32_t e : exits)
+    p_.code[e].b = here();
+  return true;
+}
+
+bool Compiler::macro(std::string_view name, Context ctx) {
+  auto it = macros_.find(name);
+  if (it == macros_.end())
+    return fail("undefined macro '" + std::string(name) + "'");
+  if (++ctx.macro_depth > 64)
+    return fail("macro '" + std::string(name) + "' calls itself");
+  return children(*it->second, ctx, -1);
+}
+
+bool Compiler::sort_keys(const XmlNode &sort) {
+  for (const XmlNode &key : sort.children) {
+    if (key.name != "key")
+      continue;
+    SortKey k;
+    k.entry = here();
+    const std::string *order = key.attribute("sort");
+    k.descending = order && *order == "descending";
+    Context ctx;
+    if (const std::string *m = key.attribute("macro")) {
+      if (!macro(*m, ctx))
+        return false;
+    } else if (const std::string *v = key.attribute("variable")) {
+      Var var = variable_named(*v);
+      if (is_name_var(var)) {
+        // Names sort family name first, all of them
+        NameSpec spec;
+        spec.vars[0] = static_cast<std::uint8_t>(var);
+        spec.var_count = 1;
+        spec.order = NameOrder::all_inverted;
+        spec.delimiter = intern(" ");
+        spec.sort_separator = intern(" ");
+        spec.names_delimiter = intern(" ");
+        p_.names.push_back(spec);
+        std::uint32_t at =
+            emit(Op::names, static_cast<std::uint32_t>(p_.names.size() - 1));
+        p_.code[at].b = here();
+      } else {
+        emit(Op::variable, 0, 0, static_cast<std::uint16_t>(var));
+      }
+    } else {
+      continue;
+    }
+    emit(Op::halt);
+    p_.sort.push_back(k);
+  }
+  return true;
+}
+
+bool Compiler::compile(const XmlNode &style, std::string &error) {
+  if (style.name != "style") {
+    error = "not a CSL style (root element is <" + style.name + ">)";
+    return false;
+  }
+  style_ = &style;
+  load_terms(style);
+
+  if (const XmlNode *info = style.child("info"))
+    if (const XmlNode *title = info->child("title"))
+      p_.title = title->text;
+  if (p_.title.empty())
+    p_.title = "CSL";
+
+  for (const XmlNode &c : style.children)
+    if (c.name == "macro")
+      if (const std::string *name = c.attribute("name"))
+        macros_[*name] = &c;
+
+  section_ = style.child("bibliography");
+  if (!section_) {
+    error = "the style has no <bibliography>";
+    return false;
+  }
+  const XmlNode *layout = section_->child("layout");
+  if (!layout) {
+    error = "<bibliography> has no <layout>";
+    return false;
+  }
+
+  Context ctx;
+  p_.bibliography = here();
+  int frame = open_frame(*layout, ctx, false, "");
+  if (!children(*layout, ctx, -1)) {
+    error = error_;
+    return false;
+  }
+  close_frame(frame, ctx);
+  emit(Op::halt);
+
+  if (const XmlNode *sort = section_->child("sort"))
+    if (!sort_keys(*sort)) {
+      error = error_;
+      return false;
+    }
+  if (!error_.empty()) {
+    error = error_;
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+bool compile(std::string_view xml, Program &program, std::string &error) {
+  XmlNode root;
+  if (!parse_xml(xml, root, error))
+    return false;
+  program = Program();
+  return Compiler(program).compile(root, error);
+}
+
+} // namespace csl
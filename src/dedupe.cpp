@@ -0,0 +1,494 @@
+#include "dedupe.hpp"
+#include "citation_record.hpp"
+#include "journal.hpp"
+#include "json_utils.hpp"
+#include "library.hpp"
+#include "parallel.hpp"
+#include "search_index.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Blocks larger than this only match identical titles; comparing every
+// pair would be quadratic in the block
+const size_t fuzzy_block_limit = 200;
+
+// Share of title words two records must have in common to match
+const double title_similarity = 0.85;
+
+struct Entry {
+  std::string id;
+  std::string summary;
+  std::vector<std::string> keys;  // "doi:..." / "isbn:..."
+  std::string block;              // first author's last name and year
+  std::string title;              // folded words, in order
+  std::vector<std::string> words; // folded words, sorted and unique
+};
+
+// ASCII letters lowercased, digits kept, UTF-8 sequences kept whole;
+// everything else separates words
+template <typename F> void for_each_folded_word(std::string_view s, F &&f) {
+  std::string word;
+  for (char ch : s) {
+    unsigned char u = static_cast<unsigned char>(ch);
+    if ((u >= '0' && u <= '9') || (u >= 'a' && u <= 'z') || u >= 0x80) {
+      word += ch;
+    } else if (u >= 'A' && u <= 'Z') {
+      word += static_cast<char>(u - 'A' + 'a');
+    } else if (ch == '\'') {
+      continue; // "Schrödinger's" and "Schrödingers" fold alike
+    } else if (!word.empty()) {
+      f(word);
+      word.clear();
+    }
+  }
+  if (!word.empty())
+    f(word);
+}
+
+std::string folded(std::string_view s) {
+  std::string out;
+  for_each_folded_word(s, [&](const std::string &w) { out += w; });
+  return out;
+}
+
+// Every DOI and ISBN in the record's "identifier" array
+std::vector<std::string> record_keys(const nlohmann::json &record) {
+  std::vector<std::string> keys;
+  auto ids = record.find("identifier");
+  if (ids == record.end() || !ids->is_array())
+    return keys;
+  for (const auto &id : *ids) {
+    if (!id.is_object() || !id.contains("id") || !id["id"].is_string())
+      continue;
+    std::string type = id.value("type", "");
+    const std::string &value = id["id"].get_ref<const std::string &>();
+    std::string key;
+    if (type == "doi")
+      key = normalized_doi(value);
+    else if (type == "isbn")
+      key = normalized_isbn(value);
+    if (!key.empty())
+      keys.push_back(type + ":" + key);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  return keys;
+}
+
+Entry make_entry(const nlohmann::json &record) {
+  Entry e;
+  Citation c = decode_citation(record);
+  e.id = std::string(c.get(Field::id));
+  e.summary = record_summary(c);
+  e.keys = record_keys(record);
+
+  bool leading = true;
+  for_each_folded_word(c.get(Field::title), [&](const std::string &w) {
+    // "The Structure of..." and "Structure of..." are the same title
+    if (leading && (w == "the" || w == "a" || w == "an"))
+      return;
+    leading = false;
+    if (!e.title.empty())
+      e.title += ' ';
+    e.title += w;
+    e.words.push_back(w);
+  });
+  std::sort(e.words.begin(), e.words.end());
+  e.words.erase(std::unique(e.words.begin(), e.words.end()), e.words.end());
+
+  std::string name;
+  if (c.author_count > 0)
+    name = folded(c.text(c.author(0).last));
+  else if (c.editor_count > 0)
+    name = folded(c.text(c.editor(0).last));
+  std::string year = folded(c.get(Field::year));
+  if (!e.title.empty() && (!name.empty() || !year.empty()))
+    e.block = name + '|' + year;
+  return e;
+}
+
+bool similar_titles(const Entry &a, const Entry &b) {
+  if (a.title == b.title)
+    return true;
+  size_t common = 0;
+  auto i = a.words.begin(), j = b.words.begin();
+  while (i != a.words.end() && j != b.words.end()) {
+    int cmp = i->compare(*j);
+    if (cmp == 0) {
+      ++common;
+      ++i;
+      ++j;
+    } else if (cmp < 0) {
+      ++i;
+    } else {
+      ++j;
+    }
+  }
+  size_t total = a.words.size() + b.words.size() - common;
+  return total > 0 &&
+         static_cast<double>(common) >= title_similarity * static_cast<double>(total);
+}
+
+// Two groups that both carry DOIs (or ISBNs) but share none are different
+// works, however alike their titles are. `a` and `b` are sorted.
+bool identifiers_conflict(const std::vector<std::string> &a,
+                          const std::vector<std::string> &b) {
+  for (std::string_view type : {"doi:", "isbn:"}) {
+    bool a_has = false, b_has = false, shared = false;
+    for (const auto &k : a)
+      if (k.compare(0, type.size(), type) == 0)
+        a_has = true;
+    for (const auto &k : b) {
+      if (k.compare(0, type.size(), type) != 0)
+        continue;
+      b_has = true;
+      if (std::binary_search(a.begin(), a.end(), k))
+        shared = true;
+    }
+    if (a_has && b_has && !shared)
+      return true;
+  }
+  return false;
+}
+
+// Union-find over record indexes, joined by size. Each root holds the
+// earliest record of its group, which is the one kept, and the identifiers
+// of the whole group so title matches can be checked against all of them.
+class Groups {
+public:
+  explicit Groups(const std::vector<Entry> &entries)
+      : parent_(entries.size()), size_(entries.size(), 1),
+        keep_(entries.size()), keys_(entries.size()) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+      parent_[i] = keep_[i] = static_cast<std::uint32_t>(i);
+      keys_[i] = entries[i].keys;
+    }
+  }
+  std::uint32_t find(std::uint32_t i) {
+    while (parent_[i] != i) {
+      parent_[i] = parent_[parent_[i]];
+      i = parent_[i];
+    }
+    return i;
+  }
+  // Earliest record in the group of `i`
+  std::uint32_t keeper(std::uint32_t i) { return keep_[find(i)]; }
+
+  void unite(std::uint32_t a, std::uint32_t b) {
+    a = find(a);
+    b = find(b);
+    if (a == b)
+      return;
+    if (size_[a] < size_[b])
+      std::swap(a, b);
+    parent_[b] = a;
+    size_[a] += size_[b];
+    keep_[a] = std::min(keep_[a], keep_[b]);
+    if (!keys_[b].empty()) {
+      std::vector<std::string> merged;
+      std::set_union(std::make_move_iterator(keys_[a].begin()),
+                     std::make_move_iterator(keys_[a].end()),
+                     std::make_move_iterator(keys_[b].begin()),
+                     std::make_move_iterator(keys_[b].end()),
+                     std::back_inserter(merged));
+      keys_[a] = std::move(merged);
+      std::vector<std::string>().swap(keys_[b]);
+    }
+  }
+  // Joins the groups of `a` and `b` unless their identifiers conflict
+  void unite_if_compatible(std::uint32_t a, std::uint32_t b) {
+    a = find(a);
+    b = find(b);
+    if (a != b && !identifiers_conflict(keys_[a], keys_[b]))
+      unite(a, b);
+  }
+
+private:
+  std::vector<std::uint32_t> parent_;
+  std::vector<std::uint32_t> size_;
+  std::vector<std::uint32_t> keep_;
+  std::vector<std::vector<std::string>> keys_; // per root
+};
+
+void match_identifiers(const std::vector<Entry> &entries, Groups &groups) {
+  std::unordered_map<std::string, std::uint32_t> owner;
+  owner.reserve(entries.size() * 2);
+  for (std::uint32_t i = 0; i < entries.size(); ++i)
+    for (const auto &key : entries[i].keys) {
+      auto it = owner.emplace(key, i).first;
+      groups.unite(it->second, i);
+    }
+}
+
+void match_titles(const std::vector<Entry> &entries, Groups &groups) {
+  std::unordered_map<std::string_view, std::vector<std::uint32_t>> blocks;
+  for (std::uint32_t i = 0; i < entries.size(); ++i)
+    if (!entries[i].block.empty())
+      blocks[entries[i].block].push_back(i);
+
+  for (const auto &b : blocks) {
+    const std::vector<std::uint32_t> &members = b.second;
+    if (members.size() > fuzzy_block_limit) {
+      std::unordered_map<std::string_view, std::uint32_t> first;
+      for (std::uint32_t i : members) {
+        auto it = first.emplace(entries[i].title, i).first;
+        if (it->second != i)
+          groups.unite_if_compatible(it->second, i);
+      }
+      continue;
+    }
+    for (size_t x = 0; x < members.size(); ++x)
+      for (size_t y = x + 1; y < members.size(); ++y) {
+        if (groups.find(members[x]) != groups.find(members[y]) &&
+            similar_titles(entries[members[x]], entries[members[y]]))
+          groups.unite_if_compatible(members[x], members[y]);
+      }
+  }
+}
+
+// Why `member` is in its group: an identifier it shares with another
+// member (`shared` counts each identifier's holders), or else its title
+const char *match_reason(const Entry &member,
+                         const std::unordered_map<std::string_view, size_t> &shared) {
+  const char *reason = "similar title, author and year";
+  for (const auto &k : member.keys)
+    if (shared.at(k) > 1) {
+      if (k.compare(0, 4, "doi:") == 0)
+        return "same DOI";
+      reason = "same ISBN";
+    }
+  return reason;
+}
+
+// Gives `keep` the members and identifiers only `dup` has
+void merge_record(nlohmann::json &keep, const nlohmann::json &dup) {
+  for (auto it = dup.begin(); it != dup.end(); ++it) {
+    if (it.key() == "id" || it.key() == "identifier")
+      continue;
+    auto k = keep.find(it.key());
+    if (k == keep.end() || k->is_null() || (k->is_string() && k->empty()))
+      keep[it.key()] = it.value();
+  }
+
+  auto ids = dup.find("identifier");
+  if (ids == dup.end() || !ids->is_array())
+    return;
+  if (!keep.contains("identifier") || !keep["identifier"].is_array())
+    keep["identifier"] = nlohmann::json::array();
+  nlohmann::json &out = keep["identifier"];
+  std::vector<std::string> have = record_keys(keep);
+  for (const auto &id : *ids) {
+    nlohmann::json one = {{"identifier", nlohmann::json::array({id})}};
+    std::vector<std::string> key = record_keys(one);
+    if (key.empty()) {
+      if (std::find(out.begin(), out.end(), id) == out.end())
+        out.push_back(id);
+    } else if (!std::binary_search(have.begin(), have.end(), key[0])) {
+      out.push_back(id);
+      have.insert(std::lower_bound(have.begin(), have.end(), key[0]), key[0]);
+    }
+  }
+}
+
+// One file of the library and where its records start in the combined
+// record list
+struct Shard {
+  std::string path;
+  nlohmann::json root;
+  nlohmann::json *records = nullptr;
+  size_t first = 0;
+  std::string error;
+};
+
+// Reads a shard (compacting its journal first when merging, replaying it
+// otherwise). False with the reason in shard.error.
+bool load_shard(Shard &shard, bool merge) {
+  if (merge && !compact_journal(shard.path, &shard.error))
+    return false;
+  try {
+    shard.root = load_json_file(shard.path);
+  } catch (const std::exception &e) {
+    shard.error = "cannot parse " + shard.path + ": " + e.what();
+    return false;
+  }
+  bool has_records = shard.root.is_object() &&
+                     shard.root.contains("records") &&
+                     shard.root["records"].is_array();
+  if (!has_records && !shard.root.is_array()) {
+    shard.error = shard.path + " is not a BibJSON library";
+    return false;
+  }
+  nlohmann::json &records =
+      shard.root.is_array() ? shard.root : shard.root["records"];
+  shard.records = &records;
+  if (!merge) {
+    std::unordered_set<std::string> ids;
+    bool have_ids = false;
+    auto in_library = [&](const std::string &id) {
+      if (!have_ids) {
+        for (const auto &r : records)
+          if (r.contains("id") && r["id"].is_string())
+            ids.insert(r["id"].get<std::string>());
+        have_ids = true;
+      }
+      return ids.count(id) > 0;
+    };
+    for_each_journal_record(shard.path, records.size(), in_library,
+                            [&](nlohmann::json &&r) {
+                              records.push_back(std::move(r));
+                              return true;
+                            });
+  }
+  return true;
+}
+
+} // namespace
+
+int cite_dedupe(const std::string &filename, const DedupeOptions &options) {
+  std::error_code ec;
+  if (!is_sharded_library(filename) && !std::filesystem::exists(filename, ec)) {
+    std::cerr << "Error: " << filename << " not found\n";
+    return 2;
+  }
+  std::string error;
+  std::vector<std::string> paths = library_shards(filename, error);
+  if (paths.empty()) {
+    std::cerr << "Error: " << error << "\n";
+    return 2;
+  }
+
+  // Shards are parsed in parallel and their records matched as one list,
+  // so duplicates are found across shards too
+  std::vector<Shard> shards(paths.size());
+  parallel_for_each_index(shards.size(), 0, [&](size_t i) {
+    shards[i].path = paths[i];
+    load_shard(shards[i], options.merge);
+  });
+  size_t total = 0;
+  for (Shard &shard : shards) {
+    if (!shard.error.empty()) {
+      std::cerr << "Error: " << shard.error << "\n";
+      return 2;
+    }
+    shard.first = total;
+    total += shard.records->size();
+  }
+
+  std::vector<Entry> entries(total);
+  parallel_for_each_index(shards.size(), 0, [&](size_t i) {
+    const Shard &shard = shards[i];
+    for (size_t k = 0; k < shard.records->size(); ++k) {
+      const nlohmann::json &record = (*shard.records)[k];
+      if (record.is_object())
+        entries[shard.first + k] = make_entry(record);
+    }
+  });
+  // Shard holding record `i` of the combined list
+  auto shard_of = [&](size_t i) {
+    auto it = std::upper_bound(
+        shards.begin(), shards.end(), i,
+        [](size_t k, const Shard &shard) { return k < shard.first; });
+    return static_cast<size_t>(it - shards.begin()) - 1;
+  };
+  auto record_at = [&](size_t i) -> nlohmann::json & {
+    const Shard &shard = shards[shard_of(i)];
+    return (*shard.records)[i - shard.first];
+  };
+
+  Groups groups(entries);
+  match_identifiers(entries, groups);
+  if (options.fuzzy)
+    match_titles(entries, groups);
+
+  // Groups in library order, each led by its kept record
+  std::unordered_map<std::uint32_t, size_t> group_of;
+  std::vector<std::vector<std::uint32_t>> found;
+  for (std::uint32_t i = 0; i < entries.size(); ++i) {
+    std::uint32_t keep = groups.keeper(i);
+    if (keep == i)
+      continue;
+    auto it = group_of.emplace(keep, found.size()).first;
+    if (it->second == found.size())
+      found.push_back({keep});
+    found[it->second].push_back(i);
+  }
+
+  std::sort(found.begin(), found.end());
+
+  if (found.empty()) {
+    std::cout << "No duplicates among " << entries.size() << " entries\n";
+    return 0;
+  }
+
+  size_t duplicates = 0;
+  std::unordered_map<std::string_view, size_t> shared;
+  for (const auto &group : found) {
+    shared.clear();
+    for (std::uint32_t i : group)
+      for (const auto &k : entries[i].keys)
+        ++shared[k];
+    const Entry &keep = entries[group[0]];
+    std::cout << (keep.id.empty() ? "(no id)" : keep.id) << "  " << keep.summary
+              << "\n";
+    for (size_t k = 1; k < group.size(); ++k) {
+      const Entry &dup = entries[group[k]];
+      std::cout << "  " << (dup.id.empty() ? "(no id)" : dup.id) << "  "
+                << dup.summary << "  (" << match_reason(dup, shared)
+                << ")\n";
+    }
+    duplicates += group.size() - 1;
+  }
+  std::cout << "\n" << duplicates << (duplicates == 1 ? " duplicate" : " duplicates")
+            << " of " << found.size() << (found.size() == 1 ? " entry" : " entries")
+            << " among " << entries.size() << "\n";
+
+  if (!options.merge) {
+    std::cout << "Run 'cite dedupe " << filename
+              << " --merge' to keep the first of each and remove the rest\n";
+    return 0;
+  }
+
+  std::vector<bool> dropped(entries.size(), false);
+  for (const auto &group : found)
+    for (size_t k = 1; k < group.size(); ++k) {
+      merge_record(record_at(group[0]), record_at(group[k]));
+      dropped[group[k]] = true;
+    }
+
+  // Only shards that lost or gained something are rewritten
+  std::vector<bool> changed(shards.size(), false);
+  for (const auto &group : found)
+    for (std::uint32_t i : group)
+      changed[shard_of(i)] = true;
+  for (size_t s = 0; s < shards.size(); ++s) {
+    if (!changed[s])
+      continue;
+    Shard &shard = shards[s];
+    nlohmann::json &records = *shard.records;
+    nlohmann::json kept = nlohmann::json::array();
+    for (size_t k = 0; k < records.size(); ++k)
+      if (!dropped[shard.first + k])
+        kept.push_back(std::move(records[k]));
+    size_t removed = records.size() - kept.size();
+    records = std::move(kept);
+    if (shard.root.is_object()) {
+      if (!shard.root.contains("metadata"))
+        shard.root["metadata"] = nlohmann::json::object();
+      shard.root["metadata"]["records"] = records.size();
+    }
+    if (!write_json_file_atomic(shard.path, shard.root, &error)) {
+      std::cerr << "Error: " << error << "\n";
+      return 2;
+    }
+    if (shards.size() > 1 && removed > 0)
+      std::cout << "Removed " << removed << " from " << shard.path << "\n";
+  }
+  std::cout << "Removed " << duplicates << " from " << filename << "\n";
+  return 0;
+}
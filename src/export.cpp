@@ -1,185 +1,423 @@
 #include "export.hpp"
 #include "../include/citation.hpp"
-#include "../parsers/json_parser.hpp"
-#include <fstream>
+#include "../include/csl.hpp"
+#include "../include/file_watch.hpp"
+#include "../include/library.hpp"
+#include "../include/metadata_cache.hpp"
+#include "../include/render.hpp"
+#include "../include/render_cache.hpp"
+#include "../include/run_stats.hpp"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <functional>
 #include <iostream>
-#include <nlohmann/json.hpp>
+#include <mutex>
 #include <string>
 
-static std::string html_to_md(const std::string &in) {
-  std::string out = in;
-  size_t pos = 0;
-  while ((pos = out.find("<i>", pos)) != std::string::npos) {
-    out.replace(pos, 3, "*");
-  }
-  pos = 0;
-  while ((pos = out.find("</i>", pos)) != std::string::npos) {
-    out.replace(pos, 4, "*");
-  }
-  return out;
-}
+static const struct ChicagoSection {
+  ChicagoVariant variant;
+  std::string_view ChicagoCitationBundle::*text;
+  const char *heading;
+} chicago_sections[] = {
+    {ChicagoVariant::bibliography, &ChicagoCitationBundle::bibliography,
+     "Bibliography"},
+    {ChicagoVariant::long_footnote, &ChicagoCitationBundle::long_footnote,
+     "Footnotes (First Reference)"},
+    {ChicagoVariant::short_footnote, &ChicagoCitationBundle::short_footnote,
+     "Footnotes (Subsequent References)"},
+};
 
-static std::string html_escape(const std::string &in) {
-  std::string out;
-  for (char c : in) {
-    switch (c) {
-      case '&': out += "&amp;"; break;
-      case '<': out += "&lt;"; break;
-      case '>': out += "&gt;"; break;
-      case '"': out += "&quot;"; break;
-      case '\'': out += "&#39;"; break;
-      default: out += c;
+static const char pg_note[] =
+    "Replace `[pg]` with actual page numbers when citing.";
+
+// Writes one section: `format_all(emit)` runs one of the for_each_*
+// citation functions in `markup`. A single renderer gets that markup
+// straight from the formatter; with several, each entry is formatted once
+// in neutral markup and converted for every renderer.
+template <typename FormatAll>
+static void render_section(const std::vector<Renderer *> &renderers,
+                           std::vector<OutputBuffer> &converted, Markup markup,
+                           std::string_view heading,
+                           const FormatAll &format_all) {
+  for (Renderer *renderer : renderers)
+    renderer->begin_section(heading);
+  format_all([&](size_t k, std::string_view text) {
+    if (markup != Markup::neutral) {
+      renderers[0]->item(k + 1, text);
+      return;
+    }
+    for (size_t r = 0; r < renderers.size(); ++r) {
+      converted[r].clear();
+      converted[r].from_neutral(text);
+      renderers[r]->item(k + 1, converted[r].view());
     }
+  });
+  for (Renderer *renderer : renderers)
+    renderer->end_section();
+}
+
+static Markup shared_markup(const std::vector<Renderer *> &renderers,
+                            std::vector<OutputBuffer> &converted) {
+  for (Renderer *renderer : renderers)
+    converted.emplace_back(renderer->markup());
+  return renderers.size() == 1 ? renderers[0]->markup() : Markup::neutral;
+}
+
+// Streams the whole Chicago document through `renderers`: every section is
+// formatted and written as it is produced
+static void render_chicago(const std::vector<Renderer *> &renderers,
+                           const Library &library,
+                           const std::vector<size_t> &order,
+                           const std::string &filename, unsigned jobs) {
+  std::vector<OutputBuffer> converted;
+  Markup markup = shared_markup(renderers, converted);
+
+  for (Renderer *renderer : renderers)
+    renderer->begin_document("Chicago Style", filename);
+  for (const auto &section : chicago_sections) {
+    render_section(renderers, converted, markup, section.heading,
+                   [&](const auto &emit) {
+                     for_each_chicago_citation(library.entries, order,
+                                               section.variant, markup, jobs,
+                                               emit);
+                   });
   }
-  return out;
+  for (Renderer *renderer : renderers)
+    renderer->end_document(pg_note);
 }
 
-int cite_export(const std::string &filename, const std::string &style,
-                const std::string &output_file) {
-  // Parse input file
-  nlohmann::json root = parse_json(filename);
-  nlohmann::json entries;
-  
-  if (root.contains("records") && root["records"].is_array()) {
-    entries = root["records"];
-  } else if (root.is_array()) {
-    entries = root;
-  } else {
-    std::cerr << "Error: Could not find any BibJSON records in " << filename << "\n";
-    std::cerr << "Expected 'records' array or top-level array.\n";
-    return 2;
+// A style other than Chicago: its bibliography is the only section
+struct SingleSectionStyle {
+  const CitationFormatter *formatter = nullptr;
+  std::string title;
+  const char *heading = "Bibliography";
+  // Order of the entries; Chicago's when empty
+  std::function<std::vector<size_t>(const std::vector<Citation> &)> sort_order;
+};
+
+// Same for a single-section style
+static void render_single(const std::vector<Renderer *> &renderers,
+                          const SingleSectionStyle &style,
+                          const Library &library,
+                          const std::vector<size_t> &order,
+                          const std::string &filename, unsigned jobs) {
+  std::vector<OutputBuffer> converted;
+  Markup markup = shared_markup(renderers, converted);
+
+  for (Renderer *renderer : renderers)
+    renderer->begin_document(style.title, filename);
+  render_section(renderers, converted, markup, style.heading,
+                 [&](const auto &emit) {
+                   for_each_citation(library.entries, order, *style.formatter,
+                                     markup, jobs, emit);
+                 });
+  for (Renderer *renderer : renderers)
+    renderer->end_document("");
+}
+
+// --incremental: takes renderings of unchanged records from the sidecar
+// cache, formats only new or changed ones, writes the document in sorted
+// order from the merged set and stores it as the next run's cache.
+// Returns the number of records that had to be formatted.
+static size_t render_chicago_incremental(Renderer &renderer,
+                                         const Library &library,
+                                         const std::vector<size_t> &order,
+                                         const std::string &filename,
+                                         const std::string &cache_path,
+                                         unsigned jobs, bool &cache_saved) {
+  const std::vector<Citation> &entries = library.entries;
+  RenderCache cache;
+  cache.load(cache_path, renderer.markup());
+
+  std::vector<std::uint64_t> hashes(entries.size());
+  std::vector<ChicagoCitationBundle> bundles(entries.size());
+  std::vector<size_t> dirty;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    hashes[i] = citation_hash(entries[i]);
+    if (const auto *cached = cache.find(entries[i].get(Field::id), hashes[i]))
+      bundles[i] = *cached;
+    else
+      dirty.push_back(i);
   }
 
-  if (entries.empty()) {
-    std::cerr << "Warning: No entries found in " << filename << "\n";
-    return 2;
+  TextArena arena;
+  auto fresh =
+      format_chicago_bundles(entries, dirty, renderer.markup(), arena, jobs);
+  for (size_t k = 0; k < dirty.size(); ++k)
+    bundles[dirty[k]] = fresh[k];
+
+  renderer.begin_document("Chicago Style", filename);
+  for (const auto &section : chicago_sections) {
+    renderer.begin_section(section.heading);
+    for (size_t k = 0; k < order.size(); ++k)
+      renderer.item(k + 1, bundles[order[k]].*section.text);
+    renderer.end_section();
   }
+  renderer.end_document(pg_note);
 
-  std::cout << "Loaded " << entries.size() << " entries from " << filename << "\n";
-
-  // Prepare output stream
-  std::ostream *out = &std::cout;
-  std::ofstream outfile;
-  bool to_html = false, to_md = false;
-  
-  if (!output_file.empty()) {
-    if (output_file.size() > 5 &&
-        output_file.substr(output_file.size() - 5) == ".html") {
-      to_html = true;
-      outfile.open(output_file);
-      if (!outfile) {
-        std::cerr << "Error: Cannot open " << output_file << " for writing\n";
+  cache_saved = RenderCache::save(cache_path, renderer.markup(), entries,
+                                  hashes, bundles);
+  return dirty.size();
+}
+
+// Status lines go to stderr when stdout carries the --stats-json report
+static std::ostream &status_out(const ExportOptions &options) {
+  return options.stats_json == "-" ? std::cerr : std::cout;
+}
+
+// Renders `library` into every output (an empty name is stdout) and
+// reports what was written. Returns 0, or 3 if any output failed.
+static int write_outputs(const Library &library, const std::string &filename,
+                         const std::vector<std::string> &outputs,
+                         const std::vector<OutputFormat> &formats,
+                         const SingleSectionStyle *single,
+                         const ExportOptions &options,
+                         RunStats &stats) {
+  const std::vector<Citation> &entries = library.entries;
+  std::vector<size_t> order;
+  {
+    auto phase = stats.phase("sort");
+    order = single && single->sort_order ? single->sort_order(entries)
+                                         : library_sort_order(library);
+  }
+
+  // Prepare output sinks
+  std::vector<std::FILE *> files;
+  for (const auto &output : outputs) {
+    std::FILE *file = stdout;
+    if (!output.empty()) {
+      file = std::fopen(output.c_str(), "wb");
+      if (!file) {
+        std::cerr << "Error: Cannot open " << output << " for writing\n";
+        for (std::FILE *open : files)
+          if (open != stdout)
+            std::fclose(open);
         return 3;
       }
-      out = &outfile;
-    } else if (output_file.size() > 3 &&
-               output_file.substr(output_file.size() - 3) == ".md") {
-      to_md = true;
-      outfile.open(output_file);
-      if (!outfile) {
-        std::cerr << "Error: Cannot open " << output_file << " for writing\n";
-        return 3;
+    }
+    files.push_back(file);
+  }
+
+  std::vector<bool> ok(outputs.size(), true);
+  size_t rendered = 0;
+  {
+    std::vector<std::unique_ptr<OutputSink>> sinks;
+    std::vector<std::unique_ptr<Renderer>> owned;
+    std::vector<Renderer *> renderers;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+      sinks.push_back(std::make_unique<OutputSink>(files[i]));
+      owned.push_back(create_renderer(formats[i], *sinks.back()));
+      renderers.push_back(owned.back().get());
+    }
+    {
+      // Output is written as it is formatted; the time spent in writes is
+      // taken out of this phase below
+      auto phase = stats.phase("format");
+      if (options.incremental) {
+        std::string cache_path = RenderCache::path_for(filename, outputs[0]);
+        bool cache_saved = false;
+        rendered = render_chicago_incremental(*renderers[0], library, order,
+                                              filename, cache_path,
+                                              options.jobs, cache_saved);
+        if (!cache_saved)
+          std::cerr << "Warning: Could not update " << cache_path << "\n";
+      } else if (single) {
+        render_single(renderers, *single, library, order, filename,
+                      options.jobs);
+      } else {
+        render_chicago(renderers, library, order, filename, options.jobs);
       }
-      out = &outfile;
-    } else {
+      for (size_t i = 0; i < sinks.size(); ++i)
+        ok[i] = sinks[i]->flush();
+    }
+    double write_wall = 0, write_cpu = 0;
+    for (const auto &sink : sinks) {
+      write_wall += sink->write_seconds();
+      write_cpu += sink->write_cpu_seconds();
+      stats.add_bytes_written(sink->bytes_written());
+    }
+    stats.split_phase("format", "write", write_wall, write_cpu);
+  }
+
+  std::ostream &status = status_out(options);
+  if (options.incremental)
+    status << "Re-rendered " << rendered << " of " << entries.size()
+              << " entries\n";
+
+  int rc = 0;
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    if (files[i] != stdout) {
+      if (std::fclose(files[i]) != 0)
+        ok[i] = false;
+      if (ok[i])
+        status << "Output written to: " << outputs[i] << "\n";
+    }
+    if (!ok[i]) {
+      std::cerr << "Error: Failed writing "
+                << (outputs[i].empty() ? "output" : outputs[i]) << "\n";
+      rc = 3;
+    }
+  }
+  status.flush();
+  return rc;
+}
+
+static volatile std::sig_atomic_t stop_watching = 0;
+
+static void request_stop(int) { stop_watching = 1; }
+
+int cite_export(const std::string &filename, const std::string &style,
+                const std::vector<std::string> &output_files,
+                const ExportOptions &options) {
+  // No output file means the terminal
+  std::vector<std::string> outputs = output_files;
+  if (outputs.empty())
+    outputs.emplace_back();
+  std::vector<OutputFormat> formats(outputs.size());
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    if (!output_format_for(outputs[i], formats[i])) {
       std::cerr << "Error: Output file must end in .html or .md\n";
       return 3;
     }
   }
 
-  // Generate citations
-  if (style == "chicago") {
-    auto bundles = format_chicago_with_footnotes(entries);
-    
-    if (to_html) {
-      // HTML output with styling
-      *out << "<!DOCTYPE html>\n";
-      *out << "<html lang=\"en\">\n";
-      *out << "<head>\n";
-      *out << "  <meta charset=\"UTF-8\">\n";
-      *out << "  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n";
-      *out << "  <title>Chicago Style Bibliography</title>\n";
-      *out << "  <style>\n";
-      *out << "    body { font-family: 'Times New Roman', Times, serif; max-width: 800px; margin: 40px auto; padding: 0 20px; line-height: 1.6; }\n";
-      *out << "    h1 { font-size: 24px; font-weight: bold; margin-top: 40px; margin-bottom: 20px; border-bottom: 2px solid #333; padding-bottom: 10px; }\n";
-      *out << "    h2 { font-size: 20px; font-weight: bold; margin-top: 30px; margin-bottom: 15px; }\n";
-      *out << "    ol { padding-left: 0; }\n";
-      *out << "    li { margin-bottom: 12px; margin-left: 2em; text-indent: -2em; }\n";
-      *out << "    i { font-style: italic; }\n";
-      *out << "    .note { color: #666; font-size: 0.9em; margin-top: 30px; padding: 10px; background: #f5f5f5; border-left: 3px solid #ccc; }\n";
-      *out << "  </style>\n";
-      *out << "</head>\n";
-      *out << "<body>\n";
-      *out << "  <h1>Chicago Style Citations</h1>\n";
-      
-      *out << "  <h2>Bibliography</h2>\n";
-      *out << "  <ol>\n";
-      for (const auto &c : bundles) {
-        *out << "    <li>" << c.bibliography << "</li>\n";
-      }
-      *out << "  </ol>\n";
-      
-      *out << "  <h2>Footnotes (First Reference)</h2>\n";
-      *out << "  <ol>\n";
-      for (const auto &c : bundles) {
-        *out << "    <li>" << c.long_footnote << "</li>\n";
-      }
-      *out << "  </ol>\n";
-      
-      *out << "  <h2>Footnotes (Subsequent References)</h2>\n";
-      *out << "  <ol>\n";
-      for (const auto &c : bundles) {
-        *out << "    <li>" << c.short_footnote << "</li>\n";
-      }
-      *out << "  </ol>\n";
-      
-      *out << "  <div class=\"note\">\n";
-      *out << "    <strong>Note:</strong> Replace <code>[pg]</code> with actual page numbers when citing.\n";
-      *out << "  </div>\n";
-      *out << "</body>\n";
-      *out << "</html>\n";
-      
+  if (options.stats_json == "-" &&
+      std::find(outputs.begin(), outputs.end(), "") != outputs.end()) {
+    std::cerr << "Error: --stats-json - needs the bibliography written to a "
+                 "file; stdout already carries it\n";
+    return 1;
+  }
+
+  if (options.incremental && (!options.csl.empty() || style != "chicago")) {
+    std::cerr << "Error: --incremental only works with chicago\n";
+    return 1;
+  }
+
+  std::unique_ptr<CslFormatter> csl;
+  std::unique_ptr<CitationFormatter> formatter;
+  SingleSectionStyle single;
+  if (!options.csl.empty()) {
+    std::string cache_dir;
+    if (options.use_cache)
+      cache_dir = MetadataCacheOptions::from_env().dir;
+    csl = load_csl_style(options.csl, cache_dir);
+    if (!csl)
+      return 2;
+    single.formatter = csl.get();
+    single.title = csl->title();
+    const CslFormatter *style_sort = csl.get();
+    single.sort_order = [style_sort](const std::vector<Citation> &entries) {
+      return style_sort->sort_order(entries);
+    };
+  } else if (style == "mla" || style == "apa") {
+    formatter = create_formatter(style);
+    single.formatter = formatter.get();
+    if (style == "mla") {
+      // Author, then title: the same order as Chicago's
+      single.title = "MLA Style";
+      single.heading = "Works Cited";
     } else {
-      // Markdown output (to file or terminal)
-      if (to_md) {
-        *out << "# Chicago Style Citations\n\n";
-        *out << "Generated from: " << filename << "\n\n";
-      } else {
-        *out << "\n=== Chicago Style Citations ===\n\n";
-      }
-      
-      *out << "## Bibliography\n\n";
-      int i = 1;
-      for (const auto &c : bundles) {
-        *out << i++ << ". " << html_to_md(c.bibliography) << "\n\n";
-      }
-      
-      *out << "## Footnotes (First Reference)\n\n";
-      i = 1;
-      for (const auto &c : bundles) {
-        *out << i++ << ". " << html_to_md(c.long_footnote) << "\n\n";
-      }
-      
-      *out << "## Footnotes (Subsequent References)\n\n";
-      i = 1;
-      for (const auto &c : bundles) {
-        *out << i++ << ". " << html_to_md(c.short_footnote) << "\n\n";
-      }
-      
-      *out << "---\n\n";
-      *out << "*Note: Replace `[pg]` with actual page numbers when citing.*\n";
+      single.title = "APA Style";
+      single.heading = "References";
+      single.sort_order = [](const std::vector<Citation> &entries) {
+        std::vector<std::string> keys;
+        keys.reserve(entries.size());
+        for (const Citation &entry : entries)
+          keys.push_back(apa_sort_key(entry));
+        return sort_order_by_keys(keys);
+      };
     }
-    
-  } else {
+  } else if (style != "chicago") {
     std::cerr << "Error: Style '" << style << "' is not yet implemented.\n";
-    std::cerr << "Currently supported: chicago\n";
+    std::cerr << "Currently supported: chicago, mla, apa\n";
     return 4;
   }
-  
-  if (outfile) {
-    outfile.close();
-    std::cout << "Output written to: " << output_file << "\n";
+  const SingleSectionStyle *single_style = single.formatter ? &single : nullptr;
+
+  if (options.incremental && outputs.size() > 1) {
+    std::cerr << "Error: --incremental writes one output at a time\n";
+    return 1;
+  }
+
+  LibraryLoadOptions load_options;
+  load_options.map_file = options.map_input;
+  load_options.use_cache = options.use_cache;
+  int load_rc = 0;
+  std::chrono::steady_clock::time_point load_started;
+  auto load = [&]() -> std::shared_ptr<const Library> {
+    load_started = std::chrono::steady_clock::now();
+    auto library = std::make_shared<Library>();
+    load_rc = load_library(filename, *library, load_options);
+    if (load_rc)
+      return nullptr;
+    return library;
+  };
+
+  RunStats stats("export", options.stats || !options.stats_json.empty());
+  if (!options.watch) {
+    std::shared_ptr<const Library> library;
+    {
+      auto phase = stats.phase("load");
+      library = load();
+    }
+    if (!library)
+      return load_rc;
+    if (library->entries.empty()) {
+      std::cerr << "Warning: No entries found in " << filename << "\n";
+      return 2;
+    }
+    status_out(options) << "Loaded " << library->entries.size()
+                        << " entries from " << filename << "\n";
+    stats.set_records(library->entries.size());
+    int rc = write_outputs(*library, filename, outputs, formats, single_style,
+                           options, stats);
+    if (!stats.report(options.stats, options.stats_json) && rc == 0)
+      rc = 3;
+    return rc;
   }
-  
+  if (stats.enabled()) {
+    std::cerr << "Error: --stats reports on a single export; it cannot be "
+                 "combined with --watch\n";
+    return 1;
+  }
+
+  // --watch: the first version is written here, later ones by the watch
+  // thread as soon as the reload is published. The mutex keeps the two
+  // from writing the outputs at the same time.
+  std::mutex writing;
+  LiveSnapshot<Library> live;
+  auto publish = [&](const std::shared_ptr<const Library> &library) {
+    std::lock_guard<std::mutex> lock(writing);
+    write_outputs(*library, filename, outputs, formats, single_style, options,
+                  stats);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - load_started);
+    std::cout << "Updated from " << library->entries.size() << " entries in "
+              << ms.count() << " ms\n";
+    std::cout.flush();
+  };
+  if (!live.start(library_watch_paths(filename), load, publish))
+    return load_rc;
+  int rc;
+  {
+    std::lock_guard<std::mutex> lock(writing);
+    std::shared_ptr<const Library> library = live.get();
+    std::cout << "Loaded " << library->entries.size() << " entries from "
+              << filename << "\n";
+    rc = write_outputs(*library, filename, outputs, formats, single_style,
+                       options, stats);
+  }
+  if (rc != 0)
+    return rc;
+
+  std::signal(SIGINT, request_stop);
+  std::signal(SIGTERM, request_stop);
+  std::cout << "Watching " << filename << " for changes (Ctrl-C to stop)\n";
+  std::cout.flush();
+  while (!stop_watching)
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  live.stop();
   return 0;
 }
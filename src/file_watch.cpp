@@ -0,0 +1,115 @@
+#include "file_watch.hpp"
+#include "hash.hpp"
+#include <chrono>
+#include <filesystem>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// A save often arrives as several events (truncate, write, close, or
+// write to a temp file then rename); they are collected for this long
+// before reporting one change
+static const int settle_ms = 10;
+
+FileWatcher::FileWatcher(const std::vector<std::string> &paths,
+                         unsigned poll_ms)
+    : paths_(paths), poll_ms_(poll_ms) {
+#ifdef __linux__
+  inotify_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  for (const auto &path : paths_) {
+    if (inotify_ < 0)
+      break;
+    std::filesystem::path p(path);
+    std::string dir = p.has_parent_path() ? p.parent_path().string() : ".";
+    // Watching the directory also catches the file being replaced by a
+    // rename, which a watch on the file itself would lose
+    int wd = ::inotify_add_watch(inotify_, dir.c_str(),
+                                 IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                                     IN_DELETE);
+    if (wd < 0) {
+      ::close(inotify_);
+      inotify_ = -1;
+      watched_.clear();
+      break;
+    }
+    watched_.emplace_back(wd, p.filename().string());
+  }
+#endif
+  if (inotify_ < 0)
+    stamps_ = stamps();
+}
+
+FileWatcher::~FileWatcher() {
+#ifdef __linux__
+  if (inotify_ >= 0)
+    ::close(inotify_);
+#endif
+}
+
+bool FileWatcher::wait(unsigned timeout_ms) {
+  return inotify_ >= 0 ? wait_inotify(timeout_ms) : wait_polling(timeout_ms);
+}
+
+bool FileWatcher::wait_inotify(unsigned timeout_ms) {
+#ifdef __linux__
+  bool changed = false;
+  int timeout = static_cast<int>(timeout_ms);
+  alignas(inotify_event) char buf[4096];
+  for (;;) {
+    pollfd p{inotify_, POLLIN, 0};
+    if (::poll(&p, 1, changed ? settle_ms : timeout) <= 0)
+      return changed;
+    ssize_t n;
+    while ((n = ::read(inotify_, buf, sizeof(buf))) > 0) {
+      for (char *at = buf; at < buf + n;) {
+        auto *event = reinterpret_cast<inotify_event *>(at);
+        at += sizeof(inotify_event) + event->len;
+        if (event->len == 0)
+          continue;
+        std::string_view name(event->name);
+        for (const auto &w : watched_)
+          if (w.first == event->wd && w.second == name)
+            changed = true;
+      }
+    }
+  }
+#else
+  return wait_polling(timeout_ms);
+#endif
+}
+
+std::vector<std::uint64_t> FileWatcher::stamps() const {
+  std::vector<std::uint64_t> out;
+  for (const auto &path : paths_) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    std::uint64_t h = ec ? 0 : static_cast<std::uint64_t>(size);
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    if (!ec)
+      h = hash_combine(h, static_cast<std::uint64_t>(
+                              mtime.time_since_epoch().count()));
+    out.push_back(h);
+  }
+  return out;
+}
+
+bool FileWatcher::wait_polling(unsigned timeout_ms) {
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  for (;;) {
+    std::vector<std::uint64_t> now = stamps();
+    if (now != stamps_) {
+      stamps_ = std::move(now);
+      return true;
+    }
+    auto left = deadline - std::chrono::steady_clock::now();
+    if (left <= std::chrono::milliseconds(0))
+      return false;
+    std::this_thread::sleep_for(
+        std::min<std::chrono::steady_clock::duration>(
+            left, std::chrono::milliseconds(poll_ms_)));
+  }
+}
@@ -0,0 +1,114 @@
+#include "format_memo.hpp"
+#include "../formatters/chicago_formatter.hpp"
+#include "hash.hpp"
+#include <algorithm>
+
+// Rough per-entry cost of the list node, index slot and string header
+static const size_t entry_overhead = 128;
+
+size_t FormatMemo::KeyHash::operator()(const Key &k) const {
+  return static_cast<size_t>(hash_combine(
+      hash_combine(k.record, k.style), static_cast<std::uint64_t>(k.variant)));
+}
+
+FormatMemo::FormatMemo(size_t max_bytes)
+    : shard_max_bytes_(std::max<size_t>(max_bytes / shard_count, 1)) {}
+
+const CitationFormatter *FormatMemo::formatter(const std::string &style) {
+  std::lock_guard<std::mutex> lock(formatters_mutex_);
+  auto it = formatters_.find(style);
+  if (it == formatters_.end()) {
+    // Only known styles are kept, so requests cannot grow the map
+    std::unique_ptr<CitationFormatter> created = create_formatter(style);
+    if (!created)
+      return nullptr;
+    it = formatters_.emplace(style, std::move(created)).first;
+  }
+  return it->second.get();
+}
+
+bool FormatMemo::has_style(const std::string &style) {
+  return formatter(style) != nullptr;
+}
+
+bool FormatMemo::format(const Citation &entry, const std::string &style,
+                        ChicagoVariant variant, OutputBuffer &out) {
+  return format(entry, citation_hash(entry), style, variant, out);
+}
+
+bool FormatMemo::format(const Citation &entry, std::uint64_t hash,
+                        const std::string &style, ChicagoVariant variant,
+                        OutputBuffer &out) {
+  Key key{hash, hash_bytes(style), variant};
+  size_t h = KeyHash()(key);
+  // The low bits pick the bucket inside the shard
+  Shard &shard = shards_[(h >> 32) % shard_count];
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      ++shard.hits;
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+      out.from_neutral(it->second->second);
+      return true;
+    }
+    ++shard.misses;
+  }
+
+  const CitationFormatter *f = formatter(style);
+  if (!f)
+    return false;
+  OutputBuffer neutral(Markup::neutral);
+  if (const auto *chicago = dynamic_cast<const ChicagoFormatter *>(f))
+    chicago->format(entry, variant, neutral);
+  else if (variant == ChicagoVariant::bibliography)
+    f->format(entry, neutral);
+  else
+    return false;
+
+  out.from_neutral(neutral.view());
+  insert(shard, key, neutral.str());
+  return true;
+}
+
+void FormatMemo::insert(Shard &shard, const Key &key, std::string text) {
+  size_t cost = text.size() + entry_overhead;
+  if (cost > shard_max_bytes_)
+    return;
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  // Another thread may have formatted the same entry meanwhile
+  if (shard.index.count(key))
+    return;
+  shard.lru.emplace_front(key, std::move(text));
+  shard.index.emplace(key, shard.lru.begin());
+  shard.bytes += cost;
+  while (shard.bytes > shard_max_bytes_) {
+    auto &last = shard.lru.back();
+    shard.bytes -= last.second.size() + entry_overhead;
+    shard.index.erase(last.first);
+    shard.lru.pop_back();
+    ++shard.evictions;
+  }
+}
+
+FormatMemo::Stats FormatMemo::stats() const {
+  Stats s;
+  for (const Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    s.hits += shard.hits;
+    s.misses += shard.misses;
+    s.evictions += shard.evictions;
+    s.entries += shard.index.size();
+    s.bytes += shard.bytes;
+  }
+  return s;
+}
+
+void FormatMemo::clear() {
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.index.clear();
+    shard.lru.clear();
+    shard.bytes = 0;
+  }
+}
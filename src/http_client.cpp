@@ -0,0 +1,214 @@
+#include "http_client.hpp"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static size_t write_cb(void *contents, size_t size, size_t nmemb, void *userp) {
+  auto *request = static_cast<HttpRequest *>(userp);
+  std::string_view chunk(static_cast<char *>(contents), size * nmemb);
+  if (request->filter)
+    request->filter->feed(chunk); // invalid JSON is reported by end_attempt
+  else
+    request->body.append(chunk.data(), chunk.size());
+  return chunk.size();
+}
+
+HttpClient::HttpClient(HttpOptions options) : options_(options) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  share_ = curl_share_init();
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+  easy_ = curl_easy_init();
+  multi_ = curl_multi_init();
+  curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS,
+                    static_cast<long>(options_.max_host_connections));
+}
+
+HttpClient::~HttpClient() {
+  curl_multi_cleanup(multi_);
+  curl_easy_cleanup(easy_);
+  curl_share_cleanup(share_);
+}
+
+void HttpClient::configure(CURL *curl, HttpRequest &request) const {
+  curl_easy_reset(curl);
+  curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &request);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, &request);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, "Cite/1.0 (mailto:user@example.com)");
+  curl_easy_setopt(curl, CURLOPT_SHARE, share_);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  // Queue behind an existing HTTP/2 connection rather than open another
+  curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, options_.connect_timeout_ms);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, options_.timeout_ms);
+}
+
+void HttpClient::begin_attempt(HttpRequest &request) {
+  request.body.clear();
+  request.status = 0;
+  if (request.filter)
+    request.filter->reset();
+  ++request.attempts;
+}
+
+// Seconds since the start of the transfer at which `info` happened, or 0
+static double transfer_time(CURL *curl, CURLINFO info) {
+#if LIBCURL_VERSION_NUM >= 0x073d00
+  curl_off_t us = 0;
+  if (curl_easy_getinfo(curl, info, &us) != CURLE_OK)
+    return 0;
+  return static_cast<double>(us) / 1e6;
+#else
+  double seconds = 0;
+  if (curl_easy_getinfo(curl, info, &seconds) != CURLE_OK)
+    return 0;
+  return seconds;
+#endif
+}
+
+// Turns curl's cumulative timestamps into the time each step took
+static void add_timing(CURL *curl, HttpTiming &timing) {
+#if LIBCURL_VERSION_NUM >= 0x073d00
+  double lookup = transfer_time(curl, CURLINFO_NAMELOOKUP_TIME_T);
+  double connect = transfer_time(curl, CURLINFO_CONNECT_TIME_T);
+  double handshake = transfer_time(curl, CURLINFO_APPCONNECT_TIME_T);
+  double total = transfer_time(curl, CURLINFO_TOTAL_TIME_T);
+#else
+  double lookup = transfer_time(curl, CURLINFO_NAMELOOKUP_TIME);
+  double connect = transfer_time(curl, CURLINFO_CONNECT_TIME);
+  double handshake = transfer_time(curl, CURLINFO_APPCONNECT_TIME);
+  double total = transfer_time(curl, CURLINFO_TOTAL_TIME);
+#endif
+  // Steps that did not happen (plain HTTP, reused connections) report 0
+  connect = std::max(connect, lookup);
+  handshake = handshake > 0 ? std::max(handshake, connect) : connect;
+  timing.dns_s += lookup;
+  timing.connect_s += connect - lookup;
+  timing.tls_s += handshake - connect;
+  timing.transfer_s += std::max(total - handshake, 0.0);
+}
+
+void HttpClient::end_attempt(CURL *curl, HttpRequest &request) {
+  add_timing(curl, request.timing);
+  if (request.filter && request.filter->finish())
+    request.body.swap(request.filter->output());
+}
+
+bool HttpClient::should_retry(const HttpRequest &request) const {
+  if (request.attempts > options_.retries)
+    return false;
+  return !request.ok || request.status == 429 || request.status >= 500;
+}
+
+// Exponential backoff, or the server's Retry-After if that is longer
+long HttpClient::retry_delay_ms(CURL *curl, const HttpRequest &request) const {
+  long delay = options_.backoff_ms
+               << std::min<unsigned>(request.attempts - 1, 6);
+#if LIBCURL_VERSION_NUM >= 0x074200
+  curl_off_t after = 0;
+  if (curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &after) == CURLE_OK &&
+      after > 0)
+    delay = std::max(delay, static_cast<long>(std::min<curl_off_t>(after, 60)) *
+                                1000);
+#else
+  (void)curl;
+#endif
+  return delay;
+}
+
+bool HttpClient::get(HttpRequest &request) {
+  request.attempts = 0;
+  request.timing = HttpTiming();
+  while (true) {
+    begin_attempt(request);
+    configure(easy_, request);
+    request.ok = curl_easy_perform(easy_) == CURLE_OK;
+    curl_easy_getinfo(easy_, CURLINFO_RESPONSE_CODE, &request.status);
+    end_attempt(easy_, request);
+    if (!should_retry(request))
+      return request.ok;
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(retry_delay_ms(easy_, request)));
+  }
+}
+
+void HttpClient::get_all(const std::vector<HttpRequest *> &requests,
+                         unsigned max_inflight) {
+  std::deque<HttpRequest *> ready(requests.begin(), requests.end());
+  std::vector<std::pair<Clock::time_point, HttpRequest *>> waiting;
+  std::vector<CURL *> idle;
+  size_t running = 0;
+  max_inflight = std::max(1u, max_inflight);
+  for (HttpRequest *r : requests) {
+    r->attempts = 0;
+    r->timing = HttpTiming();
+  }
+
+  while (!ready.empty() || !waiting.empty() || running > 0) {
+    // Requests whose backoff has elapsed go back in the queue
+    auto now = Clock::now();
+    for (size_t i = 0; i < waiting.size();) {
+      if (waiting[i].first <= now) {
+        ready.push_back(waiting[i].second);
+        waiting[i] = waiting.back();
+        waiting.pop_back();
+      } else {
+        ++i;
+      }
+    }
+
+    while (running < max_inflight && !ready.empty()) {
+      HttpRequest *r = ready.front();
+      ready.pop_front();
+      CURL *curl = idle.empty() ? curl_easy_init() : idle.back();
+      if (!idle.empty())
+        idle.pop_back();
+      begin_attempt(*r);
+      configure(curl, *r);
+      curl_multi_add_handle(multi_, curl);
+      ++running;
+    }
+
+    int still_running = 0;
+    curl_multi_perform(multi_, &still_running);
+
+    int queued = 0;
+    while (CURLMsg *msg = curl_multi_info_read(multi_, &queued)) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+      HttpRequest *r = nullptr;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &r);
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &r->status);
+      r->ok = msg->data.result == CURLE_OK;
+      end_attempt(msg->easy_handle, *r);
+      if (should_retry(*r))
+        waiting.emplace_back(
+            Clock::now() +
+                std::chrono::milliseconds(retry_delay_ms(msg->easy_handle, *r)),
+            r);
+      curl_multi_remove_handle(multi_, msg->easy_handle);
+      idle.push_back(msg->easy_handle);
+      --running;
+    }
+
+    if (running > 0) {
+      curl_multi_wait(multi_, nullptr, 0, 100, nullptr);
+    } else if (ready.empty() && !waiting.empty()) {
+      auto next = std::min_element(waiting.begin(), waiting.end())->first;
+      std::this_thread::sleep_until(next);
+    }
+  }
+
+  for (CURL *curl : idle)
+    curl_easy_cleanup(curl);
+}
@@ -0,0 +1,353 @@
+#include "journal.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct Journal {
+  bool exists = false;
+  size_t first_id = 1;      // N of the first record's "rec_N"
+  size_t base_records = 0;  // records in the library when it was started
+  std::uint64_t library_size = 0;
+  std::vector<nlohmann::json> records;
+};
+
+std::string record_id(const nlohmann::json &record) {
+  auto id = record.find("id");
+  return id != record.end() && id->is_string() ? id->get<std::string>() : "";
+}
+
+// N for ids of the form "rec_N", else 0
+size_t rec_number(const std::string &id) {
+  if (id.size() <= 4 || id.compare(0, 4, "rec_") != 0)
+    return 0;
+  size_t n = 0;
+  for (size_t i = 4; i < id.size(); ++i) {
+    if (id[i] < '0' || id[i] > '9')
+      return 0;
+    n = n * 10 + static_cast<size_t>(id[i] - '0');
+  }
+  return n;
+}
+
+std::uint64_t file_size_or_zero(const std::string &path) {
+  std::error_code ec;
+  auto size = std::filesystem::file_size(path, ec);
+  return ec ? 0 : static_cast<std::uint64_t>(size);
+}
+
+Journal read_journal(const std::string &path) {
+  Journal j;
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return j;
+  j.exists = true;
+
+  std::string line;
+  if (!std::getline(in, line))
+    return j;
+  auto header = nlohmann::json::parse(line, nullptr, false);
+  if (header.is_object()) {
+    j.first_id = header.value("first_id", size_t{1});
+    j.base_records = header.value("base_records", size_t{0});
+    j.library_size = header.value("library_size", std::uint64_t{0});
+  }
+
+  while (std::getline(in, line)) {
+    // A torn final line from an interrupted append is skipped
+    auto record = nlohmann::json::parse(line, nullptr, false);
+    if (record.is_object())
+      j.records.push_back(std::move(record));
+  }
+  return j;
+}
+
+// Appends `data` and syncs it to disk before returning
+bool append_durably(const std::string &path, const std::string &data) {
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0)
+    return false;
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+    if (n <= 0) {
+      ::close(fd);
+      return false;
+    }
+    done += static_cast<size_t>(n);
+  }
+  bool ok = ::fsync(fd) == 0;
+  return ::close(fd) == 0 && ok;
+#else
+  std::ofstream out(path, std::ios::binary | std::ios::app);
+  out << data;
+  out.flush();
+  return static_cast<bool>(out);
+#endif
+}
+
+// Advisory lock serializing appends and compactions of one library's
+// journal across processes. It is taken on a separate lib.journal.lock,
+// since compaction deletes the journal itself.
+class JournalLock {
+public:
+  explicit JournalLock(const std::string &library) {
+#ifndef _WIN32
+    std::string path = journal_path(library) + ".lock";
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ >= 0 && ::flock(fd_, LOCK_EX) != 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+#else
+    (void)library;
+#endif
+  }
+  ~JournalLock() {
+#ifndef _WIN32
+    if (fd_ >= 0)
+      ::close(fd_); // releases the lock
+#endif
+  }
+  JournalLock(const JournalLock &) = delete;
+  JournalLock &operator=(const JournalLock &) = delete;
+
+  bool held() const {
+#ifndef _WIN32
+    return fd_ >= 0;
+#else
+    return true;
+#endif
+  }
+
+private:
+  int fd_ = -1;
+};
+
+nlohmann::json empty_library() {
+  return {{"metadata", {{"collection", "my_collection"}}},
+          {"records", nlohmann::json::array()}};
+}
+
+// compact_journal() with the lock already held
+bool compact_locked(const std::string &library, std::string *error,
+                    size_t *compacted) {
+  if (compacted)
+    *compacted = 0;
+  std::string path = journal_path(library);
+  Journal j = read_journal(path);
+  if (!j.exists)
+    return true;
+
+  nlohmann::json root;
+  std::error_code ec;
+  if (std::filesystem::exists(library, ec)) {
+    try {
+      root = load_json_file(library);
+    } catch (const std::exception &e) {
+      // Never overwrite a library we could not read
+      if (error)
+        *error = "cannot parse " + library + ": " + e.what();
+      return false;
+    }
+  }
+  if (root.is_null())
+    root = empty_library();
+  if (root.is_object() &&
+      (!root.contains("records") || !root["records"].is_array()))
+    root["records"] = nlohmann::json::array();
+  if (!root.is_object() && !root.is_array()) {
+    if (error)
+      *error = library + " is not a BibJSON library";
+    return false;
+  }
+
+  nlohmann::json &records = root.is_array() ? root : root["records"];
+  std::unordered_map<std::string, size_t> by_id;
+  for (size_t i = 0; i < records.size(); ++i) {
+    std::string id = record_id(records[i]);
+    if (!id.empty())
+      by_id.emplace(std::move(id), i);
+  }
+
+  // A record already in the library was applied by a compaction that did
+  // not get to delete the journal; a different record under its id means
+  // the library was edited, and nothing is dropped without being applied
+  std::vector<nlohmann::json *> pending;
+  for (auto &record : j.records) {
+    auto found = by_id.find(record_id(record));
+    if (found == by_id.end()) {
+      pending.push_back(&record);
+    } else if (records[found->second] != record) {
+      if (error)
+        *error = library + " already has a different entry " + found->first +
+                 "; " + path + " was kept";
+      return false;
+    }
+  }
+  size_t moved = pending.size();
+  for (nlohmann::json *record : pending)
+    records.push_back(std::move(*record));
+
+  if (moved > 0) {
+    if (root.is_object()) {
+      if (!root.contains("metadata"))
+        root["metadata"] = nlohmann::json::object();
+      root["metadata"]["records"] = records.size();
+    }
+    if (!write_json_file_atomic(library, root, error))
+      return false;
+  }
+
+  std::filesystem::remove(path, ec);
+  if (ec) {
+    if (error)
+      *error = "cannot remove " + path + ": " + ec.message();
+    return false;
+  }
+  if (compacted)
+    *compacted = moved;
+  return true;
+}
+
+
+} // namespace
+
+std::string journal_path(const std::string &library) {
+  return std::filesystem::path(library).replace_extension(".journal").string();
+}
+
+void for_each_journal_record(
+    const std::string &library, size_t library_records,
+    const std::function<bool(const std::string &id)> &in_library,
+    const RecordCallback &on_record) {
+  std::string path = journal_path(library);
+  Journal j = read_journal(path);
+  if (j.records.empty())
+    return;
+
+  // The library still holds the records it had when the journal was
+  // started, so none of the journal has been applied. Otherwise it was
+  // edited, or a compaction did not get to delete the journal, and each
+  // record is checked by id.
+  if (library_records == j.base_records) {
+    for (auto &record : j.records)
+      if (!on_record(std::move(record)))
+        return;
+    return;
+  }
+  size_t skipped = 0;
+  for (auto &record : j.records) {
+    std::string id = record_id(record);
+    if (!id.empty() && in_library(id)) {
+      ++skipped;
+      continue;
+    }
+    if (!on_record(std::move(record)))
+      break;
+  }
+  std::cerr << "Warning: " << library << " changed since " << path
+            << " was started";
+  if (skipped > 0)
+    std::cerr << " (" << skipped << " of its entries are already in it)";
+  std::cerr << "; run `cite compact " << library << "`\n";
+}
+
+bool journal_append(const std::string &library,
+                    const std::vector<nlohmann::json> &entries,
+                    std::vector<std::string> &ids, std::string *error) {
+  JournalLock lock(library);
+  if (!lock.held()) {
+    if (error)
+      *error = "cannot lock " + journal_path(library);
+    return false;
+  }
+  std::string path = journal_path(library);
+  Journal j = read_journal(path);
+
+  // Fold a full or stale journal back in before starting a new one; for a
+  // stale one, that is where its records are checked against the library
+  if (j.exists && (j.records.size() >= journal_compact_threshold ||
+                   j.library_size != file_size_or_zero(library))) {
+    if (!compact_locked(library, error, nullptr))
+      return false;
+    j = Journal();
+  }
+
+  std::string data;
+  if (!j.exists) {
+    std::error_code ec;
+    if (!std::filesystem::exists(library, ec) &&
+        !write_json_file_atomic(library, empty_library(), error))
+      return false;
+
+    // One pass over the library per journal, to number new records past
+    // every id it already uses
+    std::string parse_error;
+    size_t records = 0, last_id = 0;
+    RecordStreamStatus status = for_each_json_record(
+        library,
+        [&](nlohmann::json &&record) {
+          ++records;
+          last_id = std::max(last_id, rec_number(record_id(record)));
+          return true;
+        },
+        &parse_error, JsonReadOptions{true});
+    if (status == RecordStreamStatus::open_failed ||
+        status == RecordStreamStatus::parse_error) {
+      if (error)
+        *error = "cannot read " + library +
+                 (parse_error.empty() ? "" : ": " + parse_error);
+      return false;
+    }
+    j.first_id = std::max(records, last_id) + 1;
+    j.base_records = records;
+    j.library_size = file_size_or_zero(library);
+    data = nlohmann::json{{"first_id", j.first_id},
+                          {"base_records", j.base_records},
+                          {"library_size", j.library_size}}
+               .dump() +
+           "\n";
+  }
+
+  size_t next = j.first_id + j.records.size();
+  ids.clear();
+  for (const auto &entry : entries) {
+    nlohmann::json record = entry;
+    std::string id = "rec_" + std::to_string(next++);
+    record["id"] = id;
+    record["collection"] = "my_collection";
+    data += record.dump();
+    data += '\n';
+    ids.push_back(id);
+  }
+
+  if (!append_durably(path, data)) {
+    if (error)
+      *error = "cannot append to " + path;
+    return false;
+  }
+  return true;
+}
+
+bool compact_journal(const std::string &library, std::string *error,
+                     size_t *compacted) {
+  JournalLock lock(library);
+  if (!lock.held()) {
+    if (error)
+      *error = "cannot lock " + journal_path(library);
+    return false;
+  }
+  return compact_locked(library, error, compacted);
+}
+
@@ -0,0 +1,218 @@
+#include "json_filter.hpp"
+
+const JsonFieldFilter::Node *
+JsonFieldFilter::Node::find(std::string_view key) const {
+  for (const auto &k : keys)
+    if (k.first == key)
+      return k.second;
+  return any_key;
+}
+
+const JsonFieldFilter::Node &JsonFieldFilter::Node::all() {
+  static const Node node{{}, nullptr, nullptr, true};
+  return node;
+}
+
+JsonFieldFilter::JsonFieldFilter(const Node &root) : root_(root) { reset(); }
+
+void JsonFieldFilter::reset() {
+  stack_.clear();
+  state_ = State::value;
+  pending_ = {root_.keep_all ? Emit::all : Emit::filtered, &root_};
+  out_.clear();
+  key_.clear();
+  sink_ = nullptr;
+  escape_ = false;
+  failed_ = false;
+}
+
+bool JsonFieldFilter::feed(std::string_view chunk) {
+  if (failed_)
+    return false;
+  for (char c : chunk) {
+    if (!step(c)) {
+      failed_ = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JsonFieldFilter::finish() {
+  if (!failed_ && state_ == State::scalar && stack_.empty())
+    state_ = State::end;
+  return !failed_ && state_ == State::end;
+}
+
+void JsonFieldFilter::begin_member(Frame &f) {
+  if (f.wrote)
+    out_ += ',';
+  f.wrote = true;
+}
+
+JsonFieldFilter::Target JsonFieldFilter::element_target() const {
+  const Frame &f = stack_.back();
+  if (f.emit == Emit::all)
+    return {Emit::all, nullptr};
+  if (f.emit == Emit::none || !f.node || !f.node->items)
+    return {Emit::none, nullptr};
+  const Node *n = f.node->items;
+  return {n->keep_all ? Emit::all : Emit::filtered, n};
+}
+
+void JsonFieldFilter::end_value() {
+  state_ = stack_.empty() ? State::end : State::comma_or_end;
+}
+
+bool JsonFieldFilter::start_value(char c) {
+  Target t = pending_;
+  if (!stack_.empty() && !stack_.back().object) {
+    t = element_target();
+    if (stack_.back().emit == Emit::filtered && t.emit != Emit::none)
+      begin_member(stack_.back());
+  }
+
+  switch (c) {
+  case '{':
+  case '[':
+    if (t.emit != Emit::none)
+      out_ += c;
+    stack_.push_back({c == '{', t.emit, t.node, false});
+    state_ = c == '{' ? State::key_or_end : State::value_or_end;
+    return true;
+  case '"':
+    sink_ = t.emit != Emit::none ? &out_ : nullptr;
+    if (sink_)
+      out_ += c;
+    str_key_ = false;
+    escape_ = false;
+    state_ = State::string;
+    return true;
+  default:
+    if (c != '-' && !(c >= '0' && c <= '9') && !(c >= 'a' && c <= 'z'))
+      return false;
+    scalar_emit_ = t.emit != Emit::none;
+    if (scalar_emit_)
+      out_ += c;
+    state_ = State::scalar;
+    return true;
+  }
+}
+
+// Keys of filtered objects are collected to look up in the schema and
+// only written once they match
+void JsonFieldFilter::start_key() {
+  const Frame &f = stack_.back();
+  if (f.emit == Emit::all) {
+    sink_ = &out_;
+    out_ += '"';
+  } else if (f.emit == Emit::filtered) {
+    key_.clear();
+    sink_ = &key_;
+  } else {
+    sink_ = nullptr;
+  }
+  str_key_ = true;
+  escape_ = false;
+  state_ = State::string;
+}
+
+void JsonFieldFilter::resolve_key() {
+  Frame &f = stack_.back();
+  if (f.emit == Emit::all) {
+    out_ += ':';
+    pending_ = {Emit::all, nullptr};
+    return;
+  }
+  const Node *n = f.emit == Emit::filtered && f.node ? f.node->find(key_) : nullptr;
+  if (!n) {
+    pending_ = {Emit::none, nullptr};
+    return;
+  }
+  begin_member(f);
+  out_ += '"';
+  out_ += key_;
+  out_ += "\":";
+  pending_ = {n->keep_all ? Emit::all : Emit::filtered, n};
+}
+
+bool JsonFieldFilter::close(char c) {
+  Frame f = stack_.back();
+  stack_.pop_back();
+  if (f.emit != Emit::none)
+    out_ += c;
+  end_value();
+  return true;
+}
+
+bool JsonFieldFilter::step(char c) {
+  switch (state_) {
+  case State::string:
+    if (escape_) {
+      escape_ = false;
+    } else if (c == '\\') {
+      escape_ = true;
+    } else if (c == '"') {
+      if (sink_ == &out_)
+        out_ += c;
+      if (str_key_)
+        state_ = State::colon;
+      else
+        end_value();
+      return true;
+    }
+    if (sink_)
+      *sink_ += c;
+    return true;
+  case State::scalar:
+    if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' ||
+        c == '+' || c == '-' || c == 'E') {
+      if (scalar_emit_)
+        out_ += c;
+      return true;
+    }
+    end_value();
+    return step(c);
+  default:
+    break;
+  }
+
+  if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+    return true;
+
+  switch (state_) {
+  case State::value:
+    return start_value(c);
+  case State::value_or_end:
+    return c == ']' ? close(c) : start_value(c);
+  case State::key_or_end:
+    if (c == '}')
+      return close(c);
+    [[fallthrough]];
+  case State::key:
+    if (c != '"')
+      return false;
+    start_key();
+    return true;
+  case State::colon:
+    if (c != ':')
+      return false;
+    resolve_key();
+    state_ = State::value;
+    return true;
+  case State::comma_or_end: {
+    const Frame &f = stack_.back();
+    if (c == ',') {
+      if (f.emit == Emit::all)
+        out_ += c;
+      state_ = f.object ? State::key : State::value;
+      return true;
+    }
+    if (c == (f.object ? '}' : ']'))
+      return close(c);
+    return false;
+  }
+  default:
+    return false;
+  }
+}
@@ -1,10 +1,240 @@
 #include "json_utils.hpp"
+#include "mapped_file.hpp"
+#include <filesystem>
 #include <fstream>
 #include <nlohmann/json.hpp>
 
-nlohmann::json load_json_file(const std::string& filepath) {
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+nlohmann::json load_json_file(const std::string& filepath,
+                              const JsonReadOptions& options) {
+    if (options.map_file) {
+        MappedFile mapped;
+        if (mapped.open(filepath))
+            return nlohmann::json::parse(mapped.data(),
+                                         mapped.data() + mapped.size());
+    }
     std::ifstream file(filepath);
     nlohmann::json j;
     file >> j;
     return j;
 }
+
+bool write_json_file_atomic(const std::string &filepath,
+                            const nlohmann::json &j, std::string *error) {
+  std::string tmp = filepath + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      if (error)
+        *error = "cannot open " + tmp + " for writing";
+      return false;
+    }
+    out << j.dump(2) << '\n';
+    out.close();
+    if (!out) {
+      if (error)
+        *error = "failed writing " + tmp;
+      std::error_code ignored;
+      std::filesystem::remove(tmp, ignored);
+      return false;
+    }
+  }
+#ifndef _WIN32
+  // Make the new contents durable before they replace the old file
+  int fd = ::open(tmp.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+#endif
+
+  std::error_code ec;
+  std::filesystem::rename(tmp, filepath, ec);
+  if (ec) {
+    if (error)
+      *error = "cannot replace " + filepath + ": " + ec.message();
+    std::error_code ignored;
+    std::filesystem::remove(tmp, ignored);
+    return false;
+  }
+  return true;
+}
+
+// SAX handler that only materializes one record at a time. Everything
+// outside the record array is skipped; each array element is built into a
+// small DOM and handed to the callback as soon as it closes.
+class RecordSax {
+public:
+  explicit RecordSax(const RecordCallback &cb) : on_record_(cb) {}
+
+  bool found_records() const { return records_depth_ > 0; }
+  bool stopped() const { return stopped_; }
+  const std::string &error() const { return error_; }
+
+  bool null() { return value(nullptr); }
+  bool boolean(bool v) { return value(v); }
+  bool number_integer(nlohmann::json::number_integer_t v) { return value(v); }
+  bool number_unsigned(nlohmann::json::number_unsigned_t v) { return value(v); }
+  bool number_float(nlohmann::json::number_float_t v, const std::string &) {
+    return value(v);
+  }
+  bool string(std::string &v) { return value(std::move(v)); }
+  bool binary(nlohmann::json::binary_t &v) { return value(std::move(v)); }
+
+  bool start_object(std::size_t) {
+    if (building() || at_record_level()) {
+      open(nlohmann::json::object());
+    } else {
+      ++depth_;
+      records_key_ = false;
+    }
+    return true;
+  }
+
+  bool key(std::string &k) {
+    if (building())
+      key_ = std::move(k);
+    else if (depth_ == 1)
+      records_key_ = (k == "records");
+    return true;
+  }
+
+  bool end_object() { return close(); }
+
+  bool start_array(std::size_t) {
+    if (building() || at_record_level()) {
+      open(nlohmann::json::array());
+    } else {
+      ++depth_;
+      // Top-level array, or the array under the root "records" key
+      if (depth_ == 1 || (depth_ == 2 && records_key_))
+        records_depth_ = depth_;
+      records_key_ = false;
+    }
+    return true;
+  }
+
+  bool end_array() { return close(); }
+
+  bool parse_error(std::size_t, const std::string &,
+                   const nlohmann::detail::exception &ex) {
+    error_ = ex.what();
+    return false;
+  }
+
+private:
+  bool building() const { return !stack_.empty(); }
+  bool at_record_level() const {
+    return records_depth_ > 0 && !records_done_ && depth_ == records_depth_;
+  }
+
+  template <typename T> bool value(T &&v) {
+    if (building()) {
+      insert(nlohmann::json(std::forward<T>(v)));
+      return true;
+    }
+    records_key_ = false;
+    if (at_record_level()) {
+      record_ = nlohmann::json(std::forward<T>(v));
+      return emit();
+    }
+    return true;
+  }
+
+  nlohmann::json *insert(nlohmann::json &&v) {
+    nlohmann::json &parent = *stack_.back();
+    if (parent.is_array()) {
+      parent.push_back(std::move(v));
+      return &parent.back();
+    }
+    nlohmann::json &slot = parent[key_];
+    slot = std::move(v);
+    return &slot;
+  }
+
+  void open(nlohmann::json &&container) {
+    if (building()) {
+      stack_.push_back(insert(std::move(container)));
+    } else {
+      record_ = std::move(container);
+      stack_.push_back(&record_);
+    }
+  }
+
+  bool close() {
+    if (building()) {
+      stack_.pop_back();
+      return building() ? true : emit();
+    }
+    --depth_;
+    // Objects under later root keys are not records
+    if (depth_ < records_depth_)
+      records_done_ = true;
+    return true;
+  }
+
+  bool emit() {
+    if (!on_record_(std::move(record_))) {
+      stopped_ = true;
+      return false;
+    }
+    record_ = nlohmann::json();
+    return true;
+  }
+
+  const RecordCallback &on_record_;
+  nlohmann::json record_;
+  std::vector<nlohmann::json *> stack_;
+  std::string key_;
+  std::string error_;
+  int depth_ = 0;
+  int records_depth_ = 0;
+  bool records_done_ = false; // the records array has closed
+  bool records_key_ = false;
+  bool stopped_ = false;
+};
+
+static RecordStreamStatus finish(const RecordSax &sax, bool ok,
+                                 std::string *error) {
+  if (!ok && !sax.stopped()) {
+    if (error)
+      *error = sax.error();
+    return RecordStreamStatus::parse_error;
+  }
+  return sax.found_records() ? RecordStreamStatus::ok
+                             : RecordStreamStatus::no_records;
+}
+
+RecordStreamStatus for_each_json_record_in(std::string_view text,
+                                           const RecordCallback &on_record,
+                                           std::string *error) {
+  // The lexer walks the bytes directly; no stream buffer copy and no
+  // per-character virtual call
+  RecordSax sax(on_record);
+  bool ok = nlohmann::json::sax_parse(text.data(), text.data() + text.size(),
+                                      &sax);
+  return finish(sax, ok, error);
+}
+
+RecordStreamStatus for_each_json_record(const std::string &filepath,
+                                        const RecordCallback &on_record,
+                                        std::string *error,
+                                        const JsonReadOptions &options) {
+  if (options.map_file) {
+    MappedFile mapped;
+    if (!mapped.open(filepath))
+      return RecordStreamStatus::open_failed;
+    return for_each_json_record_in(mapped.view(), on_record, error);
+  }
+
+  std::ifstream file(filepath, std::ios::binary);
+  if (!file)
+    return RecordStreamStatus::open_failed;
+  RecordSax sax(on_record);
+  bool ok = nlohmann::json::sax_parse(file, &sax);
+  return finish(sax, ok, error);
+}
@@ -0,0 +1,333 @@
+#include "library.hpp"
+#include "hash.hpp"
+#include "journal.hpp"
+#include "json_utils.hpp"
+#include "library_cache.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+static bool has_glob(std::string_view name) {
+  return name.find_first_of("*?[") != std::string_view::npos;
+}
+
+// Shell-style match of a file name: *, ? and [abc], [a-z], [!abc]
+static bool glob_match(std::string_view pattern, std::string_view name) {
+  size_t p = 0, n = 0;
+  size_t star = std::string_view::npos, resume = 0;
+  while (n < name.size()) {
+    if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      resume = n;
+      continue;
+    }
+    bool matched = false;
+    size_t next = p + 1;
+    if (p < pattern.size() && pattern[p] == '[') {
+      size_t i = p + 1;
+      bool negate =
+          i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+      if (negate)
+        ++i;
+      bool in_set = false;
+      size_t first = i;
+      for (; i < pattern.size() && (pattern[i] != ']' || i == first); ++i) {
+        if (i + 2 < pattern.size() && pattern[i + 1] == '-' &&
+            pattern[i + 2] != ']') {
+          in_set |= name[n] >= pattern[i] && name[n] <= pattern[i + 2];
+          i += 2;
+        } else {
+          in_set |= name[n] == pattern[i];
+        }
+      }
+      if (i < pattern.size()) {
+        matched = in_set != negate;
+        next = i + 1;
+      } else {
+        matched = name[n] == '['; // no closing bracket: a literal '['
+      }
+    } else if (p < pattern.size()) {
+      matched = pattern[p] == '?' || pattern[p] == name[n];
+    }
+    if (matched) {
+      p = next;
+      ++n;
+    } else if (star != std::string_view::npos) {
+      p = star + 1;
+      n = ++resume;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*')
+    ++p;
+  return p == pattern.size();
+}
+
+bool is_sharded_library(const std::string &spec) {
+  std::error_code ec;
+  if (fs::is_regular_file(spec, ec))
+    return false;
+  return fs::is_directory(spec, ec) ||
+         has_glob(fs::path(spec).filename().string());
+}
+
+std::vector<std::string> library_shards(const std::string &spec,
+                                        std::string &error) {
+  if (!is_sharded_library(spec))
+    return {spec};
+
+  std::error_code ec;
+  fs::path dir = spec;
+  std::string pattern = "*.json";
+  if (!fs::is_directory(spec, ec)) {
+    dir = fs::path(spec).parent_path();
+    pattern = fs::path(spec).filename().string();
+  }
+
+  std::vector<std::string> shards;
+  for (fs::directory_iterator it(dir.empty() ? fs::path(".") : dir, ec), end;
+       !ec && it != end; it.increment(ec)) {
+    std::string name = it->path().filename().string();
+    std::error_code fe;
+    if (name[0] != '.' && glob_match(pattern, name) &&
+        it->is_regular_file(fe))
+      shards.push_back(dir.empty() ? name : (dir / name).string());
+  }
+  std::sort(shards.begin(), shards.end());
+  if (shards.empty())
+    error = ec ? "Cannot read " + (dir.empty() ? "." : dir.string())
+               : "No BibJSON files match " + spec;
+  return shards;
+}
+
+std::vector<std::string> library_watch_paths(const std::string &spec) {
+  std::string error;
+  std::vector<std::string> paths;
+  for (const std::string &shard : library_shards(spec, error)) {
+    paths.push_back(shard);
+    paths.push_back(journal_path(shard));
+  }
+  return paths;
+}
+
+static int report_stream_error(RecordStreamStatus status,
+                               const std::string &filename,
+                               const std::string &parse_error) {
+  switch (status) {
+    case RecordStreamStatus::ok:
+      return 0;
+    case RecordStreamStatus::open_failed:
+      std::cerr << "Error: Cannot open " << filename << "\n";
+      break;
+    case RecordStreamStatus::parse_error:
+      std::cerr << "Error: Invalid JSON in " << filename << "\n";
+      std::cerr << parse_error << "\n";
+      break;
+    case RecordStreamStatus::no_records:
+      std::cerr << "Error: Could not find any BibJSON records in " << filename << "\n";
+      std::cerr << "Expected 'records' array or top-level array.\n";
+      break;
+  }
+  return 2;
+}
+
+// Loads every shard as a library of its own, computes its sort keys and
+// sorted run on the same thread, then appends them all in path order
+static int load_shards(const std::string &spec, Library &library,
+                       const LibraryLoadOptions &options) {
+  std::string error;
+  std::vector<std::string> shards = library_shards(spec, error);
+  if (shards.empty()) {
+    std::cerr << "Error: " << error << "\n";
+    return 2;
+  }
+
+  std::vector<Library> parts(shards.size());
+  std::vector<int> status(shards.size(), 0);
+  parallel_for_each_index(shards.size(), options.jobs, [&](size_t i) {
+    Library &part = parts[i];
+    status[i] = load_library(shards[i], part, options);
+    if (status[i] != 0)
+      return;
+    if (part.sort_keys.size() != part.entries.size()) {
+      part.sort_keys.clear();
+      part.sort_keys.reserve(part.entries.size());
+      for (const Citation &entry : part.entries)
+        part.sort_keys.push_back(chicago_sort_key(entry));
+    }
+    part.sorted_runs.push_back(sort_order_by_keys(part.sort_keys));
+  });
+  for (int rc : status)
+    if (rc != 0)
+      return rc;
+
+  size_t total = 0;
+  for (const Library &part : parts)
+    total += part.entries.size();
+  library.entries.reserve(total);
+  library.sort_keys.reserve(total);
+  library.source_hash = hash_bytes("");
+  for (Library &part : parts) {
+    size_t base = library.entries.size();
+    std::move(part.entries.begin(), part.entries.end(),
+              std::back_inserter(library.entries));
+    std::move(part.sort_keys.begin(), part.sort_keys.end(),
+              std::back_inserter(library.sort_keys));
+    std::vector<size_t> &run = part.sorted_runs[0];
+    for (size_t &i : run)
+      i += base;
+    library.sorted_runs.push_back(std::move(run));
+    library.source_hash = hash_combine(library.source_hash, part.source_hash);
+    library.source_size += part.source_size;
+    part = Library();
+  }
+  return 0;
+}
+
+int load_library(const std::string &filename, Library &library,
+                 const LibraryLoadOptions &options) {
+  library = Library();
+  if (is_sharded_library(filename))
+    return load_shards(filename, library, options);
+  // Only one record is parsed at a time and it is decoded straight into a
+  // compact Citation
+  auto on_record = [&library](nlohmann::json &&record) {
+    library.entries.push_back(decode_citation(record));
+    return true;
+  };
+  std::string parse_error;
+
+  if (!options.map_file && !options.use_cache) {
+    RecordStreamStatus status =
+        for_each_json_record(filename, on_record, &parse_error);
+    if (status != RecordStreamStatus::ok)
+      return report_stream_error(status, filename, parse_error);
+  } else {
+    MappedFile source;
+    if (!source.open(filename))
+      return report_stream_error(RecordStreamStatus::open_failed, filename, "");
+
+    library.source_hash = hash_bytes(source.view());
+    library.source_size = source.size();
+    bool cached =
+        options.use_cache &&
+        read_library_cache(library_cache_path(filename), library.source_hash,
+                           library.source_size, library) == CacheStatus::loaded;
+    if (!cached) {
+      RecordStreamStatus status =
+          for_each_json_record_in(source.view(), on_record, &parse_error);
+      if (status != RecordStreamStatus::ok)
+        return report_stream_error(status, filename, parse_error);
+    }
+  }
+
+  if (options.include_journal) {
+    size_t base = library.entries.size();
+    // Only built if the library changed since the journal was started
+    std::unordered_set<std::string> ids;
+    bool have_ids = false;
+    for_each_journal_record(
+        filename, base,
+        [&](const std::string &id) {
+          if (!have_ids) {
+            for (size_t i = 0; i < base; ++i)
+              if (library.entries[i].has(Field::id))
+                ids.emplace(library.entries[i].get(Field::id));
+            have_ids = true;
+          }
+          return ids.count(id) > 0;
+        },
+        on_record);
+    // Journaled records have no stored sort keys
+    if (!library.sort_keys.empty() && library.entries.size() != base) {
+      for (size_t i = base; i < library.entries.size(); ++i)
+        library.sort_keys.push_back(chicago_sort_key(library.entries[i]));
+    }
+  }
+  return 0;
+}
+
+// k-way merge of sorted runs, in the same (key, index) order a global
+// sort_order_by_keys would give. A tournament tree of the runs' heads
+// costs about log2(runs) comparisons per entry.
+static std::vector<size_t>
+merge_sorted_runs(const std::vector<std::vector<size_t>> &runs,
+                  const std::vector<std::string> &keys) {
+  struct Head {
+    std::uint64_t prefix = 0; // first 8 bytes of the key, big-endian
+    std::string_view key;     // of the run's next entry
+    size_t index = 0;
+    size_t run = 0;
+    size_t pos = 0;
+    bool done = true;
+  };
+  // Most comparisons are settled by the prefixes, without touching the
+  // keys' bytes
+  auto before = [](const Head &a, const Head &b) {
+    if (a.done || b.done)
+      return !a.done;
+    if (a.prefix != b.prefix)
+      return a.prefix < b.prefix;
+    int c = a.key.compare(b.key);
+    return c != 0 ? c < 0 : a.index < b.index;
+  };
+  auto load = [&](Head &h) {
+    h.done = h.pos >= runs[h.run].size();
+    if (h.done)
+      return;
+    h.index = runs[h.run][h.pos];
+    h.key = keys[h.index];
+    h.prefix = 0;
+    for (size_t i = 0; i < 8; ++i)
+      h.prefix = (h.prefix << 8) |
+                 (i < h.key.size() ? static_cast<unsigned char>(h.key[i]) : 0);
+  };
+
+  // Leaves are runs; tree[i] holds the winner (smaller head) of its two
+  // children, so tree[1] is the next entry overall
+  size_t leaves = 1;
+  while (leaves < runs.size())
+    leaves *= 2;
+  std::vector<Head> heads(leaves);
+  for (size_t r = 0; r < runs.size(); ++r) {
+    heads[r].run = r;
+    load(heads[r]);
+  }
+  std::vector<size_t> tree(2 * leaves);
+  for (size_t i = 0; i < leaves; ++i)
+    tree[leaves + i] = i;
+  for (size_t i = leaves - 1; i >= 1; --i) {
+    size_t l = tree[2 * i], r = tree[2 * i + 1];
+    tree[i] = before(heads[r], heads[l]) ? r : l;
+  }
+
+  std::vector<size_t> order;
+  order.reserve(keys.size());
+  while (!heads[tree[1]].done) {
+    size_t w = tree[1];
+    order.push_back(heads[w].index);
+    ++heads[w].pos;
+    load(heads[w]);
+    for (size_t i = (leaves + w) / 2; i >= 1; i /= 2) {
+      size_t l = tree[2 * i], r = tree[2 * i + 1];
+      tree[i] = before(heads[r], heads[l]) ? r : l;
+    }
+  }
+  return order;
+}
+
+std::vector<size_t> library_sort_order(const Library &library) {
+  if (!library.sorted_runs.empty() &&
+      library.sort_keys.size() == library.entries.size())
+    return merge_sorted_runs(library.sorted_runs, library.sort_keys);
+  if (library.sort_keys.size() == library.entries.size())
+    return sort_order_by_keys(library.sort_keys);
+  return chicago_sort_order(library.entries);
+}
@@ -0,0 +1,218 @@
+#include "library_cache.hpp"
+#include "mapped_file.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+const char cache_magic[8] = {'C', 'I', 'T', 'E', 'C', '\0', '\0', '\0'};
+const std::uint32_t cache_version = 1;
+// Written in host order; a cache from a machine with the other byte order
+// reads back as a different value and is rejected
+const std::uint32_t byte_order_mark = 0x01020304;
+
+struct CacheHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint64_t source_hash;
+  std::uint64_t source_size;
+  std::uint64_t record_count;
+};
+static_assert(sizeof(CacheHeader) == 40, "CacheHeader layout");
+
+// Followed by name_count ParsedNames, storage_size bytes of strings and
+// key_size bytes of sort key, padded to 8
+struct RecordHeader {
+  std::uint8_t type;
+  std::uint8_t flags;
+  std::uint16_t reserved;
+  std::uint32_t author_count;
+  std::uint32_t editor_count;
+  std::uint32_t name_count;
+  std::uint32_t storage_size;
+  std::uint32_t key_size;
+  FieldRef fields[static_cast<size_t>(Field::count)];
+};
+static_assert(sizeof(RecordHeader) ==
+                  24 + 8 * static_cast<size_t>(Field::count),
+              "RecordHeader layout");
+static_assert(sizeof(ParsedName) == 16, "ParsedName layout");
+
+size_t padded(size_t n) { return (n + 7) & ~size_t(7); }
+
+size_t record_size(const Citation &c, const std::string &key) {
+  return padded(sizeof(RecordHeader) + c.names.size() * sizeof(ParsedName) +
+                c.storage.size() + key.size());
+}
+
+bool ref_ok(FieldRef r, std::uint32_t storage_size) {
+  return r.offset <= storage_size && r.length <= storage_size - r.offset;
+}
+
+} // namespace
+
+std::string library_cache_path(const std::string &json_path) {
+  return std::filesystem::path(json_path).replace_extension(".citec").string();
+}
+
+bool write_library_cache(const std::string &path, const Library &library,
+                         std::string *error) {
+  const auto &entries = library.entries;
+  std::vector<std::string> computed;
+  const std::vector<std::string> *keys = &library.sort_keys;
+  if (keys->size() != entries.size()) {
+    computed.reserve(entries.size());
+    for (const auto &c : entries)
+      computed.push_back(chicago_sort_key(c));
+    keys = &computed;
+  }
+
+  CacheHeader header{};
+  std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.version = cache_version;
+  header.byte_order = byte_order_mark;
+  header.source_hash = library.source_hash;
+  header.source_size = library.source_size;
+  header.record_count = entries.size();
+
+  std::vector<std::uint64_t> offsets;
+  offsets.reserve(entries.size() + 1);
+  std::uint64_t offset = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    offsets.push_back(offset);
+    offset += record_size(entries[i], (*keys)[i]);
+  }
+  offsets.push_back(offset);
+
+  std::string tmp = path + ".tmp";
+  std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    if (error)
+      *error = "cannot open " + tmp + " for writing";
+    return false;
+  }
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(offsets.data()),
+            offsets.size() * sizeof(std::uint64_t));
+
+  static const char zeros[8] = {};
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const Citation &c = entries[i];
+    const std::string &key = (*keys)[i];
+    RecordHeader rh{};
+    rh.type = static_cast<std::uint8_t>(c.type);
+    rh.flags = c.flags;
+    rh.author_count = c.author_count;
+    rh.editor_count = c.editor_count;
+    rh.name_count = static_cast<std::uint32_t>(c.names.size());
+    rh.storage_size = static_cast<std::uint32_t>(c.storage.size());
+    rh.key_size = static_cast<std::uint32_t>(key.size());
+    std::memcpy(rh.fields, c.fields.data(), sizeof(rh.fields));
+
+    out.write(reinterpret_cast<const char *>(&rh), sizeof(rh));
+    out.write(reinterpret_cast<const char *>(c.names.data()),
+              c.names.size() * sizeof(ParsedName));
+    out.write(c.storage.data(), c.storage.size());
+    out.write(key.data(), key.size());
+    size_t used = sizeof(rh) + c.names.size() * sizeof(ParsedName) +
+                  c.storage.size() + key.size();
+    out.write(zeros, padded(used) - used);
+  }
+
+  out.close();
+  if (!out) {
+    if (error)
+      *error = "failed writing " + tmp;
+    std::error_code ec;
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) {
+    if (error)
+      *error = "cannot replace " + path + ": " + ec.message();
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  return true;
+}
+
+CacheStatus read_library_cache(const std::string &path,
+                               std::uint64_t source_hash,
+                               std::uint64_t source_size, Library &library) {
+  std::error_code ec;
+  if (!std::filesystem::exists(path, ec))
+    return CacheStatus::missing;
+
+  MappedFile file;
+  if (!file.open(path) || file.size() < sizeof(CacheHeader))
+    return CacheStatus::invalid;
+
+  CacheHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+      header.byte_order != byte_order_mark)
+    return CacheStatus::invalid;
+  if (header.version != cache_version || header.source_hash != source_hash ||
+      header.source_size != source_size)
+    return CacheStatus::stale;
+
+  const size_t table_size = (header.record_count + 1) * sizeof(std::uint64_t);
+  if (header.record_count > file.size() ||
+      file.size() - sizeof(CacheHeader) < table_size)
+    return CacheStatus::invalid;
+  const char *table = file.data() + sizeof(CacheHeader);
+  const char *records = table + table_size;
+  const size_t records_size = file.size() - sizeof(CacheHeader) - table_size;
+
+  std::vector<Citation> entries(header.record_count);
+  std::vector<std::string> keys(header.record_count);
+  for (size_t i = 0; i < header.record_count; ++i) {
+    std::uint64_t begin, end;
+    std::memcpy(&begin, table + i * 8, 8);
+    std::memcpy(&end, table + (i + 1) * 8, 8);
+    if (begin > end || end > records_size ||
+        end - begin < sizeof(RecordHeader))
+      return CacheStatus::invalid;
+
+    const char *p = records + begin;
+    RecordHeader rh;
+    std::memcpy(&rh, p, sizeof(rh));
+    const std::uint64_t body = std::uint64_t(rh.name_count) * sizeof(ParsedName) +
+                               rh.storage_size + rh.key_size;
+    if (rh.type > static_cast<std::uint8_t>(CitationType::chapter) ||
+        rh.name_count != std::uint64_t(rh.author_count) + rh.editor_count ||
+        body > end - begin - sizeof(RecordHeader))
+      return CacheStatus::invalid;
+    for (const FieldRef &r : rh.fields)
+      if (!ref_ok(r, rh.storage_size))
+        return CacheStatus::invalid;
+    p += sizeof(rh);
+
+    Citation &c = entries[i];
+    c.type = static_cast<CitationType>(rh.type);
+    c.flags = rh.flags;
+    c.author_count = rh.author_count;
+    c.editor_count = rh.editor_count;
+    std::memcpy(c.fields.data(), rh.fields, sizeof(rh.fields));
+    c.names.resize(rh.name_count);
+    std::memcpy(c.names.data(), p, rh.name_count * sizeof(ParsedName));
+    p += rh.name_count * sizeof(ParsedName);
+    for (const ParsedName &n : c.names)
+      if (!ref_ok(n.first, rh.storage_size) || !ref_ok(n.last, rh.storage_size))
+        return CacheStatus::invalid;
+    c.storage.assign(p, rh.storage_size);
+    p += rh.storage_size;
+    keys[i].assign(p, rh.key_size);
+  }
+
+  library.entries = std::move(entries);
+  library.sort_keys = std::move(keys);
+  library.source_hash = source_hash;
+  library.source_size = source_size;
+  return CacheStatus::loaded;
+}
@@ -1,20 +1,52 @@
 #include "add.hpp"
+#include "compile.hpp"
+#include "dedupe.hpp"
 #include "export.hpp"
+#include "journal.hpp"
+#include "process.hpp"
+#include "search.hpp"
+#include "serve.hpp"
 #include <iostream>
 #include <string>
+#include <vector>
+
+// Parses a non-negative count such as a --jobs value
+static bool parse_count(const std::string &s, unsigned &out) {
+  if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  try {
+    out = static_cast<unsigned>(std::stoul(s));
+  } catch (...) {
+    return false;
+  }
+  return true;
+}
 
 void print_usage() {
   std::cout << "\n";
   std::cout << "cite - Citation Management Tool\n";
   std::cout << "================================\n\n";
   std::cout << "USAGE:\n";
-  std::cout << "  cite add <file.json>\n";
-  std::cout << "  cite export <file.json> <style> [output]\n";
+  std::cout << "  cite add <file.json> [--batch <list|->] [options]\n";
+  std::cout << "  cite export <file.json> <style> [output...] [options]\n";
+  std::cout << "  cite export <file.json> --csl <style.csl> [output...] [options]\n";
+  std::cout << "  cite process <manuscript.md> <file.json> [output.md]\n";
+  std::cout << "  cite search <file.json> <words...> [--limit N]\n";
+  std::cout << "  cite dedupe <file.json> [--merge] [--no-fuzzy]\n";
+  std::cout << "  cite serve <file.json>... [--port N | --socket PATH]\n";
+  std::cout << "  cite compile <file.json> [output.citec]\n";
+  std::cout << "  cite compact <file.json>\n";
   std::cout << "  cite help\n";
   std::cout << "  cite version\n\n";
   std::cout << "COMMANDS:\n";
   std::cout << "  add      Search and add a citation to your bibliography\n";
   std::cout << "  export   Generate formatted bibliography and footnotes\n";
+  std::cout << "  process  Turn citation keys in a manuscript into footnotes\n";
+  std::cout << "  search   Find entries already in your bibliography\n";
+  std::cout << "  dedupe   Find and merge duplicate entries\n";
+  std::cout << "  serve    Answer format, export and search requests over HTTP\n";
+  std::cout << "  compile  Build a binary cache that speeds up export\n";
+  std::cout << "  compact  Fold added entries from the journal into the file\n";
   std::cout << "  help     Show this help message\n";
   std::cout << "  version  Show version information\n\n";
   std::cout << "ADD COMMAND:\n";
@@ -23,12 +55,92 @@ void print_usage() {
   std::cout << "  - By DOI: 10.1186/1758-2946-3-47\n";
   std::cout << "  - By ISBN: 978-0-226-45808-3\n";
   std::cout << "  - By title/author: quantum computing feynman\n\n";
+  std::cout << "  cite add mybibliography.json --batch dois.txt\n\n";
+  std::cout << "  Looks up every DOI/ISBN in dois.txt (one per line, '-' for stdin)\n";
+  std::cout << "  concurrently and adds the exact matches without prompting.\n";
+  std::cout << "  --max-inflight N  Requests open at once (default 8)\n";
+  std::cout << "  --timeout S       Give up on a request after S seconds (default 30)\n";
+  std::cout << "  --retries N       Retry failed, throttled (429) and 5xx requests\n";
+  std::cout << "                    N times with backoff (default 2)\n";
+  std::cout << "  --offline         Answer only from the lookup cache\n";
+  std::cout << "  --no-cache        Neither read nor fill the lookup cache\n";
+  std::cout << "  --stats           Report time per phase and network time split\n";
+  std::cout << "                    into DNS, connect, TLS and transfer\n";
+  std::cout << "  --stats-json F    Write the same report as JSON to F (- for stdout,\n";
+  std::cout << "                    with --batch; status lines then go to stderr)\n\n";
+  std::cout << "  Lookups are cached in ~/.cache/cite (or $CITE_CACHE_DIR, which\n";
+  std::cout << "  may be shared) for CITE_CACHE_TTL seconds (default 30 days),\n";
+  std::cout << "  up to CITE_CACHE_MAX_MB megabytes (default 64).\n\n";
+  std::cout << "  New entries go to mybibliography.journal and are folded into\n";
+  std::cout << "  the JSON file every " << journal_compact_threshold
+            << " adds, or by 'cite compact'.\n\n";
   std::cout << "EXPORT COMMAND:\n";
   std::cout << "  cite export mybibliography.json chicago\n";
   std::cout << "  cite export mybibliography.json chicago output.md\n";
-  std::cout << "  cite export mybibliography.json chicago output.html\n\n";
-  std::cout << "  Styles: chicago (mla and apa coming soon)\n";
-  std::cout << "  Formats: terminal (default), .md (Markdown), .html (HTML)\n\n";
+  std::cout << "  cite export mybibliography.json chicago output.html\n";
+  std::cout << "  cite export mybibliography.json chicago output.html output.md\n";
+  std::cout << "  cite export mybibliography.json --csl nature.csl output.html\n";
+  std::cout << "  cite export projects/ chicago output.html\n";
+  std::cout << "  cite export 'projects/2024-*.json' chicago output.html\n\n";
+  std::cout << "  A directory or glob stands for the BibJSON shards in it (export,\n";
+  std::cout << "  search, dedupe, compile). Shards load in parallel, one per core,\n";
+  std::cout << "  and their sorted entries are merged.\n";
+  std::cout << "  Styles: chicago (bibliography and footnotes), mla and apa (works\n";
+  std::cout << "  cited / references only), or any CSL style file given with --csl\n";
+  std::cout << "  (bibliography only). A compiled copy of a CSL style is kept in\n";
+  std::cout << "  the lookup cache directory, so later runs skip parsing it.\n";
+  std::cout << "  Formats: terminal (default), .md (Markdown), .html (HTML)\n";
+  std::cout << "  Several output files are written from one formatting pass.\n";
+  std::cout << "  --jobs N       Format on N threads (0 = one per core)\n";
+  std::cout << "  --no-cache     Ignore the compiled .citec and style caches\n";
+  std::cout << "  --incremental  Reuse renderings of unchanged records from the\n";
+  std::cout << "                 last run (kept in <output>.citecache)\n";
+  std::cout << "  --watch        Keep running and rewrite the outputs whenever the\n";
+  std::cout << "                 library or its journal changes\n";
+  std::cout << "  --stats        Report wall and CPU time per phase (load, sort,\n";
+  std::cout << "                 format, write), records/s, bytes written, peak\n";
+  std::cout << "                 memory and, in builds configured with\n";
+  std::cout << "                 -DCITE_COUNT_ALLOCATIONS=ON, heap allocations\n";
+  std::cout << "  --stats-json F Write the same report as JSON to F (- for stdout,\n";
+  std::cout << "                 when the export goes to files; status lines\n";
+  std::cout << "                 then go to stderr)\n\n";
+  std::cout << "PROCESS COMMAND:\n";
+  std::cout << "  cite process chapter.md mybibliography.json chapter_out.md\n\n";
+  std::cout << "  Replaces citations such as [@rec_12, 45] or [see @rec_3; @rec_7]\n";
+  std::cout << "  with footnotes: the full Chicago note on a work's first citation,\n";
+  std::cout << "  the short note after that, with the pages filled in. A\n";
+  std::cout << "  bibliography of the cited works is added at the end.\n\n";
+  std::cout << "SEARCH COMMAND:\n";
+  std::cout << "  cite search mybibliography.json turing 1950\n\n";
+  std::cout << "  Lists entries whose title, authors, journal, year, id, DOI or\n";
+  std::cout << "  ISBN contain every word. The index is kept in\n";
+  std::cout << "  mybibliography.citeidx and rebuilt when the JSON file changes;\n";
+  std::cout << "  shards each keep their own.\n";
+  std::cout << "  --limit N  Show at most N matches (default 20, 0 = all)\n\n";
+  std::cout << "DEDUPE COMMAND:\n";
+  std::cout << "  cite dedupe mybibliography.json\n\n";
+  std::cout << "  Lists entries that share a DOI or ISBN (ISBN-10 and ISBN-13\n";
+  std::cout << "  forms match), or have nearly the same title, first author and\n";
+  std::cout << "  year. Across shards too, for a directory or glob.\n";
+  std::cout << "  --merge     Keep the first entry of each group, copy over fields\n";
+  std::cout << "              and identifiers only the others have, and remove them\n";
+  std::cout << "  --no-fuzzy  Match on DOIs and ISBNs only\n\n";
+  std::cout << "SERVE COMMAND:\n";
+  std::cout << "  cite serve mybibliography.json --port 8765\n\n";
+  std::cout << "  Keeps the libraries loaded and answers HTTP requests on\n";
+  std::cout << "  127.0.0.1 (or a Unix socket), reloading a library when its\n";
+  std::cout << "  file changes:\n";
+  std::cout << "    /format?lib=mybibliography&id=rec_1&variant=long&markup=html\n";
+  std::cout << "    /export?lib=mybibliography&format=md\n";
+  std::cout << "    /search?lib=mybibliography&q=turing\n";
+  std::cout << "    /libraries, /stats\n";
+  std::cout << "  --port N       TCP port on 127.0.0.1 (default 8765)\n";
+  std::cout << "  --socket PATH  Listen on a Unix socket instead\n";
+  std::cout << "  --threads N    Request handler threads (0 = one per core)\n\n";
+  std::cout << "COMPILE COMMAND:\n";
+  std::cout << "  cite compile mybibliography.json\n\n";
+  std::cout << "  Writes mybibliography.citec. Export uses it automatically while\n";
+  std::cout << "  mybibliography.json is unchanged.\n\n";
   std::cout << "EXAMPLES:\n";
   std::cout << "  # Add a citation by DOI\n";
   std::cout << "  cite add my_papers.json\n";
@@ -70,35 +182,225 @@ int main(int argc, char *argv[]) {
   if (command == "add") {
     if (argc < 3) {
       std::cerr << "Error: Missing filename\n";
-      std::cerr << "Usage: cite add <file.json>\n";
+      std::cerr << "Usage: cite add <file.json> [--batch <list|->]\n";
       std::cerr << "Example: cite add mybibliography.json\n\n";
       return 1;
     }
     std::string filename = argv[2];
-    return add_entry(filename);
+    std::string batch;
+    AddOptions options;
+    for (int i = 3; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (arg == "--batch" && i + 1 < argc) {
+        batch = argv[++i];
+      } else if (arg == "--max-inflight") {
+        if (i + 1 >= argc || !parse_count(argv[i + 1], options.max_inflight) ||
+            options.max_inflight == 0) {
+          std::cerr << "Error: --max-inflight expects a positive count\n\n";
+          return 1;
+        }
+        ++i;
+      } else if (arg == "--timeout" || arg == "--retries") {
+        unsigned &value = arg == "--timeout" ? options.timeout : options.retries;
+        if (i + 1 >= argc || !parse_count(argv[i + 1], value)) {
+          std::cerr << "Error: " << arg << " expects a number\n\n";
+          return 1;
+        }
+        ++i;
+      } else if (arg == "--offline") {
+        options.offline = true;
+      } else if (arg == "--no-cache") {
+        options.use_cache = false;
+      } else if (arg == "--stats") {
+        options.stats = true;
+      } else if (arg == "--stats-json" && i + 1 < argc) {
+        options.stats_json = argv[++i];
+      } else {
+        std::cerr << "Error: Unexpected argument '" << arg << "'\n\n";
+        return 1;
+      }
+    }
+    if (!batch.empty())
+      return add_batch(filename, batch, options);
+    if (options.stats_json == "-") {
+      std::cerr << "Error: --stats-json - only works with --batch; "
+                   "interactive add prompts on stdout\n";
+      return 1;
+    }
+    return add_entry(filename, options);
   }
   
   // Export command
   if (command == "export") {
-    if (argc < 4) {
+    std::vector<std::string> args;
+    ExportOptions options;
+    for (int i = 2; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (arg == "--jobs" || arg == "-j") {
+        if (i + 1 >= argc || !parse_count(argv[i + 1], options.jobs)) {
+          std::cerr << "Error: " << arg << " expects a thread count\n\n";
+          return 1;
+        }
+        ++i;
+      } else if (arg == "--no-cache") {
+        options.use_cache = false;
+      } else if (arg == "--incremental") {
+        options.incremental = true;
+      } else if (arg == "--watch") {
+        options.watch = true;
+      } else if (arg == "--stats") {
+        options.stats = true;
+      } else if (arg == "--stats-json") {
+        if (i + 1 >= argc) {
+          std::cerr << "Error: --stats-json expects a file name (- for stdout)\n\n";
+          return 1;
+        }
+        options.stats_json = argv[++i];
+      } else if (arg == "--csl") {
+        if (i + 1 >= argc) {
+          std::cerr << "Error: --csl expects a .csl style file\n\n";
+          return 1;
+        }
+        options.csl = argv[++i];
+      } else {
+        args.push_back(arg);
+      }
+    }
+
+    // A CSL style takes the place of the style name
+    if (!options.csl.empty() && !args.empty())
+      return cite_export(args[0], "", {args.begin() + 1, args.end()}, options);
+
+    if (args.size() < 2) {
       std::cerr << "Error: Missing arguments\n";
-      std::cerr << "Usage: cite export <file.json> <style> [output]\n";
+      std::cerr << "Usage: cite export <file.json> <style> [output...] [options]\n";
       std::cerr << "Example: cite export mybibliography.json chicago output.html\n\n";
       return 1;
     }
-    std::string filename = argv[2];
-    std::string style = argv[3];
-    std::string output = (argc >= 5 ? argv[4] : "");
+    std::string filename = args[0];
+    std::string style = args[1];
+    std::vector<std::string> outputs(args.begin() + 2, args.end());
     
     // Validate style
-    if (style != "chicago") {
+    if (style != "chicago" && style != "mla" && style != "apa") {
       std::cerr << "Error: Unknown style '" << style << "'\n";
-      std::cerr << "Currently supported: chicago\n";
-      std::cerr << "Coming soon: mla, apa\n\n";
+      std::cerr << "Currently supported: chicago, mla, apa, or a CSL file "
+                   "with --csl\n\n";
       return 1;
     }
     
-    return cite_export(filename, style, output);
+    return cite_export(filename, style, outputs, options);
+  }
+  
+  // Compact command
+  if (command == "compact") {
+    if (argc < 3) {
+      std::cerr << "Error: Missing filename\n";
+      std::cerr << "Usage: cite compact <file.json>\n\n";
+      return 1;
+    }
+    return compact_entries(argv[2]);
+  }
+  
+  // Process command
+  if (command == "process") {
+    if (argc < 4) {
+      std::cerr << "Error: Missing arguments\n";
+      std::cerr << "Usage: cite process <manuscript.md> <file.json> [output.md]\n\n";
+      return 1;
+    }
+    return cite_process(argv[2], argv[3], argc >= 5 ? argv[4] : "");
+  }
+
+  // Search command
+  if (command == "search") {
+    std::string filename, query;
+    unsigned limit = 20;
+    for (int i = 2; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (arg == "--limit") {
+        if (i + 1 >= argc || !parse_count(argv[i + 1], limit)) {
+          std::cerr << "Error: --limit expects a count\n\n";
+          return 1;
+        }
+        ++i;
+      } else if (filename.empty()) {
+        filename = arg;
+      } else {
+        query += query.empty() ? arg : " " + arg;
+      }
+    }
+    if (filename.empty() || query.empty()) {
+      std::cerr << "Error: Missing filename or search words\n";
+      std::cerr << "Usage: cite search <file.json> <words...> [--limit N]\n\n";
+      return 1;
+    }
+    return cite_search(filename, query, limit);
+  }
+
+  // Dedupe command
+  if (command == "dedupe") {
+    std::string filename;
+    DedupeOptions options;
+    for (int i = 2; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (arg == "--merge") {
+        options.merge = true;
+      } else if (arg == "--no-fuzzy") {
+        options.fuzzy = false;
+      } else if (filename.empty()) {
+        filename = arg;
+      } else {
+        std::cerr << "Error: Unexpected argument '" << arg << "'\n\n";
+        return 1;
+      }
+    }
+    if (filename.empty()) {
+      std::cerr << "Error: Missing filename\n";
+      std::cerr << "Usage: cite dedupe <file.json> [--merge] [--no-fuzzy]\n\n";
+      return 1;
+    }
+    return cite_dedupe(filename, options);
+  }
+
+  // Serve command
+  if (command == "serve") {
+    ServeOptions options;
+    for (int i = 2; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (arg == "--port" || arg == "--threads") {
+        unsigned &value = arg == "--port" ? options.port : options.threads;
+        if (i + 1 >= argc || !parse_count(argv[i + 1], value) ||
+            (arg == "--port" && (value == 0 || value > 65535))) {
+          std::cerr << "Error: " << arg << " expects a number\n\n";
+          return 1;
+        }
+        ++i;
+      } else if (arg == "--socket" && i + 1 < argc) {
+        options.socket_path = argv[++i];
+      } else if (arg.compare(0, 2, "--") == 0) {
+        std::cerr << "Error: Unexpected argument '" << arg << "'\n\n";
+        return 1;
+      } else {
+        options.libraries.push_back(arg);
+      }
+    }
+    if (options.libraries.empty()) {
+      std::cerr << "Error: Missing filename\n";
+      std::cerr << "Usage: cite serve <file.json>... [--port N | --socket PATH]\n\n";
+      return 1;
+    }
+    return cite_serve(options);
+  }
+
+  // Compile command
+  if (command == "compile") {
+    if (argc < 3) {
+      std::cerr << "Error: Missing filename\n";
+      std::cerr << "Usage: cite compile <file.json> [output.citec]\n\n";
+      return 1;
+    }
+    return cite_compile(argv[2], argc >= 4 ? argv[3] : "");
   }
   
   // Unknown command
@@ -0,0 +1,80 @@
+#include "mapped_file.hpp"
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+MappedFile::MappedFile(MappedFile &&other) noexcept { *this = std::move(other); }
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+  if (this != &other) {
+    close();
+    fallback_ = std::move(other.fallback_);
+    data_ = other.mapped_ ? other.data_ : fallback_.data();
+    size_ = other.size_;
+    open_ = other.open_;
+    mapped_ = other.mapped_;
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.open_ = other.mapped_ = false;
+  }
+  return *this;
+}
+
+bool MappedFile::open(const std::string &path) {
+  close();
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ > 0) {
+    void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      // Parsers read front to back
+      ::madvise(p, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char *>(p);
+      mapped_ = true;
+    }
+  }
+  ::close(fd);
+  if (mapped_ || size_ == 0) {
+    open_ = true;
+    return true;
+  }
+#endif
+  // Plain read when mapping is unavailable
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+  fallback_.assign(std::istreambuf_iterator<char>(in),
+                   std::istreambuf_iterator<char>());
+  data_ = fallback_.data();
+  size_ = fallback_.size();
+  open_ = true;
+  return true;
+}
+
+void MappedFile::close() {
+#ifndef _WIN32
+  if (mapped_)
+    ::munmap(const_cast<char *>(data_), size_);
+#endif
+  fallback_.clear();
+  data_ = nullptr;
+  size_ = 0;
+  open_ = mapped_ = false;
+}
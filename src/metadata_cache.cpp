@@ -0,0 +1,207 @@
+#include "metadata_cache.hpp"
+#include "hash.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Bumped when the stored bodies change shape; 2 = pruned by the lookup's
+// JsonFieldFilter. Entries of any other format are misses.
+static const int entry_format = 2;
+
+static const char *env(const char *name) {
+  const char *v = std::getenv(name);
+  return v && *v ? v : nullptr;
+}
+
+static bool parse_number(const char *s, std::uint64_t &out) {
+  char *end = nullptr;
+  unsigned long long v = std::strtoull(s, &end, 10);
+  if (end == s || *end != '\0')
+    return false;
+  out = v;
+  return true;
+}
+
+MetadataCacheOptions MetadataCacheOptions::from_env() {
+  MetadataCacheOptions o;
+  if (const char *dir = env("CITE_CACHE_DIR"))
+    o.dir = dir;
+  else if (const char *xdg = env("XDG_CACHE_HOME"))
+    o.dir = (fs::path(xdg) / "cite").string();
+  else if (const char *home = env("HOME"))
+    o.dir = (fs::path(home) / ".cache" / "cite").string();
+
+  std::uint64_t n;
+  if (const char *ttl = env("CITE_CACHE_TTL"); ttl && parse_number(ttl, n))
+    o.ttl_seconds = static_cast<std::int64_t>(n);
+  if (const char *mb = env("CITE_CACHE_MAX_MB"); mb && parse_number(mb, n))
+    o.max_bytes = n << 20;
+  if (const char *off = env("CITE_OFFLINE"))
+    o.offline = std::string(off) != "0";
+  return o;
+}
+
+MetadataCache::MetadataCache(MetadataCacheOptions options)
+    : options_(std::move(options)) {}
+
+std::string MetadataCache::normalize(const std::string &mode,
+                                     const std::string &query) {
+  auto first = query.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos)
+    return mode + ":";
+  auto last = query.find_last_not_of(" \t\r\n");
+  std::string id = query.substr(first, last - first + 1);
+  if (mode == "isbn")
+    id.erase(std::remove_if(id.begin(), id.end(),
+                            [](char c) { return c == '-' || c == ' '; }),
+             id.end());
+  std::transform(id.begin(), id.end(), id.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return mode + ":" + id;
+}
+
+std::string MetadataCache::path_for(const std::string &key,
+                                    const std::string &url) const {
+  static const char hex[] = "0123456789abcdef";
+  std::uint64_t h = hash_combine(hash_bytes(key), hash_bytes(url));
+  std::string name(16, '0');
+  for (int i = 15; i >= 0; --i, h >>= 4)
+    name[i] = hex[h & 15];
+  return (fs::path(options_.dir) / (name + ".resp")).string();
+}
+
+// Entry layout: one JSON header line {"format", "key", "url", "fetched"}
+// followed by the response body as the lookup's filter left it
+bool MetadataCache::get(const std::string &key, const std::string &url,
+                        std::string &body) {
+  if (!enabled())
+    return false;
+  std::string path = path_for(key, url);
+  std::ifstream in(path, std::ios::binary);
+  std::string line;
+  if (!in || !std::getline(in, line)) {
+    ++misses_;
+    return false;
+  }
+
+  auto header = nlohmann::json::parse(line, nullptr, false);
+  if (!header.is_object() || header.value("format", 0) != entry_format ||
+      header.value("key", "") != key ||
+      header.value("url", "") != url) {
+    ++misses_;
+    return false;
+  }
+  std::int64_t fetched = header.value("fetched", std::int64_t{0});
+  std::int64_t now = static_cast<std::int64_t>(std::time(nullptr));
+  if (options_.ttl_seconds > 0 && now - fetched > options_.ttl_seconds &&
+      !options_.offline) {
+    ++misses_;
+    return false;
+  }
+
+  std::ostringstream rest;
+  rest << in.rdbuf();
+  body = rest.str();
+
+  // Mark as recently used
+  std::error_code ec;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+  ++hits_;
+  return true;
+}
+
+void MetadataCache::put(const std::string &key, const std::string &url,
+                        const std::string &body) {
+  if (!enabled() || body.empty())
+    return;
+  std::error_code ec;
+  fs::create_directories(options_.dir, ec);
+
+  std::string path = path_for(key, url);
+  // Unique per writer, since the directory may be shared
+  std::string tmp =
+      path + ".tmp" +
+      std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return;
+    nlohmann::json header = {
+        {"format", entry_format},
+        {"key", key},
+        {"url", url},
+        {"fetched", static_cast<std::int64_t>(std::time(nullptr))}};
+    out << header.dump() << '\n' << body;
+    if (!out) {
+      out.close();
+      fs::remove(tmp, ec);
+      return;
+    }
+  }
+  std::uint64_t old_size = fs::exists(path, ec) ? fs::file_size(path, ec) : 0;
+  fs::rename(tmp, path, ec);
+  if (ec) {
+    std::error_code ignored;
+    fs::remove(tmp, ignored);
+    return;
+  }
+
+  if (options_.max_bytes == 0)
+    return;
+  if (!total_known_) {
+    evict();
+  } else {
+    total_bytes_ += fs::file_size(path, ec);
+    total_bytes_ -= std::min(total_bytes_, old_size);
+    if (total_bytes_ > options_.max_bytes)
+      evict();
+  }
+}
+
+// Recounts the directory and, if it is over the cap, deletes least
+// recently used entries until it is back under 90% of it
+void MetadataCache::evict() {
+  struct File {
+    fs::path path;
+    fs::file_time_type used;
+    std::uint64_t size;
+  };
+  std::vector<File> files;
+  std::uint64_t total = 0;
+  std::error_code ec;
+  for (fs::directory_iterator it(options_.dir, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (it->path().extension() != ".resp")
+      continue;
+    std::error_code fe;
+    File f{it->path(), it->last_write_time(fe), it->file_size(fe)};
+    if (fe)
+      continue;
+    total += f.size;
+    files.push_back(std::move(f));
+  }
+
+  if (total > options_.max_bytes) {
+    std::sort(files.begin(), files.end(),
+              [](const File &a, const File &b) { return a.used < b.used; });
+    const std::uint64_t target = options_.max_bytes / 10 * 9;
+    for (const File &f : files) {
+      if (total <= target)
+        break;
+      std::error_code re;
+      if (fs::remove(f.path, re))
+        total -= f.size;
+    }
+  }
+  total_bytes_ = total;
+  total_known_ = true;
+}
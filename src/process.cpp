@@ -0,0 +1,344 @@
+#include "process.hpp"
+#include "../formatters/chicago_formatter.hpp"
+#include "../include/library.hpp"
+#include "../include/mapped_file.hpp"
+#include "../include/render.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+// One `@key` of a citation group, with the text around it
+struct CiteRef {
+  std::string_view prefix;  // "see"
+  std::string_view key;     // "rec_12"
+  std::string_view locator; // "45"
+};
+
+bool is_key_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+// Punctuation allowed inside a key, as long as a key character follows
+bool is_key_punct(char c) {
+  switch (c) {
+  case ':': case '.': case '#': case '$': case '%': case '&':
+  case '-': case '+': case '?': case '<': case '>': case '~': case '/':
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t' ||
+                        s.front() == '\n' || s.front() == '\r'))
+    s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t' ||
+                        s.back() == '\n' || s.back() == '\r'))
+    s.remove_suffix(1);
+  return s;
+}
+
+// "see @rec_3, 12-14" -> {"see", "rec_3", "12-14"}
+bool parse_cite(std::string_view part, CiteRef &ref) {
+  part = trim(part);
+  size_t at = 0;
+  // The @ must start a word, so e-mail addresses are not keys
+  while ((at = part.find('@', at)) != std::string_view::npos &&
+         at > 0 && part[at - 1] != ' ')
+    ++at;
+  if (at == std::string_view::npos)
+    return false;
+  size_t end = at + 1;
+  while (end < part.size() &&
+         (is_key_char(part[end]) ||
+          (is_key_punct(part[end]) && end + 1 < part.size() &&
+           is_key_char(part[end + 1]))))
+    ++end;
+  if (end == at + 1)
+    return false;
+  ref.prefix = trim(part.substr(0, at));
+  ref.key = part.substr(at + 1, end - at - 1);
+  std::string_view rest = trim(part.substr(end));
+  if (!rest.empty() && rest.front() == ',')
+    rest = trim(rest.substr(1));
+  ref.locator = rest;
+  return true;
+}
+
+// Parses the citation group opening at text[open] ('['); returns the index
+// past its ']', or npos if the brackets do not hold a citation
+size_t parse_group(std::string_view text, size_t open,
+                   std::vector<CiteRef> &refs) {
+  refs.clear();
+  size_t close = open + 1;
+  for (; close < text.size(); ++close) {
+    char c = text[close];
+    if (c == ']')
+      break;
+    // Groups do not nest or span paragraphs
+    if (c == '[' ||
+        (c == '\n' && close + 1 < text.size() && text[close + 1] == '\n'))
+      return std::string_view::npos;
+  }
+  if (close >= text.size())
+    return std::string_view::npos;
+  // "[text](link)" and "[text][ref]" are links
+  if (close + 1 < text.size() && (text[close + 1] == '(' || text[close + 1] == '['))
+    return std::string_view::npos;
+
+  std::string_view inner = text.substr(open + 1, close - open - 1);
+  while (!inner.empty()) {
+    size_t semi = inner.find(';');
+    CiteRef ref;
+    if (!parse_cite(inner.substr(0, semi), ref))
+      return std::string_view::npos;
+    refs.push_back(ref);
+    if (semi == std::string_view::npos)
+      break;
+    inner.remove_prefix(semi + 1);
+  }
+  return refs.empty() ? std::string_view::npos : close + 1;
+}
+
+// Appends a footnote with its `[pg]` placeholder replaced by `locator`,
+// or dropped with its separator when there is none. The closing period is
+// left off so several notes can share one footnote.
+void append_note(std::string &out, std::string_view note,
+                 std::string_view locator) {
+  size_t pg = note.rfind("[pg]");
+  std::string_view head = note.substr(0, pg);
+  if (pg == std::string_view::npos && !head.empty() && head.back() == '.')
+    head.remove_suffix(1);
+  while (!head.empty() && head.back() == ' ')
+    head.remove_suffix(1);
+
+  bool quoted = head.size() >= 2 && head.substr(head.size() - 2) == ",\"";
+  if (!locator.empty()) {
+    out += head;
+    // Short notes leave an italic title without its comma
+    bool separated = quoted || (!head.empty() && (head.back() == ',' ||
+                                                  head.back() == ':'));
+    out += separated ? " " : ", ";
+    out += locator;
+  } else if (quoted) {
+    out += head.substr(0, head.size() - 2);
+    out += '"';
+  } else {
+    if (!head.empty() && (head.back() == ',' || head.back() == ':'))
+      head.remove_suffix(1);
+    out += head;
+  }
+}
+
+// Ends a footnote; a period goes inside a closing quote
+void end_note(std::string &out) {
+  if (!out.empty() && out.back() == '"') {
+    out.insert(out.size() - 1, 1, '.');
+  } else {
+    out += '.';
+  }
+}
+
+} // namespace
+
+int cite_process(const std::string &manuscript, const std::string &filename,
+                 const std::string &output_file) {
+  MappedFile source;
+  if (!source.open(manuscript)) {
+    std::cerr << "Error: Cannot read " << manuscript << "\n";
+    return 2;
+  }
+  Library library;
+  if (int rc = load_library(filename, library))
+    return rc;
+  const std::vector<Citation> &entries = library.entries;
+
+  std::unordered_map<std::string_view, size_t> by_id;
+  by_id.reserve(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i)
+    if (entries[i].has(Field::id))
+      by_id.emplace(entries[i].get(Field::id), i);
+
+  std::FILE *file = stdout;
+  if (!output_file.empty()) {
+    file = std::fopen(output_file.c_str(), "wb");
+    if (!file) {
+      std::cerr << "Error: Cannot open " << output_file << " for writing\n";
+      return 3;
+    }
+  }
+
+  ChicagoFormatter formatter;
+  OutputBuffer buf(Markup::markdown);
+  std::vector<size_t> cited;                          // first-cite order
+  std::unordered_map<size_t, std::string> short_notes; // per cited work
+  std::vector<size_t> resolved;
+  std::vector<CiteRef> refs;
+  std::string notes; // footnote definitions, written after the text
+  std::string note;
+  size_t footnotes = 0, citations = 0, unresolved = 0;
+
+  bool ok;
+  {
+    OutputSink sink(file);
+    std::string_view text = source.view();
+    size_t copied = 0; // text before this is already written
+    size_t line = 1, counted = 0; // line number of text[counted]
+    bool fenced = false;
+    size_t i = 0;
+    while (i < text.size()) {
+      bool fence = (i == 0 || text[i - 1] == '\n') &&
+                   (text.compare(i, 3, "```") == 0 ||
+                    text.compare(i, 3, "~~~") == 0);
+      if (fence)
+        fenced = !fenced;
+      if (fence || fenced) {
+        i = text.find('\n', i);
+        if (i == std::string_view::npos)
+          break;
+        ++i;
+        continue;
+      }
+      i = text.find_first_of("\n\\`[", i);
+      if (i == std::string_view::npos)
+        break;
+      char c = text[i];
+      if (c == '\n') {
+        ++i;
+        continue;
+      }
+      if (c == '\\') {
+        i += 2;
+        continue;
+      }
+      if (c == '`') {
+        // Code span: skip to the matching run of backticks
+        size_t run = text.find_first_not_of('`', i);
+        if (run == std::string_view::npos)
+          break;
+        std::string_view ticks = text.substr(i, run - i);
+        size_t close = text.find(ticks, run);
+        i = close == std::string_view::npos ? run : close + ticks.size();
+        continue;
+      }
+      if (i + 1 < text.size() && text[i + 1] == '^') {
+        ++i;
+        continue;
+      }
+
+      size_t end = parse_group(text, i, refs);
+      if (end == std::string_view::npos) {
+        ++i;
+        continue;
+      }
+      resolved.clear();
+      for (const auto &ref : refs) {
+        auto it = by_id.find(ref.key);
+        if (it == by_id.end()) {
+          line += static_cast<size_t>(
+              std::count(text.begin() + counted, text.begin() + i, '\n'));
+          counted = i;
+          std::cerr << manuscript << ":" << line << ": unknown citation key @"
+                    << ref.key << "\n";
+          ++unresolved;
+          break;
+        }
+        resolved.push_back(it->second);
+      }
+      if (resolved.size() != refs.size()) {
+        i = end;
+        continue;
+      }
+
+      note.clear();
+      for (size_t k = 0; k < refs.size(); ++k) {
+        size_t record = resolved[k];
+        if (k > 0)
+          note += "; ";
+        if (!refs[k].prefix.empty()) {
+          note += refs[k].prefix;
+          note += ' ';
+          // A note starts a sentence: "See ..."
+          if (k == 0 && note[0] >= 'a' && note[0] <= 'z')
+            note[0] = static_cast<char>(note[0] - 'a' + 'A');
+        }
+        auto seen = short_notes.find(record);
+        buf.clear();
+        if (seen == short_notes.end()) {
+          formatter.format_long_footnote(entries[record], buf);
+          append_note(note, buf.view(), refs[k].locator);
+          buf.clear();
+          formatter.format_short_footnote(entries[record], buf);
+          short_notes.emplace(record, buf.str());
+          cited.push_back(record);
+        } else {
+          append_note(note, seen->second, refs[k].locator);
+        }
+      }
+      end_note(note);
+      citations += refs.size();
+
+      std::string label = "[^cite-" + std::to_string(++footnotes) + "]";
+      sink.write(text.substr(copied, i - copied));
+      sink.write(label);
+      notes += label;
+      notes += ": ";
+      notes += note;
+      notes += "\n\n";
+      i = copied = end;
+    }
+    sink.write(text.substr(copied));
+
+    if (!notes.empty()) {
+      if (!text.empty() && text.back() != '\n')
+        sink.write("\n");
+      sink.write("\n");
+      sink.write(notes);
+    }
+
+    if (!cited.empty()) {
+      // Bibliography of the cited works only, in Chicago order
+      std::vector<std::string> keys;
+      keys.reserve(cited.size());
+      for (size_t record : cited)
+        keys.push_back(library.sort_keys.size() == entries.size()
+                           ? library.sort_keys[record]
+                           : chicago_sort_key(entries[record]));
+      sink.write("## Bibliography\n\n");
+      for (size_t k : sort_order_by_keys(keys)) {
+        buf.clear();
+        formatter.format(entries[cited[k]], buf);
+        sink.write(buf.view());
+        sink.write("\n\n");
+      }
+    }
+    ok = sink.flush();
+  }
+
+  std::cerr << "Resolved " << citations
+            << (citations == 1 ? " citation" : " citations") << " of "
+            << cited.size() << (cited.size() == 1 ? " work" : " works")
+            << " in " << footnotes << (footnotes == 1 ? " footnote" : " footnotes");
+  if (unresolved > 0)
+    std::cerr << " (" << unresolved << " unknown "
+              << (unresolved == 1 ? "key" : "keys") << ")";
+  std::cerr << "\n";
+
+  if (file != stdout) {
+    if (std::fclose(file) != 0)
+      ok = false;
+    if (ok)
+      std::cout << "Output written to: " << output_file << "\n";
+  }
+  if (!ok) {
+    std::cerr << "Error: Failed writing "
+              << (output_file.empty() ? "output" : output_file) << "\n";
+    return 3;
+  }
+  return unresolved > 0 ? 1 : 0;
+}
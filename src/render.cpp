@@ -0,0 +1,228 @@
+#include "render.hpp"
+#include <charconv>
+#include <chrono>
+#include <ctime>
+#include <cstring>
+
+OutputSink::OutputSink(std::FILE *file, size_t capacity) : file_(file) {
+  buffer_.reserve(capacity);
+}
+
+OutputSink::OutputSink(std::string &target, size_t capacity)
+    : target_(&target) {
+  buffer_.reserve(capacity);
+}
+
+OutputSink::~OutputSink() { flush(); }
+
+void OutputSink::write(std::string_view s) {
+  if (buffer_.size() + s.size() > buffer_.capacity()) {
+    flush();
+    if (s.size() > buffer_.capacity()) {
+      // Too big to be worth buffering
+      if (target_)
+        target_->append(s.data(), s.size());
+      else
+        write_file(s.data(), s.size());
+      written_ += s.size();
+      return;
+    }
+  }
+  buffer_.insert(buffer_.end(), s.begin(), s.end());
+}
+
+void OutputSink::write_number(size_t n) {
+  char digits[24];
+  auto res = std::to_chars(digits, digits + sizeof(digits), n);
+  write(std::string_view(digits, res.ptr - digits));
+}
+
+bool OutputSink::flush() {
+  if (target_) {
+    target_->append(buffer_.data(), buffer_.size());
+    written_ += buffer_.size();
+    buffer_.clear();
+    return ok_;
+  }
+  write_file(buffer_.data(), buffer_.size());
+  written_ += buffer_.size();
+  buffer_.clear();
+  return ok_;
+}
+
+// Writes and flushes, n may be 0
+void OutputSink::write_file(const char *data, size_t n) {
+  auto wall = std::chrono::steady_clock::now();
+  std::clock_t cpu = std::clock();
+  if (n > 0 && std::fwrite(data, 1, n, file_) != n)
+    ok_ = false;
+  if (std::fflush(file_) != 0)
+    ok_ = false;
+  write_cpu_s_ += static_cast<double>(std::clock() - cpu) / CLOCKS_PER_SEC;
+  write_wall_s_ += std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - wall)
+                       .count();
+}
+
+static bool ends_with(const std::string &s, const char *suffix) {
+  size_t n = std::strlen(suffix);
+  return s.size() > n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+bool output_format_for(const std::string &path, OutputFormat &format) {
+  if (path.empty())
+    format = OutputFormat::terminal;
+  else if (ends_with(path, ".html"))
+    format = OutputFormat::html;
+  else if (ends_with(path, ".md"))
+    format = OutputFormat::markdown;
+  else
+    return false;
+  return true;
+}
+
+class HtmlRenderer : public Renderer {
+public:
+  explicit HtmlRenderer(OutputSink &sink) : out_(sink) {}
+
+  Markup markup() const override { return Markup::html; }
+
+  void begin_document(std::string_view style, std::string_view) override {
+    out_.write("<!DOCTYPE html>\n");
+    out_.write("<html lang=\"en\">\n");
+    out_.write("<head>\n");
+    out_.write("  <meta charset=\"UTF-8\">\n");
+    out_.write("  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n");
+    out_.write("  <title>");
+    write_text(style);
+    out_.write(" Bibliography</title>\n");
+    out_.write("  <style>\n");
+    out_.write("    body { font-family: 'Times New Roman', Times, serif; max-width: 800px; margin: 40px auto; padding: 0 20px; line-height: 1.6; }\n");
+    out_.write("    h1 { font-size: 24px; font-weight: bold; margin-top: 40px; margin-bottom: 20px; border-bottom: 2px solid #333; padding-bottom: 10px; }\n");
+    out_.write("    h2 { font-size: 20px; font-weight: bold; margin-top: 30px; margin-bottom: 15px; }\n");
+    out_.write("    ol { padding-left: 0; }\n");
+    out_.write("    li { margin-bottom: 12px; margin-left: 2em; text-indent: -2em; }\n");
+    out_.write("    i { font-style: italic; }\n");
+    out_.write("    .note { color: #666; font-size: 0.9em; margin-top: 30px; padding: 10px; background: #f5f5f5; border-left: 3px solid #ccc; }\n");
+    out_.write("  </style>\n");
+    out_.write("</head>\n");
+    out_.write("<body>\n");
+    out_.write("  <h1>");
+    write_text(style);
+    out_.write(" Citations</h1>\n");
+  }
+
+  void begin_section(std::string_view heading) override {
+    out_.write("  <h2>");
+    out_.write(heading);
+    out_.write("</h2>\n");
+    out_.write("  <ol>\n");
+  }
+
+  void item(size_t, std::string_view text) override {
+    out_.write("    <li>");
+    out_.write(text);
+    out_.write("</li>\n");
+  }
+
+  void end_section() override { out_.write("  </ol>\n"); }
+
+  void end_document(std::string_view note) override {
+    if (!note.empty()) {
+      out_.write("  <div class=\"note\">\n");
+      out_.write("    <strong>Note:</strong> ");
+      // `code` spans become <code>
+      bool in_code = false;
+      size_t start = 0;
+      for (size_t i = 0; i <= note.size(); ++i) {
+        if (i == note.size() || note[i] == '`') {
+          out_.write(note.substr(start, i - start));
+          if (i < note.size())
+            out_.write(in_code ? "</code>" : "<code>");
+          in_code = !in_code;
+          start = i + 1;
+        }
+      }
+      out_.write("\n  </div>\n");
+    }
+    out_.write("</body>\n");
+    out_.write("</html>\n");
+  }
+
+private:
+  // Style names can come from a CSL file's title
+  void write_text(std::string_view s) {
+    OutputBuffer buf(Markup::html);
+    out_.write(buf.text(s).view());
+  }
+
+  OutputSink &out_;
+};
+
+class MarkdownRenderer : public Renderer {
+public:
+  explicit MarkdownRenderer(OutputSink &sink) : out_(sink) {}
+
+  Markup markup() const override { return Markup::markdown; }
+
+  void begin_document(std::string_view style,
+                      std::string_view source) override {
+    out_.write("# ");
+    out_.write(style);
+    out_.write(" Citations\n\n");
+    out_.write("Generated from: ");
+    out_.write(source);
+    out_.write("\n\n");
+  }
+
+  void begin_section(std::string_view heading) override {
+    out_.write("## ");
+    out_.write(heading);
+    out_.write("\n\n");
+  }
+
+  void item(size_t number, std::string_view text) override {
+    out_.write_number(number);
+    out_.write(". ");
+    out_.write(text);
+    out_.write("\n\n");
+  }
+
+  void end_section() override {}
+
+  void end_document(std::string_view note) override {
+    if (note.empty())
+      return;
+    out_.write("---\n\n");
+    out_.write("*Note: ");
+    out_.write(note);
+    out_.write("*\n");
+  }
+
+protected:
+  OutputSink &out_;
+};
+
+// Markdown body under a plain banner
+class TerminalRenderer : public MarkdownRenderer {
+public:
+  using MarkdownRenderer::MarkdownRenderer;
+
+  Markup markup() const override { return Markup::terminal; }
+
+  void begin_document(std::string_view style, std::string_view) override {
+    out_.write("\n=== ");
+    out_.write(style);
+    out_.write(" Citations ===\n\n");
+  }
+};
+
+std::unique_ptr<Renderer> create_renderer(OutputFormat format,
+                                          OutputSink &sink) {
+  switch (format) {
+    case OutputFormat::html: return std::make_unique<HtmlRenderer>(sink);
+    case OutputFormat::markdown: return std::make_unique<MarkdownRenderer>(sink);
+    case OutputFormat::terminal: return std::make_unique<TerminalRenderer>(sink);
+  }
+  return nullptr;
+}
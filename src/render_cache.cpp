@@ -0,0 +1,151 @@
+#include "render_cache.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+const char render_magic[8] = {'C', 'I', 'T', 'E', 'R', 'N', 'D', '\0'};
+// Bump whenever formatter output changes, so old renderings are dropped
+const std::uint32_t render_version = 1;
+
+struct RenderHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t markup;
+  std::uint64_t count;
+};
+
+// Reads length-prefixed fields off a mapped buffer, failing on overrun
+class Reader {
+public:
+  Reader(const char *p, size_t n) : p_(p), end_(p + n) {}
+
+  bool u64(std::uint64_t &v) {
+    if (size_t(end_ - p_) < sizeof(v))
+      return false;
+    std::memcpy(&v, p_, sizeof(v));
+    p_ += sizeof(v);
+    return true;
+  }
+  bool str(std::string_view &s) {
+    std::uint64_t n;
+    if (!u64(n) || n > size_t(end_ - p_))
+      return false;
+    s = std::string_view(p_, n);
+    p_ += n;
+    return true;
+  }
+
+private:
+  const char *p_;
+  const char *end_;
+};
+
+void put_u64(std::ofstream &out, std::uint64_t v) {
+  out.write(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+void put_str(std::ofstream &out, std::string_view s) {
+  put_u64(out, s.size());
+  out.write(s.data(), s.size());
+}
+
+} // namespace
+
+std::string RenderCache::path_for(const std::string &library,
+                                  const std::string &output_file) {
+  if (!output_file.empty())
+    return output_file + ".citecache";
+  return std::filesystem::path(library)
+      .replace_extension(".terminal.citecache")
+      .string();
+}
+
+bool RenderCache::load(const std::string &path, Markup markup) {
+  entries_.clear();
+  file_.close();
+  std::error_code ec;
+  if (!std::filesystem::exists(path, ec) || !file_.open(path))
+    return false;
+
+  RenderHeader header;
+  if (file_.size() < sizeof(header))
+    return false;
+  std::memcpy(&header, file_.data(), sizeof(header));
+  if (std::memcmp(header.magic, render_magic, sizeof(render_magic)) != 0 ||
+      header.version != render_version ||
+      header.markup != static_cast<std::uint32_t>(markup))
+    return false;
+
+  // Every entry takes at least its four length prefixes and its hash, so
+  // a count the file cannot hold is a damaged header
+  const size_t body_size = file_.size() - sizeof(header);
+  if (header.count > body_size / (5 * sizeof(std::uint64_t)))
+    return false;
+
+  Reader in(file_.data() + sizeof(header), body_size);
+  entries_.reserve(header.count);
+  for (std::uint64_t i = 0; i < header.count; ++i) {
+    std::string_view id;
+    Entry e;
+    if (!in.str(id) || !in.u64(e.hash) || !in.str(e.bundle.bibliography) ||
+        !in.str(e.bundle.long_footnote) || !in.str(e.bundle.short_footnote)) {
+      entries_.clear();
+      return false;
+    }
+    entries_.emplace(id, e);
+  }
+  return true;
+}
+
+const ChicagoCitationBundle *RenderCache::find(std::string_view id,
+                                               std::uint64_t hash) const {
+  auto it = entries_.find(id);
+  if (it == entries_.end() || it->second.hash != hash)
+    return nullptr;
+  return &it->second.bundle;
+}
+
+bool RenderCache::save(const std::string &path, Markup markup,
+                       const std::vector<Citation> &entries,
+                       const std::vector<std::uint64_t> &hashes,
+                       const std::vector<ChicagoCitationBundle> &bundles) {
+  RenderHeader header{};
+  std::memcpy(header.magic, render_magic, sizeof(render_magic));
+  header.version = render_version;
+  header.markup = static_cast<std::uint32_t>(markup);
+  for (const auto &c : entries)
+    if (c.has(Field::id))
+      ++header.count;
+
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (!entries[i].has(Field::id))
+        continue;
+      put_str(out, entries[i].get(Field::id));
+      put_u64(out, hashes[i]);
+      put_str(out, bundles[i].bibliography);
+      put_str(out, bundles[i].long_footnote);
+      put_str(out, bundles[i].short_footnote);
+    }
+    if (!out.flush())
+      return false;
+  }
+
+  // The old file may still be mapped by the caller; rename leaves that
+  // mapping intact
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) {
+    std::error_code ignored;
+    std::filesystem::remove(tmp, ignored);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,310 @@
+#include "run_stats.hpp"
+#include "http_client.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#ifdef CITE_COUNT_ALLOCATIONS
+// Counting replacements for the global allocation functions. The
+// counters are relaxed atomics: one uncontended add per call.
+static std::atomic<std::uint64_t> allocations{0};
+static std::atomic<std::uint64_t> frees{0};
+static std::atomic<std::uint64_t> allocated_bytes{0};
+
+static void *counted_alloc(std::size_t n) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(n, std::memory_order_relaxed);
+  return std::malloc(n ? n : 1);
+}
+
+static void counted_free(void *p) noexcept {
+  if (!p)
+    return;
+  frees.fetch_add(1, std::memory_order_relaxed);
+  std::free(p);
+}
+
+void *operator new(std::size_t n) {
+  if (void *p = counted_alloc(n))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t n) {
+  if (void *p = counted_alloc(n))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new(std::size_t n, const std::nothrow_t &) noexcept {
+  return counted_alloc(n);
+}
+void *operator new[](std::size_t n, const std::nothrow_t &) noexcept {
+  return counted_alloc(n);
+}
+void operator delete(void *p) noexcept { counted_free(p); }
+void operator delete[](void *p) noexcept { counted_free(p); }
+void operator delete(void *p, std::size_t) noexcept { counted_free(p); }
+void operator delete[](void *p, std::size_t) noexcept { counted_free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  counted_free(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  counted_free(p);
+}
+
+bool allocation_counting_enabled() { return true; }
+
+AllocationCounts allocation_counts() {
+  AllocationCounts c;
+  c.allocations = allocations.load(std::memory_order_relaxed);
+  c.frees = frees.load(std::memory_order_relaxed);
+  c.bytes = allocated_bytes.load(std::memory_order_relaxed);
+  return c;
+}
+#else
+bool allocation_counting_enabled() { return false; }
+
+AllocationCounts allocation_counts() { return AllocationCounts(); }
+#endif
+
+std::uint64_t peak_rss_bytes() {
+#ifndef _WIN32
+  struct rusage usage;
+  if (::getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return static_cast<std::uint64_t>(usage.ru_maxrss); // bytes
+#else
+  return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024; // KiB
+#endif
+#else
+  return 0;
+#endif
+}
+
+static double cpu_seconds(std::clock_t from, std::clock_t to) {
+  return static_cast<double>(to - from) / CLOCKS_PER_SEC;
+}
+
+static AllocationCounts operator-(const AllocationCounts &a,
+                                  const AllocationCounts &b) {
+  AllocationCounts d;
+  d.allocations = a.allocations - b.allocations;
+  d.frees = a.frees - b.frees;
+  d.bytes = a.bytes - b.bytes;
+  return d;
+}
+
+RunStats::Phase::Phase(RunStats *stats, std::string name)
+    : stats_(stats), name_(std::move(name)) {
+  if (!stats_)
+    return;
+  heap_ = allocation_counts();
+  cpu_ = std::clock();
+  wall_ = std::chrono::steady_clock::now();
+}
+
+RunStats::Phase::Phase(Phase &&other) noexcept
+    : stats_(other.stats_), name_(std::move(other.name_)), wall_(other.wall_),
+      cpu_(other.cpu_), heap_(other.heap_) {
+  other.stats_ = nullptr;
+}
+
+RunStats::Phase::~Phase() { end(); }
+
+void RunStats::Phase::end() {
+  if (!stats_)
+    return;
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wall_;
+  PhaseTimes p;
+  p.name = std::move(name_);
+  p.wall_s = wall.count();
+  p.cpu_s = cpu_seconds(cpu_, std::clock());
+  p.heap = allocation_counts() - heap_;
+  stats_->add_phase(std::move(p));
+  stats_ = nullptr;
+}
+
+RunStats::RunStats(std::string command, bool enabled)
+    : command_(std::move(command)), enabled_(enabled),
+      started_(std::chrono::steady_clock::now()), started_cpu_(std::clock()) {}
+
+// A phase run more than once (such as several writes) accumulates
+void RunStats::add_phase(PhaseTimes phase) {
+  for (PhaseTimes &p : phases_) {
+    if (p.name != phase.name)
+      continue;
+    p.wall_s += phase.wall_s;
+    p.cpu_s += phase.cpu_s;
+    p.heap.allocations += phase.heap.allocations;
+    p.heap.frees += phase.heap.frees;
+    p.heap.bytes += phase.heap.bytes;
+    return;
+  }
+  phases_.push_back(std::move(phase));
+}
+
+void RunStats::split_phase(const std::string &from, std::string name,
+                           double wall_s, double cpu_s) {
+  if (!enabled_)
+    return;
+  for (PhaseTimes &p : phases_) {
+    if (p.name == from) {
+      p.wall_s = std::max(p.wall_s - wall_s, 0.0);
+      p.cpu_s = std::max(p.cpu_s - cpu_s, 0.0);
+    }
+  }
+  PhaseTimes p;
+  p.name = std::move(name);
+  p.wall_s = wall_s;
+  p.cpu_s = cpu_s;
+  add_phase(std::move(p));
+}
+
+void RunStats::add_request(const HttpTiming &timing) {
+  if (!enabled_)
+    return;
+  ++requests_;
+  dns_s_ += timing.dns_s;
+  connect_s_ += timing.connect_s;
+  tls_s_ += timing.tls_s;
+  transfer_s_ += timing.transfer_s;
+}
+
+nlohmann::json RunStats::to_json() const {
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - started_;
+  double cpu = cpu_seconds(started_cpu_, std::clock());
+  bool counting = allocation_counting_enabled();
+
+  nlohmann::json phases = nlohmann::json::array();
+  for (const PhaseTimes &p : phases_) {
+    nlohmann::json phase = {
+        {"name", p.name}, {"wall_s", p.wall_s}, {"cpu_s", p.cpu_s}};
+    if (counting) {
+      phase["allocations"] = p.heap.allocations;
+      phase["allocated_bytes"] = p.heap.bytes;
+    }
+    phases.push_back(std::move(phase));
+  }
+
+  nlohmann::json j = {
+      {"command", command_},
+      {"wall_s", wall.count()},
+      {"cpu_s", cpu},
+      {"records", records_},
+      {"records_per_s",
+       wall.count() > 0 ? static_cast<double>(records_) / wall.count() : 0.0},
+      {"bytes_written", bytes_written_},
+      {"peak_rss_bytes", peak_rss_bytes()},
+      {"phases", std::move(phases)}};
+  if (counting) {
+    AllocationCounts heap = allocation_counts();
+    j["allocations"] = {{"allocations", heap.allocations},
+                        {"frees", heap.frees},
+                        {"allocated_bytes", heap.bytes}};
+  } else {
+    j["allocations"] = nullptr;
+  }
+  if (requests_ > 0)
+    j["network"] = {{"requests", requests_},
+                    {"dns_s", dns_s_},
+                    {"connect_s", connect_s_},
+                    {"tls_s", tls_s_},
+                    {"transfer_s", transfer_s_}};
+  return j;
+}
+
+static std::string human_seconds(double s) {
+  char buf[32];
+  if (s < 1)
+    std::snprintf(buf, sizeof(buf), "%.1f ms", s * 1e3);
+  else
+    std::snprintf(buf, sizeof(buf), "%.2f s", s);
+  return buf;
+}
+
+static std::string human_bytes(double n) {
+  static const char *units[] = {"B", "KiB", "MiB", "GiB"};
+  int u = 0;
+  while (n >= 1024 && u < 3) {
+    n /= 1024;
+    ++u;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), u == 0 ? "%.0f %s" : "%.1f %s", n, units[u]);
+  return buf;
+}
+
+void RunStats::print(std::ostream &out) const {
+  nlohmann::json j = to_json();
+  bool counting = allocation_counting_enabled();
+  char line[128];
+
+  out << "\n=== Stats (" << command_ << ") ===\n";
+  std::snprintf(line, sizeof(line), "  %-14s %12s %12s", "phase", "wall", "cpu");
+  out << line << (counting ? "       allocs   allocated\n" : "\n");
+  auto row = [&](const std::string &name, double wall, double cpu,
+                 const AllocationCounts *heap) {
+    std::snprintf(line, sizeof(line), "  %-14s %12s %12s", name.c_str(),
+                  human_seconds(wall).c_str(), human_seconds(cpu).c_str());
+    out << line;
+    if (counting && heap) {
+      std::snprintf(line, sizeof(line), " %12llu %11s",
+                    static_cast<unsigned long long>(heap->allocations),
+                    human_bytes(static_cast<double>(heap->bytes)).c_str());
+      out << line;
+    }
+    out << "\n";
+  };
+  for (const PhaseTimes &p : phases_)
+    row(p.name, p.wall_s, p.cpu_s, &p.heap);
+  AllocationCounts total = allocation_counts();
+  row("total", j["wall_s"].get<double>(), j["cpu_s"].get<double>(), &total);
+
+  if (records_ > 0) {
+    std::snprintf(line, sizeof(line), "  %llu records, %.0f records/s\n",
+                  static_cast<unsigned long long>(records_),
+                  j["records_per_s"].get<double>());
+    out << line;
+  }
+  if (bytes_written_ > 0)
+    out << "  " << human_bytes(static_cast<double>(bytes_written_))
+        << " written\n";
+  if (std::uint64_t rss = peak_rss_bytes())
+    out << "  peak RSS " << human_bytes(static_cast<double>(rss)) << "\n";
+  if (!counting)
+    out << "  (allocation counts need a build with "
+           "-DCITE_COUNT_ALLOCATIONS=ON)\n";
+  if (requests_ > 0)
+    out << "  network: " << requests_ << " requests, dns "
+        << human_seconds(dns_s_) << ", connect " << human_seconds(connect_s_)
+        << ", tls " << human_seconds(tls_s_) << ", transfer "
+        << human_seconds(transfer_s_) << " (summed over requests)\n";
+}
+
+bool RunStats::report(bool human, const std::string &json_path) const {
+  if (!enabled_)
+    return true;
+  if (human)
+    print(std::cerr);
+  if (json_path.empty())
+    return true;
+  std::string text = to_json().dump(2) + "\n";
+  if (json_path == "-") {
+    std::cout << text;
+    return true;
+  }
+  std::ofstream out(json_path, std::ios::binary);
+  if (!out || !(out << text) || !out.flush()) {
+    std::cerr << "Error: Cannot write stats to " << json_path << "\n";
+    return false;
+  }
+  return true;
+}
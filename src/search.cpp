@@ -0,0 +1,59 @@
+#include "search.hpp"
+#include "library.hpp"
+#include "parallel.hpp"
+#include "search_index.hpp"
+#include <algorithm>
+#include <iostream>
+
+int cite_search(const std::string &filename, const std::string &query,
+                size_t limit) {
+  std::string error;
+  std::vector<std::string> shards = library_shards(filename, error);
+  if (shards.empty()) {
+    std::cerr << "Error: " << error << "\n";
+    return 2;
+  }
+
+  // Every shard keeps its own index; stale ones are rebuilt in parallel
+  std::vector<SearchIndex> indexes(shards.size());
+  std::vector<std::string> errors(shards.size());
+  std::vector<char> rebuilt(shards.size(), 0);
+  parallel_for_each_index(shards.size(), 0, [&](size_t i) {
+    bool fresh = false;
+    if (indexes[i].open(shards[i], &errors[i], &fresh))
+      rebuilt[i] = fresh;
+    else if (errors[i].empty())
+      errors[i] = "cannot index " + shards[i];
+  });
+  for (size_t i = 0; i < shards.size(); ++i) {
+    if (!errors[i].empty()) {
+      std::cerr << "Error: " << errors[i] << "\n";
+      return 2;
+    }
+    if (rebuilt[i])
+      std::cerr << "Indexed " << indexes[i].size() << " entries into "
+                << search_index_path(shards[i]) << "\n";
+  }
+
+  // Hits in library order: shard by shard
+  std::vector<std::pair<size_t, size_t>> hits;
+  for (size_t i = 0; i < indexes.size(); ++i)
+    for (size_t record : indexes[i].search(query))
+      hits.emplace_back(i, record);
+  if (hits.empty()) {
+    std::cout << "No entries match \"" << query << "\"\n";
+    return 1;
+  }
+
+  size_t shown = limit == 0 ? hits.size() : std::min(limit, hits.size());
+  for (size_t k = 0; k < shown; ++k) {
+    SearchIndex::Hit hit = indexes[hits[k].first].record(hits[k].second);
+    std::cout << (hit.id.empty() ? "(no id)" : hit.id) << "  " << hit.summary
+              << "\n";
+  }
+  std::cout << "\n" << hits.size() << (hits.size() == 1 ? " match" : " matches");
+  if (shown < hits.size())
+    std::cout << " (showing " << shown << ", use --limit to see more)";
+  std::cout << "\n";
+  return 0;
+}
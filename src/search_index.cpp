@@ -0,0 +1,560 @@
+#include "search_index.hpp"
+#include "hash.hpp"
+#include "journal.hpp"
+#include "library.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+
+namespace {
+
+const char index_magic[8] = {'C', 'I', 'T', 'E', 'I', 'D', 'X', '\0'};
+const std::uint32_t index_version = 2;
+const std::uint32_t byte_order_mark = 0x01020304;
+const std::uint32_t no_record = 0xffffffffu;
+
+// Followed by the record table, the sorted term table, the postings (u32
+// record numbers, padded to 8 bytes), the identifier hash table and the
+// string pool everything else points into
+struct IndexHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint64_t library_size;
+  std::int64_t library_mtime;
+  std::uint64_t record_count;
+  std::uint64_t term_count;
+  std::uint64_t posting_count;
+  std::uint64_t slot_count; // power of two
+  std::uint64_t strings_size;
+};
+static_assert(sizeof(IndexHeader) == 72, "IndexHeader layout");
+
+struct RecordEntry {
+  std::uint32_t id_offset, id_length;
+  std::uint32_t summary_offset, summary_length;
+};
+
+struct TermEntry {
+  std::uint32_t offset, length; // term text
+  std::uint32_t first, count;   // range of postings
+};
+
+// Open-addressing slot keyed by "doi:<doi>" or "isbn:<isbn>"
+struct IdSlot {
+  std::uint64_t hash;
+  std::uint32_t offset, length;
+  std::uint32_t record; // no_record when empty
+  std::uint32_t reserved;
+};
+static_assert(sizeof(IdSlot) == 24, "IdSlot layout");
+
+size_t padded(size_t n) { return (n + 7) & ~size_t(7); }
+
+bool is_token_char(unsigned char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+// Case-folded runs of letters and digits; non-ASCII bytes are kept as-is
+template <typename F> void for_each_token(std::string_view text, F &&fn) {
+  std::string token;
+  for (char ch : text) {
+    unsigned char c = static_cast<unsigned char>(ch);
+    if (is_token_char(c)) {
+      token += (c >= 'A' && c <= 'Z') ? static_cast<char>(c + 32) : ch;
+    } else if (!token.empty()) {
+      fn(token);
+      token.clear();
+    }
+  }
+  if (!token.empty())
+    fn(token);
+}
+
+std::vector<std::string> record_tokens(const Citation &c) {
+  std::vector<std::string> tokens;
+  auto add = [&tokens](const std::string &t) { tokens.push_back(t); };
+  for_each_token(c.get(Field::title), add);
+  for (const ParsedName &n : c.names)
+    for_each_token(c.text(n.last), add);
+  for_each_token(c.get(Field::journal_name), add);
+  for_each_token(c.get(Field::year), add);
+  for_each_token(c.get(Field::id), add);
+  for_each_token(c.get(Field::doi), add);
+  if (c.has(Field::isbn)) {
+    for_each_token(c.get(Field::isbn), add);
+    tokens.push_back(normalized_isbn(c.get(Field::isbn)));
+  }
+  std::sort(tokens.begin(), tokens.end());
+  tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+  return tokens;
+}
+
+} // namespace
+
+std::string record_summary(const Citation &c) {
+  std::string s;
+  const size_t authors = c.author_count;
+  for (size_t i = 0; i < authors && i < 2; ++i) {
+    if (i > 0)
+      s += authors == 2 ? " and " : ", ";
+    s += c.text(c.author(i).last);
+  }
+  if (authors > 2)
+    s += " et al.";
+  if (!s.empty())
+    s += s.back() == '.' ? " " : ". ";
+  s += c.has(Field::title) ? c.get(Field::title) : "Untitled";
+  if (c.has(Field::year)) {
+    s += " (";
+    s += c.get(Field::year);
+    s += ')';
+  }
+  return s;
+}
+
+namespace {
+
+bool file_stamp(const std::string &path, std::uint64_t &size,
+                std::int64_t &mtime) {
+  std::error_code ec;
+  size = std::filesystem::file_size(path, ec);
+  if (ec)
+    return false;
+  auto t = std::filesystem::last_write_time(path, ec);
+  if (ec)
+    return false;
+  mtime = static_cast<std::int64_t>(t.time_since_epoch().count());
+  return true;
+}
+
+template <typename T> void put(std::string &out, const T &value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> T get_at(const char *base, size_t i) {
+  T value;
+  std::memcpy(&value, base + i * sizeof(T), sizeof(T));
+  return value;
+}
+
+// Serializes the index for `entries`; false if it outgrows 32-bit offsets
+bool build_index(const std::vector<Citation> &entries,
+                 std::uint64_t library_size, std::int64_t library_mtime,
+                 std::string &out) {
+  std::string strings;
+  auto intern_string = [&strings](std::string_view s, std::uint32_t &offset,
+                                  std::uint32_t &length) {
+    offset = static_cast<std::uint32_t>(strings.size());
+    length = static_cast<std::uint32_t>(s.size());
+    strings.append(s.data(), s.size());
+  };
+
+  std::vector<RecordEntry> records(entries.size());
+  std::unordered_map<std::string, std::uint32_t> term_ids;
+  std::vector<std::vector<std::uint32_t>> postings;
+  std::vector<std::pair<std::string, std::uint32_t>> keys;
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const Citation &c = entries[i];
+    intern_string(c.get(Field::id), records[i].id_offset, records[i].id_length);
+    intern_string(record_summary(c), records[i].summary_offset,
+                  records[i].summary_length);
+    for (const std::string &token : record_tokens(c)) {
+      auto it = term_ids.emplace(token, static_cast<std::uint32_t>(postings.size()));
+      if (it.second)
+        postings.emplace_back();
+      postings[it.first->second].push_back(static_cast<std::uint32_t>(i));
+    }
+    for (std::string &key : identifier_keys(c))
+      keys.emplace_back(std::move(key), static_cast<std::uint32_t>(i));
+  }
+
+  std::vector<std::pair<std::string_view, std::uint32_t>> sorted(
+      term_ids.begin(), term_ids.end());
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<TermEntry> terms;
+  terms.reserve(sorted.size());
+  std::vector<std::uint32_t> all_postings;
+  for (const auto &t : sorted) {
+    TermEntry e;
+    intern_string(t.first, e.offset, e.length);
+    const auto &list = postings[t.second];
+    e.first = static_cast<std::uint32_t>(all_postings.size());
+    e.count = static_cast<std::uint32_t>(list.size());
+    all_postings.insert(all_postings.end(), list.begin(), list.end());
+    terms.push_back(e);
+  }
+
+  size_t slot_count = 16;
+  while (slot_count < keys.size() * 2)
+    slot_count *= 2;
+  std::vector<IdSlot> slots(slot_count, IdSlot{0, 0, 0, no_record, 0});
+  for (const auto &key : keys) {
+    std::uint64_t h = hash_bytes(key.first);
+    for (size_t s = h & (slot_count - 1);; s = (s + 1) & (slot_count - 1)) {
+      IdSlot &slot = slots[s];
+      if (slot.record == no_record) {
+        slot.hash = h;
+        intern_string(key.first, slot.offset, slot.length);
+        slot.record = key.second;
+        break;
+      }
+      // The first record with an identifier keeps it
+      if (slot.hash == h &&
+          std::string_view(strings).substr(slot.offset, slot.length) == key.first)
+        break;
+    }
+  }
+
+  if (strings.size() > 0xffffffffu || all_postings.size() > 0xffffffffu)
+    return false;
+
+  IndexHeader header{};
+  std::memcpy(header.magic, index_magic, sizeof(index_magic));
+  header.version = index_version;
+  header.byte_order = byte_order_mark;
+  header.library_size = library_size;
+  header.library_mtime = library_mtime;
+  header.record_count = records.size();
+  header.term_count = terms.size();
+  header.posting_count = all_postings.size();
+  header.slot_count = slot_count;
+  header.strings_size = strings.size();
+
+  out.clear();
+  put(out, header);
+  out.append(reinterpret_cast<const char *>(records.data()),
+             records.size() * sizeof(RecordEntry));
+  out.append(reinterpret_cast<const char *>(terms.data()),
+             terms.size() * sizeof(TermEntry));
+  out.append(reinterpret_cast<const char *>(all_postings.data()),
+             all_postings.size() * sizeof(std::uint32_t));
+  out.resize(padded(out.size()), '\0');
+  out.append(reinterpret_cast<const char *>(slots.data()),
+             slots.size() * sizeof(IdSlot));
+  out += strings;
+  return true;
+}
+
+bool write_file_atomic(const std::string &path, const std::string &bytes) {
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    if (!out) {
+      out.close();
+      std::error_code ec;
+      std::filesystem::remove(tmp, ec);
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) {
+    std::error_code ignored;
+    std::filesystem::remove(tmp, ignored);
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+std::vector<std::string> identifier_keys(const Citation &c) {
+  std::vector<std::string> keys;
+  if (c.has(Field::doi))
+    keys.push_back("doi:" + normalized_doi(c.get(Field::doi)));
+  if (c.has(Field::isbn))
+    keys.push_back("isbn:" + normalized_isbn(c.get(Field::isbn)));
+  return keys;
+}
+
+std::string search_index_path(const std::string &library) {
+  return std::filesystem::path(library).replace_extension(".citeidx").string();
+}
+
+std::string normalized_doi(std::string_view doi) {
+  while (!doi.empty() && doi.front() == ' ')
+    doi.remove_prefix(1);
+  while (!doi.empty() && doi.back() == ' ')
+    doi.remove_suffix(1);
+  for (std::string_view prefix : {"https://doi.org/", "http://doi.org/",
+                                  "https://dx.doi.org/", "http://dx.doi.org/",
+                                  "doi:"}) {
+    if (doi.size() >= prefix.size() &&
+        std::equal(prefix.begin(), prefix.end(), doi.begin(),
+                   [](char a, char b) {
+                     return a == (b >= 'A' && b <= 'Z' ? b + 32 : b);
+                   })) {
+      doi.remove_prefix(prefix.size());
+      break;
+    }
+  }
+  std::string out(doi);
+  for (char &ch : out)
+    if (ch >= 'A' && ch <= 'Z')
+      ch = static_cast<char>(ch + 32);
+  return out;
+}
+
+std::string normalized_isbn(std::string_view isbn) {
+  std::string out;
+  for (char ch : isbn) {
+    if (ch >= '0' && ch <= '9')
+      out += ch;
+    else if (ch == 'x' || ch == 'X')
+      out += 'X';
+  }
+  // ISBN-10 -> 978 prefix, same nine digits, recomputed check digit
+  if (out.size() == 10 && out.find('X') >= 9) {
+    std::string isbn13 = "978" + out.substr(0, 9);
+    int sum = 0;
+    for (size_t i = 0; i < 12; ++i)
+      sum += (isbn13[i] - '0') * (i % 2 ? 3 : 1);
+    isbn13 += static_cast<char>('0' + (10 - sum % 10) % 10);
+    return isbn13;
+  }
+  return out;
+}
+
+bool SearchIndex::attach(std::string_view bytes, std::uint64_t size,
+                         std::int64_t mtime) {
+  if (bytes.size() < sizeof(IndexHeader))
+    return false;
+  IndexHeader header;
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (std::memcmp(header.magic, index_magic, sizeof(index_magic)) != 0 ||
+      header.version != index_version ||
+      header.byte_order != byte_order_mark || header.library_size != size ||
+      header.library_mtime != mtime)
+    return false;
+
+  // Every count is checked against the file size before it is multiplied
+  const std::uint64_t limit = bytes.size();
+  if (header.record_count > limit || header.term_count > limit ||
+      header.posting_count > limit || header.slot_count > limit ||
+      header.strings_size > limit || header.slot_count == 0 ||
+      (header.slot_count & (header.slot_count - 1)) != 0)
+    return false;
+  std::uint64_t offset = sizeof(IndexHeader);
+  const std::uint64_t records = offset;
+  offset += header.record_count * sizeof(RecordEntry);
+  const std::uint64_t terms = offset;
+  offset += header.term_count * sizeof(TermEntry);
+  const std::uint64_t posts = offset;
+  offset = padded(offset + header.posting_count * sizeof(std::uint32_t));
+  const std::uint64_t slots = offset;
+  offset += header.slot_count * sizeof(IdSlot);
+  const std::uint64_t strings = offset;
+  if (offset + header.strings_size != bytes.size())
+    return false;
+
+  record_count_ = header.record_count;
+  term_count_ = header.term_count;
+  posting_count_ = header.posting_count;
+  slot_count_ = header.slot_count;
+  strings_size_ = header.strings_size;
+  records_ = bytes.data() + records;
+  terms_ = bytes.data() + terms;
+  postings_ = bytes.data() + posts;
+  slots_ = bytes.data() + slots;
+  strings_ = bytes.data() + strings;
+  return true;
+}
+
+// Entries are bounds-checked as they are read, so opening stays O(1)
+std::string_view SearchIndex::string_at(std::uint32_t offset,
+                                        std::uint32_t length) const {
+  if (offset > strings_size_ || length > strings_size_ - offset)
+    return {};
+  return std::string_view(strings_ + offset, length);
+}
+
+bool SearchIndex::open(const std::string &library, std::string *error,
+                       bool *rebuilt) {
+  *this = SearchIndex();
+  if (rebuilt)
+    *rebuilt = false;
+
+  std::uint64_t size = 0;
+  std::int64_t mtime = 0;
+  if (!file_stamp(library, size, mtime)) {
+    if (error)
+      *error = "cannot open " + library;
+    return false;
+  }
+
+  const std::string path = search_index_path(library);
+  bool ok = file_.open(path) && attach(file_.view(), size, mtime);
+  if (!ok) {
+    file_.close();
+    Library lib;
+    LibraryLoadOptions options;
+    options.include_journal = false;
+    if (load_library(library, lib, options) != 0 ||
+        !build_index(lib.entries, size, mtime, built_)) {
+      if (error)
+        *error = "cannot index " + library;
+      return false;
+    }
+    // A library we cannot write next to is still searchable, just not
+    // from a saved index next time
+    if (write_file_atomic(path, built_) && file_.open(path) &&
+        attach(file_.view(), size, mtime)) {
+      built_.clear();
+      built_.shrink_to_fit();
+    } else {
+      file_.close();
+      attach(built_, size, mtime);
+    }
+    if (rebuilt)
+      *rebuilt = true;
+  }
+
+  // Only built if the library changed since the journal was started
+  std::unordered_set<std::string_view> ids;
+  bool have_ids = false;
+  auto in_library = [&](const std::string &id) {
+    if (!have_ids) {
+      for (size_t i = 0; i < record_count_; ++i)
+        ids.insert(record(i).id);
+      have_ids = true;
+    }
+    return ids.count(id) > 0;
+  };
+  for_each_journal_record(library, record_count_, in_library,
+                          [this](nlohmann::json &&record) {
+    Citation c = decode_citation(record);
+    const size_t number = record_count_ + pending_.size();
+    for (std::string &key : identifier_keys(c))
+      if (find_key(key) == npos)
+        pending_keys_.emplace(std::move(key), number);
+    pending_.push_back(
+        {std::string(c.get(Field::id)), record_summary(c), record_tokens(c)});
+    return true;
+  });
+  return true;
+}
+
+std::uint32_t SearchIndex::posting(size_t i) const {
+  return get_at<std::uint32_t>(postings_, i);
+}
+
+bool SearchIndex::find_term(std::string_view token, size_t &first,
+                            size_t &count) const {
+  size_t lo = 0, hi = term_count_;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    auto t = get_at<TermEntry>(terms_, mid);
+    int cmp = string_at(t.offset, t.length).compare(token);
+    if (cmp == 0) {
+      if (t.first > posting_count_ || t.count > posting_count_ - t.first)
+        return false;
+      first = t.first;
+      count = t.count;
+      return true;
+    }
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return false;
+}
+
+std::vector<size_t> SearchIndex::search(std::string_view query) const {
+  std::vector<std::string> tokens;
+  for_each_token(query, [&tokens](const std::string &t) { tokens.push_back(t); });
+  std::sort(tokens.begin(), tokens.end());
+  tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+
+  std::vector<size_t> hits;
+  if (tokens.empty())
+    return hits;
+
+  // Intersect posting lists, shortest first
+  struct Range {
+    size_t first, count;
+  };
+  std::vector<Range> ranges;
+  bool all_found = true;
+  for (const std::string &t : tokens) {
+    Range r;
+    if (!find_term(t, r.first, r.count)) {
+      all_found = false;
+      break;
+    }
+    ranges.push_back(r);
+  }
+  if (all_found) {
+    std::sort(ranges.begin(), ranges.end(),
+              [](const Range &a, const Range &b) { return a.count < b.count; });
+    for (size_t i = 0; i < ranges[0].count; ++i) {
+      std::uint32_t h = posting(ranges[0].first + i);
+      if (h < record_count_)
+        hits.push_back(h);
+    }
+    for (size_t k = 1; k < ranges.size() && !hits.empty(); ++k) {
+      size_t out = 0, pos = ranges[k].first;
+      const size_t end = ranges[k].first + ranges[k].count;
+      for (size_t h : hits) {
+        // Postings are sorted, so each list is walked once
+        while (pos < end && posting(pos) < h)
+          ++pos;
+        if (pos < end && posting(pos) == h)
+          hits[out++] = h;
+      }
+      hits.resize(out);
+    }
+  }
+
+  for (size_t j = 0; j < pending_.size(); ++j) {
+    const auto &have = pending_[j].tokens;
+    if (std::all_of(tokens.begin(), tokens.end(), [&have](const std::string &t) {
+          return std::binary_search(have.begin(), have.end(), t);
+        }))
+      hits.push_back(record_count_ + j);
+  }
+  return hits;
+}
+
+SearchIndex::Hit SearchIndex::record(size_t i) const {
+  if (i >= record_count_) {
+    const Pending &p = pending_[i - record_count_];
+    return {p.id, p.summary};
+  }
+  auto r = get_at<RecordEntry>(records_, i);
+  return {string_at(r.id_offset, r.id_length),
+          string_at(r.summary_offset, r.summary_length)};
+}
+
+size_t SearchIndex::find_key(const std::string &key) const {
+  if (slot_count_ > 0) {
+    std::uint64_t h = hash_bytes(key);
+    for (size_t s = h & (slot_count_ - 1), probes = 0; probes < slot_count_;
+         s = (s + 1) & (slot_count_ - 1), ++probes) {
+      auto slot = get_at<IdSlot>(slots_, s);
+      if (slot.record == no_record)
+        break;
+      if (slot.hash == h && string_at(slot.offset, slot.length) == key &&
+          slot.record < record_count_)
+        return slot.record;
+    }
+  }
+  auto it = pending_keys_.find(key);
+  return it == pending_keys_.end() ? npos : it->second;
+}
+
+size_t SearchIndex::find_doi(std::string_view doi) const {
+  return find_key("doi:" + normalized_doi(doi));
+}
+
+size_t SearchIndex::find_isbn(std::string_view isbn) const {
+  return find_key("isbn:" + normalized_isbn(isbn));
+}
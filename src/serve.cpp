@@ -0,0 +1,797 @@
+#include "serve.hpp"
+#include "../include/format_memo.hpp"
+#include "../include/library.hpp"
+#include "../include/file_watch.hpp"
+#include "../include/parallel.hpp"
+#include "../include/render.hpp"
+#include "../include/search_index.hpp"
+#include "hash.hpp"
+#include <iostream>
+
+#ifndef _WIN32
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void request_stop(int) { stop_requested = 1; }
+
+// Largest request head accepted; requests carry everything in the URL
+const size_t max_request_head = 16 * 1024;
+
+// Idle keep-alive connections are closed after this long, and a client
+// has this long to finish sending a request it has started
+const int idle_timeout_s = 5;
+
+// One loaded version of a library. Never modified once published, so
+// any number of requests can read it while a newer one is being built.
+struct Snapshot {
+  Library library;
+  std::unordered_map<std::string_view, size_t> by_id;
+  std::vector<size_t> order;          // Chicago bibliography order
+  std::vector<std::uint64_t> hashes;  // citation_hash() per entry
+  std::vector<SearchIndex> indexes;   // one per shard, in library order
+  bool searchable = false;
+};
+
+std::shared_ptr<const Snapshot> load_snapshot(const std::string &path) {
+  auto snap = std::make_shared<Snapshot>();
+  if (load_library(path, snap->library) != 0)
+    return nullptr;
+  const std::vector<Citation> &entries = snap->library.entries;
+  snap->by_id.reserve(entries.size());
+  snap->hashes.reserve(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].has(Field::id))
+      snap->by_id.emplace(entries[i].get(Field::id), i);
+    snap->hashes.push_back(citation_hash(entries[i]));
+  }
+  snap->order = library_sort_order(snap->library);
+
+  // Every shard keeps its own index, as with `cite search`
+  std::string error;
+  std::vector<std::string> shards = library_shards(path, error);
+  snap->indexes.resize(shards.size());
+  std::vector<std::string> errors(shards.size());
+  std::vector<char> opened(shards.size(), 0);
+  parallel_for_each_index(shards.size(), 0, [&](size_t i) {
+    opened[i] = snap->indexes[i].open(shards[i], &errors[i]);
+  });
+  snap->searchable = !shards.empty();
+  for (size_t i = 0; i < shards.size() && snap->searchable; ++i) {
+    if (!opened[i]) {
+      snap->searchable = false;
+      error = errors[i].empty() ? "cannot index " + shards[i] : errors[i];
+    }
+  }
+  if (!snap->searchable) {
+    snap->indexes.clear();
+    std::cerr << "Warning: search unavailable for " << path << ": " << error
+              << "\n";
+  }
+  return snap;
+}
+
+struct Hosted {
+  std::string path;
+  std::string name; // file name without extension
+  LiveSnapshot<Snapshot> live;
+};
+
+struct Request {
+  std::string method;
+  std::string path;
+  std::vector<std::pair<std::string, std::string>> params;
+  bool keep_alive = true;
+
+  const std::string *param(std::string_view key) const {
+    for (const auto &p : params)
+      if (p.first == key)
+        return &p.second;
+    return nullptr;
+  }
+};
+
+// An open client connection. Between requests, and while a request head
+// is still arriving, it is watched by the poller, so idle or slow clients
+// do not tie up a worker thread.
+struct Connection {
+  int fd = -1;
+  std::string buffer; // bytes received but not yet handled
+  // End of the last response, or the first byte of a request still
+  // arriving; the connection is closed idle_timeout_s after it
+  std::chrono::steady_clock::time_point last_active;
+};
+
+struct Response {
+  int status = 200;
+  std::string type = "application/json";
+  std::string body;
+};
+
+Response error_response(int status, const std::string &message) {
+  Response r;
+  r.status = status;
+  r.body = nlohmann::json{{"error", message}}.dump() + "\n";
+  return r;
+}
+
+const char *status_text(int status) {
+  switch (status) {
+  case 200: return "OK";
+  case 400: return "Bad Request";
+  case 404: return "Not Found";
+  case 405: return "Method Not Allowed";
+  case 413: return "Payload Too Large";
+  case 503: return "Service Unavailable";
+  default: return "Internal Server Error";
+  }
+}
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+std::string url_decode(std::string_view s) {
+  std::string out;
+  out.reserve(s.size());
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '+') {
+      out += ' ';
+    } else if (s[i] == '%' && i + 2 < s.size() && hex_value(s[i + 1]) >= 0 &&
+               hex_value(s[i + 2]) >= 0) {
+      out += static_cast<char>(hex_value(s[i + 1]) * 16 + hex_value(s[i + 2]));
+      i += 2;
+    } else {
+      out += s[i];
+    }
+  }
+  return out;
+}
+
+std::string lowercase(std::string_view s) {
+  std::string out(s);
+  for (char &c : out)
+    if (c >= 'A' && c <= 'Z')
+      c = static_cast<char>(c - 'A' + 'a');
+  return out;
+}
+
+// "GET /format?id=a&id=b HTTP/1.1" plus headers
+bool parse_request(std::string_view head, Request &req) {
+  size_t eol = head.find("\r\n");
+  std::string_view line = head.substr(0, eol);
+  size_t sp1 = line.find(' ');
+  size_t sp2 = line.rfind(' ');
+  if (sp1 == std::string_view::npos || sp2 <= sp1)
+    return false;
+  req.method = std::string(line.substr(0, sp1));
+  std::string_view target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  std::string_view version = line.substr(sp2 + 1);
+  req.keep_alive = version == "HTTP/1.1";
+
+  size_t q = target.find('?');
+  req.path = url_decode(target.substr(0, q));
+  req.params.clear();
+  if (q != std::string_view::npos) {
+    std::string_view query = target.substr(q + 1);
+    while (!query.empty()) {
+      size_t amp = query.find('&');
+      std::string_view pair = query.substr(0, amp);
+      size_t eq = pair.find('=');
+      if (!pair.empty())
+        req.params.emplace_back(
+            url_decode(pair.substr(0, eq)),
+            eq == std::string_view::npos ? "" : url_decode(pair.substr(eq + 1)));
+      if (amp == std::string_view::npos)
+        break;
+      query.remove_prefix(amp + 1);
+    }
+  }
+
+  // Only Connection matters
+  while (eol != std::string_view::npos) {
+    size_t start = eol + 2;
+    eol = head.find("\r\n", start);
+    std::string header = lowercase(head.substr(start, eol - start));
+    if (header.compare(0, 11, "connection:") != 0)
+      continue;
+    if (header.find("close") != std::string::npos)
+      req.keep_alive = false;
+    else if (header.find("keep-alive") != std::string::npos)
+      req.keep_alive = true;
+  }
+  return true;
+}
+
+// Sockets are non-blocking; a client that stops reading for
+// idle_timeout_s is dropped
+bool send_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+#ifdef MSG_NOSIGNAL
+    ssize_t n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+#else
+    ssize_t n = ::send(fd, data.data(), data.size(), 0);
+#endif
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pollfd p{fd, POLLOUT, 0};
+      if (::poll(&p, 1, idle_timeout_s * 1000) <= 0)
+        return false;
+      continue;
+    }
+    if (n <= 0)
+      return false;
+    data.remove_prefix(static_cast<size_t>(n));
+  }
+  return true;
+}
+
+bool parse_markup(const std::string *s, Markup &markup) {
+  if (!s || *s == "html")
+    markup = Markup::html;
+  else if (*s == "markdown" || *s == "md")
+    markup = Markup::markdown;
+  else if (*s == "terminal" || *s == "text")
+    markup = Markup::terminal;
+  else
+    return false;
+  return true;
+}
+
+bool parse_variant(const std::string *s, ChicagoVariant &variant) {
+  if (!s || *s == "bibliography")
+    variant = ChicagoVariant::bibliography;
+  else if (*s == "long" || *s == "long_footnote")
+    variant = ChicagoVariant::long_footnote;
+  else if (*s == "short" || *s == "short_footnote")
+    variant = ChicagoVariant::short_footnote;
+  else
+    return false;
+  return true;
+}
+
+class Server {
+public:
+  explicit Server(const ServeOptions &options) : options_(options) {}
+
+  int run();
+
+private:
+  bool load_all();
+  int open_listener();
+  void worker();
+  bool serve_requests(Connection &conn);
+  Response handle(const Request &req);
+
+  Hosted *find_library(const Request &req, Response &error);
+  std::shared_ptr<const Snapshot> current(Hosted &lib) {
+    return lib.live.get();
+  }
+
+  Response list_libraries();
+  Response format(const Request &req);
+  Response export_document(const Request &req);
+  Response search(const Request &req);
+  Response stats();
+
+  const ServeOptions &options_;
+  std::vector<std::unique_ptr<Hosted>> libraries_;
+  FormatMemo memo_;
+  std::atomic<std::uint64_t> requests_{0};
+  std::chrono::steady_clock::time_point started_;
+
+  std::mutex queue_mutex_; // guards ready_, parked_ and stopping_
+  std::condition_variable queue_ready_;
+  std::deque<Connection> ready_;   // have a request to read
+  std::vector<Connection> parked_; // served, to be watched again
+  bool stopping_ = false;
+  int wake_[2] = {-1, -1}; // workers wake the poller through this pipe
+};
+
+bool Server::load_all() {
+  for (const auto &path : options_.libraries) {
+    auto lib = std::make_unique<Hosted>();
+    lib->path = path;
+    std::filesystem::path name(path);
+    if (!name.has_filename()) // a directory given as "projects/"
+      name = name.parent_path();
+    lib->name = name.stem().string();
+    // Replaced in the background whenever the library (each of its shards)
+    // or a journal is written; requests keep the snapshot they started
+    // with. The search indexes are not watched: loading rebuilds them when
+    // they are stale.
+    bool loaded = lib->live.start(
+        library_watch_paths(path),
+        [path] { return load_snapshot(path); },
+        [path](const std::shared_ptr<const Snapshot> &fresh) {
+          std::cerr << "Reloaded " << fresh->library.entries.size()
+                    << " entries from " << path << "\n";
+        },
+        options_.reload_ms);
+    if (!loaded)
+      return false;
+    std::cerr << "Loaded " << lib->live.get()->library.entries.size()
+              << " entries from " << path << "\n";
+    libraries_.push_back(std::move(lib));
+  }
+  return true;
+}
+
+Hosted *Server::find_library(const Request &req, Response &error) {
+  const std::string *name = req.param("lib");
+  if (!name) {
+    if (libraries_.size() == 1)
+      return libraries_[0].get();
+    error = error_response(400, "several libraries are served; pass lib=");
+    return nullptr;
+  }
+  for (const auto &lib : libraries_)
+    if (lib->name == *name || lib->path == *name)
+      return lib.get();
+  error = error_response(404, "no library named " + *name);
+  return nullptr;
+}
+
+Response Server::list_libraries() {
+  nlohmann::json list = nlohmann::json::array();
+  for (const auto &lib : libraries_) {
+    auto snap = current(*lib);
+    list.push_back({{"name", lib->name},
+                    {"path", lib->path},
+                    {"entries", snap->library.entries.size()}});
+  }
+  Response r;
+  r.body = nlohmann::json{{"libraries", list}}.dump() + "\n";
+  return r;
+}
+
+Response Server::format(const Request &req) {
+  Response r;
+  Hosted *lib = find_library(req, r);
+  if (!lib)
+    return r;
+  const std::string *style_param = req.param("style");
+  std::string style = style_param ? *style_param : "chicago";
+  if (!memo_.has_style(style))
+    return error_response(400, "unknown style " + style);
+  Markup markup;
+  ChicagoVariant variant;
+  if (!parse_markup(req.param("markup"), markup))
+    return error_response(400, "markup must be html, markdown or terminal");
+  if (!parse_variant(req.param("variant"), variant))
+    return error_response(400, "variant must be bibliography, long or short");
+
+  auto snap = current(*lib);
+  nlohmann::json results = nlohmann::json::array();
+  nlohmann::json missing = nlohmann::json::array();
+  OutputBuffer buf(markup);
+  for (const auto &p : req.params) {
+    if (p.first != "id")
+      continue;
+    auto it = snap->by_id.find(p.second);
+    if (it == snap->by_id.end()) {
+      missing.push_back(p.second);
+      continue;
+    }
+    const size_t i = it->second;
+    buf.clear();
+    if (!memo_.format(snap->library.entries[i], snap->hashes[i], style,
+                      variant, buf))
+      return error_response(400, "style " + style + " has no " +
+                                     (req.param("variant") ? *req.param("variant")
+                                                           : "bibliography") +
+                                     " format");
+    results.push_back({{"id", p.second}, {"text", buf.view()}});
+  }
+  r.body = nlohmann::json{{"results", results}, {"missing", missing}}.dump() +
+           "\n";
+  return r;
+}
+
+Response Server::export_document(const Request &req) {
+  Response r;
+  Hosted *lib = find_library(req, r);
+  if (!lib)
+    return r;
+  const std::string *style = req.param("style");
+  if (style && *style != "chicago")
+    return error_response(400, "export supports the chicago style");
+  const std::string *format = req.param("format");
+  OutputFormat out_format;
+  if (!format || *format == "html") {
+    out_format = OutputFormat::html;
+    r.type = "text/html; charset=utf-8";
+  } else if (*format == "md" || *format == "markdown") {
+    out_format = OutputFormat::markdown;
+    r.type = "text/markdown; charset=utf-8";
+  } else if (*format == "terminal" || *format == "text") {
+    out_format = OutputFormat::terminal;
+    r.type = "text/plain; charset=utf-8";
+  } else {
+    return error_response(400, "format must be html, md or terminal");
+  }
+
+  auto snap = current(*lib);
+  static const struct {
+    ChicagoVariant variant;
+    const char *heading;
+  } sections[] = {
+      {ChicagoVariant::bibliography, "Bibliography"},
+      {ChicagoVariant::long_footnote, "Footnotes (First Reference)"},
+      {ChicagoVariant::short_footnote, "Footnotes (Subsequent References)"},
+  };
+  {
+    OutputSink sink(r.body);
+    auto renderer = create_renderer(out_format, sink);
+    renderer->begin_document("Chicago Style", lib->path);
+    for (const auto &section : sections) {
+      renderer->begin_section(section.heading);
+      for_each_chicago_citation(snap->library.entries, snap->order,
+                                section.variant, renderer->markup(), 1,
+                                [&](size_t k, std::string_view text) {
+                                  renderer->item(k + 1, text);
+                                });
+      renderer->end_section();
+    }
+    renderer->end_document(
+        "Replace `[pg]` with actual page numbers when citing.");
+  }
+  return r;
+}
+
+Response Server::search(const Request &req) {
+  Response r;
+  Hosted *lib = find_library(req, r);
+  if (!lib)
+    return r;
+  const std::string *query = req.param("q");
+  if (!query || query->empty())
+    return error_response(400, "missing q=");
+  size_t limit = 20;
+  if (const std::string *l = req.param("limit")) {
+    if (l->empty() || l->find_first_not_of("0123456789") != std::string::npos)
+      return error_response(400, "limit must be a number");
+    limit = std::stoul(*l);
+  }
+
+  auto snap = current(*lib);
+  if (!snap->searchable)
+    return error_response(503, "no search index for " + lib->path);
+  // Hits in library order: shard by shard
+  std::vector<std::pair<size_t, size_t>> hits;
+  for (size_t i = 0; i < snap->indexes.size(); ++i)
+    for (size_t record : snap->indexes[i].search(*query))
+      hits.emplace_back(i, record);
+  size_t shown = limit == 0 ? hits.size() : std::min(limit, hits.size());
+  nlohmann::json list = nlohmann::json::array();
+  for (size_t k = 0; k < shown; ++k) {
+    SearchIndex::Hit hit = snap->indexes[hits[k].first].record(hits[k].second);
+    list.push_back({{"id", hit.id}, {"summary", hit.summary}});
+  }
+  r.body = nlohmann::json{{"total", hits.size()}, {"hits", list}}.dump() + "\n";
+  return r;
+}
+
+Response Server::stats() {
+  FormatMemo::Stats memo = memo_.stats();
+  std::uint64_t reloads = 0;
+  for (const auto &lib : libraries_)
+    reloads += lib->live.reloads();
+  auto uptime = std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::steady_clock::now() - started_);
+  Response r;
+  r.body = nlohmann::json{
+      {"requests", requests_.load()},
+      {"reloads", reloads},
+      {"uptime_s", uptime.count()},
+      {"memo",
+       {{"hits", memo.hits},
+        {"misses", memo.misses},
+        {"evictions", memo.evictions},
+        {"entries", memo.entries},
+        {"bytes", memo.bytes}}}}.dump() + "\n";
+  return r;
+}
+
+Response Server::handle(const Request &req) {
+  ++requests_;
+  if (req.method != "GET")
+    return error_response(405, "only GET is supported");
+  if (req.path == "/format")
+    return format(req);
+  if (req.path == "/export")
+    return export_document(req);
+  if (req.path == "/search")
+    return search(req);
+  if (req.path == "/libraries" || req.path == "/")
+    return list_libraries();
+  if (req.path == "/stats")
+    return stats();
+  return error_response(404, "no such endpoint: " + req.path);
+}
+
+// Answers the requests waiting on `conn`. Returns true if the connection
+// stays open and should go back to the poller for its next request.
+bool Server::serve_requests(Connection &conn) {
+  char chunk[4096];
+  Request req;
+  for (;;) {
+    size_t end;
+    while ((end = conn.buffer.find("\r\n\r\n")) == std::string::npos) {
+      if (conn.buffer.size() > max_request_head) {
+        Response r = error_response(413, "request too large");
+        send_all(conn.fd, "HTTP/1.1 413 Payload Too Large\r\nContent-Length: " +
+                              std::to_string(r.body.size()) +
+                              "\r\nConnection: close\r\n\r\n" + r.body);
+        return false;
+      }
+      // Only what has arrived is read; the rest of a partial head is
+      // waited for in the poller, not on this thread
+      ssize_t n = ::recv(conn.fd, chunk, sizeof(chunk), 0);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return true;
+      if (n <= 0)
+        return false;
+      // The deadline for a request runs from its first byte
+      if (conn.buffer.empty())
+        conn.last_active = std::chrono::steady_clock::now();
+      conn.buffer.append(chunk, static_cast<size_t>(n));
+    }
+
+    Response res;
+    bool parsed =
+        parse_request(std::string_view(conn.buffer).substr(0, end), req);
+    conn.buffer.erase(0, end + 4);
+    if (!parsed) {
+      req.keep_alive = false;
+      res = error_response(400, "malformed request");
+    } else {
+      try {
+        res = handle(req);
+      } catch (const std::exception &e) {
+        res = error_response(500, e.what());
+      }
+    }
+
+    std::string head = "HTTP/1.1 " + std::to_string(res.status) + " " +
+                       status_text(res.status) +
+                       "\r\nContent-Type: " + res.type +
+                       "\r\nContent-Length: " + std::to_string(res.body.size()) +
+                       (req.keep_alive ? "\r\nConnection: keep-alive\r\n\r\n"
+                                       : "\r\nConnection: close\r\n\r\n");
+    if (!send_all(conn.fd, head + res.body) || !req.keep_alive)
+      return false;
+    conn.last_active = std::chrono::steady_clock::now();
+    // Pipelined requests are answered right away; otherwise wait in the
+    // poller rather than holding this thread
+    if (conn.buffer.find("\r\n\r\n") == std::string::npos)
+      return true;
+  }
+}
+
+void Server::worker() {
+  for (;;) {
+    Connection conn;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_ready_.wait(lock, [this] { return stopping_ || !ready_.empty(); });
+      if (ready_.empty())
+        return;
+      conn = std::move(ready_.front());
+      ready_.pop_front();
+    }
+    if (!serve_requests(conn)) {
+      ::close(conn.fd);
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      parked_.push_back(std::move(conn));
+    }
+    char wake = 0;
+    if (::write(wake_[1], &wake, 1) < 0) {
+      // The pipe is full, so the poller is about to wake anyway
+    }
+  }
+}
+
+int Server::open_listener() {
+  int fd;
+  if (!options_.socket_path.empty()) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (options_.socket_path.size() >= sizeof(addr.sun_path)) {
+      std::cerr << "Error: socket path too long\n";
+      return -1;
+    }
+    std::strcpy(addr.sun_path, options_.socket_path.c_str());
+    // A socket left behind by a previous run is replaced; anything else
+    // at that path is not
+    struct stat st;
+    if (::stat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+      ::unlink(addr.sun_path);
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      std::cerr << "Error: Cannot listen on " << options_.socket_path << ": "
+                << std::strerror(errno) << "\n";
+      if (fd >= 0)
+        ::close(fd);
+      return -1;
+    }
+  } else {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<std::uint16_t>(options_.port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    if (fd >= 0)
+      ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd < 0 ||
+        ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      std::cerr << "Error: Cannot listen on 127.0.0.1:" << options_.port
+                << ": " << std::strerror(errno) << "\n";
+      if (fd >= 0)
+        ::close(fd);
+      return -1;
+    }
+  }
+  if (::listen(fd, 128) != 0) {
+    std::cerr << "Error: listen failed: " << std::strerror(errno) << "\n";
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int Server::run() {
+  started_ = std::chrono::steady_clock::now();
+  if (!load_all())
+    return 2;
+  int listener = open_listener();
+  if (listener < 0)
+    return 1;
+  if (::pipe(wake_) != 0) {
+    std::cerr << "Error: pipe failed: " << std::strerror(errno) << "\n";
+    ::close(listener);
+    return 1;
+  }
+  for (int fd : wake_)
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  std::signal(SIGINT, request_stop);
+  std::signal(SIGTERM, request_stop);
+  std::signal(SIGPIPE, SIG_IGN);
+
+  unsigned threads = resolve_jobs(options_.threads);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t)
+    workers.emplace_back([this] { worker(); });
+
+  if (options_.socket_path.empty())
+    std::cerr << "Serving on http://127.0.0.1:" << options_.port;
+  else
+    std::cerr << "Serving on " << options_.socket_path;
+  std::cerr << " with " << threads << (threads == 1 ? " thread" : " threads")
+            << "\n";
+
+  // Watches the listener and every idle connection; a connection with a
+  // request waiting is handed to the workers
+  std::vector<Connection> idle;
+  std::vector<pollfd> fds;
+  while (!stop_requested) {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      for (auto &conn : parked_)
+        idle.push_back(std::move(conn));
+      parked_.clear();
+    }
+    fds.clear();
+    fds.push_back({listener, POLLIN, 0});
+    fds.push_back({wake_[0], POLLIN, 0});
+    for (const auto &conn : idle)
+      fds.push_back({conn.fd, POLLIN, 0});
+    if (::poll(fds.data(), fds.size(), 250) < 0)
+      continue;
+
+    if (fds[1].revents & POLLIN) {
+      char drain[64];
+      while (::read(wake_[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+    auto now = std::chrono::steady_clock::now();
+    std::vector<Connection> waiting;
+    for (size_t i = 0; i < idle.size(); ++i) {
+      short events = fds[i + 2].revents;
+      // Checked first, so a client trickling in a request cannot keep
+      // its connection alive past the deadline
+      if (now - idle[i].last_active > std::chrono::seconds(idle_timeout_s)) {
+        ::close(idle[i].fd);
+      } else if (events & (POLLIN | POLLHUP | POLLERR)) {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        ready_.push_back(std::move(idle[i]));
+        queue_ready_.notify_one();
+      } else {
+        waiting.push_back(std::move(idle[i]));
+      }
+    }
+    idle.swap(waiting);
+
+    if (fds[0].revents & POLLIN) {
+      int fd = ::accept(listener, nullptr, nullptr);
+      if (fd >= 0) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        Connection conn;
+        conn.fd = fd;
+        conn.last_active = now;
+        idle.push_back(std::move(conn));
+      }
+    }
+  }
+
+  ::close(listener);
+  if (!options_.socket_path.empty())
+    ::unlink(options_.socket_path.c_str());
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    stopping_ = true;
+  }
+  queue_ready_.notify_all();
+  for (auto &w : workers)
+    w.join();
+  for (auto &conn : idle)
+    ::close(conn.fd);
+  for (auto &conn : parked_)
+    ::close(conn.fd);
+  ::close(wake_[0]);
+  ::close(wake_[1]);
+  std::cerr << "Stopped after " << requests_.load() << " requests\n";
+  return 0;
+}
+
+} // namespace
+
+int cite_serve(const ServeOptions &options) {
+  Server server(options);
+  return server.run();
+}
+
+#else
+
+int cite_serve(const ServeOptions &) {
+  std::cerr << "Error: cite serve is not available on Windows\n";
+  return 1;
+}
+
+#endif
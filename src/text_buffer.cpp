@@ -0,0 +1,112 @@
+#include "text_buffer.hpp"
+#include <cstring>
+
+// In neutral text, record bytes that some markup treats specially (and
+// any that look like the markers) are preceded by this escape byte
+static const char neutral_escape = '\x1b';
+
+static bool neutral_special(char c) {
+  switch (c) {
+    case '&': case '<': case '>': case '"': case '\'':
+    case '\x02': case '\x03': case neutral_escape:
+      return true;
+    default:
+      return false;
+  }
+}
+
+OutputBuffer &OutputBuffer::text(std::string_view s) {
+  if (markup_ == Markup::neutral) {
+    size_t run = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+      if (!neutral_special(s[i]))
+        continue;
+      append(s.substr(run, i - run)).append(neutral_escape).append(s[i]);
+      run = i + 1;
+    }
+    return append(s.substr(run));
+  }
+  if (markup_ != Markup::html)
+    return append(s);
+
+  // Copy unescaped runs in one go
+  size_t run = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    const char *entity = nullptr;
+    switch (s[i]) {
+      case '&': entity = "&amp;"; break;
+      case '<': entity = "&lt;"; break;
+      case '>': entity = "&gt;"; break;
+      case '"': entity = "&quot;"; break;
+      case '\'': entity = "&#39;"; break;
+      default: continue;
+    }
+    append(s.substr(run, i - run)).append(entity);
+    run = i + 1;
+  }
+  return append(s.substr(run));
+}
+
+OutputBuffer &OutputBuffer::from_neutral(std::string_view s) {
+  if (markup_ == Markup::neutral)
+    return append(s);
+
+  size_t run = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    char c = s[i];
+    if (c != neutral_escape && c != '\x02' && c != '\x03')
+      continue;
+    append(s.substr(run, i - run));
+    if (c == '\x02') {
+      begin_italic();
+    } else if (c == '\x03') {
+      end_italic();
+    } else if (++i < s.size()) {
+      // Escaped record text: HTML needs it as an entity
+      text(s.substr(i, 1));
+    }
+    run = i + 1;
+  }
+  return append(s.substr(run));
+}
+
+std::string_view TextArena::store(std::string_view s) {
+  if (s.empty())
+    return std::string_view();
+
+  if (blocks_.empty() || capacity_ - used_ < s.size()) {
+    // Oversized strings get a block of their own
+    size_t size = s.size() > block_size_ ? s.size() : block_size_;
+    if (!blocks_.empty() && size > block_size_) {
+      // Keep filling the current block afterwards
+      blocks_.insert(blocks_.end() - 1, std::make_unique<char[]>(size));
+      char *dst = blocks_[blocks_.size() - 2].get();
+      std::memcpy(dst, s.data(), s.size());
+      return std::string_view(dst, s.size());
+    }
+    blocks_.push_back(std::make_unique<char[]>(size));
+    used_ = 0;
+    capacity_ = size;
+  }
+
+  char *dst = blocks_.back().get() + used_;
+  std::memcpy(dst, s.data(), s.size());
+  used_ += s.size();
+  return std::string_view(dst, s.size());
+}
+
+void TextArena::adopt(TextArena &&other) {
+  if (other.blocks_.empty())
+    return;
+  bool was_empty = blocks_.empty();
+  // Our partially filled block stays last so store() keeps using it
+  auto pos = blocks_.empty() ? blocks_.end() : blocks_.end() - 1;
+  blocks_.insert(pos, std::make_move_iterator(other.blocks_.begin()),
+                 std::make_move_iterator(other.blocks_.end()));
+  if (was_empty) {
+    used_ = other.used_;
+    capacity_ = other.capacity_;
+  }
+  other.blocks_.clear();
+  other.used_ = other.capacity_ = 0;
+}
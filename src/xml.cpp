@@ -0,0 +1,271 @@
+#include "xml.hpp"
+#include <cstdint>
+
+const std::string *XmlNode::attribute(std::string_view key) const {
+  for (const auto &a : attributes)
+    if (a.first == key)
+      return &a.second;
+  return nullptr;
+}
+
+const XmlNode *XmlNode::child(std::string_view child_name) const {
+  for (const auto &c : children)
+    if (c.name == child_name)
+      return &c;
+  return nullptr;
+}
+
+namespace {
+
+class XmlParser {
+public:
+  explicit XmlParser(std::string_view s) : s_(s) {}
+
+  bool parse(XmlNode &root, std::string &error) {
+    skip_misc();
+    if (!parse_element(root, 0))
+      return fail(error);
+    skip_misc();
+    if (pos_ != s_.size()) {
+      message_ = "content after the root element";
+      return fail(error);
+    }
+    return true;
+  }
+
+private:
+  bool fail(std::string &error) {
+    size_t line = 1;
+    for (size_t i = 0; i < pos_ && i < s_.size(); ++i)
+      if (s_[i] == '\n')
+        ++line;
+    error = "line " + std::to_string(line) + ": " + message_;
+    return false;
+  }
+
+  bool error(const char *message) {
+    message_ = message;
+    return false;
+  }
+
+  bool starts_with(std::string_view t) const {
+    return s_.substr(pos_, t.size()) == t;
+  }
+
+  static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  void skip_space() {
+    while (pos_ < s_.size() && is_space(s_[pos_]))
+      ++pos_;
+  }
+
+  // Skips past `terminator`; false if it never comes
+  bool skip_past(std::string_view terminator) {
+    size_t end = s_.find(terminator, pos_);
+    if (end == std::string_view::npos) {
+      pos_ = s_.size();
+      return false;
+    }
+    pos_ = end + terminator.size();
+    return true;
+  }
+
+  // Whitespace, comments, processing instructions and DOCTYPE between
+  // elements
+  void skip_misc() {
+    for (;;) {
+      skip_space();
+      if (starts_with("<?")) {
+        skip_past("?>");
+      } else if (starts_with("<!--")) {
+        skip_past("-->");
+      } else if (starts_with("<!") && !starts_with("<![CDATA[")) {
+        skip_past(">");
+      } else {
+        return;
+      }
+    }
+  }
+
+  static bool is_name_char(char c) {
+    return !is_space(c) && c != '=' && c != '>' && c != '/' && c != '<' &&
+           c != '"' && c != '\'';
+  }
+
+  std::string_view parse_name() {
+    size_t start = pos_;
+    while (pos_ < s_.size() && is_name_char(s_[pos_]))
+      ++pos_;
+    return s_.substr(start, pos_ - start);
+  }
+
+  static void append_utf8(std::string &out, std::uint32_t cp) {
+    if (cp < 0x80) {
+      out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+      out += static_cast<char>(0xC0 | (cp >> 6));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      out += static_cast<char>(0xE0 | (cp >> 12));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+      out += static_cast<char>(0xF0 | (cp >> 18));
+      out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+
+  // Appends s_[pos_, end) with entities decoded
+  bool decode(size_t end, std::string &out) {
+    while (pos_ < end) {
+      size_t amp = s_.find('&', pos_);
+      if (amp == std::string_view::npos || amp >= end) {
+        out.append(s_.substr(pos_, end - pos_));
+        pos_ = end;
+        break;
+      }
+      out.append(s_.substr(pos_, amp - pos_));
+      pos_ = amp;
+      size_t semi = s_.find(';', amp);
+      if (semi == std::string_view::npos || semi >= end)
+        return error("unterminated entity");
+      std::string_view entity = s_.substr(amp + 1, semi - amp - 1);
+      if (entity == "amp") {
+        out += '&';
+      } else if (entity == "lt") {
+        out += '<';
+      } else if (entity == "gt") {
+        out += '>';
+      } else if (entity == "quot") {
+        out += '"';
+      } else if (entity == "apos") {
+        out += '\'';
+      } else if (entity.size() > 1 && entity[0] == '#') {
+        bool hex = entity[1] == 'x' || entity[1] == 'X';
+        std::uint32_t cp = 0;
+        for (char c : entity.substr(hex ? 2 : 1)) {
+          int digit;
+          if (c >= '0' && c <= '9')
+            digit = c - '0';
+          else if (hex && c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+          else if (hex && c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+          else
+            return error("bad character reference");
+          cp = cp * (hex ? 16 : 10) + static_cast<std::uint32_t>(digit);
+          if (cp > 0x10FFFF)
+            return error("bad character reference");
+        }
+        append_utf8(out, cp);
+      } else {
+        return error("unknown entity");
+      }
+      pos_ = semi + 1;
+    }
+    return true;
+  }
+
+  bool parse_element(XmlNode &node, int depth) {
+    if (depth > 256)
+      return error("elements nested too deeply");
+    if (pos_ >= s_.size() || s_[pos_] != '<')
+      return error("expected an element");
+    ++pos_;
+    node.name = std::string(parse_name());
+    if (node.name.empty())
+      return error("expected an element name");
+
+    // Attributes
+    for (;;) {
+      skip_space();
+      if (pos_ >= s_.size())
+        return error("unterminated start tag");
+      if (starts_with("/>")) {
+        pos_ += 2;
+        return true;
+      }
+      if (s_[pos_] == '>') {
+        ++pos_;
+        break;
+      }
+      std::string key(parse_name());
+      if (key.empty())
+        return error("expected an attribute name");
+      skip_space();
+      if (pos_ >= s_.size() || s_[pos_] != '=')
+        return error("expected '=' after attribute name");
+      ++pos_;
+      skip_space();
+      if (pos_ >= s_.size() || (s_[pos_] != '"' && s_[pos_] != '\''))
+        return error("expected a quoted attribute value");
+      char quote = s_[pos_++];
+      size_t end = s_.find(quote, pos_);
+      if (end == std::string_view::npos)
+        return error("unterminated attribute value");
+      std::string value;
+      if (!decode(end, value))
+        return false;
+      ++pos_;
+      node.attributes.emplace_back(std::move(key), std::move(value));
+    }
+
+    // Content up to the matching end tag
+    for (;;) {
+      if (pos_ >= s_.size())
+        return error("missing end tag");
+      if (starts_with("</")) {
+        pos_ += 2;
+        if (parse_name() != node.name)
+          return error("mismatched end tag");
+        skip_space();
+        if (pos_ >= s_.size() || s_[pos_] != '>')
+          return error("unterminated end tag");
+        ++pos_;
+        return true;
+      }
+      if (starts_with("<!--")) {
+        if (!skip_past("-->"))
+          return error("unterminated comment");
+      } else if (starts_with("<![CDATA[")) {
+        pos_ += 9;
+        size_t end = s_.find("]]>", pos_);
+        if (end == std::string_view::npos)
+          return error("unterminated CDATA section");
+        node.text.append(s_.substr(pos_, end - pos_));
+        pos_ = end + 3;
+      } else if (starts_with("<?")) {
+        if (!skip_past("?>"))
+          return error("unterminated processing instruction");
+      } else if (s_[pos_] == '<') {
+        node.children.emplace_back();
+        if (!parse_element(node.children.back(), depth + 1))
+          return false;
+      } else {
+        size_t end = s_.find('<', pos_);
+        if (end == std::string_view::npos)
+          end = s_.size();
+        if (!decode(end, node.text))
+          return false;
+      }
+    }
+  }
+
+  std::string_view s_;
+  size_t pos_ = 0;
+  const char *message_ = "";
+};
+
+} // namespace
+
+bool parse_xml(std::string_view source, XmlNode &root, std::string &error) {
+  // A UTF-8 byte order mark is allowed before the declaration
+  if (source.substr(0, 3) == "\xEF\xBB\xBF")
+    source.remove_prefix(3);
+  root = XmlNode();
+  return XmlParser(source).parse(root, error);
+}